@@ -136,7 +136,8 @@ module Chip8_CPU(
 		
 		
 		/*BEGIN INSTRUCTION DECODE*/
-		if(top_level_state == Chip8_RUNNING && stage != 32'h0) begin
+		if((top_level_state == Chip8_RUNNING || top_level_state == Chip8_RUN_INSTRUCTION) &&
+				stage != 32'h0) begin
 		casex (instruction)
 			// 16'h???: begin
 			//This instruction is only used on the old computers on which Chip-8
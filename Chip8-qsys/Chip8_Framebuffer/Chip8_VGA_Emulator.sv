@@ -14,6 +14,7 @@
 	input logic fb_pixel_data,
 	input logic is_paused,
 	output logic[10:0] fb_request_addr,
+	output logic vblank, //past the last active line, safe to swap buffers
  	output logic [7:0] VGA_R, VGA_G, VGA_B,
 	output logic       VGA_CLK, VGA_HS, VGA_VS, VGA_BLANK_n, VGA_SYNC_n);
 
@@ -70,6 +71,8 @@
 	assign VGA_HS = !( (hcount[10:8] == 3'b101) & !(hcount[7:5] == 3'b111));
 	assign VGA_VS = !( vcount[9:1] == (VACTIVE + VFRONT_PORCH) / 2);
 
+	assign vblank = vcount >= VACTIVE;
+
 	assign VGA_SYNC_n = 1; // For adding sync to video signals; not used for VGA
 
 	// Horizontal active: 0 to 1279     Vertical active: 0 to 479
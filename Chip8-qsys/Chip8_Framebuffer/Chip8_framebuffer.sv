@@ -14,88 +14,185 @@
 module Chip8_framebuffer(
 	input logic			clk,
 	input logic			reset,
-	
+
 	input logic [4:0]	fb_addr_y,//max val = 31
 	input logic [5:0]   fb_addr_x,//max val = 63
 	input logic			fb_writedata, //data to write to addresse.
 	input logic		    fb_WE, //enable writing to address
-	input logic         is_paused, 
+	input logic         is_paused,
+	input logic         present_ok, //no instruction is part way through drawing
 
 	output logic		fb_readdata, //data to write to addresse.
-	
+	output logic        fb_pending, //back buffer written since the last swap
+	output logic        fb_busy, //back buffer catching up after a swap
+	output logic [15:0] fb_frames, //vertical blanks so far, wraps
+
 	output logic [7:0]  VGA_R, VGA_G, VGA_B,
 	output logic        VGA_CLK, VGA_HS, VGA_VS, VGA_BLANK_n,
 	output logic        VGA_SYNC_n
 );
-	
-	
-	//The framebuffer memory has two ports. One is used
-	//constantly and combinationaly by the VGA module.
-	//The other one is general purpose. They are named
-	//as such ("_addr" and "_general")
+
+	//Entries in the write log, more writes than this between two swaps
+	//and the catch up copies the whole front buffer instead
+	parameter LOG_DEPTH = 1024;
+
+	/*
+	* Two buffers, front is the one the VGA emulator scans and the other one,
+	* the back buffer, gets every write and read from the CPU and the host.
+	* When the back buffer has been written, at the start of a vertical
+	* blank with nothing part way through drawing and not paused, the two
+	* swap, so a frame on screen is always a whole one.
+	*
+	* The new back buffer is then a frame behind. Every write is kept in a
+	* log, so after the swap the writes made since the swap before are
+	* replayed into it through its port b, a cycle each. If the log
+	* overflowed, as one CLS does, the whole front buffer is copied over
+	* first, 2048 cycles, and the writes since the swap replayed after it.
+	* fb_busy is up meanwhile and Chip8_Top holds CLS and DRW until it is
+	* done. The host can still write, the replay chases its writes, but may
+	* read pixels the catch up has not reached.
+	*/
+	typedef enum logic [1:0] {FB_IDLE, FB_COPY, FB_REPLAY} FB_CATCHUP;
+
 	wire[10:0] fb_addr_general = (fb_addr_y << 6) + (fb_addr_x);
 	wire[10:0] fb_addr_vga;
-	wire fb_writedata_general = fb_writedata;
-	wire fb_writedata_vga;
-	wire fb_WE_general = fb_WE;
-	wire fb_WE_vga = 1'b0;//vga emulator will never write to FB mem
-	wire fb_readdata_general;
 	wire fb_readdata_vga;
-	assign fb_readdata = fb_readdata_general;
-	
-	logic[10:0] counter;
+	wire vblank;
+	logic front;
 
-	initial begin
-		counter = 11'b0;
-	end
-	
-	wire[10:0] copy_from_addr;
-	wire[10:0] copy_to_addr;
-	wire copy_data;
-	wire copyWE;
-	wire deadwire;
+	wire q_a0, q_a1, q_b0, q_b1;
+	assign fb_readdata = front ? q_a0 : q_a1;
+	assign fb_readdata_vga = front ? q_a1 : q_a0;
+
+	//Write log, {data, address}, from log_mark on is since the last swap
+	logic [11:0] write_log[0:LOG_DEPTH - 1];
+	logic [9:0]  log_mark;
+	logic [9:0]  log_wr;
+	logic [9:0]  log_rp;
+	logic        log_overflow;
+	logic [11:0] log_q;
+	logic        log_q_valid;
+	logic [11:0] last_write;
+	logic        last_WE;
+
+	FB_CATCHUP   catchup;
+	logic [10:0] copy_addr;
+	logic [10:0] copy_to;
+	logic        copy_valid;
+	logic        vblank_prev;
 
-	logic [31:0] fb_stage;
-	logic [31:0] time_since_last_copy;
+	//A write held over several cycles, like the host's, is logged once
+	wire log_push = fb_WE & !(last_WE & last_write == {fb_writedata, fb_addr_general});
+	//Oldest entry still to be replayed
+	wire[9:0] log_keep = catchup == FB_IDLE ? log_mark : log_rp;
+	wire swap = catchup == FB_IDLE & fb_pending & vblank & present_ok & !is_paused;
+
+	//Port b of the back buffer, left alone for a pixel written on port a
+	wire copy_data = front ? q_b1 : q_b0;
+	wire[10:0] catchup_addr = copy_valid ? copy_to : log_q[10:0];
+	wire catchup_data = copy_valid ? copy_data : log_q[11];
+	wire catchup_WE = (copy_valid | log_q_valid) & !(fb_WE & fb_addr_general == catchup_addr);
+
+	assign fb_busy = catchup != FB_IDLE;
 
 	initial begin
-		time_since_last_copy <= 32'h0;
-		fb_stage <= 32'h0;
+		front = 1'b0;
+		fb_pending = 1'b0;
+		fb_frames = 16'h0;
+		log_mark = 10'h0;
+		log_wr = 10'h0;
+		log_rp = 10'h0;
+		log_overflow = 1'b0;
+		log_q = 12'h0;
+		log_q_valid = 1'b0;
+		last_write = 12'h0;
+		last_WE = 1'b0;
+		catchup = FB_IDLE;
+		copy_addr = 11'h0;
+		copy_to = 11'h0;
+		copy_valid = 1'b0;
+		vblank_prev = 1'b0;
 	end
 
 	always_ff @(posedge clk) begin
-		if(fb_WE) begin
-			fb_stage <= 32'h0;
-		end else if(fb_stage < FRAMEBUFFER_REFRESH_HOLD) begin
-			fb_stage <= fb_stage;
-		end else begin
-			fb_stage <= fb_stage + 32'h1;
-		end
+		if(log_push) write_log[log_wr] <= {fb_writedata, fb_addr_general};
 	end
-	
+
 	always_ff @(posedge clk) begin
-		if(fb_stage >= FRAMEBUFFER_REFRESH_HOLD || time_since_last_copy > COPY_THRESHOLD) begin
-			counter <= counter + 1;
-			
-			copyWE <= 1'b1;
+		if(reset) begin
+			front <= 1'b0;
+			fb_pending <= 1'b0;
+			fb_frames <= 16'h0;
+			log_mark <= 10'h0;
+			log_wr <= 10'h0;
+			log_rp <= 10'h0;
+			log_overflow <= 1'b0;
+			log_q_valid <= 1'b0;
+			last_WE <= 1'b0;
+			catchup <= FB_IDLE;
+			copy_valid <= 1'b0;
+			vblank_prev <= 1'b0;
+		end else begin
+			vblank_prev <= vblank;
+			if(vblank & !vblank_prev) fb_frames <= fb_frames + 16'h1;
 
-			copy_from_addr <= counter + 11'h1;
-			copy_to_addr <= counter;
+			last_write <= {fb_writedata, fb_addr_general};
+			last_WE <= fb_WE;
 
-			if(counter == 11'b111_1111_1111) time_since_last_copy <= 32'h0;
-		end else begin
-			copyWE <= 1'b0;
-			time_since_last_copy <= time_since_last_copy + 32'h1;
-			counter <= 11'h0;
+			copy_valid <= catchup == FB_COPY;
+			copy_to <= copy_addr;
+			log_q_valid <= 1'b0;
+
+			case(catchup)
+				FB_IDLE: begin
+					if(swap) begin
+						front <= !front;
+						fb_pending <= 1'b0;
+						log_mark <= log_wr;
+						log_overflow <= 1'b0;
+						if(log_overflow) begin
+							catchup <= FB_COPY;
+							copy_addr <= 11'h0;
+							log_rp <= log_wr;
+						end else begin
+							catchup <= FB_REPLAY;
+							log_rp <= log_mark;
+						end
+					end
+				end
+				FB_COPY: begin
+					copy_addr <= copy_addr + 11'h1;
+					if(copy_addr == 11'h7FF) catchup <= FB_REPLAY;
+				end
+				FB_REPLAY: begin
+					if(log_rp != log_wr) begin
+						log_q <= write_log[log_rp];
+						log_q_valid <= 1'b1;
+						log_rp <= log_rp + 10'h1;
+					end else if(!log_q_valid & !copy_valid) begin
+						catchup <= FB_IDLE;
+					end
+				end
+				default: catchup <= FB_IDLE;
+			endcase
+
+			//The host writes far slower than the replay, so the log only
+			//overflows between swaps
+			if(log_push) begin
+				fb_pending <= 1'b1;
+				if(log_wr + 10'h1 == log_keep) log_overflow <= 1'b1;
+				else log_wr <= log_wr + 10'h1;
+			end
 		end
 	end
-	
+
 	Chip8_VGA_Emulator led_emulator(
 			.clk50(clk),
 			.reset(reset),
 			.fb_pixel_data(fb_readdata_vga),
 			.fb_request_addr(fb_addr_vga),
 			.is_paused(is_paused),
+			.vblank(vblank),
 			.VGA_R(VGA_R),
 			.VGA_G(VGA_G),
 			.VGA_B(VGA_B),
@@ -105,30 +202,30 @@ module Chip8_framebuffer(
 			.VGA_BLANK_n(VGA_BLANK_n),
 			.VGA_SYNC_n(VGA_SYNC_n)
 	);
-	
-	Framebuffer from_cpu (
+
+	Framebuffer buffer0 (
 			.clock(clk),
-			.address_a(fb_addr_general),
-			.address_b(copy_from_addr),
-			.data_a(fb_writedata_general),
-			.data_b(fb_writedata_vga),
-			.wren_a(fb_WE_general),
-			.wren_b(fb_WE_vga),
-			.q_a(fb_readdata_general),
-			.q_b(copy_data)
+			.address_a(front ? fb_addr_general : fb_addr_vga),
+			.address_b(front ? catchup_addr : copy_addr),
+			.data_a(fb_writedata),
+			.data_b(catchup_data),
+			.wren_a(front & fb_WE),
+			.wren_b(front & catchup_WE),
+			.q_a(q_a0),
+			.q_b(q_b0)
 	);
-	
-	Framebuffer toscreen (
+
+	Framebuffer buffer1 (
 			.clock(clk),
-			.address_a(fb_addr_vga),
-			.address_b(copy_to_addr),
-			.data_a(fb_writedata_vga),
-			.data_b(copy_data),
-			.wren_a(fb_WE_vga),
-			.wren_b(copyWE),
-			.q_a(fb_readdata_vga),
-			.q_b(deadwire)
+			.address_a(front ? fb_addr_vga : fb_addr_general),
+			.address_b(front ? copy_addr : catchup_addr),
+			.data_a(fb_writedata),
+			.data_b(catchup_data),
+			.wren_a(!front & fb_WE),
+			.wren_b(!front & catchup_WE),
+			.q_a(q_a1),
+			.q_b(q_b1)
 	);
-	
-				 
-endmodule
\ No newline at end of file
+
+
+endmodule
@@ -0,0 +1,167 @@
+/******************************************************************************
+ * Chip8_LatencyHist.sv
+ *
+ * Per-opcode-class histogram of how many stages each instruction actually
+ * needs out of its CPU_CYCLE_LENGTH slot.
+ *
+ * Chip8_Top pulses sample for one cycle when an instruction completes, with
+ * the last stage at which the CPU produced a side effect (work_stage) and
+ * the cycles spent halted on Fx0A. The instruction is sorted into one of
+ * the classes below and the counters of that class are updated with a
+ * read-modify-write over the next 14 cycles, well inside the next slot.
+ *
+ * Every class owns 16 words, addressed as {class, field}:
+ *	- 0     : instructions completed
+ *	- 1, 2  : sum of work stages, low and high word
+ *	- 3     : largest work stage
+ *	- 4, 5  : cycles halted on Fx0A, low and high word
+ *	- 8..15 : work stages in [0,16) [16,64) [64,256) [256,1024)
+ *	          [1024,4096) [4096,16384) [16384,CPU_CYCLE_LENGTH) and
+ *	          CPU_CYCLE_LENGTH or more
+ *
+ * Classes:
+ *	0 SYS    1 CLS    2 RET    3 JP     4 CALL   5 SE Vx,kk  6 SNE Vx,kk
+ *	7 SE Vx,Vy        8 LD Vx,kk        9 ADD Vx,kk         10 8xy?
+ *	11 SNE Vx,Vy      12 LD I  13 JP V0 14 RND  15 DRW      16 SKP/SKNP
+ *	17 Fx0A  18 Fx07/Fx15/Fx18/Fx1E/Fx29  19 Fx33  20 Fx55  21 Fx65
+ *	22 anything else
+ *
+ * clear zeroes every word, which takes 512 cycles. Samples arriving while
+ * clearing are dropped.
+ *
+ * Dependencies:
+ *  - enums.svh
+ *****************************************************************************/
+
+`include "../enums.svh"
+
+module Chip8_LatencyHist(
+	input logic			clk,
+	input logic			reset,			//same as clear
+	input logic			clear,			//zero every counter
+	input logic			sample,			//an instruction completed
+	input logic [15:0]	instruction,
+	input logic [31:0]	work_stage,		//last stage with a side effect
+	input logic [31:0]	halt_cycles,	//cycles spent halted on Fx0A
+	input logic [8:0]	rd_addr,		//{class, field}
+	output logic [31:0]	rd_data
+);
+
+	logic [31:0] hist[0:511];
+
+	logic		 clearing = 1'b1;
+	logic [8:0]	 clear_addr = 9'h0;
+	logic		 updating = 1'b0;
+	logic [2:0]	 step;
+	logic		 phase;				//0 reads the field, 1 writes it back
+	logic		 carry;
+
+	logic [4:0]	 cls;
+	logic [31:0] lat_stage;
+	logic [31:0] lat_halt;
+	logic [2:0]	 bucket;
+
+	logic [8:0]	 addr;
+	logic		 we;
+	logic [31:0] wdata;
+	logic [31:0] q;
+	logic [32:0] sum;
+
+	function automatic logic [4:0] opclass(input logic [15:0] instr);
+		casex (instr)
+			16'h00E0: return 5'd1;
+			16'h00EE: return 5'd2;
+			16'h0xxx: return 5'd0;
+			16'h1xxx: return 5'd3;
+			16'h2xxx: return 5'd4;
+			16'h3xxx: return 5'd5;
+			16'h4xxx: return 5'd6;
+			16'h5xx0: return 5'd7;
+			16'h6xxx: return 5'd8;
+			16'h7xxx: return 5'd9;
+			16'h8xxx: return 5'd10;
+			16'h9xx0: return 5'd11;
+			16'hAxxx: return 5'd12;
+			16'hBxxx: return 5'd13;
+			16'hCxxx: return 5'd14;
+			16'hDxxx: return 5'd15;
+			16'hEx9E: return 5'd16;
+			16'hExA1: return 5'd16;
+			16'hFx0A: return 5'd17;
+			16'hFx07: return 5'd18;
+			16'hFx15: return 5'd18;
+			16'hFx18: return 5'd18;
+			16'hFx1E: return 5'd18;
+			16'hFx29: return 5'd18;
+			16'hFx33: return 5'd19;
+			16'hFx55: return 5'd20;
+			16'hFx65: return 5'd21;
+			default:  return 5'd22;
+		endcase
+	endfunction
+
+	always_comb begin
+		if(lat_stage < 32'd16)				bucket = 3'd0;
+		else if(lat_stage < 32'd64)			bucket = 3'd1;
+		else if(lat_stage < 32'd256)		bucket = 3'd2;
+		else if(lat_stage < 32'd1024)		bucket = 3'd3;
+		else if(lat_stage < 32'd4096)		bucket = 3'd4;
+		else if(lat_stage < 32'd16384)		bucket = 3'd5;
+		else if(lat_stage < CPU_CYCLE_LENGTH) bucket = 3'd6;
+		else								bucket = 3'd7;
+
+		sum = {1'b0, q} + {1'b0, step == 3'd1 ? lat_stage : lat_halt};
+
+		addr = rd_addr;
+		we = 1'b0;
+		wdata = 32'h0;
+		if(clearing) begin
+			addr = clear_addr;
+			we = 1'b1;
+		end else if(updating) begin
+			we = phase;
+			case (step)
+				3'd0: begin addr = {cls, 4'h0}; wdata = q + 32'h1; end
+				3'd1: begin addr = {cls, 4'h1}; wdata = sum[31:0]; end
+				3'd2: begin addr = {cls, 4'h2}; wdata = q + {31'h0, carry}; end
+				3'd3: begin addr = {cls, 4'h3}; wdata = lat_stage > q ? lat_stage : q; end
+				3'd4: begin addr = {cls, 4'h4}; wdata = sum[31:0]; end
+				3'd5: begin addr = {cls, 4'h5}; wdata = q + {31'h0, carry}; end
+				default: begin addr = {cls, 1'b1, bucket}; wdata = q + 32'h1; end
+			endcase
+		end
+	end
+
+	//One port for the update, one for the host
+	always_ff @(posedge clk) begin
+		if(we) hist[addr] <= wdata;
+		q <= hist[addr];
+		rd_data <= hist[rd_addr];
+	end
+
+	always_ff @(posedge clk) begin
+		if(reset | clear) begin
+			clearing <= 1'b1;
+			clear_addr <= 9'h0;
+			updating <= 1'b0;
+		end else if(clearing) begin
+			clear_addr <= clear_addr + 9'h1;
+			if(clear_addr == 9'h1FF) clearing <= 1'b0;
+		end else if(sample & ~updating) begin
+			cls <= opclass(instruction);
+			lat_stage <= work_stage;
+			lat_halt <= halt_cycles;
+			updating <= 1'b1;
+			step <= 3'd0;
+			phase <= 1'b0;
+		end else if(updating) begin
+			phase <= ~phase;
+			if(phase) begin
+				if(step == 3'd1 || step == 3'd4) carry <= sum[32];
+				if(step == 3'd6) updating <= 1'b0;
+				else step <= step + 3'd1;
+			end
+		end
+	end
+
+endmodule
@@ -5,7 +5,17 @@ module Chip8_Stack(
 	input logic 		reset,		//reset
 	input STACK_OP 		op,			//See enums.svh for ops
 	input logic [15:0]	writedata,	//input PC
-	output logic [15:0]	outdata		//data output 
+	output logic [15:0]	outdata,	//data output 
+
+	//Host access from Chip8_Top, only used while op is STACK_HOLD
+	input logic			dbg_sp_WE,		//overwrite the stack pointer
+	input logic [3:0]	dbg_sp,
+	input logic			dbg_en,			//drive the RAM from dbg_addr
+	input logic [3:0]	dbg_addr,
+	input logic			dbg_WE,
+	input logic [15:0]	dbg_writedata,
+	output logic [3:0]	sp,
+	output logic [15:0]	dbg_readdata
 );	
 	
 	logic [3:0]  address = 4'd0;
@@ -18,6 +28,9 @@ module Chip8_Stack(
 	logic[3:0] 	stackptr = 4'h0;
 	logic 		secondcycle = 1'h0;
 	logic 		hold = 1'h0;
+
+	assign sp = stackptr;
+	assign dbg_readdata = q;
 	
 	always_ff @(posedge cpu_clk) begin
 		if(reset) begin
@@ -26,6 +39,8 @@ module Chip8_Stack(
 			wren <= 1'b0;
 			secondcycle <= 1'h0;
 			stackptr <= 4'd0;
+		end else if(dbg_sp_WE) begin
+			stackptr <= dbg_sp;
 		end else begin
 			case (op)
 				STACK_PUSH: begin
@@ -56,7 +71,14 @@ module Chip8_Stack(
 						end
 					end
 				end
-				STACK_HOLD: hold = 1'b0;
+				STACK_HOLD: begin
+					hold = 1'b0;
+					wren <= dbg_en & dbg_WE;
+					if(dbg_en) begin
+						address <= dbg_addr;
+						data <= dbg_writedata;
+					end
+				end
 				default : /* default */;
 			endcase
 		end
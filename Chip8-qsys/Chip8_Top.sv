@@ -14,12 +14,20 @@
  *  - enums.svh
  *  - utils.svh
  *  - Chip8_CPU.sv
+ *  - Chip8_Perf/Chip8_LatencyHist.sv
  *****************************************************************************/
  
  `include "enums.svh"
  `include "utils.svh"
  
- module Chip8_Top(
+ //CYCLE_LENGTH is the slot every instruction runs for, DRW up to its VF write
+ //at least. Anything shorter than CPU_CYCLE_LENGTH runs games faster than
+ //the host software expects, and nothing below INJECT_CYCLE_LENGTH leaves
+ //room for CLS. PREFETCH enables the prefetch of the next instruction.
+ module Chip8_Top #(
+    parameter CYCLE_LENGTH = CPU_CYCLE_LENGTH,
+    parameter PREFETCH = 1
+    )(
     input logic         clk,
     input logic         reset,
     input logic [31:0]  writedata,
@@ -65,6 +73,10 @@
 	logic		fb_WE; //enable writing to address
 	logic		fb_readdata; //data to write to addresse.
     logic       fb_paused;
+    logic       fb_present_ok;  //no CLS or DRW part way through drawing
+    logic       fb_pending;
+    logic       fb_busy;
+    logic [15:0] fb_frames;
 
     //Keyboard
     logic       ispressed;
@@ -126,6 +138,31 @@
     STACK_OP        stack_op;
     logic [15:0]    stack_writedata;
     logic [15:0]    stack_outdata;
+    logic           stack_sp_WE;
+    logic [3:0]     stack_sp_writedata;
+    logic [3:0]     stack_sp;
+    logic           stack_dbg_en;
+    logic           stack_dbg_WE;
+    logic [3:0]     stack_dbg_addr;
+    logic [15:0]    stack_dbg_writedata;
+    logic [15:0]    stack_dbg_readdata;
+
+    //Latency histogram
+    logic [31:0] work_stage;    //last stage with a side effect from the CPU
+    logic [31:0] halt_cycles;   //cycles halted on Fx0A this instruction
+    logic        hist_sample;
+    logic        hist_clear;
+    logic [8:0]  hist_addr;
+    logic [31:0] hist_readdata;
+    logic [15:0] hist_instruction;  //of the instruction hist_sample is for
+    logic [31:0] hist_work_stage;
+    logic [31:0] hist_halt_cycles;
+
+    //Prefetch of the next instruction through memory port 2
+    logic        pf_valid;          //pf_instruction holds the bytes at pf_pc
+    logic        pf_stale;          //the host wrote something during the fetch
+    logic [11:0] pf_pc;
+    logic [15:0] pf_instruction;
 
     //State
     Chip8_STATE state = Chip8_PAUSED;
@@ -136,6 +173,7 @@
     logic [5:0]  fbvx_prev;
     logic [4:0]  fbvy_prev;
     logic [11:0] mem_addr_prev;
+    logic [3:0]  stk_addr_prev;
     logic        chipselect_happened;
 
     //Chipselect temporary values
@@ -182,6 +220,11 @@
         fbvx_prev <= 6'h0;
         fbvy_prev <= 5'h0;
         mem_addr_prev <= 12'h0;
+        stk_addr_prev <= 4'h0;
+
+        stack_sp_WE <= 1'b0;
+        stack_dbg_en <= 1'b0;
+        stack_dbg_WE <= 1'b0;
 
         sound_on <= 1'b0;
         chipselect_happened <= 1'b0;
@@ -189,9 +232,20 @@
         fb_paused <= 1'b1;
 
         halt_for_keypress <= 1'b0;
+
+        work_stage <= NEXT_PC_WRITE_STAGE;
+        halt_cycles <= 32'h0;
+        hist_sample <= 1'b0;
+        hist_clear <= 1'b0;
+        hist_addr <= 9'h0;
+
+        pf_valid <= 1'b0;
+        pf_stale <= 1'b0;
     end
 
     always_ff @(posedge clk) begin
+        hist_sample <= 1'b0;
+
         if(reset) begin
             //Add initial values for code
             pc <= 12'h200;
@@ -222,6 +276,11 @@
             fbvx_prev <= 6'h0;
             fbvy_prev <= 5'h0;
             mem_addr_prev <= 12'h0;
+            stk_addr_prev <= 4'h0;
+
+            stack_sp_WE <= 1'b0;
+            stack_dbg_en <= 1'b0;
+            stack_dbg_WE <= 1'b0;
 
             sound_on <= 1'b0;
             chipselect_happened <= 1'b0;
@@ -230,11 +289,25 @@
 
             halt_for_keypress <= 1'b0;
 
+            work_stage <= NEXT_PC_WRITE_STAGE;
+            halt_cycles <= 32'h0;
+            hist_clear <= 1'b0;
+            hist_addr <= 9'h0;
+
+            pf_valid <= 1'b0;
+            pf_stale <= 1'b0;
+
         //Handle input from the ARM processor
     end else if(chipselect) begin
 
         chipselect_happened <= 1'b1;
 
+        //Any write may change the next instruction or where it is
+        if(write) begin
+            pf_valid <= 1'b0;
+            pf_stale <= 1'b1;
+        end
+
         if(~chipselect_happened) begin
             chip_sound_timer_write_enable_prev <= sound_timer_write_enable;
             chip_delay_timer_write_enable_prev <= delay_timer_write_enable;
@@ -338,10 +411,13 @@
                     end
                 end
 
-    			//Read/write stack
+    			//Read/write the stack pointer
     			18'h18 : begin 
-    				$display("READ/WRITE STACK NOT IMPLEMENTED");
-    				data_out <= 32'h18;
+    				data_out <= {28'h0, stack_sp};
+    				if(write) begin
+    					stack_sp_WE <= 1'b1;
+    					stack_sp_writedata <= writedata[3:0];
+    				end
     			end 
 
                 //MODIFY MEMORY
@@ -360,11 +436,39 @@
                 end
 
                 //Load single instruction
+                //In Chip8_RUN_INSTRUCTION a write starts the instruction at
+                //stage 2, past the fetch, and stage reads back 0 once it is
+                //done. Reads leave stage alone so they can poll for that.
                 18'h1A : begin
-                    if(write) 
+                    if(write) begin
                         cpu_instruction <= writedata[15:0];
+                        if(state == Chip8_RUN_INSTRUCTION) begin
+                            stage <= 32'h2;
+                            bit_ovewritten <= 1'b0;
+                            is_drawing <= 1'b0;
+                            work_stage <= NEXT_PC_WRITE_STAGE;
+                            halt_cycles <= 32'h0;
+                        end else begin
+                            stage <= 32'h0;
+                        end
+                    end
                     data_out <= {stage[15:0], cpu_instruction};
-                    stage <= 32'h0;
+                end
+
+                //Read/write a stack entry, same two step read as memory
+                18'h1C : begin
+                    stack_dbg_en <= 1'b1;
+                    if(write) begin
+                        stack_dbg_addr <= writedata[19:16];
+                        stack_dbg_WE <= writedata[20];
+                        stack_dbg_writedata <= writedata[15:0];
+
+                        stk_addr_prev <= writedata[19:16];
+                    end else begin
+                        data_out <= {12'h0, stk_addr_prev, stack_dbg_readdata};
+                        stack_dbg_WE <= 1'b0;
+                        stack_dbg_addr <= stk_addr_prev;
+                    end
                 end
 
                 18'h1B : begin
@@ -397,6 +501,11 @@
                     fbvx_prev <= 6'h0;
                     fbvy_prev <= 5'h0;
                     mem_addr_prev <= 12'h0;
+                    stk_addr_prev <= 4'h0;
+
+                    stack_sp_WE <= 1'b0;
+                    stack_dbg_en <= 1'b0;
+                    stack_dbg_WE <= 1'b0;
 
                     sound_on <= 1'b0;
                     chipselect_happened <= 1'b0;
@@ -404,6 +513,27 @@
                     fb_paused <= 1'b1;
 
                     halt_for_keypress <= 1'b0;
+
+                    work_stage <= NEXT_PC_WRITE_STAGE;
+                    halt_cycles <= 32'h0;
+
+                    pf_valid <= 1'b0;
+                end
+
+                //Read the latency histogram, same two step read as memory
+                //writedata[8:0] selects {class, field}, writedata[9] clears it
+                18'h1D : begin
+                    if(write) begin
+                        hist_addr <= writedata[8:0];
+                        hist_clear <= writedata[9];
+                    end
+                    data_out <= hist_readdata;
+                end
+
+                //Framebuffer status, read only:
+                //{frames, 14'h0, catching up, back buffer not presented}
+                18'h1E : begin
+                    data_out <= {fb_frames, 14'h0, fb_busy, fb_pending};
                 end
 
                 default: begin
@@ -428,24 +558,35 @@
 
             chipselect_happened <= 1'b0; 
             stack_reset <= 1'b0;
+            stack_sp_WE <= 1'b0;
+            stack_dbg_en <= 1'b0;
+            stack_dbg_WE <= 1'b0;
+            hist_clear <= 1'b0;
         end else begin 
             fb_paused <= state == Chip8_PAUSED;
 
             case (state)
-                Chip8_RUNNING: begin
+                //An injected instruction runs through the same stages,
+                //without the fetch and without moving on to the next one
+                Chip8_RUNNING, Chip8_RUN_INSTRUCTION: begin
                     sound_on <= sound_timer_out;   
 
                     if(halt_for_keypress) begin
+                        halt_cycles <= halt_cycles + 32'h1;
                         if(ispressed) begin
                             halt_for_keypress <= 1'b0;
                         end
                     end else if(stage == 32'h0) begin
-                        memaddr1 <= pc;
-                        memaddr2 <= pc + 12'h1; 
-                        cpu_instruction <= 16'h0;
+                        if(state == Chip8_RUNNING) begin
+                            memaddr1 <= pc;
+                            memaddr2 <= pc + 12'h1; 
+                            cpu_instruction <= 16'h0;
+                        end
 
                         bit_ovewritten <= 1'b0;
                         is_drawing <= 1'b0;
+                        work_stage <= NEXT_PC_WRITE_STAGE;
+                        halt_cycles <= 32'h0;
 
                         delay_timer_write_enable <= 1'b0;
                         sound_timer_write_enable <= 1'b0;
@@ -461,6 +602,17 @@
                         last_stage <= stage;
                     end else if (stage >= 32'h2) begin
                         last_stage <= stage;
+
+                        //next_pc is settled by NEXT_PC_WRITE_STAGE, so only
+                        //writes past it extend the work. The VF write for DRW
+                        //at stage 30000 is left out, bit_overwritten is final
+                        //after the last pixel.
+                        if((stage > work_stage) & (cpu_reg_WE1 | cpu_reg_WE2 |
+                                (cpu_mem_request & (cpu_mem_WE1 | cpu_mem_WE2)) |
+                                cpu_fb_WE | cpu_fbreset | cpu_reg_I_WE |
+                                cpu_delay_timer_WE | cpu_sound_timer_WE |
+                                (cpu_stk_op != STACK_HOLD)))
+                            work_stage <= stage;
                         if(cpu_delay_timer_WE) begin
                             delay_timer_write_enable <= 1'b1;
                             delay_timer_data <= cpu_delay_timer_writedata;
@@ -490,7 +642,7 @@
                             bit_ovewritten <= 1'b1;
                         end
 
-                        if(stage == 32'd30000 && is_drawing) begin
+                        if(stage == DRW_VF_STAGE && is_drawing) begin
                             regWE2 <= 1'b1;
                             reg_writedata2 <= {7'h0, bit_ovewritten};
                             reg_addr2 <= 4'hF; //Setting VF register to write
@@ -547,6 +699,31 @@
 							memWE2 <= cpu_mem_WE2;
                         end 
 
+                        //Fetch the instruction at next_pc through port 2,
+                        //which the CPU leaves alone, once next_pc is final
+                        //and every memory write is done, so skips,
+                        //returns, jumps and writes to the code are all seen.
+                        //Each address is held for two cycles like the fetch
+                        //at stages 1 and 2, and a pause in between is fine.
+                        if(PREFETCH && state == Chip8_RUNNING) begin
+                            if(stage == PREFETCH_STAGE) begin
+                                pf_pc <= next_pc;
+                                pf_valid <= 1'b0;
+                                pf_stale <= 1'b0;
+                                memaddr2 <= next_pc;
+                            end else if(stage == PREFETCH_STAGE + 32'h1) begin
+                                memaddr2 <= pf_pc;
+                            end else if(stage == PREFETCH_STAGE + 32'h2) begin
+                                pf_instruction[15:8] <= memreaddata2;
+                                memaddr2 <= pf_pc + 12'h1;
+                            end else if(stage == PREFETCH_STAGE + 32'h3) begin
+                                memaddr2 <= pf_pc + 12'h1;
+                            end else if(stage == PREFETCH_STAGE + 32'h4) begin
+                                pf_instruction[7:0] <= memreaddata2;
+                                pf_valid <= ~pf_stale;
+                            end
+                        end
+
                         //Always
                         reg_addr1 <= cpu_reg_addr1;
                         fb_addr_x <= cpu_fb_addr_x;
@@ -556,16 +733,49 @@
                     end
 
                     //Cap of 50000, since 1000 instructions/sec is reasonable
-                    if(!halt_for_keypress) begin
-                        if(stage >= CPU_CYCLE_LENGTH) begin
-                            stage <= 32'h0;
+                    //Injected instructions other than DRW, whose VF write
+                    //comes at stage 30000, are done by INJECT_CYCLE_LENGTH
+                    if(!halt_for_keypress & (state == Chip8_RUNNING | stage != 32'h0)) begin
+                        if((stage >= CYCLE_LENGTH & (!is_drawing | stage > DRW_VF_STAGE)) |
+                                (state == Chip8_RUN_INSTRUCTION & !is_drawing &
+                                stage >= INJECT_CYCLE_LENGTH)) begin
                             pc <= next_pc;
+                            hist_sample <= 1'b1;
+                            hist_instruction <= cpu_instruction;
+                            hist_work_stage <= work_stage;
+                            hist_halt_cycles <= halt_cycles;
+                            pf_valid <= 1'b0;
+
+                            //With the next instruction already fetched, go
+                            //straight to stage 2 and do stage 0's clearing here
+                            if(PREFETCH && state == Chip8_RUNNING && pf_valid &&
+                                    pf_pc == next_pc) begin
+                                stage <= 32'h2;
+                                cpu_instruction <= pf_instruction;
+
+                                bit_ovewritten <= 1'b0;
+                                is_drawing <= 1'b0;
+                                work_stage <= NEXT_PC_WRITE_STAGE;
+                                halt_cycles <= 32'h0;
+
+                                delay_timer_write_enable <= 1'b0;
+                                sound_timer_write_enable <= 1'b0;
+                                regWE1 <= 1'b0;
+                                regWE2 <= 1'b0;
+                                memWE1 <= 1'b0;
+                                memWE2 <= 1'b0;
+                                stack_op <= STACK_HOLD;
+                            end else begin
+                                stage <= 32'h0;
+                            end
                         end 
                         else if (stage == 32'h1) begin
                             if(stage == last_stage) stage <= 32'h2;
                             else stage <= 32'h1;
                         end else if(stage == 32'h2) begin
-                            if(stage == last_stage) stage <= 32'h3;
+                            //CLS and DRW wait for the back buffer to catch up
+                            if(stage == last_stage & !(fb_busy & (cpu_instruction == 16'h00E0 |
+                                    cpu_instruction[15:12] == 4'hD))) stage <= 32'h3;
                             else stage <= 32'h2;
                         end 
 
@@ -574,9 +784,6 @@
                         end
                     end
                 end
-                Chip8_RUN_INSTRUCTION: begin
-                    // sound_on <= 1'b1;
-                end
                 Chip8_PAUSED: begin
                     // sound_on <= 1'b1;
                 end
@@ -585,6 +792,11 @@
         end
     end
 
+    //Buffers only swap between instructions that draw, CLS writes up to
+    //stage 8188 and DRW well before it
+    assign fb_present_ok = !(stage >= 32'h2 & stage <= 32'd8188 &
+        (cpu_instruction == 16'h00E0 | cpu_instruction[15:12] == 4'hD));
+
     Chip8_framebuffer framebuffer(
         .clk(clk),
         .reset(fbreset),
@@ -594,6 +806,10 @@
         .fb_WE(fb_WE),
         .fb_readdata(fb_readdata),
         .is_paused   (fb_paused),
+        .present_ok  (fb_present_ok),
+        .fb_pending  (fb_pending),
+        .fb_busy     (fb_busy),
+        .fb_frames   (fb_frames),
         .VGA_R(VGA_R),
         .VGA_G(VGA_G),
         .VGA_B(VGA_B),
@@ -727,7 +943,29 @@
         .cpu_clk(clk),
         .op(stack_op),
         .writedata(stack_writedata),
-        .outdata(stack_outdata)
+        .outdata(stack_outdata),
+        .dbg_sp_WE(stack_sp_WE),
+        .dbg_sp(stack_sp_writedata),
+        .dbg_en(stack_dbg_en),
+        .dbg_addr(stack_dbg_addr),
+        .dbg_WE(stack_dbg_WE),
+        .dbg_writedata(stack_dbg_writedata),
+        .sp(stack_sp),
+        .dbg_readdata(stack_dbg_readdata)
+        );
+
+    //Sampled the cycle after completion, from copies taken at completion
+    //since a prefetched instruction replaces cpu_instruction right away
+    Chip8_LatencyHist latency_hist (
+        .clk(clk),
+        .reset(reset),
+        .clear(hist_clear),
+        .sample(hist_sample),
+        .instruction(hist_instruction),
+        .work_stage(hist_work_stage),
+        .halt_cycles(hist_halt_cycles),
+        .rd_addr(hist_addr),
+        .rd_data(hist_readdata)
         );
 
 
@@ -0,0 +1,151 @@
+`timescale 1ns/100ps
+
+`include "../enums.svh"
+
+/*
+ * Loads a short program through the ARM interface, runs it and checks the
+ * latency histogram read back from 18'h1D against the stage at which each
+ * instruction writes last in Chip8_CPU.sv
+ */
+module Chip8_LatencyHist_test();
+
+	logic         	clk;
+	logic         	reset;
+	logic [31:0]  	writedata;
+	logic 			write;
+	logic 	  		chipselect;
+	logic [17:0] 	address;
+
+	logic [31:0] data_out;
+	logic [7:0]  VGA_R, VGA_G, VGA_B;
+	logic        VGA_CLK, VGA_HS, VGA_VS, VGA_BLANK_n;
+	logic        VGA_SYNC_n;
+
+	logic OSC_50_B8A;
+	wire  AUD_ADCLRCK, AUD_DACLRCK, AUD_BCLK, AUD_I2C_SDAT;
+	logic AUD_ADCDAT;
+	logic AUD_DACDAT, AUD_XCK, AUD_I2C_SCLK, AUD_MUTE;
+
+	Chip8_Top top(.*);
+
+	//200: CLS          work ends at stage 8188
+	//202: LD V0, 5     12, next_pc
+	//204: LD I, 300    12
+	//206: DRW V0,V1,5  655, last pixel of row 4
+	//208: LD B, V2     241
+	//20A: LD [I], V3   31, fourth byte
+	//20C: JP 20C       12
+	logic [15:0] program[0:6] = '{16'h00E0, 16'h6005, 16'hA300, 16'hD015,
+		16'hF233, 16'hF355, 16'h120C};
+
+	int errors = 0;
+
+	task automatic avalon_write(input logic [17:0] addr, input logic [31:0] data);
+		@(negedge clk);
+		chipselect = 1'b1;
+		write = 1'b1;
+		address = addr;
+		writedata = data;
+		@(negedge clk);
+		chipselect = 1'b0;
+		write = 1'b0;
+		@(negedge clk);
+	endtask
+
+	task automatic avalon_read(input logic [17:0] addr, output logic [31:0] data);
+		@(negedge clk);
+		chipselect = 1'b1;
+		write = 1'b0;
+		address = addr;
+		repeat(2) @(negedge clk);
+		data = data_out;
+		chipselect = 1'b0;
+		@(negedge clk);
+	endtask
+
+	task automatic hist_read(input logic [4:0] cls, input logic [3:0] field,
+			output logic [31:0] data);
+		avalon_write(18'h1D, {23'h0, cls, field});
+		repeat(2) @(negedge clk);
+		avalon_read(18'h1D, data);
+	endtask
+
+	task automatic expect_class(input logic [4:0] cls, input logic [31:0] count,
+			input logic [31:0] max, input logic [2:0] bucket);
+		logic [31:0] got_count, got_max, got_bucket;
+		hist_read(cls, 4'h0, got_count);
+		hist_read(cls, 4'h3, got_max);
+		hist_read(cls, {1'b1, bucket}, got_bucket);
+		assert(got_count >= count && got_max == max && got_bucket == got_count)
+			$display("Class %0d : PASSED (%0d, max stage %0d)", cls, got_count, got_max);
+		else begin
+			$error("Class %0d : FAILED (count %0d, max %0d, bucket %0d; expected %0d, %0d)",
+				cls, got_count, got_max, got_bucket, count, max);
+			errors++;
+		end
+	endtask
+
+	initial begin
+		clk = 0;
+		forever
+			#20ns clk = ~clk;
+	end
+
+	initial begin
+		OSC_50_B8A = 0;
+		forever
+			#10ns OSC_50_B8A = ~OSC_50_B8A;
+	end
+
+	initial begin
+		chipselect = 1'b0;
+		write = 1'b0;
+		address = 18'h0;
+		writedata = 32'h0;
+		AUD_ADCDAT = 1'b0;
+
+		reset = 1'b1;
+		repeat (2) @(posedge clk);
+		reset = 1'b0;
+		//The histogram clears itself after reset
+		repeat (600) @(posedge clk);
+
+		for (int k = 0; k < 7; ++k) begin
+			avalon_write(18'h19, {11'h0, 1'b1, 12'h200 + 12'(2 * k), program[k][15:8]});
+			avalon_write(18'h19, {11'h0, 1'b1, 12'h201 + 12'(2 * k), program[k][7:0]});
+		end
+		avalon_write(18'h14, 32'h200);
+
+		//Seven instructions plus a few turns of the final jump
+		avalon_write(18'h16, 32'h0);
+		repeat (10 * (CPU_CYCLE_LENGTH + 4)) @(posedge clk);
+		avalon_write(18'h16, 32'h2);
+		repeat (20) @(posedge clk);
+
+		expect_class(5'd1,  1, 32'd8188, 3'd5);
+		expect_class(5'd8,  1, NEXT_PC_WRITE_STAGE, 3'd0);
+		expect_class(5'd12, 1, NEXT_PC_WRITE_STAGE, 3'd0);
+		expect_class(5'd15, 1, 32'd655, 3'd3);
+		expect_class(5'd19, 1, 32'd241, 3'd2);
+		expect_class(5'd20, 1, 32'd31, 3'd1);
+		expect_class(5'd3,  2, NEXT_PC_WRITE_STAGE, 3'd0);
+
+		//Clearing through the same address zeroes every class
+		avalon_write(18'h1D, {22'h0, 1'b1, 9'h0});
+		repeat (600) @(posedge clk);
+		begin
+			logic [31:0] count;
+			hist_read(5'd15, 4'h0, count);
+			assert(count == 0)
+				$display("Clear : PASSED");
+			else begin
+				$error("Clear : FAILED (DRW count %0d)", count);
+				errors++;
+			end
+		end
+
+		$display("%0d errors", errors);
+		$stop;
+	end
+
+endmodule
@@ -0,0 +1,291 @@
+`timescale 1ns/100ps
+
+`include "../enums.svh"
+
+/*
+ * Runs the same programs on three Chip8_Tops sharing one Avalon bus: one
+ * without the instruction prefetch, one with it, and one with it and a
+ * CYCLE_LENGTH of INJECT_CYCLE_LENGTH. Reports the cycles per instruction
+ * of each. Every instruction fetched, prefetched or not, is checked against
+ * a copy of memory kept from the writes each top makes, and a short program
+ * with a skip, a call and return, Bnnn and a write to the instruction after
+ * it must leave the same registers on all three.
+ */
+module Chip8_Prefetch_test();
+
+	localparam int N = 3;
+	localparam string name[N] = '{"No prefetch", "Prefetch", "Prefetch, short slot"};
+
+	logic         	clk;
+	logic         	reset;
+	logic [31:0]  	writedata;
+	logic 			write;
+	logic 	  		chipselect;
+	logic [17:0] 	address;
+
+	logic [31:0] data_out[N];
+
+	logic OSC_50_B8A;
+	logic AUD_ADCDAT;
+
+	//200: LD V0,1      206 skipped
+	//208: CALL 300     sets V4, back to 20A
+	//214: LD [I],V1    rewrites 216 into LD V3,44
+	//21A: JP V0,21C    to 220, past two loads of V5
+	//222: JP 222
+	logic [15:0] program[0:19] = '{16'h6001, 16'h6102, 16'h3001, 16'h6155,
+		16'h2300, 16'h4001, 16'h6233, 16'h6063, 16'h6144, 16'hA216,
+		16'hF155, 16'h6399, 16'h6004, 16'hB21C, 16'h6566, 16'h6577,
+		16'h6588, 16'h1222, 16'h6477, 16'h00EE};
+
+	logic [7:0] rom[0:4095 - 12'h200];
+	int rom_size;
+
+	int errors = 0;
+	logic counting = 1'b0;
+	longint cycles = 0;
+	int retired[N], prefetched[N], fetch_errors[N];
+	longint first_done[N], last_done[N];
+
+	always @(posedge clk)
+		if (counting) cycles <= cycles + 1;
+
+	genvar g;
+	generate
+		for (g = 0; g < N; ++g) begin : dut
+			logic [7:0] shadow[0:4095];
+
+			Chip8_Top #(
+				.CYCLE_LENGTH(g == 2 ? INJECT_CYCLE_LENGTH : CPU_CYCLE_LENGTH),
+				.PREFETCH(g != 0)
+				) top (
+				.clk(clk),
+				.reset(reset),
+				.writedata(writedata),
+				.write(write),
+				.chipselect(chipselect),
+				.address(address),
+				.data_out(data_out[g]),
+				.VGA_R(), .VGA_G(), .VGA_B(),
+				.VGA_CLK(), .VGA_HS(), .VGA_VS(), .VGA_BLANK_n(), .VGA_SYNC_n(),
+				.OSC_50_B8A(OSC_50_B8A),
+				.AUD_ADCLRCK(),
+				.AUD_ADCDAT(AUD_ADCDAT),
+				.AUD_DACLRCK(),
+				.AUD_DACDAT(),
+				.AUD_XCK(),
+				.AUD_BCLK(),
+				.AUD_I2C_SCLK(),
+				.AUD_I2C_SDAT(),
+				.AUD_MUTE()
+				);
+
+			initial begin
+				for (int k = 0; k < 4096; ++k)
+					shadow[k] = 8'h0;
+			end
+
+			//Same writes the memory sees, host writes loading the ROM included
+			always @(posedge clk) begin
+				if (top.memWE1) shadow[top.memaddr1] <= top.memwritedata1;
+				if (top.memWE2) shadow[top.memaddr2] <= top.memwritedata2;
+			end
+
+			//First cycle of stage 3, the instruction is in place either way
+			always @(posedge clk) begin
+				if (counting & top.state == Chip8_RUNNING & top.stage == 32'h3 &
+						top.last_stage == 32'h2 &
+						top.cpu_instruction != {shadow[top.pc], shadow[top.pc + 12'h1]}) begin
+					if (fetch_errors[g] < 5)
+						$error("%s : %h at %h, memory holds %h", name[g], top.cpu_instruction,
+							top.pc, {shadow[top.pc], shadow[top.pc + 12'h1]});
+					fetch_errors[g] <= fetch_errors[g] + 1;
+				end
+			end
+
+			//hist_sample is up the cycle after completion, stage is 2 by then
+			//when the next instruction came from the prefetch
+			always @(posedge clk) begin
+				if (counting & top.hist_sample) begin
+					retired[g] <= retired[g] + 1;
+					if (retired[g] == 0) first_done[g] <= cycles;
+					last_done[g] <= cycles;
+					if (top.stage == 32'h2) prefetched[g] <= prefetched[g] + 1;
+				end
+			end
+		end
+	endgenerate
+
+	task automatic avalon_write(input logic [17:0] addr, input logic [31:0] data);
+		@(negedge clk);
+		chipselect = 1'b1;
+		write = 1'b1;
+		address = addr;
+		writedata = data;
+		@(negedge clk);
+		chipselect = 1'b0;
+		write = 1'b0;
+		@(negedge clk);
+	endtask
+
+	task automatic avalon_read(input logic [17:0] addr, output logic [31:0] data[N]);
+		@(negedge clk);
+		chipselect = 1'b1;
+		write = 1'b0;
+		address = addr;
+		repeat(2) @(negedge clk);
+		data = data_out;
+		chipselect = 1'b0;
+		@(negedge clk);
+	endtask
+
+	task automatic expect_read(input string what, input logic [17:0] addr,
+			input logic [31:0] mask, input logic [31:0] expected);
+		logic [31:0] data[N];
+		avalon_read(addr, data);
+		for (int k = 0; k < N; ++k) begin
+			assert((data[k] & mask) == expected)
+				$display("%s, %s : PASSED", name[k], what);
+			else begin
+				$error("%s, %s : FAILED (%h, expected %h)", name[k], what, data[k] & mask, expected);
+				errors++;
+			end
+		end
+	endtask
+
+	task automatic expect_memory(input logic [11:0] addr, input logic [7:0] expected);
+		avalon_write(18'h19, {12'h0, addr, 8'h0});
+		repeat(2) @(negedge clk);
+		expect_read($sformatf("Memory %h", addr), 18'h19, 32'hff, {24'h0, expected});
+	endtask
+
+	//Resets the tops and loads bytes at 200 through the memory port
+	task automatic load(input logic [7:0] bytes[], input int size);
+		reset = 1'b1;
+		repeat (2) @(posedge clk);
+		reset = 1'b0;
+		repeat (600) @(posedge clk);
+
+		for (int k = 0; k < size; ++k)
+			avalon_write(18'h19, {11'h0, 1'b1, 12'h200 + 12'(k), bytes[k]});
+		avalon_write(18'h15, 32'h0);
+		avalon_write(18'h14, 32'h200);
+	endtask
+
+	//Runs all three for the given cycles from a clean count
+	task automatic run(input longint length);
+		cycles = 0;
+		for (int k = 0; k < N; ++k) begin
+			retired[k] = 0;
+			prefetched[k] = 0;
+			fetch_errors[k] = 0;
+			first_done[k] = 0;
+			last_done[k] = 0;
+		end
+		counting = 1'b1;
+		avalon_write(18'h16, 32'h0);
+		repeat (length) @(posedge clk);
+		avalon_write(18'h16, 32'h2);
+		counting = 1'b0;
+		repeat (20) @(posedge clk);
+	endtask
+
+	//Between the first and the last completion, a few cycles a slot apart
+	//would not show in how many complete in a fixed time
+	function automatic real cpi(input int k);
+		return retired[k] > 1 ? real'(last_done[k] - first_done[k]) / (retired[k] - 1) : 0.0;
+	endfunction
+
+	initial begin
+		clk = 0;
+		forever
+			#20ns clk = ~clk;
+	end
+
+	initial begin
+		OSC_50_B8A = 0;
+		forever
+			#10ns OSC_50_B8A = ~OSC_50_B8A;
+	end
+
+	initial begin
+		logic [7:0] bytes[];
+		int fd;
+
+		chipselect = 1'b0;
+		write = 1'b0;
+		address = 18'h0;
+		writedata = 32'h0;
+		AUD_ADCDAT = 1'b0;
+
+		//Short program, every instruction after the first is prefetched
+		bytes = new[12'h104];
+		for (int k = 0; k < 12'h104; ++k)
+			bytes[k] = 8'h0;
+		for (int k = 0; k < $size(program); ++k) begin
+			int at = k < 18 ? 2 * k : 12'h100 + 2 * (k - 18);
+			bytes[at] = program[k][15:8];
+			bytes[at + 1] = program[k][7:0];
+		end
+		load(bytes, bytes.size());
+		run(30 * (CPU_CYCLE_LENGTH + 3));
+
+		expect_read("V0", 18'h0, 32'hff, 32'h04);
+		expect_read("V1", 18'h1, 32'hff, 32'h44);
+		expect_read("V2", 18'h2, 32'hff, 32'h33);
+		expect_read("V3", 18'h3, 32'hff, 32'h44);
+		expect_read("V4", 18'h4, 32'hff, 32'h77);
+		expect_read("V5", 18'h5, 32'hff, 32'h88);
+		expect_read("PC", 18'h14, 32'hfff, 32'h222);
+		expect_read("SP", 18'h18, 32'hf, 32'h0);
+		expect_memory(12'h216, 8'h63);
+		expect_memory(12'h217, 8'h44);
+		for (int k = 0; k < N; ++k) begin
+			assert(fetch_errors[k] == 0 && retired[k] >= 20 &&
+					prefetched[k] == (k == 0 ? 0 : retired[k]))
+				$display("%s, program : PASSED (%0d of %0d prefetched)", name[k],
+					prefetched[k], retired[k]);
+			else begin
+				$error("%s, program : FAILED (%0d fetch errors, %0d of %0d prefetched)",
+					name[k], fetch_errors[k], prefetched[k], retired[k]);
+				errors++;
+			end
+		end
+
+		//Bundled ROM, timing differs between the three so only fetches compare
+		fd = $fopen("../test/Pong.ch8", "rb");
+		if (fd == 0) begin
+			$error("Cannot open ../test/Pong.ch8");
+			$stop;
+		end
+		rom_size = $fread(rom, fd);
+		$fclose(fd);
+		bytes = new[rom_size];
+		for (int k = 0; k < rom_size; ++k)
+			bytes[k] = rom[k];
+		load(bytes, rom_size);
+		run(200 * (CPU_CYCLE_LENGTH + 3));
+
+		for (int k = 0; k < N; ++k) begin
+			$display("%s : %0d instructions, %0d prefetched, %.1f cycles per instruction",
+				name[k], retired[k], prefetched[k], cpi(k));
+			assert(fetch_errors[k] == 0 && retired[k] > 0 &&
+					(k == 0 || prefetched[k] == retired[k]))
+				$display("%s, Pong : PASSED", name[k]);
+			else begin
+				$error("%s, Pong : FAILED (%0d fetch errors)", name[k], fetch_errors[k]);
+				errors++;
+			end
+		end
+		assert(cpi(1) < cpi(0) && cpi(2) < cpi(1))
+			$display("Cycles per instruction : PASSED");
+		else begin
+			$error("Cycles per instruction : FAILED");
+			errors++;
+		end
+
+		$display("%0d errors", errors);
+		$stop;
+	end
+
+endmodule
@@ -0,0 +1,185 @@
+`timescale 1ns/100ps
+
+`include "../enums.svh"
+
+/*
+ * Injects instructions through 18'h1A in Chip8_RUN_INSTRUCTION and polls
+ * the stage read back from the same address until it is 0, the contract
+ * chip8io_inject relies on. Checks the results against what the CPU should
+ * have done and that Fx0A holds the handshake until a key is pressed.
+ */
+module Chip8_RunInstruction_test();
+
+	logic         	clk;
+	logic         	reset;
+	logic [31:0]  	writedata;
+	logic 			write;
+	logic 	  		chipselect;
+	logic [17:0] 	address;
+
+	logic [31:0] data_out;
+	logic [7:0]  VGA_R, VGA_G, VGA_B;
+	logic        VGA_CLK, VGA_HS, VGA_VS, VGA_BLANK_n;
+	logic        VGA_SYNC_n;
+
+	logic OSC_50_B8A;
+	wire  AUD_ADCLRCK, AUD_DACLRCK, AUD_BCLK, AUD_I2C_SDAT;
+	logic AUD_ADCDAT;
+	logic AUD_DACDAT, AUD_XCK, AUD_I2C_SCLK, AUD_MUTE;
+
+	Chip8_Top top(.*);
+
+	//LD VA,123; LD I,300; LD B,VA; ADD VA,1; LD V1,VA; LD V0,5; SUB V1,V0;
+	//CALL 400
+	logic [15:0] setup[0:7] = '{16'h6A7B, 16'hA300, 16'hFA33, 16'h7A01,
+		16'h81A0, 16'h6005, 16'h8105, 16'h2400};
+
+	int errors = 0;
+	int cycles = 0;
+
+	always @(posedge clk)
+		cycles <= cycles + 1;
+
+	task automatic avalon_write(input logic [17:0] addr, input logic [31:0] data);
+		@(negedge clk);
+		chipselect = 1'b1;
+		write = 1'b1;
+		address = addr;
+		writedata = data;
+		@(negedge clk);
+		chipselect = 1'b0;
+		write = 1'b0;
+		@(negedge clk);
+	endtask
+
+	task automatic avalon_read(input logic [17:0] addr, output logic [31:0] data);
+		@(negedge clk);
+		chipselect = 1'b1;
+		write = 1'b0;
+		address = addr;
+		repeat(2) @(negedge clk);
+		data = data_out;
+		chipselect = 1'b0;
+		@(negedge clk);
+	endtask
+
+	//Polls 18'h1A until the stage reads 0, returns the cycles it took or -1
+	task automatic wait_done(input int timeout, output int took);
+		logic [31:0] data;
+		int start = cycles;
+		took = -1;
+		while (cycles - start < timeout) begin
+			avalon_read(18'h1A, data);
+			if (data[31:16] == 16'h0) begin
+				took = cycles - start;
+				break;
+			end
+		end
+	endtask
+
+	task automatic inject(input logic [15:0] instruction, output int took);
+		avalon_write(18'h1A, {16'h0, instruction});
+		wait_done(CPU_CYCLE_LENGTH + 1000, took);
+	endtask
+
+	task automatic expect_read(input string name, input logic [17:0] addr,
+			input logic [31:0] mask, input logic [31:0] expected);
+		logic [31:0] data;
+		avalon_read(addr, data);
+		assert((data & mask) == expected)
+			$display("%s : PASSED", name);
+		else begin
+			$error("%s : FAILED (%h, expected %h)", name, data & mask, expected);
+			errors++;
+		end
+	endtask
+
+	task automatic expect_memory(input logic [11:0] addr, input logic [7:0] expected);
+		avalon_write(18'h19, {12'h0, addr, 8'h0});
+		repeat(2) @(negedge clk);
+		expect_read($sformatf("Memory %h", addr), 18'h19, 32'hff, {24'h0, expected});
+	endtask
+
+	initial begin
+		clk = 0;
+		forever
+			#20ns clk = ~clk;
+	end
+
+	initial begin
+		OSC_50_B8A = 0;
+		forever
+			#10ns OSC_50_B8A = ~OSC_50_B8A;
+	end
+
+	initial begin
+		int took, longest;
+
+		chipselect = 1'b0;
+		write = 1'b0;
+		address = 18'h0;
+		writedata = 32'h0;
+		AUD_ADCDAT = 1'b0;
+
+		reset = 1'b1;
+		repeat (2) @(posedge clk);
+		reset = 1'b0;
+		repeat (600) @(posedge clk);
+
+		avalon_write(18'h14, 32'h200);
+		avalon_write(18'h16, 32'h1);
+
+		longest = 0;
+		for (int k = 0; k < 8; ++k) begin
+			inject(setup[k], took);
+			if (took < 0) begin
+				$error("%h : FAILED, did not finish", setup[k]);
+				errors++;
+			end else if (took > longest)
+				longest = took;
+		end
+		assert(longest >= 0 && longest < INJECT_CYCLE_LENGTH + 200)
+			$display("Handshake : PASSED (longest %0d cycles)", longest);
+		else begin
+			$error("Handshake : FAILED (longest %0d cycles)", longest);
+			errors++;
+		end
+
+		expect_read("VA", 18'hA, 32'hff, 32'd124);
+		expect_read("V1", 18'h1, 32'hff, 32'd119);
+		expect_read("I", 18'h10, 32'hffff, 32'h300);
+		expect_memory(12'h300, 8'd1);
+		expect_memory(12'h301, 8'd2);
+		expect_memory(12'h302, 8'd3);
+		expect_read("PC", 18'h14, 32'hfff, 32'h400);
+		expect_read("SP", 18'h18, 32'hf, 32'h1);
+
+		//Polling leaves the stage alone, so it stays 0 with the latch intact
+		expect_read("Stage after done", 18'h1A, 32'hffffffff, 32'h2400);
+
+		//Fx0A holds the handshake until a key is pressed
+		avalon_write(18'h15, 32'h0);
+		avalon_write(18'h1A, 32'hF30A);
+		wait_done(20000, took);
+		assert(took < 0)
+			$display("Fx0A without a key : PASSED");
+		else begin
+			$error("Fx0A without a key : FAILED, done after %0d cycles", took);
+			errors++;
+		end
+		avalon_write(18'h15, 32'h19);
+		wait_done(CPU_CYCLE_LENGTH + 1000, took);
+		assert(took >= 0)
+			$display("Fx0A with a key : PASSED");
+		else begin
+			$error("Fx0A with a key : FAILED, did not finish");
+			errors++;
+		end
+		expect_read("V3", 18'h3, 32'hff, 32'h9);
+
+		avalon_write(18'h16, 32'h2);
+		$display("%0d errors", errors);
+		$stop;
+	end
+
+endmodule
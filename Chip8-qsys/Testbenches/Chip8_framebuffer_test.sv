@@ -0,0 +1,320 @@
+`timescale 1ns/100ps
+
+`include "../enums.svh"
+
+/*
+ * Drives Chip8_framebuffer the way Chip8_Top does: sprites drawn a pixel at
+ * a time by reading and writing back, a CLS now and then, each with
+ * present_ok low and held off while fb_busy is up, and host writes in
+ * between. Every frame the VGA emulator scans is rebuilt from VGA_R and
+ * must be one whole image from between two instructions, never a mix of
+ * two, and every pixel read back while drawing must match what was drawn.
+ * Reports the cycles per frame and how long the catch up after each swap
+ * takes, replaying the write log or copying the front buffer.
+ */
+module Chip8_framebuffer_test();
+
+	localparam int FRAMES = 8;
+	localparam int FRAME_CYCLES = 1600 * 525;
+
+	logic         	clk;
+	logic         	reset;
+	logic [4:0]		fb_addr_y;
+	logic [5:0]		fb_addr_x;
+	logic 			fb_writedata;
+	logic 			fb_WE;
+	logic 			is_paused;
+	logic 			present_ok;
+	logic 			fb_readdata;
+	logic 			fb_pending;
+	logic 			fb_busy;
+	logic [15:0]	fb_frames;
+	logic [7:0]		VGA_R, VGA_G, VGA_B;
+	logic 			VGA_CLK, VGA_HS, VGA_VS, VGA_BLANK_n, VGA_SYNC_n;
+
+	Chip8_framebuffer dut(
+		.clk(clk),
+		.reset(reset),
+		.fb_addr_y(fb_addr_y),
+		.fb_addr_x(fb_addr_x),
+		.fb_writedata(fb_writedata),
+		.fb_WE(fb_WE),
+		.is_paused(is_paused),
+		.present_ok(present_ok),
+		.fb_readdata(fb_readdata),
+		.fb_pending(fb_pending),
+		.fb_busy(fb_busy),
+		.fb_frames(fb_frames),
+		.VGA_R(VGA_R),
+		.VGA_G(VGA_G),
+		.VGA_B(VGA_B),
+		.VGA_CLK(VGA_CLK),
+		.VGA_HS(VGA_HS),
+		.VGA_VS(VGA_VS),
+		.VGA_BLANK_n(VGA_BLANK_n),
+		.VGA_SYNC_n(VGA_SYNC_n)
+		);
+
+	int errors = 0;
+
+	//What has been drawn, and every state of it a swap may show
+	logic [2047:0] image;
+	logic [2047:0] presentable[$];
+
+	//Frame being scanned, rebuilt from the middle of each 8x8 block
+	logic [2047:0] seen;
+	logic vblank_prev = 1'b0;
+	int frames = 0, torn = 0, frame_cycles = 0, bad_frame_cycles = 0;
+
+	int swaps = 0, copies = 0, busy_cycles = 0, busy_max = 0, busy_now = 0;
+	int read_errors = 0, host_writes = 0;
+
+	always @(posedge clk) begin
+		int v, h;
+
+		frame_cycles <= frame_cycles + 1;
+		vblank_prev <= dut.vblank;
+
+		v = int'(dut.led_emulator.vcount) - 116;
+		h = int'(dut.led_emulator.hcount[10:1]) - 68;
+		if (!reset & dut.led_emulator.hcount[0] & v >= 0 & v < 256 & v % 8 == 0 &
+				h >= 0 & h < 512 & h % 8 == 0)
+			seen[(v / 8) * 64 + h / 8] <= VGA_R == 8'hFF;
+
+		if (!reset & dut.vblank & !vblank_prev) begin
+			int match;
+
+			match = -1;
+			if (frames > 0 && frame_cycles != FRAME_CYCLES)
+				bad_frame_cycles <= bad_frame_cycles + 1;
+			frame_cycles <= 1;
+			frames <= frames + 1;
+
+			//Scanning starts at reset, the first frame is whole too
+			for (int k = 0; k < presentable.size(); ++k) begin
+				if (presentable[k] == seen) begin
+					match = k;
+					break;
+				end
+			end
+			if (match < 0) begin
+				if (torn < 5)
+					$error("Frame %0d is not an image that was drawn", frames);
+				torn <= torn + 1;
+			end else begin
+				//Only that image or a later one can come next
+				for (int k = 0; k < match; ++k)
+					void'(presentable.pop_front());
+			end
+		end
+
+		if (dut.swap) begin
+			swaps <= swaps + 1;
+			if (dut.log_overflow) copies <= copies + 1;
+		end
+		if (fb_busy) begin
+			busy_cycles <= busy_cycles + 1;
+			busy_now <= busy_now + 1;
+			if (busy_now + 1 > busy_max) busy_max <= busy_now + 1;
+		end else begin
+			busy_now <= 0;
+		end
+	end
+
+	//Like a DRW pixel: address, read back two cycles on, write
+	task automatic draw_pixel(input int x, input int y, input logic flip);
+		@(negedge clk);
+		fb_addr_x = x;
+		fb_addr_y = y;
+		fb_WE = 1'b0;
+		repeat(2) @(negedge clk);
+		if (fb_readdata !== image[y * 64 + x]) begin
+			if (read_errors < 5)
+				$error("Pixel %0d,%0d reads %b, drew %b", x, y, fb_readdata, image[y * 64 + x]);
+			read_errors++;
+		end
+		fb_writedata = image[y * 64 + x] ^ flip;
+		fb_WE = 1'b1;
+		image[y * 64 + x] = image[y * 64 + x] ^ flip;
+		@(negedge clk);
+		fb_WE = 1'b0;
+	endtask
+
+	task automatic draw_sprite();
+		int x = $urandom_range(63), y = $urandom_range(31), rows = $urandom_range(1, 8);
+
+		for (int r = 0; r < rows; ++r) begin
+			logic [7:0] bits = $urandom;
+			for (int c = 0; c < 8; ++c)
+				draw_pixel((x + c) % 64, (y + r) % 32, bits[7 - c]);
+		end
+	endtask
+
+	//Like CLS: every address held 4 cycles with the write enable up
+	task automatic clear_screen();
+		@(negedge clk);
+		fb_writedata = 1'b0;
+		for (int k = 0; k < 2048; ++k) begin
+			fb_addr_x = k % 64;
+			fb_addr_y = k / 64;
+			fb_WE = 1'b1;
+			repeat(4) @(negedge clk);
+		end
+		fb_WE = 1'b0;
+		image = '0;
+	endtask
+
+	//Like an Avalon write to 18'h17, the write enable stays up a while
+	task automatic host_write(input int x, input int y, input logic value);
+		@(negedge clk);
+		fb_addr_x = x;
+		fb_addr_y = y;
+		fb_writedata = value;
+		fb_WE = 1'b1;
+		image[y * 64 + x] = value;
+		presentable.push_back(image);
+		repeat(3) @(negedge clk);
+		fb_WE = 1'b0;
+		host_writes++;
+	endtask
+
+	task automatic expect_back(input string what);
+		int wrong = 0;
+
+		for (int k = 0; k < 2048; ++k) begin
+			@(negedge clk);
+			fb_addr_x = k % 64;
+			fb_addr_y = k / 64;
+			fb_WE = 1'b0;
+			repeat(2) @(negedge clk);
+			if (fb_readdata !== image[k]) wrong++;
+		end
+		assert(wrong == 0)
+			$display("%s : PASSED", what);
+		else begin
+			$error("%s : FAILED (%0d pixels differ)", what, wrong);
+			errors++;
+		end
+	endtask
+
+	initial begin
+		clk = 0;
+		forever
+			#10ns clk = ~clk;
+	end
+
+	initial begin
+		int last;
+
+		fb_addr_x = 6'h0;
+		fb_addr_y = 5'h0;
+		fb_writedata = 1'b0;
+		fb_WE = 1'b0;
+		is_paused = 1'b0;
+		present_ok = 1'b1;
+		image = '0;
+		seen = '0;
+		presentable.push_back(image);
+
+		reset = 1'b1;
+		repeat (2) @(posedge clk);
+		reset = 1'b0;
+
+		//An instruction every 40000 cycles, a CLS every 50
+		for (int n = 0; frames < FRAMES; ++n) begin
+			while (fb_busy) @(negedge clk);
+			present_ok = 1'b0;
+			if (n % 50 == 49) clear_screen();
+			else draw_sprite();
+			@(negedge clk);
+			present_ok = 1'b1;
+			presentable.push_back(image);
+
+			for (int k = 0; k < 40000; ++k) begin
+				if (fb_busy & k % 200 == 0)
+					host_write($urandom_range(63), $urandom_range(31), $urandom_range(1));
+				else
+					@(negedge clk);
+			end
+		end
+
+		$display("%0d frames, %0d cycles each, %0d swaps, %0d of them copying", frames,
+			FRAME_CYCLES, swaps, copies);
+		$display("Catch up: %0d cycles at most, %0d in all, %0d host writes during it",
+			busy_max, busy_cycles, host_writes);
+
+		assert(bad_frame_cycles == 0)
+			$display("Cycles per frame : PASSED");
+		else begin
+			$error("Cycles per frame : FAILED (%0d frames not %0d cycles)", bad_frame_cycles,
+				FRAME_CYCLES);
+			errors++;
+		end
+		assert(torn == 0)
+			$display("No tearing : PASSED");
+		else begin
+			$error("No tearing : FAILED (%0d frames)", torn);
+			errors++;
+		end
+		assert(read_errors == 0)
+			$display("Reads while drawing : PASSED");
+		else begin
+			$error("Reads while drawing : FAILED (%0d)", read_errors);
+			errors++;
+		end
+		assert(swaps >= FRAMES - 1 && copies > 0 && copies < swaps && host_writes > 0)
+			$display("Replays and copies : PASSED");
+		else begin
+			$error("Replays and copies : FAILED");
+			errors++;
+		end
+		assert(fb_frames == 16'(frames))
+			$display("Frame count : PASSED");
+		else begin
+			$error("Frame count : FAILED (%0d, expected %0d)", fb_frames, frames);
+			errors++;
+		end
+
+		//One more sprite early in a frame: presented at the next blank,
+		//then the same image on screen and in the back buffer
+		@(negedge dut.vblank);
+		while (fb_busy) @(negedge clk);
+		present_ok = 1'b0;
+		draw_sprite();
+		@(negedge clk);
+		present_ok = 1'b1;
+		presentable.push_back(image);
+		last = frames;
+		assert(fb_pending)
+			$display("Pending after drawing : PASSED");
+		else begin
+			$error("Pending after drawing : FAILED");
+			errors++;
+		end
+		wait(frames == last + 2);
+		while (fb_busy) @(negedge clk);
+		assert(!fb_pending && seen == image && torn == 0)
+			$display("Presented : PASSED");
+		else begin
+			$error("Presented : FAILED");
+			errors++;
+		end
+		expect_back("Back buffer caught up");
+
+		//Paused, nothing is presented
+		is_paused = 1'b1;
+		host_write(0, 0, !image[0]);
+		last = frames;
+		wait(frames == last + 2);
+		assert(fb_pending && seen[0] != image[0])
+			$display("Paused : PASSED");
+		else begin
+			$error("Paused : FAILED");
+			errors++;
+		end
+
+		$display("%0d errors", errors);
+		$stop;
+	end
+
+endmodule
@@ -9,6 +9,14 @@ module Stack_playground();
 	STACK_OP 		op;			//See enums.svh for ops
 	logic [15:0]	writedata;	//input PC
 	logic [15:0]	outdata;		//data output 
+	logic			dbg_sp_WE;
+	logic [3:0]		dbg_sp;
+	logic			dbg_en;
+	logic [3:0]		dbg_addr;
+	logic			dbg_WE;
+	logic [15:0]	dbg_writedata;
+	logic [3:0]		sp;
+	logic [15:0]	dbg_readdata;
 	Chip8_Stack stack(.*);
 	
 
@@ -22,6 +30,12 @@ module Stack_playground();
 	end	
 	
 	initial begin
+		dbg_sp_WE = 1'b0;
+		dbg_sp = 4'h0;
+		dbg_en = 1'b0;
+		dbg_addr = 4'h0;
+		dbg_WE = 1'b0;
+		dbg_writedata = 16'h0;
 		
 		repeat(1) @(posedge cpu_clk);
 		reset = 1'b0;
@@ -45,7 +59,41 @@ module Stack_playground();
 		op = STACK_POP;
 		repeat(5) @(posedge cpu_clk);
 		op = STACK_POP;
+		repeat(5) @(posedge cpu_clk);
+		op = STACK_HOLD;
 
+		//Host access: write two entries, set the pointer, read them back
+		repeat(2) @(posedge cpu_clk);
+		dbg_en = 1'b1;
+		dbg_WE = 1'b1;
+		dbg_addr = 4'h0;
+		dbg_writedata = 16'h202;
+		@(posedge cpu_clk);
+		dbg_addr = 4'h1;
+		dbg_writedata = 16'h2F4;
+		@(posedge cpu_clk);
+		dbg_WE = 1'b0;
+		dbg_sp_WE = 1'b1;
+		dbg_sp = 4'h2;
+		@(posedge cpu_clk);
+		dbg_sp_WE = 1'b0;
+		dbg_addr = 4'h0;
+		repeat(3) @(posedge cpu_clk);
+		assert(dbg_readdata == 16'h202 && sp == 4'h2)
+			else $display("Stack entry 0 read back %h, sp %d", dbg_readdata, sp);
+		dbg_addr = 4'h1;
+		repeat(3) @(posedge cpu_clk);
+		assert(dbg_readdata == 16'h2F4)
+			else $display("Stack entry 1 read back %h", dbg_readdata);
+		dbg_en = 1'b0;
+
+		//Popping after a host restore starts from the restored pointer
+		op = STACK_POP;
+		repeat(5) @(posedge cpu_clk);
+		op = STACK_HOLD;
+		$display("Pop after restore returned %h", outdata);
+		assert(sp == 4'h1)
+			else $display("Stack pointer after pop is %d", sp);
 	end
 	
 endmodule
@@ -0,0 +1,56 @@
+/******************************************************************************
+ * Chip8_SimTop.sv
+ *
+ * Top level for the Verilator build: Chip8_Top with only its Avalon slave
+ * brought out. The VGA and audio pins are left dangling, and the
+ * megafunctions and PHYs are replaced by the other files in this directory.
+ * Driven cycle by cycle from Chip8-sw/chip8sim.cpp.
+ *
+ * Dependencies:
+ *  - Chip8_Top.sv
+ *****************************************************************************/
+
+module Chip8_SimTop(
+	input logic			clk,
+	input logic			reset,
+	input logic [31:0]	writedata,
+	input logic			write,
+	input logic			chipselect,
+	input logic [17:0]	address,
+	output logic [31:0]	data_out
+);
+
+	logic [7:0] VGA_R, VGA_G, VGA_B;
+	logic		VGA_CLK, VGA_HS, VGA_VS, VGA_BLANK_n, VGA_SYNC_n;
+	wire		AUD_ADCLRCK, AUD_DACLRCK, AUD_BCLK, AUD_I2C_SDAT;
+	logic		AUD_DACDAT, AUD_XCK, AUD_I2C_SCLK, AUD_MUTE;
+
+	Chip8_Top top(
+		.clk(clk),
+		.reset(reset),
+		.writedata(writedata),
+		.write(write),
+		.chipselect(chipselect),
+		.address(address),
+		.data_out(data_out),
+		.VGA_R(VGA_R),
+		.VGA_G(VGA_G),
+		.VGA_B(VGA_B),
+		.VGA_CLK(VGA_CLK),
+		.VGA_HS(VGA_HS),
+		.VGA_VS(VGA_VS),
+		.VGA_BLANK_n(VGA_BLANK_n),
+		.VGA_SYNC_n(VGA_SYNC_n),
+		.OSC_50_B8A(clk),
+		.AUD_ADCLRCK(AUD_ADCLRCK),
+		.AUD_ADCDAT(1'b0),
+		.AUD_DACLRCK(AUD_DACLRCK),
+		.AUD_DACDAT(AUD_DACDAT),
+		.AUD_XCK(AUD_XCK),
+		.AUD_BCLK(AUD_BCLK),
+		.AUD_I2C_SCLK(AUD_I2C_SCLK),
+		.AUD_I2C_SDAT(AUD_I2C_SDAT),
+		.AUD_MUTE(AUD_MUTE)
+		);
+
+endmodule
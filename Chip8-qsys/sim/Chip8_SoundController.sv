@@ -0,0 +1,33 @@
+/******************************************************************************
+ * Chip8_SoundController.sv
+ *
+ * Silent stand-in for Chip8_Sound/Chip8_SoundController.sv in the Verilator
+ * build, which has no audio codec or PLL to drive. The host reads sound_on
+ * through the sound timer instead.
+ *
+ * Dependencies:
+ *****************************************************************************/
+
+module Chip8_SoundController (
+	input  OSC_50_B8A,
+	inout  AUD_ADCLRCK,
+	input  AUD_ADCDAT,
+	inout  AUD_DACLRCK,
+	output AUD_DACDAT,
+	output AUD_XCK,
+	inout  AUD_BCLK,
+	output AUD_I2C_SCLK,
+	inout  AUD_I2C_SDAT,
+	output AUD_MUTE,
+
+	input logic clk,
+	input logic is_on,
+	input logic reset
+);
+
+	assign AUD_DACDAT = 1'b0;
+	assign AUD_XCK = 1'b0;
+	assign AUD_I2C_SCLK = 1'b1;
+	assign AUD_MUTE = 1'b0;
+
+endmodule
@@ -0,0 +1,44 @@
+/******************************************************************************
+ * Chip8_VGA_Emulator.sv
+ *
+ * Stand-in for Chip8_Framebuffer/Chip8_VGA_Emulator.sv in the Verilator
+ * build. The host reads pixels through FRAMEBUFFER_ADDR, so no pixels are
+ * scanned out and the sync outputs are held idle, but vblank keeps the
+ * board's timing: 1600 x 525 cycles a frame, the last 45 lines of it
+ * blank, so the back buffer is presented as on the board. The whole raster
+ * position is one counter, scan, that chip8sim.cpp moves along with the
+ * stage counter when it fast-forwards.
+ *
+ * Dependencies:
+ *****************************************************************************/
+
+module Chip8_VGA_Emulator(
+	input logic        clk50, reset,
+	input logic        fb_pixel_data,
+	input logic        is_paused,
+	output logic[10:0] fb_request_addr,
+	output logic       vblank,
+	output logic [7:0] VGA_R, VGA_G, VGA_B,
+	output logic       VGA_CLK, VGA_HS, VGA_VS, VGA_BLANK_n, VGA_SYNC_n);
+
+	//Same as the real emulator, hcount * vcount flattened
+	parameter HTOTAL = 20'd 1600,
+	VACTIVE = 20'd 480,
+	VTOTAL = 20'd 525;
+
+	logic [19:0] scan;
+
+	initial scan = 20'h0;
+
+	always_ff @(posedge clk50 or posedge reset)
+	if (reset)                            scan <= 0;
+	else if (scan == HTOTAL * VTOTAL - 1) scan <= 0;
+	else                                  scan <= scan + 20'd 1;
+
+	assign vblank = scan >= HTOTAL * VACTIVE;
+
+	assign fb_request_addr = 11'h0;
+	assign {VGA_R, VGA_G, VGA_B} = 24'h0;
+	assign {VGA_CLK, VGA_HS, VGA_VS, VGA_BLANK_n, VGA_SYNC_n} = 5'b0_1_1_0_0;
+
+endmodule
@@ -0,0 +1,43 @@
+/******************************************************************************
+ * Framebuffer.sv
+ *
+ * Behavioral stand-in for the Chip8_Framebuffer/Framebuffer.v megafunction,
+ * used by the Verilator build only. Same ports and timing as the altsyncram
+ * it replaces: addresses registered on clock, outputs unregistered, a read
+ * of the address being written returns the new data.
+ *
+ * Dependencies:
+ *****************************************************************************/
+
+module Framebuffer (
+	input logic [10:0]	address_a,
+	input logic [10:0]	address_b,
+	input logic			clock,
+	input logic			data_a,
+	input logic			data_b,
+	input logic			wren_a,
+	input logic			wren_b,
+	output logic		q_a,
+	output logic		q_b
+);
+
+	logic        mem[0:2047];
+	logic [10:0] addr_a = 11'h0;
+	logic [10:0] addr_b = 11'h0;
+
+	initial begin
+		for (int k = 0; k < 2048; ++k)
+			mem[k] = 1'b0;
+	end
+
+	always_ff @(posedge clock) begin
+		if(wren_a) mem[address_a] <= data_a;
+		if(wren_b) mem[address_b] <= data_b;
+		addr_a <= address_a;
+		addr_b <= address_b;
+	end
+
+	assign q_a = mem[addr_a];
+	assign q_b = mem[addr_b];
+
+endmodule
@@ -0,0 +1,43 @@
+/******************************************************************************
+ * reg_file.sv
+ *
+ * Behavioral stand-in for the Chip8_CPU/reg_file.v megafunction, used by
+ * the Verilator build only. Same ports and timing as the altsyncram it
+ * replaces: addresses registered on clock, outputs unregistered, a read of
+ * the address being written returns the new data.
+ *
+ * Dependencies:
+ *****************************************************************************/
+
+module reg_file (
+	input logic [3:0]	address_a,
+	input logic [3:0]	address_b,
+	input logic			clock,
+	input logic [7:0]	data_a,
+	input logic [7:0]	data_b,
+	input logic			wren_a,
+	input logic			wren_b,
+	output logic [7:0]	q_a,
+	output logic [7:0]	q_b
+);
+
+	logic [7:0]  mem[0:15];
+	logic [3:0]  addr_a = 4'h0;
+	logic [3:0]  addr_b = 4'h0;
+
+	initial begin
+		for (int k = 0; k < 16; ++k)
+			mem[k] = 8'h0;
+	end
+
+	always_ff @(posedge clock) begin
+		if(wren_a) mem[address_a] <= data_a;
+		if(wren_b) mem[address_b] <= data_b;
+		addr_a <= address_a;
+		addr_b <= address_b;
+	end
+
+	assign q_a = mem[addr_a];
+	assign q_b = mem[addr_b];
+
+endmodule
@@ -0,0 +1,34 @@
+/******************************************************************************
+ * stack_ram.sv
+ *
+ * Behavioral stand-in for the Chip8_Memory/stack_ram.v megafunction, used by
+ * the Verilator build only. Address registered on clock and the output
+ * registered once more, so q follows address two cycles later.
+ *
+ * Dependencies:
+ *****************************************************************************/
+
+module stack_ram (
+	input logic [3:0]	address,
+	input logic			clock,
+	input logic [15:0]	data,
+	input logic			wren,
+	output logic [15:0]	q
+);
+
+	logic [15:0] mem[0:15];
+	logic [3:0]  addr = 4'h0;
+
+	initial begin
+		for (int k = 0; k < 16; ++k)
+			mem[k] = 16'h0;
+		q = 16'h0;
+	end
+
+	always_ff @(posedge clock) begin
+		if(wren) mem[address] <= data;
+		addr <= address;
+		q <= mem[addr];
+	end
+
+endmodule
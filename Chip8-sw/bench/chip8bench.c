@@ -0,0 +1,260 @@
+/*
+ * Control-path benchmark: what an operator waits for
+ *
+ * chip8bench [-b backend] [-l label] [-r rom] [-n iterations] [-o out.json]
+ *            [-c baseline.json]
+ *     Times resetChip8, loadROM, loadfontset, refreshFrameBuffer,
+ *     printStatus and single register reads, writes and write-read round
+ *     trips against a backend, and writes min, percentiles, max and mean
+ *     per call as JSON to out.json or stdout. The heavy calls run
+ *     iterations times, the single register ones 100 times as often. With a
+ *     baseline written by an earlier run, prints how the median and p99
+ *     moved.
+ *
+ * make bench runs it against the model, the LD_PRELOAD shim and the board
+ * when /dev/vga_led is there, keeping the previous results to compare.
+ *
+ * Columbia University
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "chip8io.h"
+
+#define DEFAULT_ROM "../test/Pong.ch8"
+#define LIGHT_FACTOR 100
+#define MAX_OPS 16
+
+struct result {
+	char name[32];
+	unsigned long iterations;
+	double min, p50, p90, p99, max, mean;   //Microseconds
+};
+
+struct bench_op {
+	const char *name;
+	void (*run)(unsigned long k);
+	int light;                      //A single register request
+};
+
+static const char *rom = DEFAULT_ROM;
+static FILE *devnull;
+static unsigned long mismatches;
+
+static uint64_t now_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void usage() {
+	fprintf(stderr,
+		"Usage: chip8bench [-b backend] [-l label] [-r rom] [-n iterations] [-o out.json]\n"
+		"                  [-c baseline.json]\n");
+	exit(1);
+}
+
+static void run_reset(unsigned long k) { resetChip8(rom); }
+static void run_load_rom(unsigned long k) { loadROM(rom); }
+static void run_load_fontset(unsigned long k) { loadfontset(); }
+static void run_refresh(unsigned long k) { refreshFrameBuffer(); }
+static void run_status(unsigned long k) { printStatus(devnull, (int) k); }
+static void run_read(unsigned long k) { readRegister(k & 0xf); }
+static void run_write(unsigned long k) { writeRegister(k & 0xf, k & 0xff); }
+
+static void run_round_trip(unsigned long k) {
+	writeRegister(k & 0xf, k & 0xff);
+	if (readRegister(k & 0xf) != (int) (k & 0xff))
+		mismatches++;
+}
+
+static const struct bench_op ops[] = {
+	{ "reset", run_reset, 0 },
+	{ "load_rom", run_load_rom, 0 },
+	{ "load_fontset", run_load_fontset, 0 },
+	{ "refresh_framebuffer", run_refresh, 0 },
+	{ "print_status", run_status, 0 },
+	{ "register_read", run_read, 1 },
+	{ "register_write", run_write, 1 },
+	{ "register_round_trip", run_round_trip, 1 },
+};
+
+static int by_value(const void *a, const void *b) {
+	uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+	return x < y ? -1 : x > y;
+}
+
+static double percentile(const uint64_t *sorted, unsigned long n, double q) {
+	return sorted[(unsigned long) (q * (n - 1) + 0.5)] / 1e3;
+}
+
+/* Runs one call n times after a tenth as many to warm up */
+static int measure(const struct bench_op *op, unsigned long n, struct result *r) {
+	uint64_t *t = malloc(n * sizeof(*t)), total = 0, start;
+	unsigned long k;
+
+	if (t == NULL)
+		return -1;
+	for (k = 0; k < n / 10; ++k)
+		op->run(k);
+	for (k = 0; k < n; ++k) {
+		start = now_ns();
+		op->run(k);
+		t[k] = now_ns() - start;
+		total += t[k];
+	}
+	qsort(t, n, sizeof(*t), by_value);
+
+	snprintf(r->name, sizeof(r->name), "%s", op->name);
+	r->iterations = n;
+	r->min = t[0] / 1e3;
+	r->p50 = percentile(t, n, 0.50);
+	r->p90 = percentile(t, n, 0.90);
+	r->p99 = percentile(t, n, 0.99);
+	r->max = t[n - 1] / 1e3;
+	r->mean = total / 1e3 / n;
+	free(t);
+	return 0;
+}
+
+/* One result per line, so a baseline reads back with sscanf */
+static void write_json(FILE *f, const char *label, const char *backend,
+		const struct result *r, int count) {
+	int k;
+
+	fprintf(f, "{\n");
+	fprintf(f, "  \"label\": \"%s\",\n", label);
+	fprintf(f, "  \"backend\": \"%s\",\n", backend);
+	fprintf(f, "  \"rom\": \"%s\",\n", rom);
+	fprintf(f, "  \"time\": %lld,\n", (long long) time(NULL));
+	fprintf(f, "  \"round_trip_mismatches\": %lu,\n", mismatches);
+	fprintf(f, "  \"results\": [\n");
+	for (k = 0; k < count; ++k)
+		fprintf(f, "    {\"name\": \"%s\", \"iterations\": %lu, \"min_us\": %.3f, "
+			"\"p50_us\": %.3f, \"p90_us\": %.3f, \"p99_us\": %.3f, \"max_us\": %.3f, "
+			"\"mean_us\": %.3f}%s\n", r[k].name, r[k].iterations, r[k].min, r[k].p50,
+			r[k].p90, r[k].p99, r[k].max, r[k].mean, k + 1 < count ? "," : "");
+	fprintf(f, "  ]\n}\n");
+}
+
+static int read_json(const char *path, struct result *r) {
+	char line[512];
+	int count = 0;
+	FILE *f;
+
+	if ((f = fopen(path, "r")) == NULL)
+		return -1;
+	while (count < MAX_OPS && fgets(line, sizeof(line), f) != NULL) {
+		struct result *x = &r[count];
+
+		if (sscanf(line, " {\"name\": \"%31[^\"]\", \"iterations\": %lu, \"min_us\": %lf, "
+				"\"p50_us\": %lf, \"p90_us\": %lf, \"p99_us\": %lf, \"max_us\": %lf, "
+				"\"mean_us\": %lf", x->name, &x->iterations, &x->min, &x->p50, &x->p90,
+				&x->p99, &x->max, &x->mean) == 8)
+			count++;
+	}
+	fclose(f);
+	return count;
+}
+
+static void print_table(FILE *out, const struct result *r, int count) {
+	int k;
+
+	fprintf(out, "%-20s %9s %10s %10s %10s %10s %10s\n", "call", "n", "min us", "p50 us",
+		"p90 us", "p99 us", "max us");
+	for (k = 0; k < count; ++k)
+		fprintf(out, "%-20s %9lu %10.2f %10.2f %10.2f %10.2f %10.2f\n", r[k].name,
+			r[k].iterations, r[k].min, r[k].p50, r[k].p90, r[k].p99, r[k].max);
+}
+
+static double change(double now, double then) {
+	return then > 0 ? 100.0 * (now - then) / then : 0;
+}
+
+static void print_compare(FILE *out, const struct result *r, int count,
+		const struct result *base, int base_count) {
+	int k, j;
+
+	fprintf(out, "\n%-20s %10s %10s %8s %10s %10s %8s\n", "against baseline", "p50 then",
+		"p50 now", "change", "p99 then", "p99 now", "change");
+	for (k = 0; k < count; ++k) {
+		for (j = 0; j < base_count && strcmp(base[j].name, r[k].name) != 0; ++j)
+			;
+		if (j == base_count)
+			continue;
+		fprintf(out, "%-20s %10.2f %10.2f %+7.1f%% %10.2f %10.2f %+7.1f%%\n", r[k].name,
+			base[j].p50, r[k].p50, change(r[k].p50, base[j].p50), base[j].p99, r[k].p99,
+			change(r[k].p99, base[j].p99));
+	}
+}
+
+int main(int argc, char **argv) {
+	const char *backend = NULL, *label = NULL, *out = NULL, *baseline = NULL;
+	static struct result results[MAX_OPS], base[MAX_OPS];
+	unsigned long iterations = 100;
+	int count = 0, base_count = -1, saved, k, opt;
+	FILE *json;
+
+	while ((opt = getopt(argc, argv, "b:l:r:n:o:c:")) != -1) {
+		switch (opt) {
+		case 'b': backend = optarg; break;
+		case 'l': label = optarg; break;
+		case 'r': rom = optarg; break;
+		case 'n': iterations = strtoul(optarg, NULL, 0); break;
+		case 'o': out = optarg; break;
+		case 'c': baseline = optarg; break;
+		default: usage();
+		}
+	}
+	if (iterations < 1)
+		usage();
+	if (label == NULL)
+		label = backend != NULL ? backend : "device";
+	if (access(rom, R_OK)) {
+		perror(rom);
+		return 1;
+	}
+	if (baseline != NULL && (base_count = read_json(baseline, base)) < 0)
+		fprintf(stderr, "%s: no baseline, not comparing\n", baseline);
+
+	if ((devnull = fopen("/dev/null", "w")) == NULL || chip8io_open(backend))
+		return 1;
+
+	/* resetChip8 prints the status and loadROM its mismatches to stdout */
+	fflush(stdout);
+	saved = dup(1);
+	dup2(fileno(devnull), 1);
+	resetChip8(rom);
+	for (k = 0; k < (int) (sizeof(ops) / sizeof(ops[0])); ++k) {
+		unsigned long n = ops[k].light ? iterations * LIGHT_FACTOR : iterations;
+
+		if (measure(&ops[k], n, &results[count]) == 0)
+			count++;
+	}
+	fflush(stdout);
+	dup2(saved, 1);
+	close(saved);
+	chip8io_close();
+
+	fprintf(stderr, "%s (%s)\n", label, backend != NULL ? backend : "device");
+	print_table(stderr, results, count);
+	if (base_count > 0)
+		print_compare(stderr, results, count, base, base_count);
+	if (mismatches)
+		fprintf(stderr, "%lu register round trips read back something else\n", mismatches);
+
+	json = out != NULL ? fopen(out, "w") : stdout;
+	if (json == NULL) {
+		perror(out);
+		return 1;
+	}
+	write_json(json, label, backend != NULL ? backend : "device", results, count);
+	if (json != stdout)
+		fclose(json);
+	return mismatches ? 1 : 0;
+}
@@ -0,0 +1,335 @@
+/*
+ * Host audio for the sound timer
+ *
+ * chip8aud run [-b backend] [-r rom] [-t seconds] [-l lead] [-o out.wav]
+ *     Runs a ROM with the audio engine following its sound timer for the
+ *     given time, into a WAV file or the null sink, and prints underruns
+ *     and the latency from the sound timer to the sink
+ * chip8aud test
+ *     Checks the tone against audio_effects.sv, the gate against the sound
+ *     timer of the model slot by slot and while paused, that underruns and
+ *     overruns are counted, and that in real time the WAV file holds the
+ *     tone without a break and every tone reaches the sink within its bound
+ *
+ * Columbia University
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "chip8audio.h"
+#include "chip8io.h"
+#include "chip8model.h"
+#include "chip8test.h"
+
+#define DEFAULT_ROM "../test/Pong.ch8"
+
+/* 200 LD V0,6  LD ST,V0  204 JP 204 */
+static const uint8_t beep_rom[] = { 0x60, 0x06, 0xF0, 0x18, 0x12, 0x04 };
+
+/*
+* Beeps for 8 ticks out of every 24:
+*   200 LD V0,8  LD ST,V0  LD V1,24  LD DT,V1
+*   208 LD V1,DT  SE V1,0  JP 208
+*   20E JP 200
+*/
+static const uint8_t pulse_rom[] = {
+	0x60, 0x08, 0xF0, 0x18, 0x61, 0x18, 0xF1, 0x15,
+	0xF1, 0x07, 0x31, 0x00, 0x12, 0x08, 0x12, 0x00,
+};
+
+static struct chip8_audio audio;
+
+static void usage() {
+	fprintf(stderr,
+		"Usage: chip8aud run [-b backend] [-r rom] [-t seconds] [-l lead] [-o out.wav]\n"
+		"       chip8aud test\n");
+	exit(1);
+}
+
+static int run(int argc, char **argv) {
+	const char *backend = NULL, *rom = DEFAULT_ROM, *out = NULL;
+	unsigned int seconds = 10, lead = CHIP8AUDIO_DEFAULT_LEAD;
+	int saved, devnull, opt, ret;
+
+	while ((opt = getopt(argc, argv, "b:r:t:l:o:")) != -1) {
+		switch (opt) {
+		case 'b': backend = optarg; break;
+		case 'r': rom = optarg; break;
+		case 't': seconds = strtoul(optarg, NULL, 0); break;
+		case 'l': lead = strtoul(optarg, NULL, 0); break;
+		case 'o': out = optarg; break;
+		default: usage();
+		}
+	}
+
+	if (access(rom, R_OK)) {
+		perror(rom);
+		return 1;
+	}
+	if (chip8io_open(backend))
+		return 1;
+
+	/* resetChip8 prints the status to stdout */
+	fflush(stdout);
+	saved = dup(1);
+	if ((devnull = open("/dev/null", O_WRONLY)) != -1)
+		dup2(devnull, 1);
+	resetChip8(rom);
+	fflush(stdout);
+	dup2(saved, 1);
+	close(saved);
+	if (devnull != -1)
+		close(devnull);
+
+	chip8audio_init(&audio, lead);
+	chip8io_start_clock();
+	startChip8();
+	ret = chip8audio_start(&audio, out);
+	if (ret == 0) {
+		sleep(seconds);
+		chip8audio_stop(&audio);
+	}
+	chip8io_close();
+	if (ret)
+		return 1;
+
+	printf("%s for %u s, %u samples ahead of the sink (%.1f ms)\n", rom, seconds, audio.lead,
+		audio.lead * 1e3 / CHIP8AUDIO_RATE);
+	chip8audio_report(stdout, &audio.stats);
+	return 0;
+}
+
+/* Sample k of the stream with the gate on, the table index never stops */
+static int16_t expected(uint64_t k) {
+	return chip8audio_table[k % CHIP8AUDIO_TABLE];
+}
+
+/* The table runs on while muted, and comes back in phase */
+static int tone() {
+	static int16_t out[1000];
+	unsigned int k, wrong = 0;
+	int errors = 0;
+
+	chip8audio_init(&audio, CHIP8AUDIO_DEFAULT_LEAD);
+	chip8audio_render(&audio, 0, 130, 0);
+	chip8audio_render(&audio, 1, 250, 0);
+	chip8audio_render(&audio, 0, 300, 0);
+	chip8audio_render(&audio, 1, 320, 0);
+	chip8audio_take(&audio, out, 1000, 0);
+
+	for (k = 0; k < 1000; ++k) {
+		int on = (k >= 130 && k < 380) || k >= 680;
+
+		wrong += out[k] != (on ? expected(k) : 0);
+	}
+	errors += chip8test_check("samples off the table", wrong, 0);
+	errors += chip8test_check("table length (441 Hz at 44.1 kHz)", CHIP8AUDIO_RATE / CHIP8AUDIO_TABLE, 441);
+	errors += chip8test_check("rising edges", audio.stats.edges, 2);
+	errors += chip8test_check("underruns", audio.stats.underruns, 0);
+	return errors;
+}
+
+static int underruns() {
+	static int16_t out[CHIP8AUDIO_PERIOD];
+	unsigned int k, padded = 0;
+	int errors = 0;
+
+	chip8audio_init(&audio, CHIP8AUDIO_DEFAULT_LEAD);
+	chip8audio_take(&audio, out, CHIP8AUDIO_PERIOD, 0);
+	errors += chip8test_check("underruns on an empty ring", audio.stats.underruns, 1);
+
+	chip8audio_render(&audio, 1, 100, 0);
+	chip8audio_take(&audio, out, CHIP8AUDIO_PERIOD, 0);
+	for (k = 100; k < CHIP8AUDIO_PERIOD; ++k)
+		padded += out[k] == 0;
+	errors += chip8test_check("underruns a period short", audio.stats.underruns, 2);
+	errors += chip8test_check("silence padded", audio.stats.silence, 2 * CHIP8AUDIO_PERIOD - 100);
+	errors += chip8test_check("padding silent", padded, CHIP8AUDIO_PERIOD - 100);
+
+	chip8audio_render(&audio, 1, CHIP8AUDIO_PERIOD, 0);
+	chip8audio_take(&audio, out, CHIP8AUDIO_PERIOD, 0);
+	errors += chip8test_check("underruns with a full period", audio.stats.underruns, 2);
+
+	/* The phase moves on over dropped samples, as the codec's does */
+	chip8audio_render(&audio, 1, CHIP8AUDIO_RING + 10, 0);
+	errors += chip8test_check("overruns", audio.stats.overruns, 10);
+	errors += chip8test_check("phase after the overrun", audio.phase,
+		(100 + CHIP8AUDIO_PERIOD + CHIP8AUDIO_RING + 10) % CHIP8AUDIO_TABLE);
+	return errors;
+}
+
+/*
+* The model slot by slot, rendering each slot's 44.1 samples with the gate
+* polled after it. LD ST,V0 runs in slot 1 and the sixth tick after it
+* turns the tone off, so it lasts as long as on the board to within a slot.
+*/
+static int model_gate() {
+	struct chip8_model *m;
+	uint64_t cycles = 0, rendered = 0, on = 0, due;
+	unsigned int slot;
+	int errors = 0, gate, held;
+	double board;
+
+	if (chip8io_open("model"))
+		return 1;
+	m = chip8io_model();
+	chip8core_clear_memory(&m->core);
+	chip8core_load(&m->core, beep_rom, sizeof(beep_rom));
+	startChip8();
+
+	chip8audio_init(&audio, CHIP8AUDIO_DEFAULT_LEAD);
+	for (slot = 0; slot < 150; ++slot) {
+		chip8io_advance(1);
+		cycles += m->cycles_per_instruction;
+		due = cycles * CHIP8AUDIO_RATE / CHIP8_CLOCK_HZ;
+		gate = chip8audio_poll(&audio);
+		on += gate ? due - rendered : 0;
+		chip8audio_render(&audio, gate, due - rendered, 0);
+		rendered = due;
+	}
+
+	/* From the middle of slot 1 to the sixth tick */
+	board = (6.0 * CHIP8_CLK_DIV_PERIOD - 1.5 * m->cycles_per_instruction) *
+		CHIP8AUDIO_RATE / CHIP8_CLOCK_HZ;
+	printf("tone of %llu samples, %.1f on the board\n", (unsigned long long) on, board);
+	errors += chip8test_check("tone within a slot of the board", on > board - 45 && on < board + 45, 1);
+	errors += chip8test_check("tones", audio.stats.edges, 1);
+
+	/* sound_on holds while paused, whatever the timer does */
+	writeSoundTimer(10);
+	audio.gate = chip8audio_poll(&audio);
+	pauseChip8();
+	writeSoundTimer(0);
+	held = chip8audio_poll(&audio);
+	startChip8();
+	gate = chip8audio_poll(&audio);
+	chip8io_close();
+
+	errors += chip8test_check("gate held while paused", held, 1);
+	errors += chip8test_check("gate after running again", gate, 0);
+	return errors;
+}
+
+static uint32_t le(const uint8_t *p, int bytes) {
+	uint32_t v = 0;
+
+	while (bytes--)
+		v = v << 8 | p[bytes];
+	return v;
+}
+
+/* Header sizes against the file, and every sample the tone or silence in phase */
+static int check_wav(const char *path, uint64_t samples, uint64_t *on) {
+	uint8_t h[44], b[2];
+	struct stat st;
+	uint64_t k, wrong = 0;
+	int errors = 0;
+	FILE *f;
+
+	if ((f = fopen(path, "rb")) == NULL || fread(h, sizeof(h), 1, f) != 1) {
+		perror(path);
+		return 1;
+	}
+	fstat(fileno(f), &st);
+	errors += chip8test_check("RIFF", memcmp(h, "RIFF", 4) == 0 && memcmp(h + 8, "WAVEfmt ", 8) == 0, 1);
+	errors += chip8test_check("RIFF size", le(h + 4, 4), st.st_size - 8);
+	errors += chip8test_check("sample rate", le(h + 24, 4), CHIP8AUDIO_RATE);
+	errors += chip8test_check("data size", le(h + 40, 4), samples * 2);
+
+	*on = 0;
+	for (k = 0; k < samples && fread(b, 2, 1, f) == 1; ++k) {
+		int16_t s = (int16_t) le(b, 2);
+
+		if (s != 0 && s != expected(k))
+			wrong++;
+		*on += s != 0;
+	}
+	fclose(f);
+	errors += chip8test_check("samples read back", k, samples);
+	errors += chip8test_check("samples off the table", wrong, 0);
+	return errors;
+}
+
+/*
+* The model on its clock beeping 8 ticks in 24, into a WAV file. With a
+* lead of four periods nothing should underrun on an idle host, and each
+* tone reaches the sink within the lead, a period and two polls; allow for
+* a busy host on top of that, which may also hold a thread past the lead
+* now and then, so up to one period in 20 may underrun.
+*/
+static int realtime() {
+	char path[] = "/tmp/chip8aud-XXXXXX";
+	uint64_t on = 0, bound;
+	int errors = 0, fd;
+	double duty;
+
+	if ((fd = mkstemp(path)) == -1) {
+		perror(path);
+		return 1;
+	}
+	close(fd);
+
+	if (chip8io_open("model"))
+		return 1;
+	chip8core_clear_memory(&chip8io_model()->core);
+	chip8core_load(&chip8io_model()->core, pulse_rom, sizeof(pulse_rom));
+	chip8audio_init(&audio, 4 * CHIP8AUDIO_PERIOD);
+	chip8io_start_clock();
+	startChip8();
+	if (chip8audio_start(&audio, path)) {
+		chip8io_close();
+		unlink(path);
+		return 1;
+	}
+	usleep(1500000);
+	chip8audio_stop(&audio);
+	chip8io_close();
+
+	chip8audio_report(stdout, &audio.stats);
+	bound = (uint64_t) (audio.lead + CHIP8AUDIO_PERIOD) * 1000000000ULL / CHIP8AUDIO_RATE +
+		2 * CHIP8AUDIO_POLL_US * 1000ULL;
+	errors += chip8test_check("underruns within one period in 20",
+		audio.stats.underruns * 20 <= audio.wav_samples / CHIP8AUDIO_PERIOD, 1);
+	errors += chip8test_check("overruns", audio.stats.overruns, 0);
+	errors += chip8test_check("tones in 1.5 s", audio.stats.edges >= 3, 1);
+	errors += chip8test_check("tones reaching the sink", audio.stats.latencies + 1 >= audio.stats.edges, 1);
+	printf("sound timer to sink at most %.2f ms, bound %.2f ms\n",
+		audio.stats.latency_max / 1e6, bound / 1e6);
+	errors += chip8test_check("latency within the bound and 50 ms for the host",
+		audio.stats.latency_max < bound + 50000000ULL, 1);
+
+	errors += check_wav(path, audio.wav_samples, &on);
+	unlink(path);
+	duty = audio.wav_samples ? (double) on / audio.wav_samples : 0;
+	printf("tone on for %.0f%% of the file\n", 100 * duty);
+	errors += chip8test_check("tone on about 8 ticks in 24", duty > 0.2 && duty < 0.45, 1);
+	return errors;
+}
+
+static int test(int argc, char **argv) {
+	int errors = 0;
+
+	errors += tone();
+	errors += underruns();
+	errors += model_gate();
+	errors += realtime();
+	return chip8test_report(errors);
+}
+
+int main(int argc, char **argv) {
+	if (argc < 2)
+		usage();
+
+	if (strcmp(argv[1], "run") == 0)
+		return run(argc - 1, argv + 1);
+	if (strcmp(argv[1], "test") == 0)
+		return test(argc - 1, argv + 1);
+
+	usage();
+	return 1;
+}
@@ -0,0 +1,236 @@
+/*
+ * Host audio for the sound timer, see chip8audio.h
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "chip8audio.h"
+#include "chip8io.h"
+
+/* romdata in Chip8-qsys/Chip8_Sound/audio_effects.sv */
+const int16_t chip8audio_table[CHIP8AUDIO_TABLE] = {
+	0x0000, 0x0805, 0x1002, 0x17ee, 0x1fc3, 0x2777, 0x2f04, 0x3662, 0x3d89, 0x4472,
+	0x4b16, 0x516f, 0x5776, 0x5d25, 0x6276, 0x6764, 0x6bea, 0x7004, 0x73ad, 0x76e1,
+	0x799e, 0x7be1, 0x7da7, 0x7eef, 0x7fb7, 0x7fff, 0x7fc6, 0x7f0c, 0x7dd3, 0x7c1b,
+	0x79e6, 0x7737, 0x7410, 0x7074, 0x6c67, 0x67ed, 0x630a, 0x5dc4, 0x5820, 0x5222,
+	0x4bd3, 0x4537, 0x3e55, 0x3735, 0x2fdd, 0x2855, 0x20a5, 0x18d3, 0x10e9, 0x08ee,
+	0x00e9, -0x071c, -0x0f1a, -0x1709, -0x1ee0, -0x2699, -0x2e2b, -0x358e, -0x3cbc, -0x43ac,
+	-0x4a59, -0x50ba, -0x56cb, -0x5c84, -0x61e0, -0x66da, -0x6b6c, -0x6f92, -0x7348, -0x768a,
+	-0x7955, -0x7ba6, -0x7d7a, -0x7ed0, -0x7fa7, -0x7ffd, -0x7fd3, -0x7f28, -0x7dfd, -0x7c53,
+	-0x7a2d, -0x778b, -0x7471, -0x70e3, -0x6ce2, -0x6874, -0x639d, -0x5e62, -0x58c8, -0x52d5,
+	-0x4c8e, -0x45fb, -0x3f21, -0x3807, -0x30b5, -0x2932, -0x2186, -0x19b8, -0x11d0, -0x09d7,
+};
+
+static uint64_t now_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void chip8audio_init(struct chip8_audio *a, unsigned int lead) {
+	memset(a, 0, sizeof(*a));
+	if (lead < CHIP8AUDIO_PERIOD)
+		lead = CHIP8AUDIO_PERIOD;
+	if (lead > CHIP8AUDIO_RING - CHIP8AUDIO_PERIOD)
+		lead = CHIP8AUDIO_RING - CHIP8AUDIO_PERIOD;
+	a->lead = lead;
+}
+
+int chip8audio_poll(struct chip8_audio *a) {
+	chip8_opcode ops[2];
+
+	ops[0].addr = STATE_ADDR;
+	ops[1].addr = SOUND_TIMER_ADDR;
+	if (chip8io_batch(ops, 2, 0))
+		return 0;
+	/* sound_on <= sound_timer_out only in the running states */
+	if (ops[0].readdata == RUNNING_STATE || ops[0].readdata == RUN_INSTRUCTION_STATE)
+		return ops[1].readdata != 0;
+	return a->gate;
+}
+
+unsigned int chip8audio_render(struct chip8_audio *a, int gate, unsigned int n, uint64_t now_ns) {
+	uint64_t head = a->head, tail = __atomic_load_n(&a->tail, __ATOMIC_ACQUIRE);
+	unsigned int room = CHIP8AUDIO_RING - (unsigned int) (head - tail), k;
+
+	if (gate && !a->gate) {
+		a->stats.edges++;
+		/* The sink has not reached the last one yet: measure that one */
+		if (!__atomic_load_n(&a->edge_pending, __ATOMIC_ACQUIRE)) {
+			a->edge_sample = head;
+			a->edge_ns = now_ns;
+			__atomic_store_n(&a->edge_pending, 1, __ATOMIC_RELEASE);
+		}
+	}
+	a->gate = gate;
+
+	if (n > room) {
+		a->stats.overruns += n - room;
+		/* The codec does not wait: the phase moves on over what is dropped */
+		a->phase = (a->phase + n - room) % CHIP8AUDIO_TABLE;
+		n = room;
+	}
+	for (k = 0; k < n; ++k) {
+		a->ring[(head + k) % CHIP8AUDIO_RING] = gate ? chip8audio_table[a->phase] : 0;
+		if (++a->phase == CHIP8AUDIO_TABLE)
+			a->phase = 0;
+	}
+	a->stats.rendered += n;
+	__atomic_store_n(&a->head, head + n, __ATOMIC_RELEASE);
+	return n;
+}
+
+void chip8audio_take(struct chip8_audio *a, int16_t *out, unsigned int n, uint64_t now_ns) {
+	uint64_t tail = a->tail, head = __atomic_load_n(&a->head, __ATOMIC_ACQUIRE);
+	unsigned int have = head - tail < n ? (unsigned int) (head - tail) : n, k;
+
+	for (k = 0; k < have; ++k)
+		out[k] = a->ring[(tail + k) % CHIP8AUDIO_RING];
+	if (have < n) {
+		memset(&out[have], 0, (n - have) * sizeof(*out));
+		a->stats.underruns++;
+		a->stats.silence += n - have;
+	}
+
+	if (__atomic_load_n(&a->edge_pending, __ATOMIC_ACQUIRE) && a->edge_sample < tail + have) {
+		uint64_t at = now_ns + (a->edge_sample - tail) * 1000000000ULL / CHIP8AUDIO_RATE;
+		uint64_t ns = at > a->edge_ns ? at - a->edge_ns : 0;
+
+		if (a->stats.latencies == 0 || ns < a->stats.latency_min)
+			a->stats.latency_min = ns;
+		if (ns > a->stats.latency_max)
+			a->stats.latency_max = ns;
+		a->stats.latency_sum += ns;
+		a->stats.latencies++;
+		__atomic_store_n(&a->edge_pending, 0, __ATOMIC_RELEASE);
+	}
+
+	a->stats.played += n;
+	__atomic_store_n(&a->tail, tail + have, __ATOMIC_RELEASE);
+}
+
+static void put_le(uint8_t *p, uint32_t v, int bytes) {
+	while (bytes--) {
+		*p++ = v & 0xff;
+		v >>= 8;
+	}
+}
+
+/* RIFF header of a mono 16 bit PCM file holding samples samples */
+static int write_wav_header(FILE *f, uint64_t samples) {
+	uint8_t h[44];
+	uint32_t data = samples * 2 > 0xffffffffULL - 36 ? 0xffffffffU - 36 : (uint32_t) samples * 2;
+
+	memcpy(h, "RIFF", 4);
+	put_le(h + 4, 36 + data, 4);
+	memcpy(h + 8, "WAVEfmt ", 8);
+	put_le(h + 16, 16, 4);
+	put_le(h + 20, 1, 2);                   //PCM
+	put_le(h + 22, 1, 2);                   //Mono
+	put_le(h + 24, CHIP8AUDIO_RATE, 4);
+	put_le(h + 28, CHIP8AUDIO_RATE * 2, 4);
+	put_le(h + 32, 2, 2);
+	put_le(h + 34, 16, 2);
+	memcpy(h + 36, "data", 4);
+	put_le(h + 40, data, 4);
+	return fseek(f, 0, SEEK_SET) == 0 && fwrite(h, sizeof(h), 1, f) == 1 ? 0 : -1;
+}
+
+static void *producer_f(void *arg) {
+	struct chip8_audio *a = arg;
+
+	while (atomic_load(&a->running)) {
+		int gate = chip8audio_poll(a);
+		uint64_t ahead = a->head - __atomic_load_n(&a->tail, __ATOMIC_ACQUIRE);
+
+		chip8audio_render(a, gate, ahead < a->lead ? a->lead - (unsigned int) ahead : 0,
+			now_ns());
+		usleep(CHIP8AUDIO_POLL_US);
+	}
+	return NULL;
+}
+
+/* Takes a period every CHIP8AUDIO_PERIOD samples of wall time, as the codec would */
+static void *sink_f(void *arg) {
+	struct chip8_audio *a = arg;
+	int16_t period[CHIP8AUDIO_PERIOD];
+	uint64_t k, due;
+	struct timespec ts;
+	int w;
+
+	for (k = 1; atomic_load(&a->running); ++k) {
+		due = a->start_ns + k * CHIP8AUDIO_PERIOD * 1000000000ULL / CHIP8AUDIO_RATE;
+		ts.tv_sec = due / 1000000000ULL;
+		ts.tv_nsec = due % 1000000000ULL;
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+		chip8audio_take(a, period, CHIP8AUDIO_PERIOD, now_ns());
+		if (a->wav == NULL)
+			continue;
+		/* Little endian on the board and the hosts it is built on */
+		for (w = 0; w < CHIP8AUDIO_PERIOD; ++w) {
+			uint8_t b[2];
+
+			put_le(b, (uint16_t) period[w], 2);
+			fwrite(b, 2, 1, a->wav);
+		}
+		a->wav_samples += CHIP8AUDIO_PERIOD;
+	}
+	return NULL;
+}
+
+int chip8audio_start(struct chip8_audio *a, const char *sink) {
+	if (sink != NULL && strcmp(sink, "null") != 0) {
+		if ((a->wav = fopen(sink, "wb")) == NULL) {
+			perror(sink);
+			return -1;
+		}
+		write_wav_header(a->wav, 0);
+	}
+
+	/* The sink starts with lead samples ready */
+	a->gate = chip8audio_poll(a);
+	a->start_ns = now_ns();
+	chip8audio_render(a, a->gate, a->lead, a->start_ns);
+	atomic_store(&a->running, 1);
+	if (pthread_create(&a->producer, NULL, producer_f, a)) {
+		atomic_store(&a->running, 0);
+		return -1;
+	}
+	if (pthread_create(&a->sink, NULL, sink_f, a)) {
+		atomic_store(&a->running, 0);
+		pthread_join(a->producer, NULL);
+		return -1;
+	}
+	return 0;
+}
+
+void chip8audio_stop(struct chip8_audio *a) {
+	if (!atomic_load(&a->running))
+		return;
+	atomic_store(&a->running, 0);
+	pthread_join(a->producer, NULL);
+	pthread_join(a->sink, NULL);
+	if (a->wav != NULL) {
+		write_wav_header(a->wav, a->wav_samples);
+		fclose(a->wav);
+		a->wav = NULL;
+	}
+}
+
+void chip8audio_report(FILE *out, const struct chip8audio_stats *s) {
+	fprintf(out, "%llu samples rendered, %llu played, %llu dropped for want of room\n",
+		(unsigned long long) s->rendered, (unsigned long long) s->played,
+		(unsigned long long) s->overruns);
+	fprintf(out, "%llu underruns, %llu samples of silence padded\n",
+		(unsigned long long) s->underruns, (unsigned long long) s->silence);
+	if (s->latencies == 0) {
+		fprintf(out, "%llu tones started, none reached the sink\n", (unsigned long long) s->edges);
+		return;
+	}
+	fprintf(out, "%llu tones started, sound timer to sink min %.2f ms  mean %.2f ms  max %.2f ms\n",
+		(unsigned long long) s->edges, s->latency_min / 1e6,
+		s->latency_sum / 1e6 / s->latencies, s->latency_max / 1e6);
+}
@@ -0,0 +1,114 @@
+#ifndef __CHIP8_AUDIO_H__
+#define __CHIP8_AUDIO_H__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+/*
+* Host audio for the sound timer
+*
+* Chip8_Top drives sound_on from the sound timer while running and holds it
+* while paused, and Chip8_SoundController unmutes the codec with it. The
+* codec is fed all the while from the 100 sample sine table in
+* audio_effects.sv, one sample per LRCK period of the 11.2896 MHz audio
+* clock, so the tone is 441 Hz at 44.1 kHz and its phase runs on while
+* muted. chip8audio renders the same samples on the host.
+*
+* A producer thread polls the state and sound timer of whichever backend
+* chip8io has open and renders the tone, gated the same way, into a single
+* producer single consumer ring. It stays lead samples ahead of a sink
+* thread, which takes a period at a time at the sample rate as the codec
+* would and writes it to a WAV file or nowhere. A change of the sound timer
+* is heard at most lead samples plus a poll interval after the producer
+* sees it, and the producer sees it within a poll interval.
+*
+* The sink pads a period the ring cannot fill with silence and counts an
+* underrun; samples that do not fit in the ring are counted as overruns.
+* For every rising edge of the gate, the time from the poll that saw it to
+* the sink taking its first sample is recorded.
+*/
+
+#define CHIP8AUDIO_RATE 44100
+#define CHIP8AUDIO_TABLE 100
+/* Samples in the ring, a power of two */
+#define CHIP8AUDIO_RING 8192
+/* Samples the sink takes at a time, 5.8 ms */
+#define CHIP8AUDIO_PERIOD 256
+#define CHIP8AUDIO_DEFAULT_LEAD (2 * CHIP8AUDIO_PERIOD)
+#define CHIP8AUDIO_POLL_US 1000
+
+struct chip8audio_stats {
+	uint64_t rendered;              //Samples the producer rendered
+	uint64_t overruns;              //Of those, samples the ring had no room for
+	uint64_t played;                //Samples the sink took, silence padding included
+	uint64_t underruns;             //Periods the ring could not fill
+	uint64_t silence;               //Samples padded by underruns
+	uint64_t edges;                 //Rising edges of the gate
+	uint64_t latencies;             //Edges the sink reached
+	uint64_t latency_min;           //Nanoseconds from the poll to the sink
+	uint64_t latency_max;
+	uint64_t latency_sum;
+};
+
+struct chip8_audio {
+	int16_t ring[CHIP8AUDIO_RING];
+	uint64_t head;                  //Samples written, published with release
+	uint64_t tail;                  //Samples taken, published with release
+	unsigned int lead;
+	unsigned int phase;             //Index into the sine table
+	int gate;
+
+	/* The last rising edge, handed from the producer to the sink */
+	uint64_t edge_sample;
+	uint64_t edge_ns;
+	int edge_pending;
+
+	struct chip8audio_stats stats;
+
+	FILE *wav;                      //NULL for the null sink
+	uint64_t wav_samples;
+	atomic_int running;
+	pthread_t producer, sink;
+	uint64_t start_ns;
+};
+
+extern const int16_t chip8audio_table[CHIP8AUDIO_TABLE];
+
+/* lead is clamped to a period at least and the ring less a period at most */
+void chip8audio_init(struct chip8_audio *a, unsigned int lead);
+
+/*
+* Reads STATE_ADDR and SOUND_TIMER_ADDR in one batch and returns the gate:
+* the sound timer is non-zero while running, unchanged while paused, off if
+* the backend cannot be read
+*/
+int chip8audio_poll(struct chip8_audio *a);
+
+/*
+* Producer side: renders n samples of the tone with the given gate into the
+* ring, stamping a rising edge with now_ns. Returns the number that fitted.
+*/
+unsigned int chip8audio_render(struct chip8_audio *a, int gate, unsigned int n, uint64_t now_ns);
+
+/*
+* Sink side: takes n samples out of the ring into out, padding with
+* silence and counting an underrun if there are fewer. Latency is measured
+* to now_ns plus the position of the edge in out.
+*/
+void chip8audio_take(struct chip8_audio *a, int16_t *out, unsigned int n, uint64_t now_ns);
+
+/*
+* Starts the producer and the sink on the open chip8io backend. sink is
+* NULL or "null" to discard the samples, or the path of a WAV file to
+* write, mono 16 bit at CHIP8AUDIO_RATE. Returns 0, or -1 if the file
+* could not be created or a thread started.
+*/
+int chip8audio_start(struct chip8_audio *a, const char *sink);
+/* Stops both threads and finishes the WAV file, before chip8io_close */
+void chip8audio_stop(struct chip8_audio *a);
+
+void chip8audio_report(FILE *out, const struct chip8audio_stats *s);
+
+#endif //__CHIP8_AUDIO_H__
@@ -0,0 +1,390 @@
+/*
+ * Static basic block analysis and block index, see chip8blocks.h
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "chip8blocks.h"
+#include "chip8disasm.h"
+
+/* The header and blocks are written and mapped as is */
+_Static_assert(sizeof(struct chip8blocks_header) == CHIP8BLOCKS_HEADER_SIZE,
+		"chip8blocks_header must match the file layout");
+_Static_assert(sizeof(struct chip8_block) == 12, "chip8_block must match the file layout");
+#if __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "chip8blocks assumes a little-endian host"
+#endif
+
+#define LOOKUP_SIZE (CHIP8_MEMORY_SIZE * sizeof(uint16_t))
+
+/* Why an address starts a block */
+#define LEADER        0x1
+#define LEADER_CALLED 0x2
+#define LEADER_RETURN 0x4       //Return site of a call, I is not known there
+#define LEADER_ENTRY  0x8
+
+/* A range of I wider than this is as good as unknown */
+#define MAX_I_SPAN 0x100
+/* LD F,Vx points I at one of the 16 digits of the fontset */
+#define FONT_LAST (15 * 5)
+
+#define I_NONE  0       //No path has reached the block yet
+#define I_KNOWN 1
+#define I_ANY   2
+
+struct irange {
+	uint16_t lo;
+	uint16_t hi;
+	uint8_t state;
+};
+
+/* Scratch for one analysis, one per thread so analyses can run side by side */
+struct walk {
+	const uint8_t *mem;
+	uint8_t code[CHIP8_MEMORY_SIZE];        //An instruction starts here
+	uint8_t leader[CHIP8_MEMORY_SIZE];
+	uint16_t stack[CHIP8_MEMORY_SIZE];      //Every address is pushed at most once
+	unsigned int sp;
+	struct irange in[CHIP8BLOCKS_MAX];      //I on entry to each block
+	uint16_t queue[CHIP8BLOCKS_MAX];
+	uint8_t queued[CHIP8BLOCKS_MAX];
+};
+
+static uint16_t fetch(const uint8_t *mem, unsigned int addr) {
+	return (mem[addr & 0xfff] << 8) | mem[(addr + 1) & 0xfff];
+}
+
+static void push(struct walk *w, unsigned int addr, unsigned int why) {
+	addr &= 0xfff;
+	if (!w->leader[addr])
+		w->stack[w->sp++] = addr;
+	w->leader[addr] |= LEADER | why;
+}
+
+/* Marks every instruction reachable from the leaders on the stack */
+static void discover(struct walk *w) {
+	while (w->sp > 0) {
+		unsigned int addr = w->stack[--w->sp];
+
+		while (!w->code[addr]) {
+			uint16_t instruction = fetch(w->mem, addr);
+			unsigned int flow = chip8disasm_flow(instruction);
+
+			if (instruction == 0 || !chip8disasm_valid(instruction))
+				break;
+			w->code[addr] = 1;
+
+			if ((flow & (CHIP8_FLOW_JUMP | CHIP8_FLOW_CALL)) && !(flow & CHIP8_FLOW_INDIRECT))
+				push(w, instruction & 0xfff, flow & CHIP8_FLOW_CALL ? LEADER_CALLED : 0);
+			if (flow & CHIP8_FLOW_CALL)
+				push(w, addr + 2, LEADER_RETURN);
+			if (flow & (CHIP8_FLOW_SKIP | CHIP8_FLOW_WAIT))
+				push(w, addr + 2, 0);
+			if (flow & CHIP8_FLOW_SKIP)
+				push(w, addr + 4, 0);
+			if (flow & CHIP8_FLOW_ENDS_BLOCK)
+				break;
+			addr = (addr + 2) & 0xfff;
+		}
+	}
+}
+
+/* Grows a block from a leader up to its last instruction and works out where it goes */
+static void build_block(struct walk *w, struct chip8_blocks *b, unsigned int start) {
+	struct chip8_block *blk = &b->block[b->count];
+	unsigned int end = start, next, flow, nnn;
+	uint16_t instruction;
+
+	memset(blk, 0, sizeof(*blk));
+	blk->start = start;
+	blk->count = 1;
+	for (;;) {
+		b->lookup[end] = b->count + 1;
+		instruction = fetch(w->mem, end);
+		flow = chip8disasm_flow(instruction);
+		next = (end + 2) & 0xfff;
+		if (flow & CHIP8_FLOW_ENDS_BLOCK)
+			break;
+		if (!w->code[next]) {
+			blk->flags |= CHIP8_BLOCK_INVALID;
+			break;
+		}
+		if (w->leader[next])
+			break;
+		end = next;
+		blk->count++;
+	}
+	blk->end = end;
+
+	nnn = instruction & 0xfff;
+	blk->succ[0] = blk->succ[1] = CHIP8_NO_SUCC;
+	if (flow & CHIP8_FLOW_INDIRECT) {
+		blk->flags |= CHIP8_BLOCK_INDIRECT;
+		blk->succ[0] = nnn;
+	} else if (flow & CHIP8_FLOW_JUMP) {
+		blk->succ[0] = nnn;
+	} else if (flow & CHIP8_FLOW_CALL) {
+		blk->succ[0] = nnn;
+		blk->succ[1] = next;
+	} else if (flow & CHIP8_FLOW_RET) {
+		blk->flags |= CHIP8_BLOCK_RETURNS;
+	} else if (flow & CHIP8_FLOW_SKIP) {
+		blk->succ[0] = next;
+		blk->succ[1] = (end + 4) & 0xfff;
+	} else if (!(blk->flags & CHIP8_BLOCK_INVALID)) {
+		blk->succ[0] = next;
+	}
+
+	/* A jump or call into data */
+	if (!(blk->flags & CHIP8_BLOCK_INDIRECT) &&
+			((blk->succ[0] != CHIP8_NO_SUCC && !w->code[blk->succ[0]]) ||
+			(blk->succ[1] != CHIP8_NO_SUCC && !w->code[blk->succ[1]])))
+		blk->flags |= CHIP8_BLOCK_INVALID;
+
+	if (w->leader[start] & LEADER_ENTRY)
+		blk->flags |= CHIP8_BLOCK_ENTRY;
+	if (w->leader[start] & LEADER_CALLED)
+		blk->flags |= CHIP8_BLOCK_SUBROUTINE;
+	b->instructions += blk->count;
+	b->count++;
+}
+
+static struct irange meet(struct irange a, struct irange b) {
+	struct irange r;
+
+	if (a.state == I_NONE)
+		return b;
+	if (b.state == I_NONE)
+		return a;
+	if (a.state == I_ANY || b.state == I_ANY)
+		return (struct irange) { 0, 0, I_ANY };
+
+	r.lo = a.lo < b.lo ? a.lo : b.lo;
+	r.hi = a.hi > b.hi ? a.hi : b.hi;
+	r.state = r.hi - r.lo < MAX_I_SPAN ? I_KNOWN : I_ANY;
+	return r;
+}
+
+static int same_range(struct irange a, struct irange b) {
+	return a.state == b.state && (a.state != I_KNOWN || (a.lo == b.lo && a.hi == b.hi));
+}
+
+/* Marks the instructions a store of len bytes from I overwrites */
+static void check_store(struct chip8_blocks *b, struct chip8_block *blk, struct irange r,
+		unsigned int len) {
+	unsigned int addr, k;
+
+	if (r.state != I_KNOWN) {
+		blk->flags |= CHIP8_BLOCK_UNKNOWN_STORE;
+		return;
+	}
+
+	blk->flags |= CHIP8_BLOCK_STORES;
+	for (addr = r.lo; addr < r.hi + len; ++addr) {
+		/* The instruction starting at the byte and the one it is the low byte of */
+		for (k = 0; k < 2; ++k) {
+			unsigned int n = b->lookup[(addr - k) & 0xfff];
+
+			if (n) {
+				blk->flags |= CHIP8_BLOCK_SELF_MODIFYING;
+				b->block[n - 1].flags |= CHIP8_BLOCK_MODIFIED;
+			}
+		}
+	}
+}
+
+/* I at the end of a block given I at its start, checking stores if asked */
+static struct irange transfer(const struct walk *w, struct chip8_blocks *b,
+		struct chip8_block *blk, struct irange r, int stores) {
+	unsigned int addr = blk->start, k;
+
+	for (k = 0; k < blk->count; ++k, addr = (addr + 2) & 0xfff) {
+		uint16_t instruction = fetch(w->mem, addr);
+		unsigned int x = (instruction >> 8) & 0xf;
+
+		if ((instruction >> 12) == 0xA) {
+			r.lo = r.hi = instruction & 0xfff;
+			r.state = I_KNOWN;
+		} else if ((instruction >> 12) == 0xF) {
+			switch (instruction & 0xff) {
+			case 0x1E:
+				r.state = I_ANY;
+				break;
+			case 0x29:
+				r.lo = 0;
+				r.hi = FONT_LAST;
+				r.state = I_KNOWN;
+				break;
+			case 0x33:
+				if (stores)
+					check_store(b, blk, r, 3);
+				break;
+			case 0x55:
+				if (stores)
+					check_store(b, blk, r, x + 1);
+				break;
+			default: break;
+			}
+		}
+	}
+	return r;
+}
+
+static void enqueue(struct walk *w, unsigned int *tail, unsigned int n) {
+	if (w->queued[n])
+		return;
+	w->queued[n] = 1;
+	w->queue[*tail % CHIP8BLOCKS_MAX] = n;
+	(*tail)++;
+}
+
+/* Follows I along every edge but call returns and Bnnn until nothing changes */
+static void follow_i(struct walk *w, struct chip8_blocks *b) {
+	unsigned int head = 0, tail = 0, n, k;
+
+	for (n = 0; n < b->count; ++n) {
+		w->in[n].state = I_NONE;
+		if (w->leader[b->block[n].start] & (LEADER_ENTRY | LEADER_RETURN)) {
+			w->in[n].state = I_ANY;
+			enqueue(w, &tail, n);
+		}
+	}
+
+	while (head != tail) {
+		struct chip8_block *blk;
+		struct irange out;
+		int call;
+
+		n = w->queue[head++ % CHIP8BLOCKS_MAX];
+		w->queued[n] = 0;
+		blk = &b->block[n];
+		out = transfer(w, b, blk, w->in[n], 0);
+		call = chip8disasm_flow(fetch(w->mem, blk->end)) & CHIP8_FLOW_CALL;
+
+		for (k = 0; k < 2; ++k) {
+			struct irange next;
+			unsigned int s;
+
+			if (blk->succ[k] == CHIP8_NO_SUCC || (blk->flags & CHIP8_BLOCK_INDIRECT))
+				continue;
+			if (k == 1 && call)
+				continue;
+			if ((s = b->lookup[blk->succ[k]]) == 0)
+				continue;
+			next = meet(w->in[s - 1], out);
+			if (!same_range(next, w->in[s - 1])) {
+				w->in[s - 1] = next;
+				enqueue(w, &tail, s - 1);
+			}
+		}
+	}
+}
+
+unsigned int chip8blocks_analyze(struct chip8_blocks *b, const uint8_t mem[CHIP8_MEMORY_SIZE],
+		uint16_t entry) {
+	static __thread struct walk w;
+	unsigned int addr, n;
+
+	memset(&w, 0, sizeof(w));
+	w.mem = mem;
+	b->count = b->instructions = 0;
+	b->entry = entry & 0xfff;
+	b->flags = 0;
+	memset(b->lookup, 0, sizeof(b->lookup));
+
+	push(&w, entry, LEADER_ENTRY);
+	discover(&w);
+	for (addr = 0; addr < CHIP8_MEMORY_SIZE; ++addr)
+		if (w.code[addr] && w.leader[addr])
+			build_block(&w, b, addr);
+
+	follow_i(&w, b);
+	for (n = 0; n < b->count; ++n) {
+		struct irange r = w.in[n];
+
+		if (r.state == I_NONE)
+			r.state = I_ANY;
+		transfer(&w, b, &b->block[n], r, 1);
+	}
+	for (n = 0; n < b->count; ++n)
+		b->flags |= b->block[n].flags;
+	return b->count;
+}
+
+int chip8blocks_save(const struct chip8_blocks *b, const char *path, uint32_t rom_hash) {
+	struct chip8blocks_header h;
+	size_t len = b->count * sizeof(b->block[0]);
+	FILE *f;
+	int ret = 0;
+
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, "C8BI", 4);
+	h.version = CHIP8BLOCKS_VERSION;
+	h.count = b->count;
+	h.rom_hash = rom_hash;
+	h.entry = b->entry;
+	h.flags = b->flags;
+
+	if ((f = fopen(path, "wb")) == NULL)
+		return -1;
+	ret |= fwrite(&h, 1, sizeof(h), f) != sizeof(h);
+	ret |= fwrite(b->lookup, 1, LOOKUP_SIZE, f) != LOOKUP_SIZE;
+	ret |= fwrite(b->block, 1, len, f) != len;
+	ret |= fclose(f) != 0;
+	return ret ? -1 : 0;
+}
+
+int chip8blocks_map(struct chip8blocks_map *map, const char *path) {
+	const struct chip8blocks_header *h;
+	struct stat st;
+	unsigned int addr;
+	int fd;
+
+	memset(map, 0, sizeof(*map));
+	if ((fd = open(path, O_RDONLY)) == -1)
+		return -1;
+	if (fstat(fd, &st) || st.st_size < CHIP8BLOCKS_HEADER_SIZE + LOOKUP_SIZE) {
+		close(fd);
+		return -1;
+	}
+
+	map->len = st.st_size;
+	map->addr = mmap(NULL, map->len, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map->addr == MAP_FAILED) {
+		map->addr = NULL;
+		return -1;
+	}
+
+	h = map->addr;
+	if (memcmp(h->magic, "C8BI", 4) != 0 || h->version != CHIP8BLOCKS_VERSION ||
+			h->count > CHIP8BLOCKS_MAX || map->len != CHIP8BLOCKS_HEADER_SIZE + LOOKUP_SIZE +
+			h->count * sizeof(struct chip8_block)) {
+		chip8blocks_unmap(map);
+		return -1;
+	}
+
+	map->h = h;
+	map->lookup = (const uint16_t *) ((const uint8_t *) map->addr + CHIP8BLOCKS_HEADER_SIZE);
+	map->block = (const struct chip8_block *) (map->lookup + CHIP8_MEMORY_SIZE);
+
+	/* Checked once here so chip8blocks_find never reads past the blocks */
+	for (addr = 0; addr < CHIP8_MEMORY_SIZE; ++addr) {
+		if (map->lookup[addr] > h->count) {
+			chip8blocks_unmap(map);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+void chip8blocks_unmap(struct chip8blocks_map *map) {
+	if (map->addr != NULL)
+		munmap(map->addr, map->len);
+	memset(map, 0, sizeof(*map));
+}
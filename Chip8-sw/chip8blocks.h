@@ -0,0 +1,120 @@
+#ifndef __CHIP8_BLOCKS_H__
+#define __CHIP8_BLOCKS_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include "chip8core.h"
+
+/*
+* Static basic block analysis of a ROM image
+*
+* Code is found by following control flow from the entry point (0x200):
+* 1nnn and 2nnn targets, the return site after a 2nnn, both ways out of a
+* skip and the instruction after an Fx0A. 00EE ends a path, and so does a
+* word that does not decode or 0x0000, which is where a walk runs off the
+* end of the ROM into empty memory or into data. A Bnnn jumps to nnn + V0,
+* which is not followed; its block is flagged and keeps nnn as succ[0].
+*
+* A block starts wherever execution can arrive other than by falling
+* through and ends at the first control transfer. Instructions at odd
+* addresses are fine, their blocks simply overlap the even ones in memory.
+*
+* I is followed across blocks as a range of addresses: LD I,nnn sets it,
+* LD F,Vx narrows it to the fontset and ADD I,Vx loses it, as do the return
+* site of a call and the entry point. With it, the bytes an Fx55 or Fx33
+* writes are known in most games; a store that lands on an instruction
+* makes its block self-modifying and the block it lands in modified.
+*
+* Index file layout (all integers little-endian):
+*
+*   offset  size  field
+*   0       4     "C8BI"
+*   4       2     version
+*   6       2     number of blocks
+*   8       4     FNV-1a hash of the ROM image, as in chip8state.h
+*   12      2     entry point
+*   14      2     every block flag OR-ed together
+*   16      8192  one u16 per address, the number of the block holding the
+*                 instruction that starts there plus one, 0 outside code
+*   8208          blocks, 12 bytes each as struct chip8_block, by address
+*
+* A mapped index answers which block a PC is in with two loads, see
+* chip8blocks_find.
+*/
+
+#define CHIP8BLOCKS_VERSION 1
+#define CHIP8BLOCKS_HEADER_SIZE 16
+#define CHIP8BLOCKS_MAX (CHIP8_MEMORY_SIZE)
+
+#define CHIP8_NO_SUCC 0xffff
+
+#define CHIP8_BLOCK_ENTRY       0x001  //Starts at the entry point
+#define CHIP8_BLOCK_SUBROUTINE  0x002  //Target of a 2nnn
+#define CHIP8_BLOCK_RETURNS     0x004  //Ends with 00EE
+#define CHIP8_BLOCK_INDIRECT    0x008  //Ends with Bnnn, succ[0] is nnn
+#define CHIP8_BLOCK_INVALID     0x010  //Runs into a word that does not decode
+#define CHIP8_BLOCK_STORES      0x020  //Fx55 or Fx33 with a known target
+#define CHIP8_BLOCK_UNKNOWN_STORE 0x040 //Fx55 or Fx33 with I unknown
+#define CHIP8_BLOCK_SELF_MODIFYING 0x080 //Stores over an instruction
+#define CHIP8_BLOCK_MODIFIED    0x100  //Written by a self-modifying block
+
+struct chip8_block {
+	uint16_t start;
+	uint16_t end;           //Address of the last instruction
+	uint16_t succ[2];       //Addresses execution goes on at, CHIP8_NO_SUCC for none
+	uint16_t flags;
+	uint16_t count;         //Instructions
+};
+
+struct chip8_blocks {
+	unsigned int count;
+	unsigned int instructions;
+	uint16_t entry;
+	uint16_t flags;                         //All block flags OR-ed together
+	uint16_t lookup[CHIP8_MEMORY_SIZE];     //As in the index file
+	struct chip8_block block[CHIP8BLOCKS_MAX];
+};
+
+struct chip8blocks_header {
+	char     magic[4];
+	uint16_t version;
+	uint16_t count;
+	uint32_t rom_hash;
+	uint16_t entry;
+	uint16_t flags;
+};
+
+/* An index file mapped with chip8blocks_map */
+struct chip8blocks_map {
+	const struct chip8blocks_header *h;
+	const uint16_t *lookup;
+	const struct chip8_block *block;
+	void *addr;
+	size_t len;
+};
+
+/* Analyzes a 4 KB memory image from entry, returns the number of blocks */
+unsigned int chip8blocks_analyze(struct chip8_blocks *b, const uint8_t mem[CHIP8_MEMORY_SIZE],
+		uint16_t entry);
+
+/* Writes an index file, 0 or -1 */
+int chip8blocks_save(const struct chip8_blocks *b, const char *path, uint32_t rom_hash);
+
+/* Maps an index file read only and checks its header and size, 0 or -1 */
+int chip8blocks_map(struct chip8blocks_map *map, const char *path);
+void chip8blocks_unmap(struct chip8blocks_map *map);
+
+/* The block holding the instruction at pc, NULL outside code */
+static inline const struct chip8_block *chip8blocks_find(const struct chip8blocks_map *map,
+		unsigned int pc) {
+	unsigned int n = map->lookup[pc & 0xfff];
+	return n ? &map->block[n - 1] : NULL;
+}
+
+static inline const struct chip8_block *chip8blocks_block(const struct chip8_blocks *b,
+		unsigned int pc) {
+	unsigned int n = b->lookup[pc & 0xfff];
+	return n ? &b->block[n - 1] : NULL;
+}
+
+#endif //__CHIP8_BLOCKS_H__
@@ -0,0 +1,272 @@
+/*
+ * Virtual clock benchmark and test
+ *
+ * chip8clk run [-r rom] [-i per_tick] [-t ticks] [-f] [-R]
+ *     Runs a ROM on the model for the given number of 60 Hz ticks at
+ *     per_tick instructions per tick (0 for the board's rate), in virtual
+ *     time or with -R in real time, -f fast-forwarding delay-timer waits
+ * chip8clk bench [-r rom] [-i per_tick] [-t ticks]
+ *     Runs Pong and a built-in ROM that spends most of its time waiting on
+ *     DT, or the given ROM, with and without fast-forward at the board's
+ *     rate and faster ones, and prints the speedup
+ * chip8clk test [-r rom]
+ *     Checks that fast-forwarding ends in exactly the state stepping every
+ *     slot does, and that real time keeps to 60 ticks a second
+ *
+ * Columbia University
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "chip8model.h"
+#include "chip8sched.h"
+#include "chip8test.h"
+
+#define DEFAULT_ROM "../test/Pong.ch8"
+#define MAX_ROMS 8
+
+/*
+* Sets DT to 5 and waits for it, then moves a pixel and sets ST from Cxkk:
+*   200 LD VA,0  LD VB,0  LD I,21A
+*   206 LD V0,5  LD DT,V0
+*   20A LD V1,DT  SE V1,0  JP 20A
+*   210 DRW VA,VB,1  ADD VA,1  RND V2,0F  LD ST,V2  JP 206
+*   21A sprite
+*/
+static const uint8_t timer_rom[] = {
+	0x6A, 0x00, 0x6B, 0x00, 0xA2, 0x1A, 0x60, 0x05, 0xF0, 0x15,
+	0xF1, 0x07, 0x31, 0x00, 0x12, 0x0A,
+	0xDA, 0xB1, 0x7A, 0x01, 0xC2, 0x0F, 0xF2, 0x18, 0x12, 0x06,
+	0x80, 0x00,
+};
+
+/* The board's rate, then faster clocks where the waits are longer in slots */
+static const unsigned long bench_rates[] = { 0, 1000, 10000, 100000 };
+
+static double seconds() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void usage() {
+	fprintf(stderr,
+		"Usage: chip8clk run [-r rom] [-i per_tick] [-t ticks] [-f] [-R]\n"
+		"       chip8clk bench [-r rom] [-i per_tick] [-t ticks]\n"
+		"       chip8clk test [-r rom]\n");
+	exit(1);
+}
+
+/* NULL loads the built-in timer ROM */
+static int start_model(struct chip8_model *m, const char *rom) {
+	chip8model_init(m);
+	chip8core_clear_memory(&m->core);
+	if (rom == NULL) {
+		chip8core_load(&m->core, timer_rom, sizeof(timer_rom));
+	} else if (chip8core_load_file(&m->core, rom) < 0) {
+		perror(rom);
+		return -1;
+	}
+	m->state = RUNNING_STATE;
+	return 0;
+}
+
+static const char *rom_name(const char *rom) {
+	return rom != NULL ? rom : "timer (built-in)";
+}
+
+/* Everything but the fast-forward settings and counters */
+static int same_state(const struct chip8_model *a, const struct chip8_model *b) {
+	static struct chip8_model x, y;
+
+	x = *a;
+	y = *b;
+	x.fast_forward = y.fast_forward = 0;
+	x.skipped = y.skipped = 0;
+	return memcmp(&x, &y, sizeof(x)) == 0;
+}
+
+static int run(int argc, char **argv) {
+	const char *rom = DEFAULT_ROM;
+	unsigned long per_tick = 0;
+	uint64_t ticks = 600, retired;
+	int fast_forward = 0, mode = CHIP8SCHED_VIRTUAL, opt;
+	static struct chip8_model m;
+	struct chip8_sched s;
+	double t;
+
+	while ((opt = getopt(argc, argv, "r:i:t:fR")) != -1) {
+		switch (opt) {
+		case 'r': rom = optarg; break;
+		case 'i': per_tick = strtoul(optarg, NULL, 0); break;
+		case 't': ticks = strtoull(optarg, NULL, 0); break;
+		case 'f': fast_forward = 1; break;
+		case 'R': mode = CHIP8SCHED_REALTIME; break;
+		default: usage();
+		}
+	}
+
+	if (start_model(&m, rom))
+		return 1;
+	chip8sched_init(&s, &m, per_tick, mode, fast_forward);
+	t = seconds();
+	retired = chip8sched_run(&s, ticks);
+	t = seconds() - t;
+
+	printf("%llu ticks, %llu instructions (%llu fast-forwarded) at %u cycles each\n",
+		(unsigned long long) s.ticks, (unsigned long long) retired,
+		(unsigned long long) m.skipped, m.cycles_per_instruction);
+	printf("%.3f s, %.0f instructions/s, %.1fx real time\n", t, t > 0 ? retired / t : 0,
+		t > 0 ? s.ticks / 60.0 / t : 0);
+	return 0;
+}
+
+/* Runs a ROM both ways, returns 0 if both ended in the same state */
+static int compare(const char *rom, unsigned long per_tick, uint64_t ticks) {
+	static struct chip8_model plain, fast;
+	struct chip8_sched s;
+	char rate[24];
+	double tp, tf;
+	int same;
+
+	if (start_model(&plain, rom) || start_model(&fast, rom))
+		return -1;
+
+	chip8sched_init(&s, &plain, per_tick, CHIP8SCHED_VIRTUAL, 0);
+	tp = seconds();
+	chip8sched_run(&s, ticks);
+	tp = seconds() - tp;
+
+	chip8sched_init(&s, &fast, per_tick, CHIP8SCHED_VIRTUAL, 1);
+	tf = seconds();
+	chip8sched_run(&s, ticks);
+	tf = seconds() - tf;
+
+	same = same_state(&plain, &fast);
+	if (per_tick)
+		snprintf(rate, sizeof(rate), "%lu", per_tick);
+	else
+		strcpy(rate, "board");
+	printf("%-20s %9s %12llu %6.1f%% %10.0f %10.0f %7.1fx %s\n", rom_name(rom), rate,
+		(unsigned long long) plain.core.retired,
+		plain.core.retired ? 100.0 * fast.skipped / plain.core.retired : 0,
+		tp > 0 ? ticks / tp : 0, tf > 0 ? ticks / tf : 0, tf > 0 ? tp / tf : 0,
+		same ? "same" : "DIFFERS");
+	return same ? 0 : 1;
+}
+
+static void print_header() {
+	printf("%-20s %9s %12s %7s %10s %10s %8s\n", "rom", "per tick", "instructions",
+		"skipped", "plain t/s", "fast t/s", "speedup");
+}
+
+static int bench(int argc, char **argv) {
+	const char *roms[MAX_ROMS] = { DEFAULT_ROM, NULL };
+	int nroms = 2, user_roms = 0, bad = 0, k, r, opt;
+	unsigned long per_tick = 0;
+	uint64_t ticks = 3600;
+	int one_rate = 0;
+
+	while ((opt = getopt(argc, argv, "r:i:t:")) != -1) {
+		switch (opt) {
+		case 'r':
+			if (user_roms < MAX_ROMS)
+				roms[user_roms++] = optarg;
+			break;
+		case 'i': per_tick = strtoul(optarg, NULL, 0); one_rate = 1; break;
+		case 't': ticks = strtoull(optarg, NULL, 0); break;
+		default: usage();
+		}
+	}
+	if (user_roms)
+		nroms = user_roms;
+
+	printf("%llu ticks (%.0f s of board time) per run\n", (unsigned long long) ticks, ticks / 60.0);
+	print_header();
+	for (k = 0; k < nroms; ++k) {
+		if (one_rate) {
+			bad += compare(roms[k], per_tick, ticks) != 0;
+			continue;
+		}
+		for (r = 0; r < (int) (sizeof(bench_rates) / sizeof(bench_rates[0])); ++r)
+			bad += compare(roms[k], bench_rates[r], ticks) != 0;
+	}
+	return bad ? 1 : 0;
+}
+
+/* Odd slot budgets cut passes short, what is left must still line up */
+static int short_budgets() {
+	static struct chip8_model plain, fast;
+	unsigned long k;
+
+	if (start_model(&plain, NULL) || start_model(&fast, NULL))
+		return 1;
+	plain.cycles_per_instruction = fast.cycles_per_instruction = 97;
+	fast.fast_forward = 1;
+	for (k = 0; k < 20000; ++k)
+		chip8model_run(&fast, k % 101);
+	chip8model_run(&plain, fast.slots);
+
+	if (same_state(&plain, &fast) && fast.skipped > 0)
+		return 0;
+	printf("short budgets: %s\n", fast.skipped ? "state differs" : "nothing skipped");
+	return 1;
+}
+
+static int test(int argc, char **argv) {
+	static const unsigned long rates[] = { 0, 7, 300, 4096, 100000, CHIP8_CLK_DIV_PERIOD };
+	const char *rom = DEFAULT_ROM;
+	static struct chip8_model m;
+	struct chip8_sched s;
+	int errors = 0, r, opt;
+	double t;
+
+	while ((opt = getopt(argc, argv, "r:")) != -1) {
+		switch (opt) {
+		case 'r': rom = optarg; break;
+		default: usage();
+		}
+	}
+
+	print_header();
+	for (r = 0; r < (int) (sizeof(rates) / sizeof(rates[0])); ++r) {
+		errors += compare(rom, rates[r], 240) != 0;
+		errors += compare(NULL, rates[r], 240) != 0;
+	}
+
+	errors += short_budgets();
+
+	/* 15 ticks of real time take a quarter of a second */
+	if (start_model(&m, NULL))
+		return 1;
+	chip8sched_init(&s, &m, 0, CHIP8SCHED_REALTIME, 1);
+	t = seconds();
+	chip8sched_run(&s, 15);
+	t = seconds() - t;
+	printf("15 ticks in real time took %.3f s\n", t);
+	if (t < 0.24 || t > 0.5) {
+		printf("real time: expected 0.25 s\n");
+		errors++;
+	}
+
+	return chip8test_report(errors);
+}
+
+int main(int argc, char **argv) {
+	if (argc < 2)
+		usage();
+
+	if (strcmp(argv[1], "run") == 0)
+		return run(argc - 1, argv + 1);
+	if (strcmp(argv[1], "bench") == 0)
+		return bench(argc - 1, argv + 1);
+	if (strcmp(argv[1], "test") == 0)
+		return test(argc - 1, argv + 1);
+
+	usage();
+	return 1;
+}
@@ -0,0 +1,354 @@
+/*
+ * Software model of the Chip8 CPU
+ *
+ * Mirrors the instruction semantics of Chip8-qsys/Chip8_CPU/Chip8_CPU.sv so
+ * host tools can run without the board. See chip8core.h.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "chip8core.h"
+#include "chip8rewind.h"
+
+const uint8_t chip8_fontset[CHIP8_FONTSET_LENGTH] =
+	{
+		0xF0, 0x90, 0x90, 0x90, 0xF0, //0
+		0x20, 0x60, 0x20, 0x20, 0x70, //1
+		0xF0, 0x10, 0xF0, 0x80, 0xF0, //2
+		0xF0, 0x10, 0xF0, 0x10, 0xF0, //3
+		0x90, 0x90, 0xF0, 0x10, 0x10, //4
+		0xF0, 0x80, 0xF0, 0x10, 0xF0, //5
+		0xF0, 0x80, 0xF0, 0x90, 0xF0, //6
+		0xF0, 0x10, 0x20, 0x40, 0x40, //7
+		0xF0, 0x90, 0xF0, 0x90, 0xF0, //8
+		0xF0, 0x90, 0xF0, 0x10, 0xF0, //9
+		0xF0, 0x90, 0xF0, 0x90, 0x90, //A
+		0xE0, 0x90, 0xE0, 0x90, 0xE0, //B
+		0xF0, 0x80, 0x80, 0x80, 0xF0, //C
+		0xE0, 0x90, 0x90, 0x90, 0xE0, //D
+		0xF0, 0x80, 0xF0, 0x80, 0xF0, //E
+		0xF0, 0x80, 0xF0, 0x80, 0x80  //F
+	};
+
+void chip8core_reset(struct chip8_core *c) {
+	memset(c->v, 0, sizeof(c->v));
+	memset(c->stack, 0, sizeof(c->stack));
+	memset(c->fb, 0, sizeof(c->fb));
+	c->i = 0;
+	c->pc = CHIP8_PROGRAM_START;
+	c->sp = 0;
+	c->delay_timer = 0;
+	c->sound_timer = 0;
+	c->key = 0;
+	c->key_pressed = 0;
+	c->halted = 0;
+	c->rand_state = CHIP8_RAND_SEED;
+	c->retired = 0;
+	c->dirty_pages = ~0ULL;
+	c->dirty_rows = ~0u;
+	/* Stamps restart at zero, older records are no use any more */
+	if (c->rewind != NULL)
+		chip8rewind_discard(c->rewind, c);
+	else
+		c->rewind_due = UINT64_MAX;
+}
+
+void chip8core_clear_memory(struct chip8_core *c) {
+	memset(c->mem, 0, sizeof(c->mem));
+	memcpy(c->mem, chip8_fontset, CHIP8_FONTSET_LENGTH);
+	c->dirty_pages = ~0ULL;
+	chip8core_touch(c);
+}
+
+size_t chip8core_load(struct chip8_core *c, const uint8_t *rom, size_t len) {
+	if (len > CHIP8_MEMORY_SIZE - CHIP8_PROGRAM_START)
+		len = CHIP8_MEMORY_SIZE - CHIP8_PROGRAM_START;
+	memcpy(c->mem + CHIP8_PROGRAM_START, rom, len);
+	c->dirty_pages = ~0ULL;
+	chip8core_touch(c);
+	return len;
+}
+
+int chip8core_load_file(struct chip8_core *c, const char *filename) {
+	uint8_t rom[CHIP8_MEMORY_SIZE - CHIP8_PROGRAM_START];
+	FILE *romfile = fopen(filename, "rb");
+	size_t len;
+
+	if (romfile == NULL)
+		return -1;
+	len = fread(rom, 1, sizeof(rom), romfile);
+	fclose(romfile);
+
+	return (int) chip8core_load(c, rom, len);
+}
+
+/*
+* One step of Chip8_rand_num_generator.sv: bit i becomes r[15-i] ^ r[14-i],
+* bit 15 becomes r[0] ^ r[15], and an all zero state is reseeded
+*/
+static uint16_t next_rand(uint16_t r) {
+	uint16_t out = 0;
+	int i;
+
+	if (r == 0)
+		return CHIP8_RAND_SEED;
+	for (i = 0; i < 15; ++i)
+		out |= (((r >> (15 - i)) ^ (r >> (14 - i))) & 0x1) << i;
+	out |= ((r ^ (r >> 15)) & 0x1) << 15;
+	return out;
+}
+
+/*
+* XORs an n-byte sprite from I onto the screen at (vx, vy), returns 1 if any
+* lit pixel was erased
+*/
+static int draw_sprite(struct chip8_core *c, unsigned int vx, unsigned int vy, unsigned int n) {
+	unsigned int row;
+	int collision = 0;
+
+	vx %= CHIP8_FB_WIDTH;
+	for (row = 0; row < n; ++row) {
+		uint8_t sprite = c->mem[(c->i + row) & 0xfff];
+		/* Bit 7 of the sprite byte lands on column vx */
+		uint64_t bits = 0;
+		int b;
+		for (b = 0; b < 8; ++b)
+			if (sprite & (0x80 >> b))
+				bits |= 1ULL << ((vx + b) % CHIP8_FB_WIDTH);
+
+		uint64_t *line = &c->fb[(vy + row) % CHIP8_FB_HEIGHT];
+		if (*line & bits)
+			collision = 1;
+		*line ^= bits;
+		c->dirty_rows |= 1u << ((vy + row) % CHIP8_FB_HEIGHT);
+	}
+
+	return collision;
+}
+
+int chip8core_execute(struct chip8_core *c, uint16_t instruction) {
+	unsigned int x = (instruction >> 8) & 0xf;
+	unsigned int y = (instruction >> 4) & 0xf;
+	unsigned int kk = instruction & 0xff;
+	unsigned int nnn = instruction & 0xfff;
+	uint16_t next_pc = (c->pc + 2) & 0xfff;
+	unsigned int result;
+
+	c->rand_state = next_rand(c->rand_state);
+
+	switch (instruction >> 12) {
+	case 0x0:
+		if (instruction == 0x00E0) {
+			memset(c->fb, 0, sizeof(c->fb));
+			c->dirty_rows = ~0u;
+		} else if (instruction == 0x00EE) {
+			c->sp = (c->sp - 1) & (CHIP8_STACK_DEPTH - 1);
+			next_pc = c->stack[c->sp] & 0xfff;
+		}
+		break;
+
+	case 0x1:
+		next_pc = nnn;
+		break;
+
+	case 0x2:
+		c->stack[c->sp] = (c->pc + 2) & 0xfff;
+		c->sp = (c->sp + 1) & (CHIP8_STACK_DEPTH - 1);
+		next_pc = nnn;
+		break;
+
+	case 0x3:
+		if (c->v[x] == kk) next_pc = (c->pc + 4) & 0xfff;
+		break;
+
+	case 0x4:
+		if (c->v[x] != kk) next_pc = (c->pc + 4) & 0xfff;
+		break;
+
+	case 0x5:
+		if ((instruction & 0xf) == 0 && c->v[x] == c->v[y])
+			next_pc = (c->pc + 4) & 0xfff;
+		break;
+
+	case 0x6:
+		c->v[x] = kk;
+		break;
+
+	case 0x7:
+		c->v[x] = (c->v[x] + kk) & 0xff;
+		break;
+
+	case 0x8:
+		switch (instruction & 0xf) {
+		case 0x0: c->v[x] = c->v[y]; break;
+		case 0x1: c->v[x] |= c->v[y]; break;
+		case 0x2: c->v[x] &= c->v[y]; break;
+		case 0x3: c->v[x] ^= c->v[y]; break;
+		case 0x4:
+			result = c->v[x] + c->v[y];
+			c->v[x] = result & 0xff;
+			c->v[0xF] = result > 0xff;
+			break;
+		case 0x5:
+			result = c->v[x] > c->v[y];
+			c->v[x] = (c->v[x] - c->v[y]) & 0xff;
+			c->v[0xF] = result;
+			break;
+		case 0x6:
+			result = c->v[x] & 0x1;
+			c->v[x] >>= 1;
+			c->v[0xF] = result;
+			break;
+		case 0x7:
+			result = c->v[y] > c->v[x];
+			c->v[x] = (c->v[y] - c->v[x]) & 0xff;
+			c->v[0xF] = result;
+			break;
+		case 0xE:
+			result = c->v[x] >> 7;
+			c->v[x] = (c->v[x] << 1) & 0xff;
+			c->v[0xF] = result;
+			break;
+		default: break;
+		}
+		break;
+
+	case 0x9:
+		if ((instruction & 0xf) == 0 && c->v[x] != c->v[y])
+			next_pc = (c->pc + 4) & 0xfff;
+		break;
+
+	case 0xA:
+		c->i = nnn;
+		break;
+
+	case 0xB:
+		next_pc = (nnn + c->v[0]) & 0xfff;
+		break;
+
+	case 0xC:
+		c->v[x] = c->rand_state & kk;
+		break;
+
+	case 0xD:
+		c->v[0xF] = draw_sprite(c, c->v[x], c->v[y], instruction & 0xf);
+		break;
+
+	case 0xE:
+		if (kk == 0x9E && c->key_pressed && c->key == c->v[x])
+			next_pc = (c->pc + 4) & 0xfff;
+		else if (kk == 0xA1 && (!c->key_pressed || c->key != c->v[x]))
+			next_pc = (c->pc + 4) & 0xfff;
+		break;
+
+	case 0xF:
+		switch (kk) {
+		case 0x07: c->v[x] = c->delay_timer; break;
+		case 0x0A:
+			if (!c->key_pressed) {
+				c->halted = 1;
+				return CHIP8_STEP_HALTED;
+			}
+			c->halted = 0;
+			c->v[x] = c->key;
+			break;
+		case 0x15: c->delay_timer = c->v[x]; break;
+		case 0x18: c->sound_timer = c->v[x]; break;
+		case 0x1E: c->i = c->i + c->v[x]; break;
+		case 0x29: c->i = (c->v[x] & 0xf) * 5; break;
+		case 0x33:
+			chip8core_store(c, c->i, c->v[x] / 100);
+			chip8core_store(c, c->i + 1, (c->v[x] / 10) % 10);
+			chip8core_store(c, c->i + 2, c->v[x] % 10);
+			break;
+		case 0x55:
+			for (result = 0; result <= x; ++result)
+				chip8core_store(c, c->i + result, c->v[result]);
+			break;
+		case 0x65:
+			for (result = 0; result <= x; ++result)
+				c->v[result] = c->mem[(c->i + result) & 0xfff];
+			break;
+		default: break;
+		}
+		break;
+	}
+
+	c->pc = next_pc;
+	c->retired++;
+	return CHIP8_STEP_OK;
+}
+
+/* The linear part of next_rand applied to r, columns[i] is the image of bit i */
+static uint16_t apply_rand(const uint16_t columns[16], uint16_t r) {
+	uint16_t out = 0;
+	int i;
+
+	for (i = 0; i < 16; ++i)
+		if ((r >> i) & 0x1)
+			out ^= columns[i];
+	return out;
+}
+
+/*
+* next_rand is linear apart from the reseed at zero, but not invertible:
+* states in its nilpotent part reach zero within 16 steps, and the seed is
+* one of them, so from reset the LFSR goes round a 15 state cycle through
+* zero. A walk that comes back to zero is cut short to the remainder of
+* its period. Once 16 steps in a row have avoided zero the state is out of
+* that part for good and the rest of the walk is the matrix power, unless
+* it is short enough to step through.
+*/
+void chip8core_skip_rand(struct chip8_core *c, uint64_t steps) {
+	uint16_t r = c->rand_state, power[16], square[16];
+	uint64_t walked = 0, zero = UINT64_MAX;
+	int clean = 0, i;
+
+	while (steps > 0 && (clean < 16 || r == 0 || steps < 64)) {
+		if (r == 0) {
+			if (zero != UINT64_MAX && (steps %= walked - zero) == 0)
+				break;
+			zero = walked;
+		}
+		clean = r != 0 ? clean + 1 : 0;
+		r = next_rand(r);
+		steps--;
+		walked++;
+	}
+
+	for (i = 0; i < 16; ++i)
+		power[i] = next_rand(1 << i);
+	while (steps > 0) {
+		if (steps & 1)
+			r = apply_rand(power, r);
+		for (i = 0; i < 16; ++i)
+			square[i] = apply_rand(power, power[i]);
+		memcpy(power, square, sizeof(power));
+		steps >>= 1;
+	}
+	c->rand_state = r;
+}
+
+int chip8core_step(struct chip8_core *c) {
+	if (c->retired >= c->rewind_due)
+		chip8rewind_record(c->rewind, c);
+	return chip8core_execute(c, chip8core_fetch(c, c->pc));
+}
+
+void chip8core_tick60(struct chip8_core *c) {
+	if (c->delay_timer) c->delay_timer--;
+	if (c->sound_timer) c->sound_timer--;
+	if (c->rewind != NULL)
+		chip8rewind_tick(c->rewind, c);
+}
+
+void chip8core_set_key(struct chip8_core *c, unsigned int key, unsigned int ispressed) {
+	if (c->key == (key & 0xf) && c->key_pressed == (ispressed & 0x1) && !c->halted)
+		return;
+	c->key = key & 0xf;
+	c->key_pressed = ispressed & 0x1;
+	if (c->key_pressed)
+		c->halted = 0;
+	chip8core_touch(c);
+}
@@ -0,0 +1,137 @@
+#ifndef __CHIP8_CORE_H__
+#define __CHIP8_CORE_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "chip8driver.h"
+
+/*
+* Software model of the Chip8 CPU in Chip8-qsys/Chip8_CPU/Chip8_CPU.sv
+*
+* Executes one whole instruction per call to chip8core_step instead of
+* walking the stage counter, but matches the RTL for everything the host
+* can observe: 8xy5/8xy7 set VF to a strict greater-than, 8xy6/8xyE shift
+* Vx, Fx55/Fx65 leave I untouched, sprites wrap on both axes and Cxkk
+* draws from the same LFSR as Chip8_rand_num_generator.sv.
+*/
+
+#define CHIP8_MEMORY_SIZE 0x1000
+#define CHIP8_NUM_REGISTERS 16
+#define CHIP8_PROGRAM_START 0x200
+
+#define CHIP8_FB_WIDTH 64
+#define CHIP8_FB_HEIGHT 32
+/* Packed framebuffer: one uint64_t per row, bit x is pixel (x, y) */
+#define CHIP8_FB_BYTES (CHIP8_FB_HEIGHT * sizeof(uint64_t))
+
+#define CHIP8_FONTSET_LENGTH 80
+#define CHIP8_RAND_SEED 0xF5D2
+
+/* Dirty tracking granularity for the rewind buffer, see chip8rewind.h */
+#define CHIP8_PAGE_SHIFT 6
+#define CHIP8_PAGE_SIZE (1 << CHIP8_PAGE_SHIFT)
+#define CHIP8_NUM_PAGES (CHIP8_MEMORY_SIZE / CHIP8_PAGE_SIZE)
+
+/* Result of chip8core_step */
+#define CHIP8_STEP_OK 0
+#define CHIP8_STEP_HALTED 1 //Fx0A is waiting for a keypress
+
+struct chip8_rewind;
+struct chip8_debug;
+
+struct chip8_core {
+	uint8_t  mem[CHIP8_MEMORY_SIZE];
+	uint8_t  v[CHIP8_NUM_REGISTERS];
+	uint16_t i;
+	uint16_t pc;
+	uint16_t stack[CHIP8_STACK_DEPTH];
+	uint8_t  sp;
+	uint8_t  delay_timer;
+	uint8_t  sound_timer;
+	uint8_t  key;           //Last key written to KEY_PRESS_ADDR
+	uint8_t  key_pressed;
+	uint8_t  halted;        //Set while Fx0A waits for a keypress
+	uint16_t rand_state;
+	uint64_t fb[CHIP8_FB_HEIGHT];
+	uint64_t retired;       //Number of instructions retired since reset
+
+	/*
+	* Rewind support. Pages and framebuffer rows written since the last
+	* rewind record are flagged here, and chip8core_step calls into the
+	* rewind buffer once retired reaches rewind_due, which stays at
+	* UINT64_MAX while no buffer is attached.
+	*/
+	struct chip8_rewind *rewind;
+	uint64_t rewind_due;
+	uint64_t dirty_pages;   //Bit n covers mem[n * CHIP8_PAGE_SIZE]
+	uint32_t dirty_rows;    //Bit y covers fb[y]
+
+	/* Breakpoints and watches, see chip8debug.h. NULL runs without them. */
+	struct chip8_debug *debug;
+};
+
+extern const uint8_t chip8_fontset[CHIP8_FONTSET_LENGTH];
+
+/*
+* Clears registers, stack, timers and the framebuffer and sets the PC to
+* 0x200. Memory is left alone, like the reset register on the board.
+* A new core must be zeroed before its first reset.
+*/
+void chip8core_reset(struct chip8_core *c);
+
+/* Zeroes memory and loads the fontset at address 0 */
+void chip8core_clear_memory(struct chip8_core *c);
+
+/* Copies a ROM image to 0x200, returns the number of bytes loaded */
+size_t chip8core_load(struct chip8_core *c, const uint8_t *rom, size_t len);
+
+/* Loads a ROM file from disk, returns -1 if it could not be read */
+int chip8core_load_file(struct chip8_core *c, const char *filename);
+
+/* Executes a single instruction */
+int chip8core_step(struct chip8_core *c);
+
+/* Executes a single instruction without reading it from memory */
+int chip8core_execute(struct chip8_core *c, uint16_t instruction);
+
+/* Advances the Cxkk generator as far as the given number of instructions would */
+void chip8core_skip_rand(struct chip8_core *c, uint64_t steps);
+
+/* One 60 Hz tick of the delay and sound timers (see timer.sv) */
+void chip8core_tick60(struct chip8_core *c);
+
+void chip8core_set_key(struct chip8_core *c, unsigned int key, unsigned int ispressed);
+
+static inline unsigned int chip8core_pixel(const struct chip8_core *c, unsigned int x, unsigned int y) {
+	return (c->fb[y % CHIP8_FB_HEIGHT] >> (x % CHIP8_FB_WIDTH)) & 0x1;
+}
+
+static inline void chip8core_set_pixel(struct chip8_core *c, unsigned int x, unsigned int y, unsigned int value) {
+	uint64_t bit = 1ULL << (x % CHIP8_FB_WIDTH);
+	if (value) c->fb[y % CHIP8_FB_HEIGHT] |= bit;
+	else       c->fb[y % CHIP8_FB_HEIGHT] &= ~bit;
+	c->dirty_rows |= 1u << (y % CHIP8_FB_HEIGHT);
+}
+
+static inline void chip8core_store(struct chip8_core *c, unsigned int addr, uint8_t value) {
+	addr &= 0xfff;
+	c->mem[addr] = value;
+	c->dirty_pages |= 1ULL << (addr >> CHIP8_PAGE_SHIFT);
+}
+
+/*
+* Tells an attached rewind buffer that state was changed from outside an
+* instruction (host writes, key presses) and must be recorded before the
+* next instruction runs
+*/
+static inline void chip8core_touch(struct chip8_core *c) {
+	if (c->rewind != NULL)
+		c->rewind_due = c->retired;
+}
+
+static inline uint16_t chip8core_fetch(const struct chip8_core *c, uint16_t pc) {
+	return (c->mem[pc & 0xfff] << 8) | c->mem[(pc + 1) & 0xfff];
+}
+
+#endif //__CHIP8_CORE_H__
@@ -0,0 +1,365 @@
+/*
+ * Breakpoints and watchpoints against the model
+ *
+ * chip8dbg run [-r rom] [-b addr] [-R addr[:len]] [-W addr[:len]] [-c reg]
+ *              [-e reg=value] [-s stops] [-n instructions]
+ *     Runs a ROM on the model with breakpoints (-b), read and write
+ *     watches (-R, -W), and stops when Vx changes (-c) or changes to a value
+ *     (-e), all of which can be given more than once. Prints every stop
+ *     with the registers and carries on, up to stops times or until the
+ *     instructions run out.
+ * chip8dbg bench [-r rom] [-n instructions]
+ *     Runs the model without a debugger, with an idle one, and with a
+ *     breakpoint on every address and a watch on every byte that the run
+ *     does not touch, and prints the throughput of each
+ * chip8dbg test
+ *     Checks that breakpoints, watches and register conditions stop the
+ *     model where they should and resume from there, that watches on
+ *     neighbouring bytes stay quiet, and that an idle debugger changes
+ *     nothing the host can see
+ *
+ * Columbia University
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "chip8io.h"
+#include "chip8model.h"
+#include "chip8debug.h"
+#include "chip8test.h"
+
+#define DEFAULT_ROM "../test/Pong.ch8"
+#define BENCH_RUNS 9
+
+/*
+*   200 LD V0,0
+*   202 ADD V0,1  LD I,300  LD [I],V0
+*   208 LD I,310  DRW V0,V1,1  JP 202
+*/
+static const uint8_t watch_rom[] = {
+	0x60, 0x00, 0x70, 0x01, 0xA3, 0x00, 0xF0, 0x55,
+	0xA3, 0x10, 0xD0, 0x11, 0x12, 0x02,
+};
+
+static struct chip8_debug debug;
+
+static double seconds() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void usage() {
+	fprintf(stderr,
+		"Usage: chip8dbg run [-r rom] [-b addr] [-R addr[:len]] [-W addr[:len]] [-c reg]\n"
+		"                    [-e reg=value] [-s stops] [-n instructions]\n"
+		"       chip8dbg bench [-r rom] [-n instructions]\n"
+		"       chip8dbg test\n");
+	exit(1);
+}
+
+static void watch_arg(unsigned int type, const char *arg) {
+	char *end;
+	unsigned int addr = strtoul(arg, &end, 16), len = 1;
+
+	if (*end == ':')
+		len = strtoul(end + 1, NULL, 0);
+	chip8debug_watch(&debug, type, addr, len, 1);
+}
+
+static void print_stop(const struct chip8_model *m, const struct chip8_debug *d) {
+	const struct chip8debug_hit *h = &d->hit;
+	int k;
+
+	switch (h->type) {
+	case CHIP8DEBUG_BREAK:
+		printf("breakpoint at %03x", h->pc);
+		break;
+	case CHIP8DEBUG_READ:
+	case CHIP8DEBUG_WRITE:
+		printf("%s of %03x = %02x by %03x", chip8debug_type_name(h->type), h->addr, h->value, h->pc);
+		break;
+	case CHIP8DEBUG_REGISTER:
+		printf("V%X %02x -> %02x by %03x", h->addr, h->old, h->value, h->pc);
+		break;
+	}
+	printf(", %llu retired\n  PC %03x  I %03x  SP %x  DT %02x  ST %02x\n ",
+		(unsigned long long) m->core.retired, m->core.pc, m->core.i, m->core.sp,
+		m->core.delay_timer, m->core.sound_timer);
+	for (k = 0; k < CHIP8_NUM_REGISTERS; ++k)
+		printf(" V%X %02x", k, m->core.v[k]);
+	printf("\n");
+}
+
+static int run(int argc, char **argv) {
+	const char *rom = DEFAULT_ROM;
+	unsigned long stops = 10, instructions = 1000000, done = 0, k = 0;
+	struct chip8_model *m;
+	char *end;
+	int opt, x;
+
+	chip8debug_init(&debug);
+	while ((opt = getopt(argc, argv, "r:b:R:W:c:e:s:n:")) != -1) {
+		switch (opt) {
+		case 'r': rom = optarg; break;
+		case 'b': chip8debug_break(&debug, strtoul(optarg, NULL, 16), 1); break;
+		case 'R': watch_arg(CHIP8DEBUG_READ, optarg); break;
+		case 'W': watch_arg(CHIP8DEBUG_WRITE, optarg); break;
+		case 'c': chip8debug_register(&debug, strtoul(optarg, NULL, 16), 0, 0, 1); break;
+		case 'e':
+			x = strtoul(optarg, &end, 16);
+			if (*end != '=')
+				usage();
+			chip8debug_register(&debug, x, 1, strtoul(end + 1, NULL, 0), 1);
+			break;
+		case 's': stops = strtoul(optarg, NULL, 0); break;
+		case 'n': instructions = strtoul(optarg, NULL, 0); break;
+		default: usage();
+		}
+	}
+
+	if (chip8io_open("model"))
+		return 1;
+	m = chip8io_model();
+	chip8core_clear_memory(&m->core);
+	if (chip8core_load_file(&m->core, rom) < 0) {
+		perror(rom);
+		chip8io_close();
+		return 1;
+	}
+	m->core.debug = &debug;
+
+	while (k < stops && done < instructions) {
+		startChip8();
+		done += chip8io_advance(instructions - done);
+		if (!chip8isPaused())
+			break;
+		printf("%lu: ", ++k);
+		print_stop(m, &debug);
+	}
+	printf("%lu stops in %lu instructions\n", k, done);
+	chip8io_close();
+	return 0;
+}
+
+static int setup(struct chip8_model *m, const char *rom) {
+	chip8model_init(m);
+	chip8core_clear_memory(&m->core);
+	if (chip8core_load_file(&m->core, rom) < 0) {
+		perror(rom);
+		return -1;
+	}
+	m->state = RUNNING_STATE;
+	return 0;
+}
+
+/* One run of n instructions, in instructions per second */
+static double throughput(const char *rom, struct chip8_debug *d, unsigned long n, uint64_t *stopped) {
+	static struct chip8_model m;
+	double t;
+
+	if (setup(&m, rom))
+		return 0;
+	m.core.debug = d;
+	t = seconds();
+	chip8model_run(&m, n);
+	t = seconds() - t;
+	if (m.state != RUNNING_STATE)
+		(*stopped)++;
+	return t > 0 ? m.core.retired / t : 0;
+}
+
+/*
+* Sets everything, then takes off each breakpoint and watch that stops a
+* run of n instructions until one gets through
+*/
+static void untouched(const char *rom, struct chip8_debug *d, unsigned long n) {
+	static struct chip8_model m;
+	unsigned long left = n;
+
+	chip8debug_init(d);
+	memset(d->breakpoints, 0xff, sizeof(d->breakpoints));
+	chip8debug_watch(d, CHIP8DEBUG_READ, 0, CHIP8_MEMORY_SIZE, 1);
+	chip8debug_watch(d, CHIP8DEBUG_WRITE, 0, CHIP8_MEMORY_SIZE, 1);
+	if (setup(&m, rom))
+		return;
+	m.core.debug = d;
+
+	while (left > 0) {
+		m.state = RUNNING_STATE;
+		left -= chip8model_run(&m, left);
+		if (m.state == RUNNING_STATE)
+			break;
+		if (d->hit.type == CHIP8DEBUG_BREAK)
+			chip8debug_break(d, d->hit.addr, 0);
+		else
+			chip8debug_watch(d, d->hit.type, d->hit.addr, 1, 0);
+	}
+	d->resume = 0;
+	d->hits = 0;
+}
+
+static unsigned int count_bits(const uint64_t *words, unsigned int n) {
+	unsigned int k, bits = 0;
+
+	for (k = 0; k < n; ++k)
+		bits += __builtin_popcountll(words[k]);
+	return bits;
+}
+
+/* Best of BENCH_RUNS rounds, the three taking turns so that they see the same host */
+static int bench(int argc, char **argv) {
+	static struct chip8_debug idle;
+	const char *rom = DEFAULT_ROM;
+	unsigned long n = 2000000;
+	uint64_t stopped = 0;
+	double best[3] = { 0, 0, 0 }, t;
+	char loaded[64];
+	int k, opt;
+
+	while ((opt = getopt(argc, argv, "r:n:")) != -1) {
+		switch (opt) {
+		case 'r': rom = optarg; break;
+		case 'n': n = strtoul(optarg, NULL, 0); break;
+		default: usage();
+		}
+	}
+	if (access(rom, R_OK)) {
+		perror(rom);
+		return 1;
+	}
+
+	chip8debug_init(&idle);
+	untouched(rom, &debug, n);
+	for (k = 0; k < 3 * BENCH_RUNS; ++k) {
+		t = throughput(rom, k % 3 == 0 ? NULL : k % 3 == 1 ? &idle : &debug, n, &stopped);
+		if (t > best[k % 3])
+			best[k % 3] = t;
+	}
+
+	printf("%s, %lu instructions, best of %d\n", rom, n, BENCH_RUNS);
+	printf("%-50s %6.1f M/s\n", "no debugger", best[0] / 1e6);
+	printf("%-50s %6.1f M/s %+6.1f%%\n", "debugger, nothing set", best[1] / 1e6,
+		100 * (best[1] - best[0]) / best[0]);
+	snprintf(loaded, sizeof(loaded), "%u breakpoints, %u read and %u write watches",
+		count_bits(debug.breakpoints, CHIP8_MEMORY_SIZE / 64),
+		count_bits(debug.read_bytes, CHIP8_NUM_PAGES), count_bits(debug.write_bytes, CHIP8_NUM_PAGES));
+	printf("%-50s %6.1f M/s %+6.1f%%\n", loaded, best[2] / 1e6, 100 * (best[2] - best[0]) / best[0]);
+	if (stopped)
+		printf("%llu runs stopped early\n", (unsigned long long) stopped);
+	return 0;
+}
+
+/* Resumes the model and runs until it stops or n instructions have gone */
+static int resume(unsigned long n) {
+	startChip8();
+	chip8io_advance(n);
+	return chip8isPaused();
+}
+
+static int stops() {
+	struct chip8_model *m;
+	int errors = 0, target;
+
+	if (chip8io_open("model"))
+		return 1;
+	m = chip8io_model();
+	chip8core_clear_memory(&m->core);
+	chip8core_load(&m->core, watch_rom, sizeof(watch_rom));
+	chip8debug_init(&debug);
+	m->core.debug = &debug;
+
+	chip8debug_break(&debug, 0x206, 1);
+	errors += chip8test_check("stopped at the breakpoint", resume(1000), 1);
+	errors += chip8test_check("breakpoint PC", readPC(), 0x206);
+	errors += chip8test_check("breakpoint before LD [I],V0", m->core.retired, 3);
+	errors += chip8test_check("breakpoint hit", debug.hit.type, CHIP8DEBUG_BREAK);
+	errors += chip8test_check("resumed to the breakpoint again", resume(1000), 1);
+	errors += chip8test_check("once round the loop", readRegister(0), 2);
+	chip8debug_break(&debug, 0x206, 0);
+
+	/* Same pages, other bytes */
+	chip8debug_watch(&debug, CHIP8DEBUG_WRITE, 0x301, 1, 1);
+	chip8debug_watch(&debug, CHIP8DEBUG_READ, 0x311, 2, 1);
+	errors += chip8test_check("quiet next to the watched bytes", resume(300), 0);
+	errors += chip8test_check("no stops", debug.hits, 2);
+
+	chip8debug_watch(&debug, CHIP8DEBUG_WRITE, 0x300, 1, 1);
+	errors += chip8test_check("stopped on the write", resume(300), 1);
+	errors += chip8test_check("write hit", debug.hit.type, CHIP8DEBUG_WRITE);
+	errors += chip8test_check("write address", debug.hit.addr, 0x300);
+	errors += chip8test_check("write by", debug.hit.pc, 0x206);
+	errors += chip8test_check("written value", debug.hit.value, readRegister(0));
+	errors += chip8test_check("after LD [I],V0", readPC(), 0x208);
+	chip8debug_watch(&debug, CHIP8DEBUG_WRITE, 0x300, 2, 0);
+
+	chip8debug_watch(&debug, CHIP8DEBUG_READ, 0x310, 1, 1);
+	errors += chip8test_check("stopped on the read", resume(300), 1);
+	errors += chip8test_check("read hit", debug.hit.type, CHIP8DEBUG_READ);
+	errors += chip8test_check("read address", debug.hit.addr, 0x310);
+	errors += chip8test_check("after DRW", readPC(), 0x20C);
+	chip8debug_watch(&debug, CHIP8DEBUG_READ, 0x310, 3, 0);
+
+	target = (readRegister(0) + 20) & 0xff;
+	chip8debug_register(&debug, 0, 1, target, 1);
+	errors += chip8test_check("stopped on V0 reaching its value", resume(1000), 1);
+	errors += chip8test_check("V0", readRegister(0), target);
+	errors += chip8test_check("after ADD V0,1", readPC(), 0x204);
+	errors += chip8test_check("register hit", debug.hit.type, CHIP8DEBUG_REGISTER);
+	chip8debug_register(&debug, 0, 1, target, 0);
+
+	chip8debug_register(&debug, 1, 0, 0, 1);
+	errors += chip8test_check("V1 never changes", resume(300), 0);
+	chip8debug_register(&debug, 0, 0, 0, 1);
+	errors += chip8test_check("V0 changes", resume(300), 1);
+	errors += chip8test_check("V0 by one", debug.hit.value, (debug.hit.old + 1) & 0xff);
+	chip8io_close();
+	return errors;
+}
+
+/* Everything but the debugger pointer, fast-forward included */
+static int idle_same() {
+	static struct chip8_model plain, debugged;
+	int errors = 0;
+
+	if (setup(&plain, DEFAULT_ROM) || setup(&debugged, DEFAULT_ROM))
+		return 1;
+	chip8debug_init(&debug);
+	debugged.core.debug = &debug;
+	plain.fast_forward = debugged.fast_forward = 1;
+	chip8model_run(&plain, 200000);
+	chip8model_run(&debugged, 200000);
+
+	debugged.core.debug = NULL;
+	debugged.skipped = plain.skipped;
+	errors += chip8test_check("idle debugger changes nothing", memcmp(&plain, &debugged, sizeof(plain)) == 0, 1);
+	errors += chip8test_check("idle debugger stops", debug.hits, 0);
+	return errors;
+}
+
+static int test(int argc, char **argv) {
+	int errors = 0;
+
+	errors += stops();
+	errors += idle_same();
+	return chip8test_report(errors);
+}
+
+int main(int argc, char **argv) {
+	if (argc < 2)
+		usage();
+
+	if (strcmp(argv[1], "run") == 0)
+		return run(argc - 1, argv + 1);
+	if (strcmp(argv[1], "bench") == 0)
+		return bench(argc - 1, argv + 1);
+	if (strcmp(argv[1], "test") == 0)
+		return test(argc - 1, argv + 1);
+
+	usage();
+	return 1;
+}
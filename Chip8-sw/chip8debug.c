@@ -0,0 +1,140 @@
+/*
+ * Breakpoints and watchpoints for the software core, see chip8debug.h
+ */
+
+#include <string.h>
+
+#include "chip8debug.h"
+
+void chip8debug_init(struct chip8_debug *d) {
+	memset(d, 0, sizeof(*d));
+}
+
+void chip8debug_break(struct chip8_debug *d, unsigned int addr, int set) {
+	addr &= 0xfff;
+	if (set)
+		d->breakpoints[addr >> 6] |= 1ULL << (addr & 63);
+	else
+		d->breakpoints[addr >> 6] &= ~(1ULL << (addr & 63));
+}
+
+void chip8debug_watch(struct chip8_debug *d, unsigned int type, unsigned int addr, unsigned int len,
+		int set) {
+	uint64_t *pages = type == CHIP8DEBUG_READ ? &d->read_pages : &d->write_pages;
+	uint64_t *bytes = type == CHIP8DEBUG_READ ? d->read_bytes : d->write_bytes;
+	unsigned int k, a, page;
+
+	for (k = 0; k < len && k < CHIP8_MEMORY_SIZE; ++k) {
+		a = (addr + k) & 0xfff;
+		page = a >> CHIP8_PAGE_SHIFT;
+		if (set)
+			bytes[page] |= 1ULL << (a & (CHIP8_PAGE_SIZE - 1));
+		else
+			bytes[page] &= ~(1ULL << (a & (CHIP8_PAGE_SIZE - 1)));
+		if (bytes[page])
+			*pages |= 1ULL << page;
+		else
+			*pages &= ~(1ULL << page);
+	}
+}
+
+void chip8debug_register(struct chip8_debug *d, unsigned int x, int match, unsigned int value, int set) {
+	uint16_t bit = 1 << (x & 0xf);
+
+	if (match) {
+		d->reg_value[x & 0xf] = value;
+		d->reg_match = set ? d->reg_match | bit : d->reg_match & ~bit;
+	} else {
+		d->reg_change = set ? d->reg_change | bit : d->reg_change & ~bit;
+	}
+}
+
+static void stop(struct chip8_debug *d, unsigned int type, uint16_t pc, unsigned int addr,
+		uint8_t value, uint8_t old) {
+	d->hit.type = type;
+	d->hit.pc = pc;
+	d->hit.addr = addr;
+	d->hit.value = value;
+	d->hit.old = old;
+	d->stopped = 1;
+	d->hits++;
+}
+
+/* The memory an instruction reads or writes from I, CHIP8DEBUG_NONE for none */
+static unsigned int memory_access(const struct chip8_core *c, uint16_t op, unsigned int *len) {
+	unsigned int x = (op >> 8) & 0xf;
+
+	if ((op & 0xf000) == 0xd000) {
+		*len = op & 0xf;
+		return CHIP8DEBUG_READ;
+	}
+	switch (op & 0xf0ff) {
+	case 0xf065: *len = x + 1; return CHIP8DEBUG_READ;
+	case 0xf055: *len = x + 1; return CHIP8DEBUG_WRITE;
+	case 0xf033: *len = 3; return CHIP8DEBUG_WRITE;
+	default: return CHIP8DEBUG_NONE;
+	}
+}
+
+int chip8debug_step(struct chip8_core *c) {
+	struct chip8_debug *d = c->debug;
+	uint16_t pc = c->pc, op = chip8core_fetch(c, pc);
+	unsigned int type = CHIP8DEBUG_NONE, addr = c->i, len = 0, k;
+	uint8_t before[CHIP8_NUM_REGISTERS];
+	int result;
+
+	if (chip8debug_is_break(d, pc) && !(d->resume && d->resume_pc == pc)) {
+		d->resume = 1;
+		d->resume_pc = pc;
+		stop(d, CHIP8DEBUG_BREAK, pc, pc, 0, 0);
+		return CHIP8_STEP_BREAK;
+	}
+
+	if (d->read_pages | d->write_pages)
+		type = memory_access(c, op, &len);
+	if (d->reg_change | d->reg_match)
+		memcpy(before, c->v, sizeof(before));
+
+	result = chip8core_step(c);
+	/* Fx0A waiting stays at the breakpoint it may have been resumed from */
+	if (result == CHIP8_STEP_HALTED)
+		return result;
+	d->resume = 0;
+
+	if (type != CHIP8DEBUG_NONE) {
+		uint64_t pages = type == CHIP8DEBUG_READ ? d->read_pages : d->write_pages;
+		const uint64_t *bytes = type == CHIP8DEBUG_READ ? d->read_bytes : d->write_bytes;
+
+		for (k = 0; k < len; ++k) {
+			unsigned int a = (addr + k) & 0xfff;
+
+			if (chip8debug_watched(pages, bytes, a)) {
+				stop(d, type, pc, a, c->mem[a], 0);
+				return result;
+			}
+		}
+	}
+
+	if (d->reg_change | d->reg_match) {
+		for (k = 0; k < CHIP8_NUM_REGISTERS; ++k) {
+			if (c->v[k] == before[k])
+				continue;
+			if (((d->reg_change >> k) & 1) ||
+					(((d->reg_match >> k) & 1) && c->v[k] == d->reg_value[k])) {
+				stop(d, CHIP8DEBUG_REGISTER, pc, k, c->v[k], before[k]);
+				break;
+			}
+		}
+	}
+	return result;
+}
+
+const char *chip8debug_type_name(unsigned int type) {
+	switch (type) {
+	case CHIP8DEBUG_BREAK: return "breakpoint";
+	case CHIP8DEBUG_READ: return "read";
+	case CHIP8DEBUG_WRITE: return "write";
+	case CHIP8DEBUG_REGISTER: return "register";
+	default: return "none";
+	}
+}
@@ -0,0 +1,94 @@
+#ifndef __CHIP8_DEBUG_H__
+#define __CHIP8_DEBUG_H__
+
+#include <stdint.h>
+#include "chip8core.h"
+
+/*
+* Breakpoints, memory watchpoints and register conditions for the software core
+*
+* chip8core_step is left as it is; chip8debug_step wraps it for a core with
+* a chip8_debug attached. chip8model_run is built twice from one inline
+* loop, with and without the debug step, and picks one per call, so a model
+* without a debugger runs exactly the loop it did before.
+*
+* Breakpoints stop before the instruction at their address runs. Watches
+* stop after an instruction that read or wrote a watched byte: Dxyn and
+* Fx65 read from I, Fx33 and Fx55 write from I; instruction fetches do not
+* count. Register conditions stop after an instruction that changed a
+* watched Vx, or changed it to a given value. Addresses are checked against
+* a bitmap of 64 byte pages first and a bitmap of bytes second, so the
+* cost of a check does not grow with the number of watches.
+*
+* The model pauses on a stop, as if PAUSED_STATE had been written, and the
+* host inspects it through the usual registers. Starting it again carries
+* on past the breakpoint it stopped at.
+*/
+
+/* What stopped the core, see chip8debug_step */
+#define CHIP8DEBUG_NONE     0
+#define CHIP8DEBUG_BREAK    1
+#define CHIP8DEBUG_READ     2
+#define CHIP8DEBUG_WRITE    3
+#define CHIP8DEBUG_REGISTER 4
+
+/* Result of chip8debug_step for a breakpoint, besides CHIP8_STEP_OK and _HALTED */
+#define CHIP8_STEP_BREAK 2
+
+struct chip8debug_hit {
+	unsigned int type;
+	uint16_t pc;            //Of the instruction that hit, or the breakpoint
+	uint16_t addr;          //Memory address, or register number
+	uint8_t value;          //Read, written, or the register's new value
+	uint8_t old;            //Register's value before
+};
+
+struct chip8_debug {
+	uint64_t breakpoints[CHIP8_MEMORY_SIZE / 64];   //Bit per address
+	uint64_t read_pages;                            //Bit n: a byte in page n is watched
+	uint64_t write_pages;
+	uint64_t read_bytes[CHIP8_NUM_PAGES];           //Bit per byte of each page
+	uint64_t write_bytes[CHIP8_NUM_PAGES];
+	uint16_t reg_change;                            //Vx stops when it changes
+	uint16_t reg_match;                             //Vx stops when equal to reg_value[x]
+	uint8_t reg_value[CHIP8_NUM_REGISTERS];
+
+	uint16_t resume_pc;     //Breakpoint to run past once, after stopping there
+	int resume;
+	int stopped;            //Set by a stop, cleared by whoever pauses on it
+	struct chip8debug_hit hit;
+	uint64_t hits;
+};
+
+/* Nothing set */
+void chip8debug_init(struct chip8_debug *d);
+
+void chip8debug_break(struct chip8_debug *d, unsigned int addr, int set);
+/* Watches len bytes from addr for reads (type CHIP8DEBUG_READ) or writes */
+void chip8debug_watch(struct chip8_debug *d, unsigned int type, unsigned int addr, unsigned int len,
+		int set);
+/* Stops when Vx changes, or with match when it changes to value */
+void chip8debug_register(struct chip8_debug *d, unsigned int x, int match, unsigned int value, int set);
+
+/*
+* Steps a core with c->debug set. A breakpoint at the PC returns
+* CHIP8_STEP_BREAK without running anything; the next call runs it. A watch
+* or register condition runs the instruction and returns as chip8core_step
+* would. Either way d->stopped is set and d->hit says why.
+*/
+int chip8debug_step(struct chip8_core *c);
+
+static inline int chip8debug_is_break(const struct chip8_debug *d, unsigned int addr) {
+	addr &= 0xfff;
+	return (d->breakpoints[addr >> 6] >> (addr & 63)) & 1;
+}
+
+static inline int chip8debug_watched(uint64_t pages, const uint64_t *bytes, unsigned int addr) {
+	addr &= 0xfff;
+	return ((pages >> (addr >> CHIP8_PAGE_SHIFT)) & 1) &&
+		((bytes[addr >> CHIP8_PAGE_SHIFT] >> (addr & (CHIP8_PAGE_SIZE - 1))) & 1);
+}
+
+const char *chip8debug_type_name(unsigned int type);
+
+#endif //__CHIP8_DEBUG_H__
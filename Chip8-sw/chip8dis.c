@@ -0,0 +1,506 @@
+/*
+ * Static disassembly and basic block index of a ROM
+ *
+ * chip8dis list [-r rom]
+ *     Disassembles the code reachable from 0x200 block by block, with the
+ *     successors and flags of each block
+ * chip8dis index <index> [-r rom]
+ *     Writes the block index of a ROM, see chip8blocks.h
+ * chip8dis lookup <index> <pc>...
+ *     Maps an index and prints the block each PC is in
+ * chip8dis bench [-n repeat] [-c count] [rom|dir]...
+ *     Analyzes every .ch8 given or found in the directories, or Pong and
+ *     count generated ROMs, repeat times, and prints the time per ROM and
+ *     the time per lookup in a mapped index
+ * chip8dis test [-r rom]
+ *     Checks blocks, successors and flags of a built-in ROM, and that an
+ *     index written and mapped again finds the same block for every address
+ *
+ * Columbia University
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <time.h>
+
+#include "chip8blocks.h"
+#include "chip8disasm.h"
+#include "chip8state.h"
+#include "chip8test.h"
+
+#define DEFAULT_ROM "../test/Pong.ch8"
+#define TEST_INDEX "chip8dis-test.c8bi"
+#define BENCH_INDEX "chip8dis-bench.c8bi"
+#define MAX_CORPUS 4096
+#define BENCH_LOOKUPS 10000000
+
+static const char *flag_names[] = {
+	"entry", "subroutine", "returns", "indirect", "invalid", "stores",
+	"unknown-store", "self-modifying", "modified",
+};
+
+/*
+* Covers every flag:
+*   200 LD I,20E  LD V0,12  CALL 216
+*   206 SE V0,0                         return site, skips
+*   208 JP V0,300                       indirect
+*   20A JP 20C
+*   20C LD V1,K                         waits
+*   20E ADD V1,1  ADD I,V1  LD B,V1     I unknown, overwritten by the call
+*   214 JP 200
+*   216 LD [I],V0                       I is 20E from the caller
+*   218 LD I,300  LD B,V2  RET          a store outside code
+*   21E JP 222                          not reached
+*   220 1234
+*/
+static const uint8_t test_rom[] = {
+	0xA2, 0x0E, 0x60, 0x12, 0x22, 0x16,
+	0x30, 0x00,
+	0xB3, 0x00,
+	0x12, 0x0C,
+	0xF1, 0x0A,
+	0x71, 0x01, 0xF1, 0x1E, 0xF1, 0x33,
+	0x12, 0x00,
+	0xF0, 0x55,
+	0xA3, 0x00, 0xF2, 0x33, 0x00, 0xEE,
+	0x12, 0x22,
+	0x12, 0x34,
+};
+
+static struct chip8_blocks blocks;
+
+static double seconds() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void usage() {
+	fprintf(stderr,
+		"Usage: chip8dis list [-r rom]\n"
+		"       chip8dis index <index> [-r rom]\n"
+		"       chip8dis lookup <index> <pc>...\n"
+		"       chip8dis bench [-n repeat] [-c count] [rom|dir]...\n"
+		"       chip8dis test [-r rom]\n");
+	exit(1);
+}
+
+static uint16_t fetch(const uint8_t *mem, unsigned int addr) {
+	return (mem[addr & 0xfff] << 8) | mem[(addr + 1) & 0xfff];
+}
+
+static void print_flags(unsigned int flags) {
+	unsigned int k;
+
+	for (k = 0; k < sizeof(flag_names) / sizeof(flag_names[0]); ++k)
+		if (flags & (1 << k))
+			printf(" %s", flag_names[k]);
+}
+
+static void print_block(unsigned int n, const struct chip8_block *blk) {
+	unsigned int k;
+
+	printf("block %u 0x%03x-0x%03x, %u instruction%s ->", n, blk->start, blk->end,
+		blk->count, blk->count == 1 ? "" : "s");
+	for (k = 0; k < 2; ++k)
+		if (blk->succ[k] != CHIP8_NO_SUCC)
+			printf(" 0x%03x%s", blk->succ[k], blk->flags & CHIP8_BLOCK_INDIRECT ? "+V0" : "");
+	if (blk->succ[0] == CHIP8_NO_SUCC)
+		printf(" none");
+	print_flags(blk->flags);
+	printf("\n");
+}
+
+static void print_summary(const struct chip8_blocks *b, size_t rom_len) {
+	printf("%u blocks, %u instructions, %zu of %zu ROM bytes not reached\n", b->count,
+		b->instructions, b->instructions * 2 < rom_len ? rom_len - b->instructions * 2 : 0,
+		rom_len);
+}
+
+/* Builds the memory image of a ROM file, returns its length or -1 */
+static long load_rom(const char *rom, uint8_t image[CHIP8_MEMORY_SIZE]) {
+	uint8_t buf[CHIP8_MEMORY_SIZE - CHIP8_PROGRAM_START];
+	size_t len;
+	FILE *f;
+
+	if ((f = fopen(rom, "rb")) == NULL) {
+		perror(rom);
+		return -1;
+	}
+	len = fread(buf, 1, sizeof(buf), f);
+	fclose(f);
+	chip8state_rom_image(image, buf, len);
+	return len;
+}
+
+static int list(int argc, char **argv) {
+	const char *rom = DEFAULT_ROM;
+	uint8_t image[CHIP8_MEMORY_SIZE];
+	unsigned int n, k;
+	long len;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "r:")) != -1) {
+		switch (opt) {
+		case 'r': rom = optarg; break;
+		default: usage();
+		}
+	}
+
+	if ((len = load_rom(rom, image)) < 0)
+		return 1;
+	chip8blocks_analyze(&blocks, image, CHIP8_PROGRAM_START);
+	for (n = 0; n < blocks.count; ++n) {
+		const struct chip8_block *blk = &blocks.block[n];
+
+		print_block(n, blk);
+		for (k = 0; k < blk->count; ++k) {
+			unsigned int addr = (blk->start + 2 * k) & 0xfff;
+			char text[32];
+
+			chip8disasm(fetch(image, addr), text, sizeof(text));
+			printf("  0x%03x  %04x  %s\n", addr, fetch(image, addr), text);
+		}
+	}
+	print_summary(&blocks, len);
+	return 0;
+}
+
+static int index_rom(const char *path, int argc, char **argv) {
+	const char *rom = DEFAULT_ROM;
+	uint8_t image[CHIP8_MEMORY_SIZE];
+	long len;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "r:")) != -1) {
+		switch (opt) {
+		case 'r': rom = optarg; break;
+		default: usage();
+		}
+	}
+
+	if ((len = load_rom(rom, image)) < 0)
+		return 1;
+	chip8blocks_analyze(&blocks, image, CHIP8_PROGRAM_START);
+	if (chip8blocks_save(&blocks, path, chip8state_hash(image, CHIP8_MEMORY_SIZE))) {
+		perror(path);
+		return 1;
+	}
+	print_summary(&blocks, len);
+	printf("flags:");
+	print_flags(blocks.flags);
+	printf("\n%s: %zu bytes\n", path, CHIP8BLOCKS_HEADER_SIZE + sizeof(blocks.lookup) +
+		blocks.count * sizeof(blocks.block[0]));
+	return 0;
+}
+
+static int lookup(const char *path, int argc, char **argv) {
+	struct chip8blocks_map map;
+	int k;
+
+	if (argc < 2)
+		usage();
+	if (chip8blocks_map(&map, path)) {
+		fprintf(stderr, "%s: not a block index\n", path);
+		return 1;
+	}
+	printf("ROM image %08x, entry 0x%03x, %u blocks\n", map.h->rom_hash, map.h->entry,
+		map.h->count);
+	for (k = 1; k < argc; ++k) {
+		unsigned int pc = strtoul(argv[k], NULL, 16) & 0xfff;
+		const struct chip8_block *blk = chip8blocks_find(&map, pc);
+
+		printf("0x%03x: ", pc);
+		if (blk == NULL)
+			printf("not code\n");
+		else
+			print_block(blk - map.block, blk);
+	}
+	chip8blocks_unmap(&map);
+	return 0;
+}
+
+static uint32_t next_random(uint32_t *state) {
+	*state ^= *state << 13;
+	*state ^= *state >> 17;
+	*state ^= *state << 5;
+	return *state;
+}
+
+/*
+* A ROM that looks like a game to the analyzer: mostly arithmetic and
+* loads, with skips, jumps and calls to even addresses inside the ROM,
+* returns, stores and the odd word that does not decode
+*/
+static void generate(uint8_t *rom, size_t len, uint32_t *seed) {
+	size_t k;
+
+	for (k = 0; k + 1 < len; k += 2) {
+		unsigned int r = next_random(seed);
+		unsigned int target = CHIP8_PROGRAM_START + ((r >> 8) % (len / 2)) * 2;
+		unsigned int reg = (r >> 20) & 0xf, pick = r % 100;
+		uint16_t instruction;
+
+		if (pick < 30)
+			instruction = 0x6000 | (reg << 8) | ((r >> 24) & 0xff);
+		else if (pick < 45)
+			instruction = 0x8000 | (reg << 8) | (((r >> 24) & 0xf) << 4) | ((r >> 28) & 0x7);
+		else if (pick < 53)
+			instruction = 0x7000 | (reg << 8) | ((r >> 24) & 0xff);
+		else if (pick < 60)
+			instruction = 0xA000 | target;
+		else if (pick < 66)
+			instruction = 0xF000 | (reg << 8) | ((r & 0x100) ? 0x55 : 0x33);
+		else if (pick < 68)
+			instruction = 0xF01E | (reg << 8);
+		else if (pick < 78)
+			instruction = 0x3000 | (reg << 8) | ((r >> 24) & 0xff);
+		else if (pick < 84)
+			instruction = 0x1000 | target;
+		else if (pick < 89)
+			instruction = 0x2000 | target;
+		else if (pick < 93)
+			instruction = 0x00EE;
+		else if (pick < 97)
+			instruction = 0xD000 | (reg << 8) | ((r >> 24) & 0xff);
+		else if (pick < 98)
+			instruction = 0xB000 | target;
+		else
+			instruction = r >> 16;
+		rom[k] = instruction >> 8;
+		rom[k + 1] = instruction & 0xff;
+	}
+}
+
+struct corpus {
+	uint8_t (*image)[CHIP8_MEMORY_SIZE];
+	size_t *len;
+	int count;
+};
+
+static void add_image(struct corpus *c, const uint8_t *rom, size_t len) {
+	if (c->count >= MAX_CORPUS)
+		return;
+	chip8state_rom_image(c->image[c->count], rom, len);
+	c->len[c->count++] = len;
+}
+
+static void add_path(struct corpus *c, const char *path) {
+	uint8_t buf[CHIP8_MEMORY_SIZE - CHIP8_PROGRAM_START];
+	struct dirent *e;
+	DIR *d;
+	FILE *f;
+	size_t len;
+
+	if ((d = opendir(path)) != NULL) {
+		while ((e = readdir(d)) != NULL) {
+			char name[4096];
+			size_t n = strlen(e->d_name);
+
+			if (n < 4 || strcmp(e->d_name + n - 4, ".ch8") != 0)
+				continue;
+			snprintf(name, sizeof(name), "%s/%s", path, e->d_name);
+			add_path(c, name);
+		}
+		closedir(d);
+		return;
+	}
+
+	if ((f = fopen(path, "rb")) == NULL) {
+		perror(path);
+		return;
+	}
+	len = fread(buf, 1, sizeof(buf), f);
+	fclose(f);
+	add_image(c, buf, len);
+}
+
+static int bench(int argc, char **argv) {
+	static uint8_t image[MAX_CORPUS][CHIP8_MEMORY_SIZE];
+	static size_t lens[MAX_CORPUS];
+	struct corpus c = { image, lens, 0 };
+	uint8_t rom[CHIP8_MEMORY_SIZE - CHIP8_PROGRAM_START];
+	unsigned long long total_blocks = 0, total_bytes = 0, found = 0;
+	int repeat = 10, count = 1000, n, k, opt;
+	struct chip8blocks_map map;
+	double t, worst = 0, all = 0;
+	uint32_t seed = 0x2545F491;
+
+	while ((opt = getopt(argc, argv, "n:c:")) != -1) {
+		switch (opt) {
+		case 'n': repeat = atoi(optarg); break;
+		case 'c': count = atoi(optarg); break;
+		default: usage();
+		}
+	}
+
+	for (k = optind; k < argc; ++k)
+		add_path(&c, argv[k]);
+	if (optind == argc) {
+		add_path(&c, DEFAULT_ROM);
+		for (k = 0; k < count; ++k) {
+			size_t len = 64 + (next_random(&seed) % (sizeof(rom) - 64));
+
+			generate(rom, len, &seed);
+			add_image(&c, rom, len);
+		}
+	}
+	if (c.count == 0 || repeat < 1)
+		usage();
+
+	for (k = 0; k < c.count; ++k) {
+		double best = 0;
+
+		for (n = 0; n < repeat; ++n) {
+			t = seconds();
+			chip8blocks_analyze(&blocks, c.image[k], CHIP8_PROGRAM_START);
+			t = seconds() - t;
+			if (n == 0 || t < best)
+				best = t;
+			all += t;
+		}
+		if (best > worst)
+			worst = best;
+		total_blocks += blocks.count;
+		total_bytes += c.len[k];
+	}
+
+	printf("%d ROMs, %llu bytes, %llu blocks, analyzed %d times each\n", c.count, total_bytes,
+		total_blocks, repeat);
+	printf("%.1f us per ROM on average, %.1f us for the slowest, %.1f MB/s\n",
+		1e6 * all / repeat / c.count, 1e6 * worst,
+		all > 0 ? total_bytes * (double) repeat / all / 1e6 : 0);
+
+	/* Lookups of every address in turn in the index of the last ROM */
+	if (chip8blocks_save(&blocks, BENCH_INDEX, 0) || chip8blocks_map(&map, BENCH_INDEX)) {
+		perror(BENCH_INDEX);
+		return 1;
+	}
+	t = seconds();
+	for (k = 0; k < BENCH_LOOKUPS; ++k)
+		found += chip8blocks_find(&map, k * 2) != NULL;
+	t = seconds() - t;
+	printf("%d lookups in a mapped index in %.3f s, %.1f ns each (%llu in code)\n",
+		BENCH_LOOKUPS, t, 1e9 * t / BENCH_LOOKUPS, found);
+	chip8blocks_unmap(&map);
+	unlink(BENCH_INDEX);
+	return 0;
+}
+
+/* start, end, successors, flags of every block of test_rom */
+static const struct chip8_block expected[] = {
+	{ 0x200, 0x204, { 0x216, 0x206 }, CHIP8_BLOCK_ENTRY, 3 },
+	{ 0x206, 0x206, { 0x208, 0x20A }, 0, 1 },
+	{ 0x208, 0x208, { 0x300, CHIP8_NO_SUCC }, CHIP8_BLOCK_INDIRECT, 1 },
+	{ 0x20A, 0x20A, { 0x20C, CHIP8_NO_SUCC }, 0, 1 },
+	{ 0x20C, 0x20C, { 0x20E, CHIP8_NO_SUCC }, 0, 1 },
+	{ 0x20E, 0x214, { 0x200, CHIP8_NO_SUCC },
+		CHIP8_BLOCK_UNKNOWN_STORE | CHIP8_BLOCK_MODIFIED, 4 },
+	{ 0x216, 0x21C, { CHIP8_NO_SUCC, CHIP8_NO_SUCC }, CHIP8_BLOCK_SUBROUTINE |
+		CHIP8_BLOCK_RETURNS | CHIP8_BLOCK_STORES | CHIP8_BLOCK_SELF_MODIFYING, 4 },
+};
+
+/* The mapped index must agree with the analysis at every address */
+static int round_trip(const struct chip8_blocks *b, uint32_t hash) {
+	struct chip8blocks_map map;
+	unsigned int pc;
+	int errors = 0;
+
+	if (chip8blocks_save(b, TEST_INDEX, hash) || chip8blocks_map(&map, TEST_INDEX)) {
+		printf("index could not be written and mapped\n");
+		return 1;
+	}
+	errors += chip8test_check_hex("index hash", map.h->rom_hash, hash);
+	errors += chip8test_check_hex("index blocks", map.h->count, b->count);
+	for (pc = 0; pc < CHIP8_MEMORY_SIZE; ++pc) {
+		const struct chip8_block *x = chip8blocks_block(b, pc), *y = chip8blocks_find(&map, pc);
+
+		if ((x == NULL) != (y == NULL) || (x != NULL && memcmp(x, y, sizeof(*x)) != 0)) {
+			printf("index differs at 0x%03x\n", pc);
+			errors++;
+			break;
+		}
+	}
+	chip8blocks_unmap(&map);
+
+	/* A truncated index is refused */
+	if (truncate(TEST_INDEX, CHIP8BLOCKS_HEADER_SIZE + sizeof(b->lookup) + 6) == 0)
+		errors += chip8test_check_hex("truncated index maps", chip8blocks_map(&map, TEST_INDEX), -1);
+	unlink(TEST_INDEX);
+	return errors;
+}
+
+static int test(int argc, char **argv) {
+	const char *rom = DEFAULT_ROM;
+	uint8_t image[CHIP8_MEMORY_SIZE];
+	unsigned int n, k;
+	int errors = 0, opt;
+	long len;
+
+	while ((opt = getopt(argc, argv, "r:")) != -1) {
+		switch (opt) {
+		case 'r': rom = optarg; break;
+		default: usage();
+		}
+	}
+
+	chip8state_rom_image(image, test_rom, sizeof(test_rom));
+	chip8blocks_analyze(&blocks, image, CHIP8_PROGRAM_START);
+	for (n = 0; n < blocks.count; ++n)
+		print_block(n, &blocks.block[n]);
+	errors += chip8test_check_hex("blocks", blocks.count, sizeof(expected) / sizeof(expected[0]));
+	for (n = 0; n < blocks.count && n < sizeof(expected) / sizeof(expected[0]); ++n) {
+		const struct chip8_block *got = &blocks.block[n], *want = &expected[n];
+		char what[32];
+
+		snprintf(what, sizeof(what), "block %u start", n);
+		errors += chip8test_check_hex(what, got->start, want->start);
+		snprintf(what, sizeof(what), "block %u end", n);
+		errors += chip8test_check_hex(what, got->end, want->end);
+		snprintf(what, sizeof(what), "block %u count", n);
+		errors += chip8test_check_hex(what, got->count, want->count);
+		snprintf(what, sizeof(what), "block %u flags", n);
+		errors += chip8test_check_hex(what, got->flags, want->flags);
+		for (k = 0; k < 2; ++k) {
+			snprintf(what, sizeof(what), "block %u successor %u", n, k);
+			errors += chip8test_check_hex(what, got->succ[k], want->succ[k]);
+		}
+	}
+	errors += chip8test_check_hex("not reached", chip8blocks_block(&blocks, 0x21E) == NULL, 1);
+	errors += chip8test_check_hex("low byte", chip8blocks_block(&blocks, 0x201) == NULL, 1);
+	errors += chip8test_check_hex("lookup", chip8blocks_block(&blocks, 0x212) - blocks.block, 5);
+	errors += round_trip(&blocks, chip8state_hash(image, CHIP8_MEMORY_SIZE));
+
+	/* A real game: every block reached, none running into data */
+	if ((len = load_rom(rom, image)) < 0)
+		return 1;
+	chip8blocks_analyze(&blocks, image, CHIP8_PROGRAM_START);
+	print_summary(&blocks, len);
+	errors += chip8test_check_hex("blocks in a game", blocks.count > 10, 1);
+	errors += chip8test_check_hex("game runs into data", blocks.flags & CHIP8_BLOCK_INVALID, 0);
+	errors += round_trip(&blocks, chip8state_hash(image, CHIP8_MEMORY_SIZE));
+
+	return chip8test_report(errors);
+}
+
+int main(int argc, char **argv) {
+	if (argc < 2)
+		usage();
+
+	if (strcmp(argv[1], "list") == 0)
+		return list(argc - 1, argv + 1);
+	if (strcmp(argv[1], "index") == 0 && argc >= 3)
+		return index_rom(argv[2], argc - 2, argv + 2);
+	if (strcmp(argv[1], "lookup") == 0 && argc >= 3)
+		return lookup(argv[2], argc - 2, argv + 2);
+	if (strcmp(argv[1], "bench") == 0)
+		return bench(argc - 1, argv + 1);
+	if (strcmp(argv[1], "test") == 0)
+		return test(argc - 1, argv + 1);
+
+	usage();
+	return 1;
+}
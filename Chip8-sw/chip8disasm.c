@@ -0,0 +1,112 @@
+/*
+ * Chip8 disassembler, see chip8disasm.h
+ */
+
+#include <stdio.h>
+
+#include "chip8disasm.h"
+
+int chip8disasm(uint16_t instruction, char *buf, size_t len) {
+	unsigned int x = (instruction >> 8) & 0xf;
+	unsigned int y = (instruction >> 4) & 0xf;
+	unsigned int n = instruction & 0xf;
+	unsigned int kk = instruction & 0xff;
+	unsigned int nnn = instruction & 0xfff;
+
+	switch (instruction >> 12) {
+	case 0x0:
+		if (instruction == 0x00E0) return snprintf(buf, len, "CLS");
+		if (instruction == 0x00EE) return snprintf(buf, len, "RET");
+		return snprintf(buf, len, "SYS 0x%03x", nnn);
+	case 0x1: return snprintf(buf, len, "JP 0x%03x", nnn);
+	case 0x2: return snprintf(buf, len, "CALL 0x%03x", nnn);
+	case 0x3: return snprintf(buf, len, "SE V%X, 0x%02x", x, kk);
+	case 0x4: return snprintf(buf, len, "SNE V%X, 0x%02x", x, kk);
+	case 0x5:
+		if (n == 0) return snprintf(buf, len, "SE V%X, V%X", x, y);
+		break;
+	case 0x6: return snprintf(buf, len, "LD V%X, 0x%02x", x, kk);
+	case 0x7: return snprintf(buf, len, "ADD V%X, 0x%02x", x, kk);
+	case 0x8:
+		switch (n) {
+		case 0x0: return snprintf(buf, len, "LD V%X, V%X", x, y);
+		case 0x1: return snprintf(buf, len, "OR V%X, V%X", x, y);
+		case 0x2: return snprintf(buf, len, "AND V%X, V%X", x, y);
+		case 0x3: return snprintf(buf, len, "XOR V%X, V%X", x, y);
+		case 0x4: return snprintf(buf, len, "ADD V%X, V%X", x, y);
+		case 0x5: return snprintf(buf, len, "SUB V%X, V%X", x, y);
+		case 0x6: return snprintf(buf, len, "SHR V%X", x);
+		case 0x7: return snprintf(buf, len, "SUBN V%X, V%X", x, y);
+		case 0xE: return snprintf(buf, len, "SHL V%X", x);
+		default: break;
+		}
+		break;
+	case 0x9:
+		if (n == 0) return snprintf(buf, len, "SNE V%X, V%X", x, y);
+		break;
+	case 0xA: return snprintf(buf, len, "LD I, 0x%03x", nnn);
+	case 0xB: return snprintf(buf, len, "JP V0, 0x%03x", nnn);
+	case 0xC: return snprintf(buf, len, "RND V%X, 0x%02x", x, kk);
+	case 0xD: return snprintf(buf, len, "DRW V%X, V%X, %u", x, y, n);
+	case 0xE:
+		if (kk == 0x9E) return snprintf(buf, len, "SKP V%X", x);
+		if (kk == 0xA1) return snprintf(buf, len, "SKNP V%X", x);
+		break;
+	case 0xF:
+		switch (kk) {
+		case 0x07: return snprintf(buf, len, "LD V%X, DT", x);
+		case 0x0A: return snprintf(buf, len, "LD V%X, K", x);
+		case 0x15: return snprintf(buf, len, "LD DT, V%X", x);
+		case 0x18: return snprintf(buf, len, "LD ST, V%X", x);
+		case 0x1E: return snprintf(buf, len, "ADD I, V%X", x);
+		case 0x29: return snprintf(buf, len, "LD F, V%X", x);
+		case 0x33: return snprintf(buf, len, "LD B, V%X", x);
+		case 0x55: return snprintf(buf, len, "LD [I], V%X", x);
+		case 0x65: return snprintf(buf, len, "LD V%X, [I]", x);
+		default: break;
+		}
+		break;
+	}
+
+	return snprintf(buf, len, "DW 0x%04x", instruction);
+}
+
+unsigned int chip8disasm_flow(uint16_t instruction) {
+	unsigned int kk = instruction & 0xff;
+
+	switch (instruction >> 12) {
+	case 0x0: return instruction == 0x00EE ? CHIP8_FLOW_RET : 0;
+	case 0x1: return CHIP8_FLOW_JUMP;
+	case 0x2: return CHIP8_FLOW_CALL;
+	case 0x3: return CHIP8_FLOW_SKIP;
+	case 0x4: return CHIP8_FLOW_SKIP;
+	case 0x5: return (instruction & 0xf) == 0 ? CHIP8_FLOW_SKIP : 0;
+	case 0x9: return (instruction & 0xf) == 0 ? CHIP8_FLOW_SKIP : 0;
+	case 0xB: return CHIP8_FLOW_JUMP | CHIP8_FLOW_INDIRECT;
+	case 0xE: return (kk == 0x9E || kk == 0xA1) ? CHIP8_FLOW_SKIP : 0;
+	case 0xF: return kk == 0x0A ? CHIP8_FLOW_WAIT : 0;
+	default: break;
+	}
+	return 0;
+}
+
+int chip8disasm_valid(uint16_t instruction) {
+	unsigned int n = instruction & 0xf;
+	unsigned int kk = instruction & 0xff;
+
+	switch (instruction >> 12) {
+	case 0x5: return n == 0;
+	case 0x8: return n <= 0x7 || n == 0xE;
+	case 0x9: return n == 0;
+	case 0xE: return kk == 0x9E || kk == 0xA1;
+	case 0xF:
+		switch (kk) {
+		case 0x07: case 0x0A: case 0x15: case 0x18: case 0x1E:
+		case 0x29: case 0x33: case 0x55: case 0x65:
+			return 1;
+		default: return 0;
+		}
+	default: break;
+	}
+	return 1;
+}
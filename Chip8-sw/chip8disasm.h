@@ -0,0 +1,37 @@
+#ifndef __CHIP8_DISASM_H__
+#define __CHIP8_DISASM_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+* Chip8 disassembler
+*
+* Mnemonics follow Cowgod's Chip-8 technical reference (LD, ADD, SE, SKP,
+* DRW, ...), with the semantics of Chip8_CPU.sv.
+*/
+
+/* How an instruction affects control flow, see chip8disasm_flow */
+#define CHIP8_FLOW_JUMP  0x01   //1nnn, Bnnn
+#define CHIP8_FLOW_CALL  0x02   //2nnn
+#define CHIP8_FLOW_RET   0x04   //00EE
+#define CHIP8_FLOW_SKIP  0x08   //3xkk, 4xkk, 5xy0, 9xy0, Ex9E, ExA1
+#define CHIP8_FLOW_WAIT  0x10   //Fx0A
+#define CHIP8_FLOW_INDIRECT 0x20 //Bnnn, target depends on V0
+
+/* Any of these ends a basic block */
+#define CHIP8_FLOW_ENDS_BLOCK (CHIP8_FLOW_JUMP | CHIP8_FLOW_CALL | CHIP8_FLOW_RET | \
+		CHIP8_FLOW_SKIP | CHIP8_FLOW_WAIT)
+
+/*
+* Writes the mnemonic for an instruction into buf, "DW 0xNNNN" for words
+* that do not decode. Returns the length like snprintf.
+*/
+int chip8disasm(uint16_t instruction, char *buf, size_t len);
+
+unsigned int chip8disasm_flow(uint16_t instruction);
+
+/* 1 if the instruction decodes, 0 for the words chip8disasm prints as DW */
+int chip8disasm_valid(uint16_t instruction);
+
+#endif //__CHIP8_DISASM_H__
@@ -31,7 +31,12 @@
 #include <linux/of_address.h>
 #include <linux/fs.h>
 #include <linux/uaccess.h>
+#include <linux/spinlock.h>
+#include <linux/percpu.h>
+#include <linux/debugfs.h>
+#include <linux/ktime.h>
 #include "chip8driver.h"
+#include "chip8stats.h"
 
 #define DRIVER_NAME "vga_led"
 
@@ -41,8 +46,29 @@
 struct chip8_dev {
 	struct resource res;         /* Resource: our registers */
 	void __iomem *virtbase;      /* Where registers can be accessed in memory */
+	spinlock_t class_lock[CHIP8_CLASSES]; /* See chip8_reg_class */
+	struct dentry *debugfs;      /* vga_led/stats and vga_led/reset */
 } dev;
 
+/* Request counters, see chip8stats.h */
+static DEFINE_PER_CPU(struct chip8_stats, chip8_stats);
+
+static void count_op(unsigned int addr, int write, int valid)
+{
+	struct chip8_stats *s = get_cpu_ptr(&chip8_stats);
+
+	chip8stats_op(s, addr, write, valid);
+	put_cpu_ptr(&chip8_stats);
+}
+
+static void count_ioctl(unsigned int type, unsigned int ops, int failed, u64 start)
+{
+	struct chip8_stats *s = get_cpu_ptr(&chip8_stats);
+
+	chip8stats_ioctl(s, type, ops, failed, ktime_get_ns() - start);
+	put_cpu_ptr(&chip8_stats);
+}
+
 /*
  * Writes an opcode (defined in chip8driver.h) to the device
  */
@@ -58,74 +84,99 @@ static int read_value(unsigned int addr) {
 }
 
 /*
-* Checks to see if the address is validly formatted
-*/
-static int isValidInstruction(unsigned int addr, unsigned int instruction, int isWrite) {
-	switch(addr) {
-		//Register instructions are always okay
-		case V0_ADDR: return 1;
-		case V1_ADDR: return 1;
-		case V2_ADDR: return 1;
-		case V3_ADDR: return 1;
-		case V4_ADDR: return 1;
-		case V5_ADDR: return 1;
-		case V6_ADDR: return 1;
-		case V7_ADDR: return 1;
-		case V8_ADDR: return 1;
-		case V9_ADDR: return 1;
-		case VA_ADDR: return 1;
-		case VB_ADDR: return 1;
-		case VC_ADDR: return 1;
-		case VD_ADDR: return 1;
-		case VE_ADDR: return 1;
-		case VF_ADDR: return 1;
-		case I_ADDR:  return 1;
-
-		//Timer instructions are always okay
-		case SOUND_TIMER_ADDR: return 1;
-		case DELAY_TIMER_ADDR: return 1;
-
-		//Stack instructions are only valid if they conform to stack size
-		//Always looks at last three nibbles
-		case STACK_POINTER_ADDR: return !isWrite || (instruction >= 0 && instruction < 64);
-		case STACK_ADDR: 		 return 1;
-
-		//Handle state transition
-		case STATE_ADDR: switch(instruction) {
-			case RUNNING_STATE: return 1;
-			case RUN_INSTRUCTION_STATE: return 1;
-			case PAUSED_STATE: return 1;
-			default: return !isWrite;
-		} 
-
-		//Memory address
-		case MEMORY_ADDR: 
-		//0000_0000_0001_AAAA_AAAA_AAAA_DDDD_DDDD
-		if(isWrite) return 1;
-		else return 2;
-
-		//Program Counter will always look at the last 3 nibbles
-		case PROGRAM_COUNTER_ADDR: return 1;
-
-		//Always considers last nibble
-		case KEY_PRESS_ADDR: return 1;
-
-		//Make sure X, Y, and data values conform
-		//Data value will always be 1 byte
-		case FRAMEBUFFER_ADDR: 
-		//0000_0000_0000_0000_0001_DXXX_XXXY_YYYY
-		if(isWrite) return 1;
-		else 		return 2;
-
-		case INSTRUCTION_ADDR: return 1;
-		case RESET_ADDR : return 1;
-
-		default: break;
+ * Takes the lock guarding the address latch behind a register class,
+ * every latch for CHIP8_CLASS_ALL. The locks share one lockdep class, so
+ * taking them all is annotated as nesting, always in the same order.
+ */
+static void lock_class(int cls)
+{
+	int i;
+
+	if (cls == CHIP8_CLASS_ALL) {
+		for (i = 0; i < CHIP8_CLASSES; ++i)
+			spin_lock_nested(&dev.class_lock[i], i);
+	} else if (cls != CHIP8_CLASS_NONE) {
+		spin_lock(&dev.class_lock[cls]);
 	}
+}
+
+static void unlock_class(int cls)
+{
+	int i;
+
+	if (cls == CHIP8_CLASS_ALL) {
+		for (i = CHIP8_CLASSES - 1; i >= 0; --i)
+			spin_unlock(&dev.class_lock[i]);
+	} else if (cls != CHIP8_CLASS_NONE) {
+		spin_unlock(&dev.class_lock[cls]);
+	}
+}
+
+/*
+ * Performs one request that has already been copied from userspace
+ * The address write and data read of a two-step read happen under the
+ * lock of the register class, so no other access can move the latch
+ * in between
+ */
+static int do_op(chip8_opcode *op, int write)
+{
+	int isWrite, cls;
+
+	isWrite = isValidInstruction(op->addr, op->data, write);
+	count_op(op->addr, write, isWrite != 0);
+	if (isWrite == 0)
+		return -EINVAL;
 
+	cls = chip8_reg_class(op->addr);
+	lock_class(cls);
+
+	if (write || isWrite == 2)
+		write_op(op->addr, op->data);
+	if (!write)
+		op->readdata = read_value(op->addr);
+
+	unlock_class(cls);
 	return 0;
 }
 
+/*
+ * Runs a chip8_batch, copying requests in and out in chunks so a whole
+ * memory or framebuffer dump costs one system call
+ * done is set to the requests handled, up to and including the one the
+ * batch stopped at, and for reads the ones before it are copied back
+ */
+static long do_batch(chip8_batch *batch, unsigned int *done)
+{
+	chip8_opcode ops[32];
+	chip8_opcode __user *uops = (chip8_opcode __user *) batch->ops;
+	unsigned int i, j, n;
+	int ret;
+
+	*done = 0;
+	if (batch->count > CHIP8_BATCH_MAX)
+		return -EINVAL;
+
+	for (i = 0; i < batch->count; i += n) {
+		n = min_t(unsigned int, batch->count - i, ARRAY_SIZE(ops));
+		if (copy_from_user(ops, uops + i, n * sizeof(chip8_opcode)))
+			return -EACCES;
+
+		for (j = 0; j < n; ++j) {
+			ret = do_op(&ops[j], batch->write);
+			*done = i + j + 1;
+			if (ret)
+				break;
+		}
+
+		/* Reads before a failed request still return their data */
+		if (!batch->write && j > 0 && copy_to_user(uops + i, ops, j * sizeof(chip8_opcode)))
+			return -EACCES;
+		if (j < n)
+			return ret;
+	}
+
+	return 0;
+}
 
 /*
  * Handle ioctl() calls from userspace:
@@ -135,40 +186,104 @@ static int isValidInstruction(unsigned int addr, unsigned int instruction, int i
 static long chip8_ioctl(struct file *f, unsigned int cmd, unsigned long arg)
 {
 	chip8_opcode op;
-	int isWrite = 0;
+	chip8_batch batch;
+	u64 start = ktime_get_ns();
+	unsigned int done;
+	long ret;
 
 	switch (cmd) {
 	case CHIP8_WRITE_ATTR:
 		if (copy_from_user(&op, (chip8_opcode *) arg, sizeof(chip8_opcode)))
-			return -EACCES;
-		if (!isValidInstruction(op.addr, op.data, 1))
-			return -EINVAL;
-		write_op(op.addr, op.data);
-		break;
+			ret = -EACCES;
+		else
+			ret = do_op(&op, 1);
+		count_ioctl(CHIP8STATS_WRITE, 1, ret, start);
+		return ret;
 
 	case CHIP8_READ_ATTR:
 		if (copy_from_user(&op, (chip8_opcode *) arg, sizeof(chip8_opcode)))
+			ret = -EACCES;
+		else
+			ret = do_op(&op, 0);
+		if (!ret && copy_to_user((chip8_opcode *) arg, &op, sizeof(chip8_opcode)))
+			ret = -EACCES;
+		count_ioctl(CHIP8STATS_READ, 1, ret, start);
+		return ret;
+
+	case CHIP8_BATCH_ATTR:
+		if (copy_from_user(&batch, (chip8_batch *) arg, sizeof(chip8_batch)))
 			return -EACCES;
-		isWrite = isValidInstruction(op.addr, op.data, 0);
-		if(isWrite == 0)
-			return -EINVAL;
-
-
-		if(isWrite == 2)
-			write_op(op.addr, op.data);
-		
-		op.readdata = read_value(op.addr);
-		if (copy_to_user((chip8_opcode *) arg, &op, sizeof(chip8_opcode)))
-			return -EACCES;
-		break;
+		ret = do_batch(&batch, &done);
+		count_ioctl(CHIP8STATS_BATCH, done, ret, start);
+		return ret;
 
 	default:
-		return -EINVAL;
+		return -ENOTTY;
 	}
+}
 
+/*
+ * debugfs: vga_led/stats sums the counters of every CPU into text when it
+ * is opened, vga_led/reset clears them on any write
+ */
+static int stats_open(struct inode *inode, struct file *f)
+{
+	struct chip8_stats *sum;
+	char *buf;
+	int cpu;
+
+	sum = kzalloc(sizeof(*sum), GFP_KERNEL);
+	buf = kmalloc(CHIP8STATS_TEXT_MAX, GFP_KERNEL);
+	if (sum == NULL || buf == NULL) {
+		kfree(sum);
+		kfree(buf);
+		return -ENOMEM;
+	}
+
+	for_each_possible_cpu(cpu)
+		chip8stats_add(sum, per_cpu_ptr(&chip8_stats, cpu));
+	chip8stats_format(sum, buf, CHIP8STATS_TEXT_MAX);
+	kfree(sum);
+
+	f->private_data = buf;
 	return 0;
 }
 
+static ssize_t stats_read(struct file *f, char __user *ubuf, size_t count, loff_t *ppos)
+{
+	const char *buf = f->private_data;
+
+	return simple_read_from_buffer(ubuf, count, ppos, buf, strlen(buf));
+}
+
+static int stats_release(struct inode *inode, struct file *f)
+{
+	kfree(f->private_data);
+	return 0;
+}
+
+static ssize_t reset_write(struct file *f, const char __user *ubuf, size_t count, loff_t *ppos)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		memset(per_cpu_ptr(&chip8_stats, cpu), 0, sizeof(struct chip8_stats));
+	return count;
+}
+
+static const struct file_operations stats_fops = {
+	.owner		= THIS_MODULE,
+	.open		= stats_open,
+	.read		= stats_read,
+	.release	= stats_release,
+	.llseek		= default_llseek,
+};
+
+static const struct file_operations reset_fops = {
+	.owner		= THIS_MODULE,
+	.write		= reset_write,
+};
+
 /* The operations our device knows how to do */
 static const struct file_operations chip8_fops = {
 	.owner		= THIS_MODULE,
@@ -188,7 +303,10 @@ static struct miscdevice chip8_misc_device = {
  */
 static int __init chip8_probe(struct platform_device *pdev)
 {
-	int ret;
+	int ret, i;
+
+	for (i = 0; i < CHIP8_CLASSES; ++i)
+		spin_lock_init(&dev.class_lock[i]);
 
 	/* Register ourselves as a misc device: creates /dev/chip8 */
 	ret = misc_register(&chip8_misc_device);
@@ -216,6 +334,13 @@ static int __init chip8_probe(struct platform_device *pdev)
 	/* Write paused state to the chip8 device */
 	write_op(STATE_ADDR, PAUSED_STATE);
 
+	/* Counters are only for diagnostics, the device works without them */
+	dev.debugfs = debugfs_create_dir(DRIVER_NAME, NULL);
+	if (!IS_ERR_OR_NULL(dev.debugfs)) {
+		debugfs_create_file("stats", 0444, dev.debugfs, NULL, &stats_fops);
+		debugfs_create_file("reset", 0200, dev.debugfs, NULL, &reset_fops);
+	}
+
 	return 0;
 
 out_release_mem_region:
@@ -228,6 +353,7 @@ out_deregister:
 /* Clean-up code: release resources */
 static int chip8_remove(struct platform_device *pdev)
 {
+	debugfs_remove_recursive(dev.debugfs);
 	iounmap(dev.virtbase);
 	release_mem_region(dev.res.start, resource_size(&dev.res));
 	misc_deregister(&chip8_misc_device);
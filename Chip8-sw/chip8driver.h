@@ -10,11 +10,27 @@ typedef struct {
 	unsigned int readdata;
 } chip8_opcode;
 
+/*
+* A batch of requests handled by a single ioctl
+* Every request is validated and performed in order as if it were passed
+* to CHIP8_WRITE_ATTR (write != 0) or CHIP8_READ_ATTR (write == 0), and for
+* reads readdata is filled in. The batch stops at the first invalid request,
+* the reads before it still have readdata filled in.
+*/
+typedef struct {
+	chip8_opcode *ops;
+	unsigned int count;
+	unsigned int write;
+} chip8_batch;
+
+#define CHIP8_BATCH_MAX 8192
+
 #define CHIP8_MAGIC 'q'
 
 /* ioctls and their arguments */
 #define CHIP8_WRITE_ATTR _IOW(CHIP8_MAGIC, 1, chip8_opcode *)
 #define CHIP8_READ_ATTR  _IOWR(CHIP8_MAGIC, 2, chip8_opcode *)
+#define CHIP8_BATCH_ATTR _IOWR(CHIP8_MAGIC, 3, chip8_batch *)
 
 /*
 * To write data to a particular register, use iowrite with
@@ -72,11 +88,24 @@ typedef struct {
 * To write to the stack pointer
 * NNNNNNDD
 * Where DD is the number to write to the stack pointer
-* Only the last six bits are considered
+* Only values below CHIP8_STACK_DEPTH are accepted
 * 
 * Use ioread to read from the stack pointer
 */
 #define STACK_POINTER_ADDR 0x60
+#define CHIP8_STACK_DEPTH 16
+
+/*
+* To write to an entry on the stack
+* 0000_0000_0001_EEEE_DDDD_DDDD_DDDD_DDDD
+* Where EEEE is the 4-bit index of the entry (0-15)
+* Where DD is the 16-bit return address
+*
+* To read an entry on the stack, use iowrite with
+* 0000_0000_0000_EEEE_NNNN_NNNN_NNNN_NNNN
+* then ioread returns 0000_0000_0000_EEEE_DDDD_DDDD_DDDD_DDDD
+*/
+#define STACK_ENTRY_ADDR 0x70
 
 /*
 * To reset the stack, iowrite
@@ -152,16 +181,17 @@ typedef struct {
 #define MAX_FBY 64
 
 /*
-* In order to write data to the instruction
+* In order to run a single instruction
 * 0000_0000_0000_0000_IIII_IIII_IIII_IIII
 * Where I corresponds to the 16 bits in the instruction
-* The state must currently be in Chip8_RUN_INSTRUCTION
+* The state must currently be in Chip8_RUN_INSTRUCTION, in any other state
+* the instruction is only latched
 *
-* In order to read data from the framebuffer
-* 0000_0000_0000_0000_0000_NXXX_XXXY_YYYY
-* Where XX is the x position (6 bits)
-* Where YY is the y position (5 bits)
-* Where NN is ignored
+* ioread returns
+* SSSS_SSSS_SSSS_SSSS_IIII_IIII_IIII_IIII
+* Where S is the low 16 bits of the CPU stage and I the instruction
+* In Chip8_RUN_INSTRUCTION the stage reads 0 once the instruction written
+* last is done. Reads do not disturb the stage.
 */
 #define INSTRUCTION_ADDR 0x68
 
@@ -170,4 +200,134 @@ typedef struct {
  */
 #define RESET_ADDR 0x6C
 
+/*
+* To select a word of the per-opcode latency histogram
+* 0000_0000_0000_0000_0000_00RC_CCCC_FFFF
+* Where CCCCC is the opcode class and FFFF the field, see chip8latency.h
+* Where R clears every counter
+*
+* ioread then returns the 32-bit word selected by the last iowrite
+*/
+#define LATENCY_HIST_ADDR 0x74
+
+/*
+* To see whether what was drawn is on screen, read only
+* FFFF_FFFF_FFFF_FFFF_0000_0000_0000_00BP
+* Where P is set while the back buffer holds drawing not yet presented,
+* B while the back buffer catches up after a swap, and F counts the
+* vertical blanks since power-on
+*/
+#define FRAMEBUFFER_STATUS_ADDR 0x78
+#define FRAMEBUFFER_STATUS_PENDING 0x1
+#define FRAMEBUFFER_STATUS_BUSY 0x2
+#define FRAMEBUFFER_STATUS_FRAMES(status) (((status) >> 16) & 0xffff)
+
+/*
+* Checks to see if the address is validly formatted
+* Shared by chip8driver.c and the userspace model in chip8model.c
+* Returns 2 for reads that need the request written to the device first
+*/
+static inline int isValidInstruction(unsigned int addr, unsigned int instruction, int isWrite) {
+	switch(addr) {
+		//Register instructions are always okay
+		case V0_ADDR: return 1;
+		case V1_ADDR: return 1;
+		case V2_ADDR: return 1;
+		case V3_ADDR: return 1;
+		case V4_ADDR: return 1;
+		case V5_ADDR: return 1;
+		case V6_ADDR: return 1;
+		case V7_ADDR: return 1;
+		case V8_ADDR: return 1;
+		case V9_ADDR: return 1;
+		case VA_ADDR: return 1;
+		case VB_ADDR: return 1;
+		case VC_ADDR: return 1;
+		case VD_ADDR: return 1;
+		case VE_ADDR: return 1;
+		case VF_ADDR: return 1;
+		case I_ADDR:  return 1;
+
+		//Timer instructions are always okay
+		case SOUND_TIMER_ADDR: return 1;
+		case DELAY_TIMER_ADDR: return 1;
+
+		//Stack instructions are only valid if they conform to stack size
+		case STACK_POINTER_ADDR: return !isWrite || instruction < CHIP8_STACK_DEPTH;
+		case STACK_ADDR: 		 return 1;
+		case STACK_ENTRY_ADDR:
+		if(isWrite) return 1;
+		else return 2;
+
+		//Handle state transition
+		case STATE_ADDR: switch(instruction) {
+			case RUNNING_STATE: return 1;
+			case RUN_INSTRUCTION_STATE: return 1;
+			case PAUSED_STATE: return 1;
+			default: return !isWrite;
+		} 
+
+		//Memory address
+		case MEMORY_ADDR: 
+		//0000_0000_0001_AAAA_AAAA_AAAA_DDDD_DDDD
+		if(isWrite) return 1;
+		else return 2;
+
+		//Program Counter will always look at the last 3 nibbles
+		case PROGRAM_COUNTER_ADDR: return 1;
+
+		//Always considers last nibble
+		case KEY_PRESS_ADDR: return 1;
+
+		//Make sure X, Y, and data values conform
+		//Data value will always be 1 byte
+		case FRAMEBUFFER_ADDR: 
+		//0000_0000_0000_0000_0001_DXXX_XXXY_YYYY
+		if(isWrite) return 1;
+		else 		return 2;
+
+		case INSTRUCTION_ADDR: return 1;
+		case RESET_ADDR : return 1;
+
+		case LATENCY_HIST_ADDR:
+		if(isWrite) return 1;
+		else return 2;
+
+		case FRAMEBUFFER_STATUS_ADDR: return !isWrite;
+
+		default: break;
+	}
+
+	return 0;
+}
+
+/*
+* Register classes for locking
+* MEMORY_ADDR, FRAMEBUFFER_ADDR, STACK_ENTRY_ADDR and LATENCY_HIST_ADDR each
+* latch the address of their last write in Chip8_Top, and a two-step read
+* returns whatever that latch holds. Every access that moves or depends on a
+* latch holds the lock of its class, so two-step reads cannot interleave and
+* reads of different classes never contend. Everything else is a single bus
+* transfer and needs no lock. RESET_ADDR clears every latch and holds all of
+* them, taken in class order.
+*/
+#define CHIP8_CLASS_NONE -1
+#define CHIP8_CLASS_MEMORY 0
+#define CHIP8_CLASS_FRAMEBUFFER 1
+#define CHIP8_CLASS_STACK 2
+#define CHIP8_CLASS_LATENCY 3
+#define CHIP8_CLASSES 4
+#define CHIP8_CLASS_ALL CHIP8_CLASSES
+
+static inline int chip8_reg_class(unsigned int addr) {
+	switch(addr) {
+		case MEMORY_ADDR: return CHIP8_CLASS_MEMORY;
+		case FRAMEBUFFER_ADDR: return CHIP8_CLASS_FRAMEBUFFER;
+		case STACK_ENTRY_ADDR: return CHIP8_CLASS_STACK;
+		case LATENCY_HIST_ADDR: return CHIP8_CLASS_LATENCY;
+		case RESET_ADDR: return CHIP8_CLASS_ALL;
+		default: return CHIP8_CLASS_NONE;
+	}
+}
+
 #endif //__CHIP8_DRIVER_H__
@@ -0,0 +1,1087 @@
+/*
+ * Coverage-guided fuzzer for the software core, cross-checked against a
+ * reference backend
+ *
+ * chip8fuzz run [-j threads] [-t seconds] [-n execs] [-s seed] [-x backend]
+ *               [-c ms] [-o dir]
+ *     Generates and mutates short programs with key events and runs them on
+ *     one model per thread, keeping those that reach new coverage. Every ms
+ *     (1000, 0 for never) the main thread replays the inputs kept since the
+ *     last time on the backend (model, or sim-fast for chip8vfuzz) and
+ *     compares everything the host can read. A divergent input is
+ *     minimized and written to dir as diverge-NNN.ch8 with a listing in
+ *     diverge-NNN.txt. Prints executions per second while running and the
+ *     coverage reached per instruction at the end.
+ * chip8fuzz bench [-j threads] [-t seconds]
+ *     Fuzzes for seconds on 1, 2, 4, ... up to threads threads, round robin
+ *     and best of three, and prints executions per second and the speedup
+ *     over one thread
+ * chip8fuzz test
+ *     Checks that runs are deterministic, that a short run reaches the VF,
+ *     carry and wraparound cases, that threads share the corpus and count
+ *     every execution, that replaying the corpus through chip8io on the
+ *     model finds nothing, and that a planted divergence is minimized down
+ *     to the instructions behind it
+ *
+ * Coverage is a feature per retired instruction: what it is, whether it
+ * left VF alone or set it to 0, 1 or anything else, and which edges it hit
+ * (VF as Vx, x == y, a carry or borrow, I running past 0xFFF, a sprite
+ * wrapping on either axis, the stack wrapping, the PC at the top of
+ * memory), plus a feature per pair of instructions retired back to back.
+ *
+ * Cxkk and Fx07 are never generated. The LFSR behind Cxkk is not reset on
+ * the board and runs on every clock, and the 60 Hz divider is not reset
+ * either, so neither would read back the same on two backends. An input
+ * that runs into one anyway, out of memory it wrote or wrapped around to,
+ * is not cross-checked. Timers are compared to within one tick.
+ *
+ * Columbia University
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "chip8io.h"
+#include "chip8model.h"
+#include "chip8state.h"
+#include "chip8disasm.h"
+#include "chip8test.h"
+
+#ifdef CHIP8_SIM
+#define DEFAULT_BACKEND "sim-fast"
+#else
+#define DEFAULT_BACKEND "model"
+#endif
+
+#define FUZZ_MAX_OPS 24
+#define FUZZ_MAX_KEYS 8
+#define FUZZ_MAX_SLOTS 96
+#define CORPUS_MAX 16384
+
+/* Feature numbering, see execute */
+#define SINGLE_FEATURES (64 << 10)
+#define PAIR_FEATURES (64 * 64)
+#define FEATURES (SINGLE_FEATURES + PAIR_FEATURES)
+#define FEATURE_WORDS (FEATURES / 64)
+
+#define EDGE_VF_DEST    0x01    //Vx is VF
+#define EDGE_SAME_REG   0x02    //x == y
+#define EDGE_CARRY      0x04    //Carry, borrow on equal values, bit shifted out, I past 0xFFF
+#define EDGE_MEM_WRAP   0x08    //Access from I runs past 0xFFF
+#define EDGE_WRAP_X     0x10    //Sprite wraps at the right edge
+#define EDGE_WRAP_Y     0x20    //Sprite wraps at the bottom
+#define EDGE_STACK_WRAP 0x40    //CALL with 16 entries, RET with none
+#define EDGE_PC_WRAP    0x80    //PC at the top of memory or BNNN past it
+
+/* Operand fields of an instruction */
+#define F_X   0x01
+#define F_Y   0x02
+#define F_KK  0x04
+#define F_NNN 0x08
+#define F_N   0x10
+
+enum {
+	K_CLS, K_RET, K_SYS, K_JP, K_CALL, K_SE_KK, K_SNE_KK, K_SE_VV, K_LD_KK, K_ADD_KK,
+	K_LD_VV, K_OR, K_AND, K_XOR, K_ADD_VV, K_SUB, K_SHR, K_SUBN, K_SHL, K_SNE_VV,
+	K_LD_I, K_JP_V0, K_RND, K_DRW, K_SKP, K_SKNP, K_LD_DT_READ, K_LD_K, K_LD_DT, K_LD_ST,
+	K_ADD_I, K_LD_F, K_LD_B, K_STORE, K_LOAD, K_INVALID, KINDS
+};
+
+struct kind {
+	const char *name;
+	uint16_t mask;
+	uint16_t match;
+	unsigned int fields;
+	int fuzzed;
+};
+
+/* First match wins */
+static const struct kind kinds[KINDS] = {
+	{ "CLS",           0xFFFF, 0x00E0, 0,                  1 },
+	{ "RET",           0xFFFF, 0x00EE, 0,                  1 },
+	{ "SYS",           0xF000, 0x0000, F_NNN,              0 },
+	{ "JP",            0xF000, 0x1000, F_NNN,              1 },
+	{ "CALL",          0xF000, 0x2000, F_NNN,              1 },
+	{ "SE Vx,kk",      0xF000, 0x3000, F_X | F_KK,         1 },
+	{ "SNE Vx,kk",     0xF000, 0x4000, F_X | F_KK,         1 },
+	{ "SE Vx,Vy",      0xF00F, 0x5000, F_X | F_Y,          1 },
+	{ "LD Vx,kk",      0xF000, 0x6000, F_X | F_KK,         1 },
+	{ "ADD Vx,kk",     0xF000, 0x7000, F_X | F_KK,         1 },
+	{ "LD Vx,Vy",      0xF00F, 0x8000, F_X | F_Y,          1 },
+	{ "OR",            0xF00F, 0x8001, F_X | F_Y,          1 },
+	{ "AND",           0xF00F, 0x8002, F_X | F_Y,          1 },
+	{ "XOR",           0xF00F, 0x8003, F_X | F_Y,          1 },
+	{ "ADD Vx,Vy",     0xF00F, 0x8004, F_X | F_Y,          1 },
+	{ "SUB",           0xF00F, 0x8005, F_X | F_Y,          1 },
+	{ "SHR",           0xF00F, 0x8006, F_X | F_Y,          1 },
+	{ "SUBN",          0xF00F, 0x8007, F_X | F_Y,          1 },
+	{ "SHL",           0xF00F, 0x800E, F_X | F_Y,          1 },
+	{ "SNE Vx,Vy",     0xF00F, 0x9000, F_X | F_Y,          1 },
+	{ "LD I",          0xF000, 0xA000, F_NNN,              1 },
+	{ "JP V0",         0xF000, 0xB000, F_NNN,              1 },
+	{ "RND",           0xF000, 0xC000, F_X | F_KK,         0 },
+	{ "DRW",           0xF000, 0xD000, F_X | F_Y | F_N,    1 },
+	{ "SKP",           0xF0FF, 0xE09E, F_X,                1 },
+	{ "SKNP",          0xF0FF, 0xE0A1, F_X,                1 },
+	{ "LD Vx,DT",      0xF0FF, 0xF007, F_X,                0 },
+	{ "LD Vx,K",       0xF0FF, 0xF00A, F_X,                1 },
+	{ "LD DT",         0xF0FF, 0xF015, F_X,                1 },
+	{ "LD ST",         0xF0FF, 0xF018, F_X,                1 },
+	{ "ADD I",         0xF0FF, 0xF01E, F_X,                1 },
+	{ "LD F",          0xF0FF, 0xF029, F_X,                1 },
+	{ "LD B",          0xF0FF, 0xF033, F_X,                1 },
+	{ "LD [I]",        0xF0FF, 0xF055, F_X,                1 },
+	{ "LD Vx,[I]",     0xF0FF, 0xF065, F_X,                1 },
+	{ "invalid",       0x0000, 0x0000, 0,                  0 },
+};
+
+static const uint8_t interesting_kk[] = { 0x00, 0x01, 0x7F, 0x80, 0xFE, 0xFF };
+static const uint16_t interesting_nnn[] = { 0xFFE, 0xFFC, 0x000, 0x1FE };
+
+struct fuzz_key {
+	uint16_t slot;          //Written before this slot runs
+	uint8_t key;
+	uint8_t pressed;
+};
+
+struct fuzz_input {
+	uint16_t ops[FUZZ_MAX_OPS];     //Loaded at 0x200
+	struct fuzz_key keys[FUZZ_MAX_KEYS];    //In slot order
+	uint8_t nops;
+	uint8_t nkeys;
+	uint16_t slots;                 //Instruction slots to run
+};
+
+struct worker {
+	pthread_t thread;
+	uint64_t rng;
+	uint64_t limit;                 //Executions to run, 0 for no limit
+	uint64_t execs;                 //Published with a relaxed store
+	uint64_t known[FEATURE_WORDS];  //Features this worker has seen in the map
+	struct chip8_model m;
+};
+
+static uint8_t kind_of[0x10000];
+static unsigned int fuzzed_kinds[KINDS];
+static unsigned int nfuzzed;
+static struct chip8_model template;
+
+static uint64_t coverage[FEATURE_WORDS];
+static struct fuzz_input corpus[CORPUS_MAX];
+static unsigned int corpus_count;       //Published with release after the entry
+static pthread_mutex_t corpus_lock = PTHREAD_MUTEX_INITIALIZER;
+static volatile int stop;
+
+static double seconds() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void usage() {
+	fprintf(stderr,
+		"Usage: chip8fuzz run [-j threads] [-t seconds] [-n execs] [-s seed] [-x backend]\n"
+		"                     [-c ms] [-o dir]\n"
+		"       chip8fuzz bench [-j threads] [-t seconds]\n"
+		"       chip8fuzz test\n");
+	exit(1);
+}
+
+static void setup() {
+	unsigned int op, k;
+
+	for (op = 0; op < 0x10000; ++op) {
+		for (k = 0; (op & kinds[k].mask) != kinds[k].match; ++k)
+			;
+		kind_of[op] = k;
+	}
+	for (k = 0; k < KINDS; ++k)
+		if (kinds[k].fuzzed)
+			fuzzed_kinds[nfuzzed++] = k;
+
+	chip8model_init(&template);
+	chip8core_clear_memory(&template.core);
+	template.state = RUNNING_STATE;
+}
+
+/* Forgets the corpus and the coverage, between bench runs */
+static void forget() {
+	memset(coverage, 0, sizeof(coverage));
+	corpus_count = 0;
+}
+
+/* xorshift64* */
+static inline uint32_t rnd(uint64_t *s) {
+	uint64_t x = *s;
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	*s = x;
+	return (x * 0x2545F4914F6CDD1DULL) >> 32;
+}
+
+static uint64_t seed_rng(uint64_t seed, unsigned int n) {
+	uint64_t s = (seed + 1) * 0x9E3779B97F4A7C15ULL + n * 0xBF58476D1CE4E5B9ULL;
+	return s ? s : 1;
+}
+
+/*
+* Fields are biased towards the edges: VF and equal registers, values
+* that carry, jumps into the program or the top of memory, I near 0xFFF
+*/
+static uint16_t generate_op(uint64_t *rng, unsigned int nops) {
+	const struct kind *k = &kinds[fuzzed_kinds[rnd(rng) % nfuzzed]];
+	uint16_t op = k->match | (rnd(rng) & ~k->mask);
+
+	if ((k->fields & F_X) && rnd(rng) % 4 == 0)
+		op |= 0x0F00;
+	if ((k->fields & F_Y) && rnd(rng) % 4 == 0)
+		op = (op & ~0x00F0) | (rnd(rng) % 2 ? 0x00F0 : op >> 4 & 0x00F0);
+	if ((k->fields & F_KK) && rnd(rng) % 2)
+		op = (op & 0xFF00) | interesting_kk[rnd(rng) % sizeof(interesting_kk)];
+	if (k->fields & F_NNN) {
+		unsigned int r = rnd(rng) % 4;
+		if (k->match == 0xA000)
+			op = 0xA000 | (r == 0 ? 0xFF0 + rnd(rng) % 16 : r == 1 ? 0x200 + rnd(rng) % 64 :
+				rnd(rng) & 0xFFF);
+		else if (r != 0)
+			op = k->match | (CHIP8_PROGRAM_START + 2 * (rnd(rng) % nops));
+		else
+			op = k->match | interesting_nnn[rnd(rng) % 4];
+	}
+	return op;
+}
+
+static void add_key(struct fuzz_input *in, uint64_t *rng) {
+	struct fuzz_key key;
+	unsigned int k;
+
+	if (in->nkeys == FUZZ_MAX_KEYS)
+		return;
+	key.slot = rnd(rng) % in->slots;
+	key.key = rnd(rng) % 16;
+	key.pressed = rnd(rng) % 2;
+	for (k = in->nkeys; k > 0 && in->keys[k - 1].slot > key.slot; --k)
+		in->keys[k] = in->keys[k - 1];
+	in->keys[k] = key;
+	in->nkeys++;
+}
+
+static void remove_key(struct fuzz_input *in, unsigned int k) {
+	memmove(&in->keys[k], &in->keys[k + 1], (in->nkeys - k - 1) * sizeof(in->keys[0]));
+	in->nkeys--;
+}
+
+/* Drops the key events past the last slot */
+static void trim_keys(struct fuzz_input *in) {
+	while (in->nkeys > 0 && in->keys[in->nkeys - 1].slot >= in->slots)
+		in->nkeys--;
+}
+
+static void generate(struct fuzz_input *in, uint64_t *rng) {
+	unsigned int k, keys;
+
+	memset(in, 0, sizeof(*in));
+	in->nops = 2 + rnd(rng) % (FUZZ_MAX_OPS - 1);
+	for (k = 0; k < in->nops; ++k)
+		in->ops[k] = generate_op(rng, in->nops);
+	in->slots = 2 * in->nops + rnd(rng) % 32;
+	if (in->slots > FUZZ_MAX_SLOTS)
+		in->slots = FUZZ_MAX_SLOTS;
+	for (keys = rnd(rng) % 3; keys > 0; --keys)
+		add_key(in, rng);
+}
+
+static void mutate(struct fuzz_input *in, uint64_t *rng, unsigned int count) {
+	const struct fuzz_input *other;
+	unsigned int times = 1 + rnd(rng) % 4, k, j, shift;
+	uint16_t op;
+
+	while (times-- > 0) {
+		k = rnd(rng) % in->nops;
+		switch (rnd(rng) % 9) {
+		case 0:
+			in->ops[k] = generate_op(rng, in->nops);
+			break;
+		case 1:
+			/* A new value for one operand nibble, if that leaves it fuzzable */
+			shift = 4 * (rnd(rng) % 3);
+			op = (in->ops[k] & ~(0xF << shift)) | (rnd(rng) % 16) << shift;
+			if (kinds[kind_of[op]].fuzzed)
+				in->ops[k] = op;
+			break;
+		case 2:
+			if (in->nops < FUZZ_MAX_OPS) {
+				memmove(&in->ops[k + 1], &in->ops[k], (in->nops - k) * sizeof(in->ops[0]));
+				in->ops[k] = generate_op(rng, in->nops);
+				in->nops++;
+			}
+			break;
+		case 3:
+			if (in->nops > 1) {
+				memmove(&in->ops[k], &in->ops[k + 1], (in->nops - k - 1) * sizeof(in->ops[0]));
+				in->nops--;
+			}
+			break;
+		case 4:
+			j = rnd(rng) % in->nops;
+			op = in->ops[k];
+			in->ops[k] = in->ops[j];
+			in->ops[j] = op;
+			break;
+		case 5:
+			in->ops[k] = in->ops[rnd(rng) % in->nops];
+			break;
+		case 6:
+			if (in->nkeys > 0 && rnd(rng) % 2)
+				remove_key(in, rnd(rng) % in->nkeys);
+			else
+				add_key(in, rng);
+			break;
+		case 7:
+			in->slots = 1 + rnd(rng) % FUZZ_MAX_SLOTS;
+			trim_keys(in);
+			break;
+		case 8:
+			/* Splice the tail of another input onto this one */
+			if (count == 0)
+				break;
+			other = &corpus[rnd(rng) % count];
+			for (j = rnd(rng) % other->nops; j < other->nops && k < FUZZ_MAX_OPS; ++j)
+				in->ops[k++] = other->ops[j];
+			in->nops = k > 0 ? k : 1;
+			break;
+		}
+	}
+}
+
+static inline unsigned int vf_outcome(uint8_t before, uint8_t after) {
+	if (after == before)
+		return 0;
+	return after <= 1 ? 1 + after : 3;
+}
+
+static unsigned int edges(uint16_t op, unsigned int kind, const uint8_t *v, uint16_t i, uint8_t sp,
+		uint16_t pc) {
+	unsigned int x = (op >> 8) & 0xf, y = (op >> 4) & 0xf, n = op & 0xf;
+	unsigned int e = 0;
+
+	if ((kinds[kind].fields & F_X) && x == 0xF)
+		e |= EDGE_VF_DEST;
+	if ((kinds[kind].fields & F_Y) && x == y)
+		e |= EDGE_SAME_REG;
+
+	switch (kind) {
+	case K_ADD_KK: if (v[x] + (op & 0xff) > 0xff) e |= EDGE_CARRY; break;
+	case K_ADD_VV: if (v[x] + v[y] > 0xff) e |= EDGE_CARRY; break;
+	case K_SUB:
+	case K_SUBN: if (v[x] == v[y]) e |= EDGE_CARRY; break;
+	case K_SHR: if (v[x] & 0x1) e |= EDGE_CARRY; break;
+	case K_SHL: if (v[x] & 0x80) e |= EDGE_CARRY; break;
+	case K_ADD_I: if (i + v[x] > 0xfff) e |= EDGE_CARRY; break;
+	case K_STORE:
+	case K_LOAD: if (i + x > 0xfff) e |= EDGE_MEM_WRAP; break;
+	case K_LD_B: if (i + 2 > 0xfff) e |= EDGE_MEM_WRAP; break;
+	case K_DRW:
+		if (n > 0 && i + n - 1 > 0xfff) e |= EDGE_MEM_WRAP;
+		if ((v[x] & 63) + 8 > 64) e |= EDGE_WRAP_X;
+		if ((v[y] & 31) + n > 32) e |= EDGE_WRAP_Y;
+		break;
+	case K_CALL: if (sp == CHIP8_STACK_DEPTH - 1) e |= EDGE_STACK_WRAP; break;
+	case K_RET: if (sp == 0) e |= EDGE_STACK_WRAP; break;
+	case K_JP_V0: if ((op & 0xfff) + v[0] > 0xfff) e |= EDGE_PC_WRAP; break;
+	}
+	if (pc >= 0xffc)
+		e |= EDGE_PC_WRAP;
+	return e;
+}
+
+static void load(struct chip8_core *c, const struct fuzz_input *in) {
+	unsigned int k;
+
+	for (k = 0; k < in->nops; ++k) {
+		c->mem[CHIP8_PROGRAM_START + 2 * k] = in->ops[k] >> 8;
+		c->mem[CHIP8_PROGRAM_START + 2 * k + 1] = in->ops[k] & 0xff;
+	}
+}
+
+/*
+* Runs an input on m from the power-on state with the fontset loaded and
+* fills features with those it reached, up to 2 per slot. Feature
+* kind << 10 | VF outcome << 8 | edges covers one instruction, and
+* SINGLE_FEATURES + (previous kind << 6 | kind) two retired in a row.
+*/
+static unsigned int execute(struct chip8_model *m, const struct fuzz_input *in, uint32_t *features) {
+	struct chip8_core *c = &m->core;
+	unsigned int n = 0, s, k = 0, kind, prev = KINDS;
+	uint8_t v[CHIP8_NUM_REGISTERS];
+	uint16_t i, pc, op;
+	uint8_t sp;
+
+	memcpy(m, &template, sizeof(*m));
+	load(c, in);
+
+	for (s = 0; s < in->slots; ++s) {
+		for (; k < in->nkeys && in->keys[k].slot == s; ++k)
+			chip8core_set_key(c, in->keys[k].key, in->keys[k].pressed);
+
+		pc = c->pc;
+		op = chip8core_fetch(c, pc);
+		memcpy(v, c->v, sizeof(v));
+		i = c->i;
+		sp = c->sp;
+		if (chip8model_run(m, 1) == 0)
+			continue;
+
+		kind = kind_of[op];
+		features[n++] = kind << 10 | vf_outcome(v[0xF], c->v[0xF]) << 8 | edges(op, kind, v, i, sp, pc);
+		if (prev != KINDS)
+			features[n++] = SINGLE_FEATURES + (prev << 6 | kind);
+		prev = kind;
+	}
+	return n;
+}
+
+/* Marks features in the shared map, 1 if any of them was not there yet */
+static int novel(struct worker *w, const uint32_t *features, unsigned int n) {
+	unsigned int k;
+	int found = 0;
+
+	for (k = 0; k < n; ++k) {
+		uint64_t bit = 1ULL << (features[k] & 63);
+		uint64_t *known = &w->known[features[k] >> 6];
+
+		if (*known & bit)
+			continue;
+		*known |= bit;
+		if (!(__atomic_fetch_or(&coverage[features[k] >> 6], bit, __ATOMIC_RELAXED) & bit))
+			found = 1;
+	}
+	return found;
+}
+
+static void corpus_add(const struct fuzz_input *in) {
+	pthread_mutex_lock(&corpus_lock);
+	if (corpus_count < CORPUS_MAX) {
+		corpus[corpus_count] = *in;
+		__atomic_store_n(&corpus_count, corpus_count + 1, __ATOMIC_RELEASE);
+	}
+	pthread_mutex_unlock(&corpus_lock);
+}
+
+static void *worker_f(void *arg) {
+	struct worker *w = arg;
+	uint32_t features[2 * FUZZ_MAX_SLOTS];
+	struct fuzz_input in;
+	unsigned int count, n;
+	uint64_t execs = 0;
+
+	while (!stop && (w->limit == 0 || execs < w->limit)) {
+		count = __atomic_load_n(&corpus_count, __ATOMIC_ACQUIRE);
+		if (count == 0 || rnd(&w->rng) % 16 == 0) {
+			generate(&in, &w->rng);
+		} else {
+			in = corpus[rnd(&w->rng) % count];
+			mutate(&in, &w->rng, count);
+		}
+
+		n = execute(&w->m, &in, features);
+		if (novel(w, features, n))
+			corpus_add(&in);
+		__atomic_store_n(&w->execs, ++execs, __ATOMIC_RELAXED);
+	}
+	return NULL;
+}
+
+static struct worker *start_workers(unsigned int threads, uint64_t seed, uint64_t execs) {
+	struct worker *w = calloc(threads, sizeof(*w));
+	unsigned int k;
+
+	if (w == NULL) {
+		perror("calloc");
+		exit(1);
+	}
+	stop = 0;
+	for (k = 0; k < threads; ++k) {
+		w[k].rng = seed_rng(seed, k);
+		w[k].limit = execs / threads + (k < execs % threads);
+		if (execs != 0 && w[k].limit == 0)
+			continue;
+		if (pthread_create(&w[k].thread, NULL, worker_f, &w[k])) {
+			perror("pthread_create");
+			exit(1);
+		}
+	}
+	return w;
+}
+
+/* Waits for the workers to run out of executions, or to see stop */
+static uint64_t join_workers(struct worker *w, unsigned int threads, uint64_t execs) {
+	uint64_t total = 0;
+	unsigned int k;
+
+	for (k = 0; k < threads; ++k) {
+		if (execs == 0 || w[k].limit != 0)
+			pthread_join(w[k].thread, NULL);
+		total += w[k].execs;
+	}
+	return total;
+}
+
+static uint64_t total_execs(const struct worker *w, unsigned int threads) {
+	uint64_t total = 0;
+	unsigned int k;
+
+	for (k = 0; k < threads; ++k)
+		total += __atomic_load_n(&w[k].execs, __ATOMIC_RELAXED);
+	return total;
+}
+
+static int workers_done(const struct worker *w, unsigned int threads) {
+	unsigned int k;
+
+	for (k = 0; k < threads; ++k)
+		if (w[k].limit == 0 || __atomic_load_n(&w[k].execs, __ATOMIC_RELAXED) < w[k].limit)
+			return 0;
+	return 1;
+}
+
+static unsigned int count_bits(const uint64_t *words, unsigned int n) {
+	unsigned int k, bits = 0;
+
+	for (k = 0; k < n; ++k)
+		bits += __builtin_popcountll(__atomic_load_n(&words[k], __ATOMIC_RELAXED));
+	return bits;
+}
+
+static int covered(unsigned int kind, unsigned int edge) {
+	unsigned int f;
+
+	for (f = kind << 10; f < (kind + 1) << 10; ++f)
+		if ((f & edge) == edge && ((coverage[f >> 6] >> (f & 63)) & 1))
+			return 1;
+	return 0;
+}
+
+/*
+* Cross-checking against the backend chip8io has open. The reference starts
+* from the same power-on state, restored in one batch with only the memory
+* that changed since the last input, and is advanced a slot at a time with
+* the key events written in between.
+*/
+static struct chip8_model expected_model;
+static uint8_t reference_mem[CHIP8_MEMORY_SIZE];
+static int reference_mem_valid;
+
+/*
+* Runs an input on the core for comparison. Returns 0 if it ran Cxkk or
+* Fx07 after all, out of memory it wrote or wrapped around to, and cannot
+* be compared.
+*/
+static int expected_run(const struct fuzz_input *in, struct chip8_state *s) {
+	uint32_t features[2 * FUZZ_MAX_SLOTS];
+	unsigned int n, k;
+
+	n = execute(&expected_model, in, features);
+	for (k = 0; k < n; ++k)
+		if (features[k] < SINGLE_FEATURES &&
+				(features[k] >> 10 == K_RND || features[k] >> 10 == K_LD_DT_READ))
+			return 0;
+	chip8state_from_core(s, &expected_model.core, PAUSED_STATE);
+	return 1;
+}
+
+static int reference_run(const struct fuzz_input *in, struct chip8_state *s) {
+	static struct chip8_state initial;
+	static struct chip8_model m;
+	unsigned int slot, k = 0;
+
+	memcpy(&m, &template, sizeof(m));
+	load(&m.core, in);
+	chip8state_from_core(&initial, &m.core, PAUSED_STATE);
+
+	writeReset();
+	if (chip8state_restore(&initial.h, initial.mem, reference_mem_valid ? reference_mem : NULL))
+		return -1;
+
+	startChip8();
+	for (slot = 0; slot < in->slots; ++slot) {
+		for (; k < in->nkeys && in->keys[k].slot == slot; ++k)
+			chip8writekeypress(in->keys[k].key, in->keys[k].pressed);
+		chip8io_advance(1);
+	}
+	pauseChip8();
+
+	reference_mem_valid = 0;
+	if (chip8state_capture(s))
+		return -1;
+	memcpy(reference_mem, s->mem, sizeof(reference_mem));
+	reference_mem_valid = 1;
+	return 0;
+}
+
+static int timer_differs(unsigned int a, unsigned int b) {
+	return a > b + 1 || b > a + 1;
+}
+
+/* Describes the first difference into buf, returns 0 if there is none */
+static int compare(const struct chip8_state *want, const struct chip8_state *got, char *buf, size_t len) {
+	const struct chip8state_header *w = &want->h, *g = &got->h;
+	unsigned int k;
+
+	for (k = 0; k < CHIP8_NUM_REGISTERS; ++k)
+		if (w->v[k] != g->v[k])
+			return snprintf(buf, len, "V%X %02x, expected %02x", k, g->v[k], w->v[k]);
+	if (w->i != g->i)
+		return snprintf(buf, len, "I %03x, expected %03x", g->i, w->i);
+	if (w->pc != g->pc)
+		return snprintf(buf, len, "PC %03x, expected %03x", g->pc, w->pc);
+	if (w->sp != g->sp)
+		return snprintf(buf, len, "SP %u, expected %u", g->sp, w->sp);
+	for (k = 0; k < CHIP8_STACK_DEPTH; ++k)
+		if (w->stack[k] != g->stack[k])
+			return snprintf(buf, len, "stack[%u] %03x, expected %03x", k, g->stack[k], w->stack[k]);
+	if (timer_differs(w->delay_timer, g->delay_timer))
+		return snprintf(buf, len, "DT %u, expected %u", g->delay_timer, w->delay_timer);
+	if (timer_differs(w->sound_timer, g->sound_timer))
+		return snprintf(buf, len, "ST %u, expected %u", g->sound_timer, w->sound_timer);
+	if (w->key != g->key)
+		return snprintf(buf, len, "key %02x, expected %02x", g->key, w->key);
+	for (k = 0; k < CHIP8_FB_HEIGHT; ++k)
+		if (w->fb[k] != g->fb[k])
+			return snprintf(buf, len, "framebuffer row %u %016llx, expected %016llx", k,
+				(unsigned long long) g->fb[k], (unsigned long long) w->fb[k]);
+	for (k = 0; k < CHIP8_MEMORY_SIZE; ++k)
+		if (want->mem[k] != got->mem[k])
+			return snprintf(buf, len, "memory[%03x] %02x, expected %02x", k, got->mem[k], want->mem[k]);
+	return 0;
+}
+
+/* Predicate for minimize: the reference disagrees with the core */
+static int reference_diverges(const struct fuzz_input *in, void *arg) {
+	static struct chip8_state want, got;
+	char *diff = arg;
+
+	if (!expected_run(in, &want) || reference_run(in, &got))
+		return 0;
+	return compare(&want, &got, diff, 128) != 0;
+}
+
+typedef int (*fuzz_predicate)(const struct fuzz_input *in, void *arg);
+
+/* Shortest run of slots that still satisfies diverges, assuming it stays so once it is */
+static int shorten(struct fuzz_input *in, fuzz_predicate diverges, void *arg) {
+	struct fuzz_input t = *in;
+	unsigned int lo = 1, hi = in->slots;
+
+	while (lo < hi) {
+		t = *in;
+		t.slots = (lo + hi) / 2;
+		trim_keys(&t);
+		if (diverges(&t, arg))
+			hi = t.slots;
+		else
+			lo = t.slots + 1;
+	}
+	if (hi == in->slots)
+		return 0;
+	t = *in;
+	t.slots = hi;
+	trim_keys(&t);
+	if (!diverges(&t, arg))
+		return 0;
+	*in = t;
+	return 1;
+}
+
+/*
+* Greedy delta debugging: cuts slots, then drops key events and
+* instructions one at a time and clears immediate values, for as long as
+* the input keeps diverging
+*/
+static void minimize(struct fuzz_input *in, fuzz_predicate diverges, void *arg) {
+	struct fuzz_input t;
+	unsigned int k;
+	int progress = 1;
+
+	while (progress) {
+		progress = shorten(in, diverges, arg);
+
+		for (k = in->nkeys; k-- > 0; ) {
+			t = *in;
+			remove_key(&t, k);
+			if (diverges(&t, arg)) {
+				*in = t;
+				progress = 1;
+			}
+		}
+
+		for (k = in->nops; k-- > 0 && in->nops > 1; ) {
+			t = *in;
+			memmove(&t.ops[k], &t.ops[k + 1], (t.nops - k - 1) * sizeof(t.ops[0]));
+			t.nops--;
+			if (diverges(&t, arg)) {
+				*in = t;
+				progress = 1;
+			}
+		}
+
+		for (k = 0; k < in->nops; ++k) {
+			if (!(kinds[kind_of[in->ops[k]]].fields & F_KK) || (in->ops[k] & 0xff) == 0)
+				continue;
+			t = *in;
+			t.ops[k] &= 0xFF00;
+			if (diverges(&t, arg)) {
+				*in = t;
+				progress = 1;
+			}
+		}
+	}
+}
+
+/* Writes the program as a ROM and a listing with the key events and the difference */
+static int save_case(const char *dir, unsigned int n, const struct fuzz_input *in, const char *diff) {
+	char path[4096], line[32];
+	unsigned int k;
+	FILE *f;
+
+	snprintf(path, sizeof(path), "%s/diverge-%03u.ch8", dir, n);
+	if ((f = fopen(path, "wb")) == NULL) {
+		perror(path);
+		return -1;
+	}
+	for (k = 0; k < in->nops; ++k) {
+		fputc(in->ops[k] >> 8, f);
+		fputc(in->ops[k] & 0xff, f);
+	}
+	fclose(f);
+
+	snprintf(path, sizeof(path), "%s/diverge-%03u.txt", dir, n);
+	if ((f = fopen(path, "w")) == NULL) {
+		perror(path);
+		return -1;
+	}
+	fprintf(f, "%s after %u slots\n\n", diff, in->slots);
+	for (k = 0; k < in->nops; ++k) {
+		chip8disasm(in->ops[k], line, sizeof(line));
+		fprintf(f, "%03x  %04x  %s\n", CHIP8_PROGRAM_START + 2 * k, in->ops[k], line);
+	}
+	for (k = 0; k < in->nkeys; ++k)
+		fprintf(f, "slot %u: key %X %s\n", in->keys[k].slot, in->keys[k].key,
+			in->keys[k].pressed ? "pressed" : "released");
+	fclose(f);
+	printf("divergent: %s, minimized to %u instructions in %u slots, saved to %s\n", diff, in->nops,
+		in->slots, path);
+	return 0;
+}
+
+struct cross_check {
+	unsigned int checked;           //Corpus entries replayed so far
+	unsigned int divergent;
+	const char *dir;
+};
+
+static void cross_check(struct cross_check *x) {
+	unsigned int count = __atomic_load_n(&corpus_count, __ATOMIC_ACQUIRE);
+	struct fuzz_input in;
+	char diff[128];
+
+	for (; x->checked < count; ++x->checked) {
+		in = corpus[x->checked];
+		if (!reference_diverges(&in, diff))
+			continue;
+		minimize(&in, reference_diverges, diff);
+		if (!reference_diverges(&in, diff))
+			continue;
+		save_case(x->dir, x->divergent++, &in, diff);
+	}
+}
+
+static void report_coverage(FILE *out) {
+	unsigned int k;
+
+	fprintf(out, "%-10s %8s\n", "", "features");
+	for (k = 0; k < KINDS; ++k)
+		if (kinds[k].fuzzed)
+			fprintf(out, "%-10s %8u\n", kinds[k].name, count_bits(&coverage[k << 4], 16));
+	fprintf(out, "%-10s %8u\n", "pairs", count_bits(&coverage[SINGLE_FEATURES / 64], PAIR_FEATURES / 64));
+}
+
+static int run(int argc, char **argv) {
+	const char *backend = DEFAULT_BACKEND, *dir = ".";
+	unsigned int threads = sysconf(_SC_NPROCESSORS_ONLN), k;
+	unsigned long check_ms = 1000;
+	uint64_t execs = 0, seed = time(NULL), done, last = 0;
+	double duration = 10, start, now, last_status, next_check;
+	struct cross_check x = { 0, 0, NULL };
+	struct worker *w;
+	int c;
+
+	while ((c = getopt(argc, argv, "j:t:n:s:x:c:o:")) != -1) {
+		switch (c) {
+		case 'j': threads = strtoul(optarg, NULL, 0); break;
+		case 't': duration = atof(optarg); break;
+		case 'n': execs = strtoull(optarg, NULL, 0); break;
+		case 's': seed = strtoull(optarg, NULL, 0); break;
+		case 'x': backend = optarg; break;
+		case 'c': check_ms = strtoul(optarg, NULL, 0); break;
+		case 'o': dir = optarg; break;
+		default: usage();
+		}
+	}
+	if (threads == 0)
+		threads = 1;
+	x.dir = dir;
+
+	setup();
+	if (check_ms != 0 && chip8io_open(backend)) {
+		fprintf(stderr, "Could not open %s\n", backend);
+		return 1;
+	}
+	printf("fuzzing on %u threads, seed %llu, cross-checking against %s\n", threads,
+		(unsigned long long) seed, check_ms ? backend : "nothing");
+
+	start = seconds();
+	last_status = start;
+	next_check = start + check_ms / 1000.0;
+	w = start_workers(threads, seed, execs);
+	while (!workers_done(w, threads) && (now = seconds()) - start < duration) {
+		if (check_ms != 0 && now >= next_check) {
+			cross_check(&x);
+			next_check = seconds() + check_ms / 1000.0;
+		}
+		if (now - last_status >= 1) {
+			done = total_execs(w, threads);
+			printf("%6.0fs  %12llu execs  %9.0f/s  %6u features  %5u corpus  %5u checked  %u divergent\n",
+				now - start, (unsigned long long) done, (done - last) / (now - last_status),
+				count_bits(coverage, FEATURE_WORDS), corpus_count, x.checked, x.divergent);
+			last = done;
+			last_status = now;
+		}
+		usleep(10000);
+	}
+	now = seconds();
+	stop = 1;
+	done = join_workers(w, threads, execs);
+	if (check_ms != 0) {
+		cross_check(&x);
+		chip8io_close();
+	}
+
+	printf("\n%llu execs in %.2f s, %.0f/s\n", (unsigned long long) done, now - start, done / (now - start));
+	for (k = 0; k < threads; ++k)
+		printf("  thread %2u: %.0f/s\n", k, w[k].execs / (now - start));
+	printf("%u features, %u inputs in the corpus, %u checked, %u divergent\n\n",
+		count_bits(coverage, FEATURE_WORDS), corpus_count, x.checked, x.divergent);
+	report_coverage(stdout);
+	free(w);
+	return x.divergent ? 2 : 0;
+}
+
+static double throughput(unsigned int threads, double duration) {
+	struct worker *w;
+	uint64_t done;
+	double start;
+
+	forget();
+	start = seconds();
+	w = start_workers(threads, threads, 0);
+	usleep(duration * 1e6);
+	stop = 1;
+	done = join_workers(w, threads, 0);
+	free(w);
+	return done / (seconds() - start);
+}
+
+static int bench(int argc, char **argv) {
+	unsigned int max = sysconf(_SC_NPROCESSORS_ONLN), counts[32], n = 0, k, round;
+	double duration = 1, best[32] = { 0 }, r;
+	int c;
+
+	while ((c = getopt(argc, argv, "j:t:")) != -1) {
+		switch (c) {
+		case 'j': max = strtoul(optarg, NULL, 0); break;
+		case 't': duration = atof(optarg); break;
+		default: usage();
+		}
+	}
+	if (max == 0)
+		max = 1;
+
+	for (k = 1; k < max && n < 31; k *= 2)
+		counts[n++] = k;
+	counts[n++] = max;
+
+	setup();
+	/* Round robin so that a noisy neighbour hurts every count alike */
+	for (round = 0; round < 3; ++round) {
+		for (k = 0; k < n; ++k) {
+			r = throughput(counts[k], duration);
+			if (r > best[k])
+				best[k] = r;
+		}
+	}
+
+	printf("%7s %12s %8s %10s\n", "threads", "execs/s", "speedup", "efficiency");
+	for (k = 0; k < n; ++k)
+		printf("%7u %12.0f %7.2fx %9.0f%%\n", counts[k], best[k], best[k] / best[0],
+			100 * best[k] / best[0] / counts[k]);
+	return 0;
+}
+
+static int deterministic() {
+	static struct chip8_model a, b;
+	uint32_t fa[2 * FUZZ_MAX_SLOTS], fb[2 * FUZZ_MAX_SLOTS];
+	struct fuzz_input in;
+	uint64_t rng = seed_rng(7, 0);
+	unsigned int k, na, nb;
+	int errors = 0;
+
+	for (k = 0; k < 1000; ++k) {
+		generate(&in, &rng);
+		mutate(&in, &rng, 0);
+		na = execute(&a, &in, fa);
+		nb = execute(&b, &in, fb);
+		if (na != nb || memcmp(fa, fb, na * sizeof(fa[0])) || memcmp(&a.core, &b.core, sizeof(a.core)))
+			errors++;
+	}
+	return chip8test_check("runs that differ", errors, 0);
+}
+
+static int reaches_edges() {
+	struct worker *w;
+	int errors = 0;
+
+	forget();
+	w = start_workers(1, 1, 300000);
+	join_workers(w, 1, 300000);
+	free(w);
+
+	errors += chip8test_check("ADD VF,Vy with a carry", covered(K_ADD_VV, EDGE_VF_DEST | EDGE_CARRY), 1);
+	errors += chip8test_check("SUB with equal values", covered(K_SUB, EDGE_CARRY), 1);
+	errors += chip8test_check("SHL VF", covered(K_SHL, EDGE_VF_DEST), 1);
+	errors += chip8test_check("ADD I past 0xFFF", covered(K_ADD_I, EDGE_CARRY), 1);
+	errors += chip8test_check("LD [I] past 0xFFF", covered(K_STORE, EDGE_MEM_WRAP), 1);
+	errors += chip8test_check("LD B past 0xFFF", covered(K_LD_B, EDGE_MEM_WRAP), 1);
+	errors += chip8test_check("DRW wrapping on x", covered(K_DRW, EDGE_WRAP_X), 1);
+	errors += chip8test_check("DRW wrapping on y", covered(K_DRW, EDGE_WRAP_Y), 1);
+	errors += chip8test_check("DRW setting VF", covered(K_DRW, 2 << 8), 1);
+	errors += chip8test_check("CALL wrapping the stack", covered(K_CALL, EDGE_STACK_WRAP), 1);
+	errors += chip8test_check("RET wrapping the stack", covered(K_RET, EDGE_STACK_WRAP), 1);
+	errors += chip8test_check("PC at the top of memory", covered(K_JP, EDGE_PC_WRAP) | covered(K_CLS, EDGE_PC_WRAP) |
+		covered(K_SYS, EDGE_PC_WRAP), 1);
+	errors += chip8test_check("LD Vx,K done", covered(K_LD_K, 0), 1);
+	return errors;
+}
+
+static int threads_share() {
+	unsigned int threads = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? 4 : 2;
+	struct worker *w;
+	uint64_t done;
+	int errors = 0;
+
+	forget();
+	w = start_workers(threads, 3, 100001);
+	done = join_workers(w, threads, 100001);
+	free(w);
+	errors += chip8test_check("executions counted", done, 100001);
+	errors += chip8test_check("corpus kept", corpus_count > 100, 1);
+	errors += chip8test_check("features reached", count_bits(coverage, FEATURE_WORDS) > 1000, 1);
+	return errors;
+}
+
+static int replay_on_model() {
+	struct cross_check x = { 0, 0, "." };
+	unsigned int count = corpus_count;
+	int errors = 0;
+
+	if (chip8io_open("model"))
+		return chip8test_check("model opened", 0, 1);
+	if (corpus_count > 300)
+		corpus_count = 300;
+	cross_check(&x);
+	chip8io_close();
+	corpus_count = count;
+
+	errors += chip8test_check("inputs replayed", x.checked > 100, 1);
+	errors += chip8test_check("divergent on the model", x.divergent, 0);
+	return errors;
+}
+
+/* Stands in for a backend that gets ADD VF,Vy wrong when it carries */
+static int carry_into_vf(const struct fuzz_input *in, void *arg) {
+	static struct chip8_model m;
+	uint32_t features[2 * FUZZ_MAX_SLOTS];
+	unsigned int n, k, *calls = arg;
+
+	(*calls)++;
+	n = execute(&m, in, features);
+	for (k = 0; k < n; ++k)
+		if (features[k] < SINGLE_FEATURES && features[k] >> 10 == K_ADD_VV &&
+				(features[k] & (EDGE_VF_DEST | EDGE_CARRY)) == (EDGE_VF_DEST | EDGE_CARRY))
+			return 1;
+	return 0;
+}
+
+static int minimizes() {
+	static const uint16_t ops[] = {
+		0x6230, 0x6FF0, 0x7305, 0xA300, 0x8231, 0x6120, 0x6455, 0x8452,
+		0x8F14, 0x6711, 0x8784, 0x6899, 0xF355, 0x1200,
+	};
+	struct fuzz_input in;
+	unsigned int calls = 0;
+	int errors = 0;
+
+	memset(&in, 0, sizeof(in));
+	memcpy(in.ops, ops, sizeof(ops));
+	in.nops = sizeof(ops) / sizeof(ops[0]);
+	in.slots = 60;
+	in.nkeys = 2;
+	in.keys[0].slot = 3;
+	in.keys[0].key = 5;
+	in.keys[0].pressed = 1;
+	in.keys[1].slot = 20;
+	in.keys[1].key = 5;
+
+	errors += chip8test_check("planted case diverges", carry_into_vf(&in, &calls), 1);
+	minimize(&in, carry_into_vf, &calls);
+	errors += chip8test_check("minimized instructions", in.nops, 3);
+	errors += chip8test_check("minimized slots", in.slots, 3);
+	errors += chip8test_check("minimized key events", in.nkeys, 0);
+	errors += chip8test_check("kept LD VF,F0", in.ops[0], 0x6FF0);
+	errors += chip8test_check("kept LD V1,20", in.ops[1], 0x6120);
+	errors += chip8test_check("kept ADD VF,V1", in.ops[2], 0x8F14);
+	errors += chip8test_check("minimized within 200 runs", calls < 200, 1);
+	return errors;
+}
+
+static int test(int argc, char **argv) {
+	int errors = 0;
+
+	setup();
+	errors += deterministic();
+	errors += reaches_edges();
+	errors += threads_share();
+	errors += replay_on_model();
+	errors += minimizes();
+	return chip8test_report(errors);
+}
+
+int main(int argc, char **argv) {
+	if (argc < 2)
+		usage();
+
+	if (strcmp(argv[1], "run") == 0)
+		return run(argc - 1, argv + 1);
+	if (strcmp(argv[1], "bench") == 0)
+		return bench(argc - 1, argv + 1);
+	if (strcmp(argv[1], "test") == 0)
+		return test(argc - 1, argv + 1);
+
+	usage();
+	return 1;
+}
@@ -0,0 +1,153 @@
+/*
+ * Opcode injection through RUN_INSTRUCTION_STATE
+ *
+ * chip8inj run [-b backend] [-t timeout_us] <opcode>...
+ *     Runs the opcodes (hex) one at a time with chip8io_inject and prints
+ *     how long they took and the registers afterwards
+ * chip8inj test
+ *     Injects register, I, BCD, ALU and CALL sequences into the model and
+ *     checks the results, then checks that Fx0A times out until a key is
+ *     pressed
+ *
+ * Columbia University
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+
+#include "chip8io.h"
+#include "chip8test.h"
+
+#define MAX_OPCODES 256
+
+static double seconds() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void usage() {
+	fprintf(stderr,
+		"Usage: chip8inj run [-b backend] [-t timeout_us] <opcode>...\n"
+		"       chip8inj test\n");
+	exit(1);
+}
+
+static void print_registers() {
+	int k;
+
+	for (k = 0; k < 16; ++k)
+		printf("V%X=%02x%c", k, readRegister(k), k == 7 || k == 15 ? '\n' : ' ');
+	printf("I=%03x PC=%03x SP=%d\n", readIRegister(), readPC(), readStackPointer());
+}
+
+static int run(int argc, char **argv) {
+	const char *backend = NULL;
+	unsigned long timeout = 1000000;
+	uint16_t opcodes[MAX_OPCODES];
+	int count = 0, done, opt;
+	double t;
+
+	while ((opt = getopt(argc, argv, "b:t:")) != -1) {
+		switch (opt) {
+		case 'b': backend = optarg; break;
+		case 't': timeout = strtoul(optarg, NULL, 0); break;
+		default: usage();
+		}
+	}
+	for (; optind < argc && count < MAX_OPCODES; ++optind)
+		opcodes[count++] = strtoul(argv[optind], NULL, 16);
+	if (count == 0)
+		usage();
+
+	if (chip8io_open(backend))
+		return 1;
+	t = seconds();
+	done = chip8io_inject(opcodes, count, timeout);
+	t = seconds() - t;
+	if (done < 0) {
+		perror("inject failed");
+		chip8io_close();
+		return 1;
+	}
+
+	printf("%d of %d instructions in %.1f us, %.1f us each\n", done, count, t * 1e6,
+		done ? t * 1e6 / done : 0);
+	if (done < count)
+		printf("%04x did not finish within %lu us\n", opcodes[done], timeout);
+	print_registers();
+	chip8io_close();
+	return done == count ? 0 : 1;
+}
+
+static int test() {
+	/* LD VA,123; LD I,300; LD B,VA; ADD VA,1; LD V1,VA; SUB V1,V0; CALL 400 */
+	static const uint16_t setup[] = {
+		0x6A7B, 0xA300, 0xFA33, 0x7A01, 0x81A0, 0x6005, 0x8105, 0x2400
+	};
+	static const uint16_t wait_key[] = { 0xF30A };
+	int errors = 0, done;
+	chip8_opcode op;
+	double t;
+
+	if (chip8io_open("model"))
+		return 1;
+	pauseChip8();
+	writePC(MEMORY_START);
+
+	t = seconds();
+	done = chip8io_inject(setup, sizeof(setup) / sizeof(setup[0]), 1000000);
+	t = seconds() - t;
+	errors += chip8test_check_hex("completed", done, sizeof(setup) / sizeof(setup[0]));
+	errors += chip8test_check_hex("VA", readRegister(0xA), 124);
+	errors += chip8test_check_hex("V1", readRegister(0x1), 119);
+	errors += chip8test_check_hex("I", readIRegister(), 0x300);
+	errors += chip8test_check_hex("BCD hundreds", readMemory(0x300), 1);
+	errors += chip8test_check_hex("BCD tens", readMemory(0x301), 2);
+	errors += chip8test_check_hex("BCD ones", readMemory(0x302), 3);
+	errors += chip8test_check_hex("PC", readPC(), 0x400);
+	errors += chip8test_check_hex("SP", readStackPointer(), 1);
+	errors += chip8test_check_hex("state restored", chip8isPaused(), 1);
+	printf("%d instructions in %.1f us\n", done, t * 1e6);
+
+	/* Reading the stage back must not restart the instruction */
+	op.addr = INSTRUCTION_ADDR;
+	op.data = 0;
+	chip8_read(&op);
+	chip8_read(&op);
+	errors += chip8test_check_hex("stage after done", op.readdata >> 16, 0);
+	errors += chip8test_check_hex("instruction latched", op.readdata & 0xffff, 0x2400);
+
+	/* Fx0A holds the handshake until a key comes in */
+	chip8writekeypress(0, 0);
+	done = chip8io_inject(wait_key, 1, 2000);
+	errors += chip8test_check_hex("Fx0A without a key", done, 0);
+	errors += chip8test_check_hex("timed out", errno, ETIMEDOUT);
+	runInstructionChip8();
+	chip8writekeypress(0x9, 1);
+	errors += chip8test_check_hex("Fx0A with a key", chip8io_wait_instruction(2000), 0);
+	errors += chip8test_check_hex("V3", readRegister(0x3), 0x9);
+	errors += chip8test_check_hex("writeInstruction", writeInstruction(0x6A07), 0);
+	errors += chip8test_check_hex("VA after writeInstruction", readRegister(0xA), 7);
+	pauseChip8();
+
+	chip8io_close();
+	return chip8test_report(errors);
+}
+
+int main(int argc, char **argv) {
+	if (argc < 2)
+		usage();
+
+	if (strcmp(argv[1], "run") == 0)
+		return run(argc - 1, argv + 1);
+	if (strcmp(argv[1], "test") == 0 && argc == 2)
+		return test();
+
+	usage();
+	return 1;
+}
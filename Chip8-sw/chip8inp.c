@@ -0,0 +1,303 @@
+/*
+ * Input logs: replay and inspect what chip8 -i records
+ *
+ * chip8inp replay <log> [-b backend] [-r rom] [-s session]
+ *     Replays every session, or only the given one, as fast as the backend
+ *     goes and checks that each event lands on the instruction it was
+ *     recorded at and that the state at the end hashes the same
+ * chip8inp info <log> [-v]
+ *     Lists the sessions, -v the events as well
+ * chip8inp bench <log> [-b backend] [-r rom] [-n repeat]
+ *     Replays every session repeat times unattended and prints
+ *     instructions/s
+ * chip8inp test [-r rom]
+ *     Records a scripted session against the model, replays it into a
+ *     fresh model and checks the end state, then appends a second session
+ *     at another rate and phase and replays both
+ *
+ * Columbia University
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "chip8io.h"
+#include "chip8model.h"
+#include "chip8input.h"
+#include "chip8test.h"
+
+#define DEFAULT_ROM "../test/Pong.ch8"
+#define TEST_LOG "chip8inp-test.log"
+
+static const char *event_names[] = { "start", "pause", "reset" };
+
+static void usage() {
+	fprintf(stderr,
+		"Usage: chip8inp replay <log> [-b backend] [-r rom] [-s session]\n"
+		"       chip8inp info <log> [-v]\n"
+		"       chip8inp bench <log> [-b backend] [-r rom] [-n repeat]\n"
+		"       chip8inp test [-r rom]\n");
+	exit(1);
+}
+
+static void print_event(const struct chip8input_event *e) {
+	printf("  %10llu %8llu %10llu  ", (unsigned long long) e->at.retired,
+		(unsigned long long) e->at.tick, (unsigned long long) e->at.slot);
+	if (e->event <= CHIP8INPUT_KEY_MAX)
+		printf("key %X %s\n", e->event & 0xf, e->event & 0x10 ? "down" : "up");
+	else
+		printf("%s\n", event_names[e->event - CHIP8INPUT_START]);
+}
+
+static int info(const char *path, int argc, char **argv) {
+	struct chip8input_session *sessions;
+	struct stat st;
+	int verbose = 0, count, k, opt;
+	size_t e;
+
+	while ((opt = getopt(argc, argv, "v")) != -1) {
+		switch (opt) {
+		case 'v': verbose = 1; break;
+		default: usage();
+		}
+	}
+
+	if ((count = chip8input_load(path, &sessions)) < 0 || stat(path, &st))
+		return 1;
+	printf("%s: %d sessions, %lld bytes\n", path, count, (long long) st.st_size);
+	for (k = 0; k < count; ++k) {
+		const struct chip8input_session *s = &sessions[k];
+
+		printf("session %d: ROM image %08x, %u cycles per instruction, phase %u, %zu events",
+			k, s->rom_hash, s->cycles_per_instruction, s->phase, s->count);
+		if (s->ended)
+			printf(", %llu instructions, %llu ticks, state %08x\n",
+				(unsigned long long) s->end.retired, (unsigned long long) s->end.tick,
+				s->end_hash);
+		else
+			printf(", not ended\n");
+
+		if (!verbose)
+			continue;
+		printf("  %10s %8s %10s  event\n", "retired", "tick", "slot");
+		for (e = 0; e < s->count; ++e)
+			print_event(&s->events[e]);
+	}
+	chip8input_free(sessions, count);
+	return 0;
+}
+
+/* Replays a session into a freshly opened backend, returns 0 if it matched */
+static int replay_session(const struct chip8input_session *s, const char *backend,
+		const char *rom, struct chip8input_replay *r) {
+	int ret;
+
+	if (chip8io_open(backend))
+		return -1;
+	ret = chip8input_replay(s, rom, r);
+	chip8io_close();
+	if (ret)
+		return -1;
+	return r->diverged == 0 && r->hash_match != 0 ? 0 : 1;
+}
+
+static void print_replay(int k, const struct chip8input_replay *r) {
+	printf("session %d: %u events, %llu instructions in %.3f s, %.0f/s, %u diverged, %s\n",
+		k, r->events, (unsigned long long) r->instructions, r->seconds,
+		r->seconds > 0 ? r->instructions / r->seconds : 0, r->diverged,
+		r->hash_match < 0 ? "not ended" : r->hash_match ? "state matches" : "STATE DIFFERS");
+}
+
+static int replay(const char *path, int argc, char **argv) {
+	const char *backend = NULL, *rom = DEFAULT_ROM;
+	struct chip8input_session *sessions;
+	struct chip8input_replay r;
+	int only = -1, bad = 0, count, k, opt;
+
+	while ((opt = getopt(argc, argv, "b:r:s:")) != -1) {
+		switch (opt) {
+		case 'b': backend = optarg; break;
+		case 'r': rom = optarg; break;
+		case 's': only = atoi(optarg); break;
+		default: usage();
+		}
+	}
+
+	if ((count = chip8input_load(path, &sessions)) < 0)
+		return 1;
+	for (k = 0; k < count; ++k) {
+		if (only >= 0 && k != only)
+			continue;
+		if (replay_session(&sessions[k], backend, rom, &r) < 0) {
+			bad++;
+			continue;
+		}
+		print_replay(k, &r);
+		bad += r.diverged || r.hash_match == 0;
+	}
+	chip8input_free(sessions, count);
+	return bad ? 1 : 0;
+}
+
+static int bench(const char *path, int argc, char **argv) {
+	const char *backend = NULL, *rom = DEFAULT_ROM;
+	struct chip8input_session *sessions;
+	struct chip8input_replay r;
+	unsigned long long instructions = 0, events = 0;
+	double t = 0;
+	int repeat = 10, bad = 0, count, k, n, opt;
+
+	while ((opt = getopt(argc, argv, "b:r:n:")) != -1) {
+		switch (opt) {
+		case 'b': backend = optarg; break;
+		case 'r': rom = optarg; break;
+		case 'n': repeat = atoi(optarg); break;
+		default: usage();
+		}
+	}
+
+	if ((count = chip8input_load(path, &sessions)) < 0)
+		return 1;
+	for (n = 0; n < repeat; ++n) {
+		for (k = 0; k < count; ++k) {
+			if (replay_session(&sessions[k], backend, rom, &r))
+				bad++;
+			instructions += r.instructions;
+			events += r.events;
+			t += r.seconds;
+		}
+	}
+	chip8input_free(sessions, count);
+
+	printf("%d replays of %d sessions: %llu instructions, %llu events in %.3f s\n",
+		repeat, count, instructions, events, t);
+	printf("%.0f instructions/s, %d replays did not match\n", t > 0 ? instructions / t : 0, bad);
+	return bad ? 1 : 0;
+}
+
+/* Runs the model for whole frames, the way the clock thread would */
+static void frames(unsigned int n) {
+	while (n-- > 0)
+		chip8io_advance(chip8io_slots_per_frame());
+}
+
+/*
+* A scripted game of Pong: both paddles, a pause, a reset and key repeats
+* that must not be logged. Returns the hash of the state it ends in.
+*/
+static int record(const char *rom, unsigned int cycles_per_instruction, unsigned long phase,
+		uint32_t *hash) {
+	struct chip8input_writer w;
+	struct chip8_model *m;
+
+	if (chip8io_open("model"))
+		return -1;
+	m = chip8io_model();
+	m->cycles_per_instruction = cycles_per_instruction;
+	m->cycles = phase;
+	resetChip8(rom);
+	if (chip8input_start(&w, TEST_LOG, rom)) {
+		chip8io_close();
+		return -1;
+	}
+
+	startChip8();
+	frames(30);
+	chip8writekeypress(0x1, 1);
+	chip8writekeypress(0x1, 1);
+	frames(12);
+	chip8writekeypress(0x1, 0);
+	chip8writekeypress(0xC, 1);
+	frames(7);
+	chip8writekeypress(0xD, 1);
+	frames(20);
+	pauseChip8();
+	frames(5);
+	startChip8();
+	chip8writekeypress(0xD, 0);
+	frames(40);
+	resetChip8(rom);
+	startChip8();
+	frames(10);
+	chip8writekeypress(0x4, 1);
+	frames(25);
+	chip8writekeypress(0x4, 0);
+	frames(60);
+
+	if (chip8input_stop(&w) || chip8input_state_hash(hash)) {
+		chip8io_close();
+		return -1;
+	}
+	chip8io_close();
+	return 0;
+}
+
+static int test(int argc, char **argv) {
+	const char *rom = DEFAULT_ROM;
+	struct chip8input_session *sessions;
+	struct chip8input_replay r;
+	uint32_t hash[2];
+	struct stat st;
+	int errors = 0, count, k, opt;
+
+	while ((opt = getopt(argc, argv, "r:")) != -1) {
+		switch (opt) {
+		case 'r': rom = optarg; break;
+		default: usage();
+		}
+	}
+
+	unlink(TEST_LOG);
+	if (record(rom, CHIP8_CPU_CYCLE_LENGTH, 0, &hash[0]) ||
+			record(rom, CHIP8_CPU_CYCLE_LENGTH / 7, CHIP8_CLK_DIV_PERIOD / 3, &hash[1])) {
+		perror("recording failed");
+		return 1;
+	}
+	if ((count = chip8input_load(TEST_LOG, &sessions)) < 0 || stat(TEST_LOG, &st))
+		return 1;
+	errors += chip8test_check("sessions", count, 2);
+
+	for (k = 0; k < count && k < 2; ++k) {
+		const struct chip8input_session *s = &sessions[k];
+
+		/* start, 1 down, 1 up, C down, D down, pause, start, D up, reset, start, 4 down, 4 up */
+		errors += chip8test_check("events", s->count, 12);
+		errors += chip8test_check("ended", s->ended, 1);
+		errors += chip8test_check("end hash", s->end_hash, hash[k]);
+		if (replay_session(s, "model", rom, &r) < 0) {
+			errors++;
+			continue;
+		}
+		print_replay(k, &r);
+		errors += chip8test_check("diverged", r.diverged, 0);
+		errors += chip8test_check("state matches", r.hash_match, 1);
+		errors += chip8test_check("instructions", r.instructions, s->end.retired);
+	}
+	errors += chip8test_check("different sessions", count == 2 && hash[0] != hash[1], 1);
+	printf("%lld bytes for %zu events\n", (long long) st.st_size,
+		count == 2 ? sessions[0].count + sessions[1].count : 0);
+
+	chip8input_free(sessions, count);
+	unlink(TEST_LOG);
+	return chip8test_report(errors);
+}
+
+int main(int argc, char **argv) {
+	if (argc < 2)
+		usage();
+
+	if (strcmp(argv[1], "replay") == 0 && argc >= 3)
+		return replay(argv[2], argc - 2, argv + 2);
+	if (strcmp(argv[1], "info") == 0 && argc >= 3)
+		return info(argv[2], argc - 2, argv + 2);
+	if (strcmp(argv[1], "bench") == 0 && argc >= 3)
+		return bench(argv[2], argc - 2, argv + 2);
+	if (strcmp(argv[1], "test") == 0)
+		return test(argc - 1, argv + 1);
+
+	usage();
+	return 1;
+}
@@ -0,0 +1,536 @@
+/*
+ * Input log record and replay, see chip8input.h
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "chip8input.h"
+#include "chip8io.h"
+#include "chip8model.h"
+#include "chip8latency.h"
+#include "chip8state.h"
+
+/* Type byte and three varints */
+#define MAX_RECORD (1 + 3 * 10)
+
+/* Histogram fields a stamp is computed from */
+static const unsigned int stamp_fields[] = {
+	CHIP8LATENCY_COUNT, CHIP8LATENCY_HALT_LO, CHIP8LATENCY_HALT_HI
+};
+#define STAMP_FIELDS (sizeof(stamp_fields) / sizeof(stamp_fields[0]))
+
+static double seconds() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void put_u16(uint8_t *p, uint16_t v) {
+	p[0] = v & 0xff;
+	p[1] = v >> 8;
+}
+
+static void put_u32(uint8_t *p, uint32_t v) {
+	put_u16(p, v & 0xffff);
+	put_u16(p + 2, v >> 16);
+}
+
+static uint32_t get_u32(const uint8_t *p) {
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static size_t put_varint(uint8_t *p, uint64_t v) {
+	size_t n = 0;
+
+	while (v >= 0x80) {
+		p[n++] = (v & 0x7f) | 0x80;
+		v >>= 7;
+	}
+	p[n++] = v;
+	return n;
+}
+
+/* Returns the bytes used, 0 if the varint runs past end */
+static size_t get_varint(const uint8_t *p, const uint8_t *end, uint64_t *v) {
+	size_t n = 0;
+	unsigned int shift = 0;
+
+	*v = 0;
+	while (p + n < end && shift < 64) {
+		*v |= (uint64_t) (p[n] & 0x7f) << shift;
+		if ((p[n++] & 0x80) == 0)
+			return n;
+		shift += 7;
+	}
+	return 0;
+}
+
+void chip8input_stamp_model(const struct chip8_model *m, struct chip8input_stamp *s) {
+	s->retired = m->core.retired;
+	s->tick = m->ticks;
+	s->slot = m->slots;
+}
+
+/*
+* Every retired instruction took one CPU_CYCLE_LENGTH slot plus the cycles
+* it spent halted on Fx0A, so the histogram gives time as well as count
+*/
+int chip8input_stamp_histogram(struct chip8input_stamp *s) {
+	chip8_opcode ops[CHIP8LATENCY_CLASSES * STAMP_FIELDS];
+	uint64_t retired = 0, halt = 0, cycles;
+	unsigned int cls, k, n = 0;
+
+	for (cls = 0; cls < CHIP8LATENCY_CLASSES; ++cls) {
+		for (k = 0; k < STAMP_FIELDS; ++k) {
+			ops[n].addr = LATENCY_HIST_ADDR;
+			ops[n++].data = cls * CHIP8LATENCY_FIELDS + stamp_fields[k];
+		}
+	}
+	if (chip8io_batch(ops, n, 0))
+		return -1;
+
+	for (n = 0; n < CHIP8LATENCY_CLASSES * STAMP_FIELDS; n += STAMP_FIELDS) {
+		retired += ops[n].readdata;
+		halt += ops[n + 1].readdata | ((uint64_t) ops[n + 2].readdata << 32);
+	}
+	cycles = retired * CHIP8_CPU_CYCLE_LENGTH + halt;
+	s->retired = retired;
+	s->slot = cycles / CHIP8_CPU_CYCLE_LENGTH;
+	s->tick = cycles / CHIP8_CLK_DIV_PERIOD;
+	return 0;
+}
+
+/* Key state and run state are left out, they are what the log drives */
+int chip8input_state_hash(uint32_t *hash) {
+	static struct chip8_state s;
+
+	memset(&s, 0, sizeof(s));
+	if (chip8state_capture(&s))
+		return -1;
+	s.h.key = 0;
+	s.h.run_state = 0;
+	*hash = chip8state_hash((const uint8_t *) &s, sizeof(s));
+	return 0;
+}
+
+static uint64_t delta(uint64_t a, uint64_t b) {
+	return a > b ? a - b : 0;
+}
+
+/* Type byte and the deltas of now against the last record */
+static int write_record(struct chip8input_writer *w, uint8_t type,
+		const struct chip8input_stamp *now) {
+	uint8_t buf[MAX_RECORD];
+	uint64_t d;
+	size_t n = 0;
+
+	buf[n++] = type;
+	d = delta(delta(now->retired, w->base.retired), w->last.retired);
+	n += put_varint(buf + n, d);
+	w->last.retired += d;
+	d = delta(delta(now->tick, w->base.tick), w->last.tick);
+	n += put_varint(buf + n, d);
+	w->last.tick += d;
+	d = delta(delta(now->slot, w->base.slot), w->last.slot);
+	n += put_varint(buf + n, d);
+	w->last.slot += d;
+
+	return fwrite(buf, 1, n, w->f) == n ? 0 : -1;
+}
+
+/* A log that already has a header must be one of ours */
+static int check_header(const char *path) {
+	uint8_t header[CHIP8INPUT_HEADER_SIZE];
+	FILE *f = fopen(path, "rb");
+	size_t n;
+
+	if (f == NULL)
+		return 0;
+	n = fread(header, 1, sizeof(header), f);
+	fclose(f);
+	if (n == 0)
+		return 0;
+	if (n < sizeof(header) || memcmp(header, "C8IN", 4) != 0 ||
+			(header[4] | (header[5] << 8)) != CHIP8INPUT_VERSION) {
+		fprintf(stderr, "%s: not an input log\n", path);
+		return -1;
+	}
+	return 0;
+}
+
+int chip8input_create(struct chip8input_writer *w, const char *path, uint32_t rom_hash,
+		uint32_t cycles_per_instruction, uint32_t phase, const struct chip8input_stamp *now) {
+	uint8_t buf[CHIP8INPUT_HEADER_SIZE + 13];
+	size_t n = 0;
+
+	memset(w, 0, sizeof(*w));
+	w->key = -1;
+	w->state = -1;
+	w->base = *now;
+
+	if (check_header(path) || (w->f = fopen(path, "ab")) == NULL)
+		return -1;
+
+	fseek(w->f, 0, SEEK_END);
+	if (ftell(w->f) == 0) {
+		memcpy(buf, "C8IN", 4);
+		put_u16(buf + 4, CHIP8INPUT_VERSION);
+		put_u16(buf + 6, 0);
+		n = CHIP8INPUT_HEADER_SIZE;
+	}
+	buf[n++] = CHIP8INPUT_SESSION;
+	put_u32(buf + n, rom_hash);
+	put_u32(buf + n + 4, cycles_per_instruction);
+	put_u32(buf + n + 8, phase);
+	n += 12;
+
+	if (fwrite(buf, 1, n, w->f) != n || fflush(w->f)) {
+		fclose(w->f);
+		w->f = NULL;
+		return -1;
+	}
+	return 0;
+}
+
+/* Whether an event changes anything the log has not seen yet */
+static int changes(const struct chip8input_writer *w, unsigned int event) {
+	if (event <= CHIP8INPUT_KEY_MAX)
+		return (int) event != w->key;
+	if (event == CHIP8INPUT_START || event == CHIP8INPUT_PAUSE)
+		return (int) event != w->state;
+	return 1;
+}
+
+int chip8input_log(struct chip8input_writer *w, unsigned int event,
+		const struct chip8input_stamp *now) {
+	if (w->f == NULL || event > CHIP8INPUT_RESET)
+		return -1;
+	if (!changes(w, event))
+		return 0;
+
+	if (event <= CHIP8INPUT_KEY_MAX) {
+		w->key = event;
+	} else if (event == CHIP8INPUT_RESET) {
+		/* resetChip8 clears the key and pauses */
+		w->key = 0;
+		w->state = CHIP8INPUT_PAUSE;
+	} else {
+		w->state = event;
+	}
+
+	/* Flushed every time, a session cut short still replays up to its last event */
+	if (write_record(w, event, now) || fflush(w->f))
+		return -1;
+	return 0;
+}
+
+int chip8input_finish(struct chip8input_writer *w, const struct chip8input_stamp *now,
+		uint32_t hash) {
+	uint8_t buf[4];
+	int ret;
+
+	if (w->f == NULL)
+		return -1;
+	put_u32(buf, hash);
+	ret = write_record(w, CHIP8INPUT_END, now) || fwrite(buf, 1, 4, w->f) != 4 ? -1 : 0;
+	if (fclose(w->f))
+		ret = -1;
+	w->f = NULL;
+	return ret;
+}
+
+static void record_write(void *arg, unsigned int addr, unsigned int data,
+		const struct chip8_model *m) {
+	struct chip8input_writer *w = arg;
+	struct chip8input_stamp now;
+	unsigned int event;
+
+	if (addr == KEY_PRESS_ADDR)
+		event = data & CHIP8INPUT_KEY_MAX;
+	else if (addr == RESET_ADDR)
+		event = CHIP8INPUT_RESET;
+	else if ((data & 0x3) == RUNNING_STATE)
+		event = CHIP8INPUT_START;
+	else if ((data & 0x3) == RUN_INSTRUCTION_STATE)
+		return;
+	else
+		event = CHIP8INPUT_PAUSE;
+
+	/* Saves reading the histogram for the repeats chip8 writes on every report */
+	if (!changes(w, event))
+		return;
+	if (m != NULL)
+		chip8input_stamp_model(m, &now);
+	else if (chip8input_stamp_histogram(&now))
+		return;
+	chip8input_log(w, event, &now);
+}
+
+static int stamp_now(struct chip8input_stamp *s) {
+	struct chip8_model *m = chip8io_model();
+
+	if (m == NULL)
+		return chip8input_stamp_histogram(s);
+	chip8input_stamp_model(m, s);
+	return 0;
+}
+
+int chip8input_start(struct chip8input_writer *w, const char *path, const char *rom) {
+	uint8_t image[CHIP8_MEMORY_SIZE];
+	struct chip8_model *m = chip8io_model();
+	struct chip8input_stamp now;
+	uint32_t cycles_per_instruction = CHIP8_CPU_CYCLE_LENGTH, phase = 0;
+
+	if (chip8state_rom_image_file(image, rom)) {
+		fprintf(stderr, "could not read %s\n", rom);
+		return -1;
+	}
+	if (m != NULL) {
+		cycles_per_instruction = m->cycles_per_instruction;
+		phase = m->cycles;
+	}
+	if (stamp_now(&now) || chip8input_create(w, path,
+			chip8state_hash(image, CHIP8_MEMORY_SIZE), cycles_per_instruction, phase, &now))
+		return -1;
+
+	/* Right after resetChip8 */
+	w->key = 0;
+	w->state = CHIP8INPUT_PAUSE;
+	chip8io_set_write_hook(record_write, w);
+	return 0;
+}
+
+int chip8input_stop(struct chip8input_writer *w) {
+	struct chip8input_stamp now;
+	uint32_t hash;
+
+	chip8io_set_write_hook(NULL, NULL);
+	if (w->f == NULL)
+		return -1;
+	if (stamp_now(&now) || chip8input_state_hash(&hash)) {
+		fclose(w->f);
+		w->f = NULL;
+		return -1;
+	}
+	return chip8input_finish(w, &now, hash);
+}
+
+static int add_event(struct chip8input_session *s, size_t *cap, uint8_t event,
+		const struct chip8input_stamp *at) {
+	struct chip8input_event *events;
+
+	if (s->count == *cap) {
+		*cap = *cap ? *cap * 2 : 64;
+		events = realloc(s->events, *cap * sizeof(*events));
+		if (events == NULL)
+			return -1;
+		s->events = events;
+	}
+	s->events[s->count].event = event;
+	s->events[s->count++].at = *at;
+	return 0;
+}
+
+/* A record cut short at the end of the file ends the last session there */
+static int parse(const uint8_t *p, const uint8_t *end, struct chip8input_session **sessions) {
+	struct chip8input_session *s = NULL, *grown;
+	struct chip8input_stamp at;
+	uint64_t d[3];
+	size_t cap = 0, n;
+	int count = 0, k;
+
+	*sessions = NULL;
+	while (p < end) {
+		if (*p == CHIP8INPUT_SESSION) {
+			if (end - p < 13)
+				break;
+			grown = realloc(*sessions, (count + 1) * sizeof(*grown));
+			if (grown == NULL)
+				goto fail;
+			*sessions = grown;
+			s = &grown[count++];
+			memset(s, 0, sizeof(*s));
+			s->rom_hash = get_u32(p + 1);
+			s->cycles_per_instruction = get_u32(p + 5);
+			s->phase = get_u32(p + 9);
+			memset(&at, 0, sizeof(at));
+			cap = 0;
+			p += 13;
+			continue;
+		}
+
+		if (s == NULL || s->ended || (*p > CHIP8INPUT_RESET && *p != CHIP8INPUT_END)) {
+			fprintf(stderr, "corrupt input log at a %#x record\n", *p);
+			goto fail;
+		}
+		n = 1;
+		for (k = 0; k < 3; ++k) {
+			size_t used = get_varint(p + n, end, &d[k]);
+			if (used == 0)
+				return count;
+			n += used;
+		}
+		at.retired += d[0];
+		at.tick += d[1];
+		at.slot += d[2];
+
+		if (*p == CHIP8INPUT_END) {
+			if (end - p < (long) n + 4)
+				return count;
+			s->ended = 1;
+			s->end = at;
+			s->end_hash = get_u32(p + n);
+			n += 4;
+		} else if (add_event(s, &cap, *p, &at)) {
+			goto fail;
+		}
+		p += n;
+	}
+	return count;
+
+fail:
+	chip8input_free(*sessions, count);
+	*sessions = NULL;
+	return -1;
+}
+
+int chip8input_load(const char *path, struct chip8input_session **sessions) {
+	FILE *f = fopen(path, "rb");
+	uint8_t *buf;
+	long len;
+	int count;
+
+	if (f == NULL) {
+		perror(path);
+		return -1;
+	}
+	fseek(f, 0, SEEK_END);
+	len = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	buf = malloc(len > 0 ? len : 1);
+	if (buf == NULL || fread(buf, 1, len, f) != (size_t) len) {
+		fclose(f);
+		free(buf);
+		return -1;
+	}
+	fclose(f);
+
+	if (len < CHIP8INPUT_HEADER_SIZE || memcmp(buf, "C8IN", 4) != 0 ||
+			(buf[4] | (buf[5] << 8)) != CHIP8INPUT_VERSION) {
+		fprintf(stderr, "%s: not an input log\n", path);
+		free(buf);
+		return -1;
+	}
+	count = parse(buf + CHIP8INPUT_HEADER_SIZE, buf + len, sessions);
+	free(buf);
+	return count;
+}
+
+void chip8input_free(struct chip8input_session *sessions, int count) {
+	int k;
+
+	for (k = 0; k < count; ++k)
+		free(sessions[k].events);
+	free(sessions);
+}
+
+/*
+* Brings the backend up to a stamp relative to base. The model runs the
+* exact number of slots, which stops short only if it is not running. The
+* board and the RTL are paced on instructions retired.
+*/
+static int run_to(const struct chip8input_stamp *base, const struct chip8input_stamp *at,
+		struct chip8input_stamp *now) {
+	struct chip8_model *m = chip8io_model();
+	uint64_t target, last = 0;
+
+	if (m != NULL) {
+		target = base->slot + at->slot;
+		while (m->slots < target && m->state == RUNNING_STATE)
+			chip8io_advance(target - m->slots);
+		chip8input_stamp_model(m, now);
+		return 0;
+	}
+
+	target = base->retired + at->retired;
+	for (;;) {
+		if (chip8input_stamp_histogram(now))
+			return -1;
+		if (now->retired >= target)
+			return 0;
+		if (chip8io_simulated())
+			chip8io_advance(target - now->retired);
+		else if (now->retired == last && !chip8isRunning())
+			return 0;
+		last = now->retired;
+	}
+}
+
+static void apply(uint8_t event, const char *rom) {
+	switch (event) {
+	case CHIP8INPUT_START: startChip8(); break;
+	case CHIP8INPUT_PAUSE: pauseChip8(); break;
+	case CHIP8INPUT_RESET: resetChip8(rom); break;
+	default: chip8writekeypress(event & 0xf, event >> 4); break;
+	}
+}
+
+int chip8input_replay(const struct chip8input_session *s, const char *rom,
+		struct chip8input_replay *r) {
+	uint8_t image[CHIP8_MEMORY_SIZE];
+	struct chip8_model *m = chip8io_model();
+	struct chip8input_stamp base, now;
+	uint32_t hash;
+	size_t k;
+	double t;
+
+	memset(r, 0, sizeof(*r));
+	r->hash_match = -1;
+	if (chip8state_rom_image_file(image, rom)) {
+		fprintf(stderr, "could not read %s\n", rom);
+		return -1;
+	}
+	if (chip8state_hash(image, CHIP8_MEMORY_SIZE) != s->rom_hash)
+		fprintf(stderr, "%s is not the ROM the session was recorded with\n", rom);
+
+	resetChip8(rom);
+	if (m != NULL) {
+		m->cycles_per_instruction = s->cycles_per_instruction;
+		m->cycles = s->phase;
+	}
+	if (stamp_now(&base))
+		return -1;
+
+	t = seconds();
+	for (k = 0; k < s->count; ++k) {
+		const struct chip8input_event *e = &s->events[k];
+
+		if (run_to(&base, &e->at, &now))
+			return -1;
+		if (now.retired - base.retired != e->at.retired)
+			r->diverged++;
+		apply(e->event, rom);
+		r->events++;
+	}
+	if (s->ended) {
+		if (run_to(&base, &s->end, &now))
+			return -1;
+		if (now.retired - base.retired != s->end.retired)
+			r->diverged++;
+	} else if (stamp_now(&now)) {
+		return -1;
+	}
+	r->seconds = seconds() - t;
+	r->instructions = now.retired - base.retired;
+	r->slots = now.slot - base.slot;
+
+	if (s->ended) {
+		if (chip8input_state_hash(&hash))
+			return -1;
+		r->hash_match = hash == s->end_hash;
+	}
+	return 0;
+}
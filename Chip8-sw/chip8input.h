@@ -0,0 +1,144 @@
+#ifndef __CHIP8_INPUT_H__
+#define __CHIP8_INPUT_H__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+* Input log, deterministic record and replay of key presses
+*
+* Every key transition written to KEY_PRESS_ADDR, and every start, pause
+* and reset, is stamped with the number of instructions retired, 60 Hz
+* timer ticks and instruction slots (halted ones included) since the log
+* was started. Replaying the events at the same slots into a model that
+* starts in the same phase of the 60 Hz divider gives the same game.
+*
+* File layout (all integers little-endian, varints are LEB128):
+*
+* Header, once at the start of the file
+*   "C8IN", u16 version, u16 reserved
+*
+* Session record, starts a recording; a file holds any number of them and
+* new sessions are appended to the end
+*   u8 'S', u32 hash of the ROM image as in chip8state.h, u32 cycles per
+*   instruction, u32 cycles into the current 60 Hz tick
+*
+* Event record
+*   u8 event, varint retired delta, varint tick delta, varint slot delta
+*   Events 0x00-0x1F are key states as written to KEY_PRESS_ADDR, see
+*   CHIP8INPUT_* for the rest. Deltas are against the previous record of
+*   the session, so a key press costs 4 bytes.
+*
+* End record, written when the recording is closed
+*   u8 'E', varint retired delta, varint tick delta, varint slot delta,
+*   u32 hash of the state at that point (chip8input_state_hash)
+*
+* Against the model, stamps are exact. On the board they are computed from
+* the latency histogram (Chip8_Perf/Chip8_LatencyHist.sv) and are exact in
+* instructions, while the time spent in an Fx0A that has not finished yet
+* is missing from the slot and tick counts.
+*
+* The generator behind Cxkk is not visible through the register map and
+* resetChip8 leaves it alone, so a session replays exactly into a backend
+* opened fresh, like the one chip8 -i records from.
+*/
+
+#define CHIP8INPUT_VERSION 1
+#define CHIP8INPUT_HEADER_SIZE 8
+
+#define CHIP8INPUT_KEY_MAX 0x1F
+#define CHIP8INPUT_START 0x20
+#define CHIP8INPUT_PAUSE 0x21
+#define CHIP8INPUT_RESET 0x22
+#define CHIP8INPUT_SESSION 'S'
+#define CHIP8INPUT_END 'E'
+
+struct chip8_model;
+
+struct chip8input_stamp {
+	uint64_t retired;
+	uint64_t tick;
+	uint64_t slot;
+};
+
+struct chip8input_event {
+	uint8_t event;
+	struct chip8input_stamp at;     //Since the start of the session
+};
+
+struct chip8input_session {
+	uint32_t rom_hash;
+	uint32_t cycles_per_instruction;
+	uint32_t phase;                 //Cycles into the 60 Hz tick at the start
+	struct chip8input_event *events;
+	size_t count;
+	int ended;
+	struct chip8input_stamp end;
+	uint32_t end_hash;
+};
+
+struct chip8input_writer {
+	FILE *f;
+	struct chip8input_stamp base;   //Absolute stamp at the session start
+	struct chip8input_stamp last;   //Of the last record, relative to base
+	int key;                        //Last key state logged, -1 for none
+	int state;                      //Last start or pause logged, -1 for none
+};
+
+struct chip8input_replay {
+	uint64_t instructions;
+	uint64_t slots;
+	double seconds;
+	unsigned int events;
+	unsigned int diverged;          //Events reached at another instruction count
+	int hash_match;                 //-1 without an end record
+};
+
+/* Stamp of the model, exact between two instruction slots */
+void chip8input_stamp_model(const struct chip8_model *m, struct chip8input_stamp *s);
+/* Stamp read back from the latency histogram of the selected backend, 0 or -1 */
+int chip8input_stamp_histogram(struct chip8input_stamp *s);
+
+/* Hash of the architectural state of the selected backend, 0 or -1 */
+int chip8input_state_hash(uint32_t *hash);
+
+/*
+* Starts a session at the end of path, creating the file if needed. now is
+* the stamp at the start, phase the cycles into the current 60 Hz tick.
+*/
+int chip8input_create(struct chip8input_writer *w, const char *path, uint32_t rom_hash,
+		uint32_t cycles_per_instruction, uint32_t phase, const struct chip8input_stamp *now);
+
+/* Logs an event at an absolute stamp, key states and start/pause only when they change */
+int chip8input_log(struct chip8input_writer *w, unsigned int event,
+		const struct chip8input_stamp *now);
+
+/* Writes the end record with the state hash and closes the log */
+int chip8input_finish(struct chip8input_writer *w, const struct chip8input_stamp *now,
+		uint32_t hash);
+
+/*
+* Starts recording every write to KEY_PRESS_ADDR and STATE_ADDR made
+* through the selected chip8io backend, and every resetChip8, into a new
+* session of path. Call it right after resetChip8(rom) and before
+* chip8io_start_clock.
+*/
+int chip8input_start(struct chip8input_writer *w, const char *path, const char *rom);
+/* Stops recording and ends the session, after chip8io_stop_clock */
+int chip8input_stop(struct chip8input_writer *w);
+
+/* Reads every session in a log, returns the session count or -1 */
+int chip8input_load(const char *path, struct chip8input_session **sessions);
+void chip8input_free(struct chip8input_session *sessions, int count);
+
+/*
+* Replays a session through the selected chip8io backend, starting from
+* resetChip8(rom). The model is run slot by slot to each stamp as fast as
+* it goes. The board is paced by polling the latency histogram until it
+* has retired the instructions of the next event. Returns 0 or -1.
+*/
+int chip8input_replay(const struct chip8input_session *s, const char *rom,
+		struct chip8input_replay *r);
+
+#endif //__CHIP8_INPUT_H__
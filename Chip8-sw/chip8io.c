@@ -0,0 +1,1060 @@
+/*
+ * Register access helpers shared by chip8 and the host tools
+ *
+ * Every request goes through chip8io_ioctl, which forwards it either to
+ * the chip8driver ioctls on /dev/vga_led, to the in-process model in
+ * chip8model.c, or, when built with CHIP8_SIM, to the verilated RTL in
+ * chip8sim.cpp
+ *
+ * David Watkins (djw2146), Ashley Kling (ask2203)
+ * Columbia University
+ */
+
+#include <stdio.h>
+#include "chip8io.h"
+#include <sys/ioctl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "chip8model.h"
+#include "chip8trace.h"
+#include "chip8stats.h"
+#ifdef CHIP8_SIM
+#include "chip8sim.h"
+#endif
+
+#define FRAME_NS (1000000000L / 60)
+
+/* Backoff while waiting on an injected instruction */
+#define INJECT_SPIN_POLLS 16
+#define INJECT_MAX_SLEEP_US 1000
+/* Between polls of FRAMEBUFFER_STATUS_ADDR, a tenth of an instruction */
+#define PRESENT_POLL_US 100
+
+int chip8_fd = -1;
+/* Whether the device takes CHIP8_BATCH_ATTR, probed when it is opened */
+static int batch_supported;
+
+/* Set when the in-process model stands in for /dev/vga_led */
+static struct chip8_model *model;
+/* Set when the verilated RTL stands in for /dev/vga_led */
+static int sim;
+/*
+* One access at a time reaches the model, like transfers on the Avalon bus,
+* and two-step reads hold the lock of their register class across both
+* steps the way chip8driver.c does
+*/
+static pthread_mutex_t model_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t class_lock[CHIP8_CLASSES] = {
+	PTHREAD_MUTEX_INITIALIZER, PTHREAD_MUTEX_INITIALIZER,
+	PTHREAD_MUTEX_INITIALIZER, PTHREAD_MUTEX_INITIALIZER,
+};
+static int class_locking = 1;
+
+static chip8io_write_hook write_hook;
+static void *write_hook_arg;
+
+static pthread_t clock_thread;
+static atomic_int clock_running;
+
+/*
+* Request counters for the model and the verilated RTL, one chip8_stats per
+* thread where chip8driver.c keeps one per CPU. A thread registers its own
+* on its first request while counting is on, and it lives until exit.
+*/
+struct stats_slot {
+	struct chip8_stats stats;
+	struct stats_slot *next;
+};
+static struct stats_slot *stats_slots;
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static __thread struct stats_slot *thread_stats;
+static atomic_int stats_enabled;
+
+/*
+* An empty batch does nothing but answer whether the driver knows
+* CHIP8_BATCH_ATTR. Modules from before it fail unknown ioctls with EINVAL
+* rather than ENOTTY, so any failure means no batches.
+*/
+static int probe_batch() {
+	chip8_batch batch;
+
+	batch.ops = NULL;
+	batch.count = 0;
+	batch.write = 0;
+	return ioctl(chip8_fd, CHIP8_BATCH_ATTR, &batch) == 0;
+}
+
+int chip8io_open(const char *backend) {
+	if(backend == NULL || strcmp(backend, "device") == 0)
+		backend = CHIP8_DEVICE;
+
+	if(strcmp(backend, "model") == 0) {
+		model = malloc(sizeof(*model));
+		if(model == NULL)
+			return -1;
+		chip8model_init(model);
+		return 0;
+	}
+
+	if(strcmp(backend, "sim") == 0 || strcmp(backend, "sim-fast") == 0) {
+#ifdef CHIP8_SIM
+		if(chip8sim_open(strcmp(backend, "sim-fast") == 0))
+			return -1;
+		sim = 1;
+		return 0;
+#else
+		fprintf(stderr, "%s: built without the Verilator backend, see make sim\n", backend);
+		return -1;
+#endif
+	}
+
+	if((chip8_fd = open(backend, O_RDWR)) == -1) {
+		fprintf(stderr, "could not open %s\n", backend);
+		return -1;
+	}
+	batch_supported = probe_batch();
+	return 0;
+}
+
+void chip8io_close() {
+	chip8io_stop_clock();
+#ifdef CHIP8_SIM
+	if(sim) {
+		chip8sim_close();
+		sim = 0;
+	}
+#endif
+	if(model != NULL) {
+		free(model);
+		model = NULL;
+	}
+	if(chip8_fd != -1) {
+		close(chip8_fd);
+		chip8_fd = -1;
+	}
+}
+
+struct chip8_model *chip8io_model() {
+	return model;
+}
+
+static void lock_class(int cls) {
+	int i;
+
+	if(!class_locking || cls == CHIP8_CLASS_NONE)
+		return;
+	if(cls == CHIP8_CLASS_ALL) {
+		for(i = 0; i < CHIP8_CLASSES; ++i)
+			pthread_mutex_lock(&class_lock[i]);
+	} else {
+		pthread_mutex_lock(&class_lock[cls]);
+	}
+}
+
+static void unlock_class(int cls) {
+	int i;
+
+	if(!class_locking || cls == CHIP8_CLASS_NONE)
+		return;
+	if(cls == CHIP8_CLASS_ALL) {
+		for(i = CHIP8_CLASSES - 1; i >= 0; --i)
+			pthread_mutex_unlock(&class_lock[i]);
+	} else {
+		pthread_mutex_unlock(&class_lock[cls]);
+	}
+}
+
+/*
+* Stamps a traced KEY_PRESS_ADDR write. The model, which calls this under
+* the bus lock, stamps the next instruction it retires itself.
+*/
+static void trace_key_write(struct chip8_model *m) {
+	uint32_t id = chip8trace_current();
+
+	if(id == 0)
+		return;
+	chip8trace_point(CHIP8TRACE_KEY_WRITE, 0);
+	if(m != NULL) {
+		m->trace_id = id;
+		m->trace_due = m->core.retired + 1;
+	}
+}
+
+static void notify_write(unsigned int addr, unsigned int data, struct chip8_model *m) {
+	if(addr == KEY_PRESS_ADDR && chip8trace_enabled)
+		trace_key_write(m);
+	if(write_hook != NULL && (addr == KEY_PRESS_ADDR || addr == STATE_ADDR))
+		write_hook(write_hook_arg, addr, data, m);
+}
+
+void chip8io_set_write_hook(chip8io_write_hook hook, void *arg) {
+	write_hook = hook;
+	write_hook_arg = arg;
+}
+
+static struct chip8_stats *my_stats() {
+	if(thread_stats == NULL) {
+		if((thread_stats = calloc(1, sizeof(*thread_stats))) == NULL) {
+			perror("calloc");
+			exit(1);
+		}
+		pthread_mutex_lock(&stats_lock);
+		thread_stats->next = stats_slots;
+		stats_slots = thread_stats;
+		pthread_mutex_unlock(&stats_lock);
+	}
+	return &thread_stats->stats;
+}
+
+static uint64_t stats_start() {
+	struct timespec ts;
+
+	if(!atomic_load(&stats_enabled))
+		return 0;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void count_op(unsigned int addr, int write, int valid) {
+	if(atomic_load(&stats_enabled))
+		chip8stats_op(my_stats(), addr, write, valid);
+}
+
+static void count_ioctl(unsigned int type, unsigned int ops, long ret, uint64_t start) {
+	if(atomic_load(&stats_enabled) && start != 0)
+		chip8stats_ioctl(my_stats(), type, ops, ret != 0, stats_start() - start);
+}
+
+#ifdef CHIP8_SIM
+/*
+* Counts the requests of a batch the verilated RTL ran, up to the first
+* invalid one, and returns how many that is
+*/
+static unsigned int count_batch(const chip8_opcode *ops, unsigned int count, int write) {
+	unsigned int i;
+	int valid = 1;
+
+	if(count > CHIP8_BATCH_MAX)
+		return 0;
+	for(i = 0; i < count && valid; ++i) {
+		valid = isValidInstruction(ops[i].addr, ops[i].data, write) != 0;
+		count_op(ops[i].addr, write, valid);
+	}
+	return i;
+}
+#endif
+
+void chip8io_stats_enable(int enable) {
+	atomic_store(&stats_enabled, enable);
+}
+
+void chip8io_stats(struct chip8_stats *s) {
+	struct stats_slot *slot;
+
+	memset(s, 0, sizeof(*s));
+	pthread_mutex_lock(&stats_lock);
+	for(slot = stats_slots; slot != NULL; slot = slot->next)
+		chip8stats_add(s, &slot->stats);
+	pthread_mutex_unlock(&stats_lock);
+}
+
+void chip8io_stats_reset() {
+	struct stats_slot *slot;
+
+	pthread_mutex_lock(&stats_lock);
+	for(slot = stats_slots; slot != NULL; slot = slot->next)
+		memset(&slot->stats, 0, sizeof(slot->stats));
+	pthread_mutex_unlock(&stats_lock);
+}
+
+/* do_op in chip8driver.c against the model, returns 0 or -errno */
+static long model_op(chip8_opcode *op, int write) {
+	int isWrite, cls;
+
+	isWrite = isValidInstruction(op->addr, op->data, write);
+	count_op(op->addr, write, isWrite != 0);
+	if(isWrite == 0)
+		return -EINVAL;
+
+	cls = chip8_reg_class(op->addr);
+	lock_class(cls);
+
+	if(write || isWrite == 2) {
+		pthread_mutex_lock(&model_lock);
+		chip8model_write(model, op->addr, op->data);
+		if(write)
+			notify_write(op->addr, op->data, model);
+		pthread_mutex_unlock(&model_lock);
+	}
+	if(!write) {
+		pthread_mutex_lock(&model_lock);
+		op->readdata = chip8model_read(model, op->addr);
+		pthread_mutex_unlock(&model_lock);
+	}
+
+	unlock_class(cls);
+	return 0;
+}
+
+void chip8io_class_locking(int enable) {
+	class_locking = enable;
+}
+
+int chip8io_ioctl(unsigned long cmd, chip8_opcode *op) {
+	uint64_t start = stats_start();
+
+	if(model != NULL) {
+		long ret;
+		if(cmd != CHIP8_WRITE_ATTR && cmd != CHIP8_READ_ATTR) {
+			ret = -ENOTTY;
+		} else {
+			ret = model_op(op, cmd == CHIP8_WRITE_ATTR);
+			count_ioctl(cmd == CHIP8_WRITE_ATTR ? CHIP8STATS_WRITE : CHIP8STATS_READ, 1, ret, start);
+		}
+		if(ret) {
+			errno = -ret;
+			return -1;
+		}
+		return 0;
+	}
+
+#ifdef CHIP8_SIM
+	if(sim) {
+		long ret;
+		pthread_mutex_lock(&model_lock);
+		ret = chip8sim_ioctl(cmd, op);
+		pthread_mutex_unlock(&model_lock);
+		if(cmd == CHIP8_WRITE_ATTR || cmd == CHIP8_READ_ATTR) {
+			count_op(op->addr, cmd == CHIP8_WRITE_ATTR,
+				isValidInstruction(op->addr, op->data, cmd == CHIP8_WRITE_ATTR) != 0);
+			count_ioctl(cmd == CHIP8_WRITE_ATTR ? CHIP8STATS_WRITE : CHIP8STATS_READ, 1, ret, start);
+		}
+		if(ret) {
+			errno = -ret;
+			return -1;
+		}
+		if(cmd == CHIP8_WRITE_ATTR)
+			notify_write(op->addr, op->data, NULL);
+		return 0;
+	}
+#endif
+
+	if(ioctl(chip8_fd, cmd, op))
+		return -1;
+	if(cmd == CHIP8_WRITE_ATTR)
+		notify_write(op->addr, op->data, NULL);
+	return 0;
+}
+
+int chip8io_batch(chip8_opcode *ops, unsigned int count, int write) {
+	uint64_t start = stats_start();
+	chip8_batch batch;
+	unsigned int i;
+
+	batch.ops = ops;
+	batch.count = count;
+	batch.write = write;
+
+	if(model != NULL) {
+		long ret = count > CHIP8_BATCH_MAX ? -EINVAL : 0;
+		for(i = 0; i < count && ret == 0; ++i)
+			ret = model_op(&ops[i], write);
+		count_ioctl(CHIP8STATS_BATCH, i, ret, start);
+		if(ret) {
+			errno = -ret;
+			return -1;
+		}
+		return 0;
+	}
+
+#ifdef CHIP8_SIM
+	if(sim) {
+		long ret;
+		pthread_mutex_lock(&model_lock);
+		ret = chip8sim_batch(&batch);
+		pthread_mutex_unlock(&model_lock);
+		count_ioctl(CHIP8STATS_BATCH, count_batch(ops, count, write), ret, start);
+		if(ret) {
+			errno = -ret;
+			return -1;
+		}
+		for(i = 0; write && i < count; ++i)
+			notify_write(ops[i].addr, ops[i].data, NULL);
+		return 0;
+	}
+#endif
+
+	if(batch_supported && count <= CHIP8_BATCH_MAX) {
+		if(ioctl(chip8_fd, CHIP8_BATCH_ATTR, &batch))
+			return -1;
+	} else {
+		/* Drivers without CHIP8_BATCH_ATTR and longer batches, one ioctl per request */
+		for(i = 0; i < count; ++i) {
+			if(ioctl(chip8_fd, write ? CHIP8_WRITE_ATTR : CHIP8_READ_ATTR, &ops[i]))
+				return -1;
+		}
+	}
+	for(i = 0; write && i < count; ++i)
+		notify_write(ops[i].addr, ops[i].data, NULL);
+	return 0;
+}
+
+unsigned long chip8io_advance(unsigned long instructions) {
+	unsigned long retired = 0;
+
+	if(model == NULL && !sim)
+		return 0;
+	pthread_mutex_lock(&model_lock);
+	if(model != NULL)
+		retired = chip8model_run(model, instructions);
+#ifdef CHIP8_SIM
+	else
+		retired = chip8sim_run(instructions);
+#endif
+	pthread_mutex_unlock(&model_lock);
+	return retired;
+}
+
+int chip8io_simulated() {
+	return model != NULL || sim;
+}
+
+unsigned long chip8io_slots_per_frame() {
+	if(model != NULL)
+		return chip8model_slots_per_frame(model);
+	return (CHIP8_CLK_DIV_PERIOD + CHIP8_CPU_CYCLE_LENGTH - 1) / CHIP8_CPU_CYCLE_LENGTH;
+}
+
+/* Advances a simulated backend one frame every 1/60 s of wall time */
+static void *clock_f(void *arg) {
+	struct timespec deadline, now;
+
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	while(atomic_load(&clock_running)) {
+		chip8io_advance(chip8io_slots_per_frame());
+
+		deadline.tv_nsec += FRAME_NS;
+		while(deadline.tv_nsec >= 1000000000L) {
+			deadline.tv_nsec -= 1000000000L;
+			deadline.tv_sec++;
+		}
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL);
+
+		/* A slow simulation runs behind real time rather than in bursts */
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if(now.tv_sec > deadline.tv_sec + 1)
+			deadline = now;
+	}
+	return NULL;
+}
+
+int chip8io_start_clock() {
+	if(!chip8io_simulated() || atomic_load(&clock_running))
+		return 0;
+	atomic_store(&clock_running, 1);
+	if(pthread_create(&clock_thread, NULL, clock_f, NULL)) {
+		atomic_store(&clock_running, 0);
+		return -1;
+	}
+	return 0;
+}
+
+void chip8io_stop_clock() {
+	if(!atomic_load(&clock_running))
+		return;
+	atomic_store(&clock_running, 0);
+	pthread_join(clock_thread, NULL);
+}
+
+void quit_program(int signal) {
+	printf("Chip8 is terminating\n");
+	chip8io_close();
+	exit(0);
+}
+
+void chip8_write(chip8_opcode *op) {
+	if(chip8io_ioctl(CHIP8_WRITE_ATTR, op)) {
+		perror("ioctl(CHIP8_WRITE_ATTR) failed");
+		quit_program(0);
+	}
+}
+
+void chip8_read(chip8_opcode *op) {
+	if(chip8io_ioctl(CHIP8_READ_ATTR, op)) {
+		perror("ioctl(CHIP8_READ_ATTR) failed");
+		printf("(%d, %d)\n", op->addr, op->data);
+		quit_program(0);
+	}
+}
+
+void setFramebuffer(int x, int y, int value) {
+	chip8_opcode op;
+	op.addr = FRAMEBUFFER_ADDR;
+	op.data = (1 << 12) | ((value & 0x1) << 11) | ((x & 0x3f) << 5) | (y & 0x1f);
+	chip8_write(&op);
+}
+
+int readFramebuffer(int x, int y) {
+	chip8_opcode op;
+	op.addr = FRAMEBUFFER_ADDR;
+	op.data = (0 << 12) | (0 << 11) | ((x & 0x3f) << 5) | (y & 0x1f);
+	chip8_read(&op);
+	return op.readdata;
+}
+
+void flipPixel(int x, int y) {
+	int px = readFramebuffer(x, y);
+	setFramebuffer(x, y, !px);
+}
+
+/*
+* Reads the whole 64x32 back buffer into one uint64_t per row,
+* bit x of rows[y] is pixel (x, y)
+*/
+void readFramebufferPacked(uint64_t rows[CHIP8_FB_HEIGHT]) {
+	static chip8_opcode ops[CHIP8_FB_WIDTH * CHIP8_FB_HEIGHT];
+	int x, y;
+
+	for(y = 0; y < CHIP8_FB_HEIGHT; ++y) {
+		for(x = 0; x < CHIP8_FB_WIDTH; ++x) {
+			chip8_opcode *op = &ops[y * CHIP8_FB_WIDTH + x];
+			op->addr = FRAMEBUFFER_ADDR;
+			op->data = ((x & 0x3f) << 5) | (y & 0x1f);
+		}
+	}
+
+	if(chip8io_batch(ops, CHIP8_FB_WIDTH * CHIP8_FB_HEIGHT, 0)) {
+		perror("framebuffer read failed");
+		quit_program(0);
+	}
+
+	for(y = 0; y < CHIP8_FB_HEIGHT; ++y) {
+		uint64_t row = 0;
+		for(x = 0; x < CHIP8_FB_WIDTH; ++x) {
+			if(ops[y * CHIP8_FB_WIDTH + x].readdata & 0x1)
+				row |= 1ULL << x;
+		}
+		rows[y] = row;
+	}
+}
+
+int readFramebufferStatus() {
+	chip8_opcode op;
+	op.addr = FRAMEBUFFER_STATUS_ADDR;
+	chip8_read(&op);
+	return op.readdata;
+}
+
+int chip8io_wait_present(unsigned int frames) {
+	unsigned int status, first;
+	unsigned int polls = 0;
+	int running;
+	chip8_opcode op;
+
+	op.addr = FRAMEBUFFER_STATUS_ADDR;
+	op.data = 0;
+	if(chip8io_ioctl(CHIP8_READ_ATTR, &op))
+		return -1;
+	first = FRAMEBUFFER_STATUS_FRAMES(op.readdata);
+	for(;;) {
+		status = op.readdata;
+		if(!(status & (FRAMEBUFFER_STATUS_PENDING | FRAMEBUFFER_STATUS_BUSY)))
+			return 0;
+		if(((FRAMEBUFFER_STATUS_FRAMES(status) - first) & 0xffff) >= frames) {
+			errno = ETIMEDOUT;
+			return -1;
+		}
+
+		/* Board time only passes for the model while it runs */
+		if(model != NULL) {
+			pthread_mutex_lock(&model_lock);
+			running = model->state == RUNNING_STATE;
+			pthread_mutex_unlock(&model_lock);
+			if(!running) {
+				errno = ETIMEDOUT;
+				return -1;
+			}
+			chip8io_advance(1);
+		}
+#ifdef CHIP8_SIM
+		/* The verilated board keeps time, running or not */
+		else if(sim) {
+			pthread_mutex_lock(&model_lock);
+			chip8sim_clock(CHIP8_CPU_CYCLE_LENGTH);
+			pthread_mutex_unlock(&model_lock);
+		}
+#endif
+		else if(++polls >= INJECT_SPIN_POLLS) {
+			usleep(PRESENT_POLL_US);
+		}
+
+		if(chip8io_ioctl(CHIP8_READ_ATTR, &op))
+			return -1;
+	}
+}
+
+void readMemoryBlock(uint8_t *buf, int address, int len) {
+	static chip8_opcode ops[MEMORY_END];
+	int i;
+
+	if(len > MEMORY_END)
+		len = MEMORY_END;
+	for(i = 0; i < len; ++i) {
+		ops[i].addr = MEMORY_ADDR;
+		ops[i].data = ((address + i) & 0xfff) << 8;
+	}
+
+	if(chip8io_batch(ops, len, 0)) {
+		perror("memory read failed");
+		quit_program(0);
+	}
+
+	for(i = 0; i < len; ++i)
+		buf[i] = ops[i].readdata & 0xff;
+}
+
+void setMemory(int address, int data) {
+	chip8_opcode op;
+	op.addr = MEMORY_ADDR;
+	op.data = (1 << 20) | ((address & 0xfff) << 8) | (data & 0xff);
+	chip8_write(&op);	
+}
+
+int readMemory(int address) {
+	chip8_opcode op;
+	op.addr = MEMORY_ADDR;
+	op.data = (0 << 20) | ((address & 0xfff) << 8) | (0 & 0xff);
+	chip8_read(&op);
+	return (op.readdata & 0xff);
+}
+
+void setIRegister(int data) {
+	chip8_opcode op;
+	op.addr = I_ADDR;
+	op.data = (data & 0xffff);
+	chip8_write(&op);
+}
+
+int readIRegister() {
+	chip8_opcode op;
+	op.addr = I_ADDR;
+	chip8_read(&op);
+	return op.readdata;
+}
+
+int readRegister(int reg) {
+	chip8_opcode op;
+	op.addr = V0_ADDR + 4 * (reg & 0xf);
+	chip8_read(&op);
+	return op.readdata;
+}
+
+void writeRegister(int reg, int value) {
+	chip8_opcode op;
+	op.addr = V0_ADDR + 4 * (reg & 0xf);
+	op.data = value & 0xff;
+	chip8_write(&op);
+}
+
+/*
+* Load the font set onto the chip8 sequentially
+* Uses the op codes specified in chip8driver.h
+*/
+void loadfontset() {
+	int i;
+	for(i = 0; i < FONTSET_LENGTH; ++i) {
+		setMemory(i, chip8_fontset[i]);
+		// int mem_val = readMemory(i);
+		// printf("(Address: %d) Wrote: %d, Read: %d\n", i, CHIP8_FONTSET[i], mem_val);
+		int got = readMemory(i);
+		if (chip8_fontset[i] != got) {
+			printf("Memory mismatch (expected: %d, got: %d)\n", chip8_fontset[i], got);
+		} 
+	}
+}
+
+void refreshFrameBuffer() {
+	int x, y;
+	for(x = 0; x < 64; ++x) {
+		for(y = 0; y < 32; ++y) {
+
+			// int mem_val = readFramebuffer(x, y);
+			setFramebuffer(x, y, 0);
+
+			// printf("(x: %d, y: %d) Wrote: %d, Read: %d\n", x, y, !mem_val, mem_val);
+		}
+	}
+}
+
+/*
+* Loads a ROM file onto the chip8 with one batch of writes, clearing the
+* rest of program memory, then reads it back with readMemoryBlock
+*/
+void loadROM(const char* romfilename) {
+	static uint8_t image[MEMORY_END - MEMORY_START], got[MEMORY_END - MEMORY_START];
+	static chip8_opcode ops[MEMORY_END - MEMORY_START];
+	FILE *romfile;
+	int i;
+
+	if((romfile = fopen(romfilename, "rb")) == NULL) {
+		perror(romfilename);
+		return;
+	}
+	memset(image, 0, sizeof(image));
+	fread(image, 1, sizeof(image), romfile);
+	fclose(romfile);
+
+	for(i = 0; i < MEMORY_END - MEMORY_START; ++i) {
+		ops[i].addr = MEMORY_ADDR;
+		ops[i].data = (1 << 20) | ((MEMORY_START + i) << 8) | image[i];
+	}
+	if(chip8io_batch(ops, MEMORY_END - MEMORY_START, 1)) {
+		perror("ROM write failed");
+		quit_program(0);
+	}
+
+	readMemoryBlock(got, MEMORY_START, MEMORY_END - MEMORY_START);
+	for(i = 0; i < MEMORY_END - MEMORY_START; ++i) {
+		if(image[i] != got[i])
+			printf("Memory mismatch at 0x%03x (expected: %d, got: %d)\n", MEMORY_START + i, image[i], got[i]);
+	}
+}
+
+void resetMemory() {
+	int i;
+	for(i = 0; i < MEMORY_END; i++) {
+		setMemory(i, 0);
+	}
+}
+
+void startChip8() {
+	chip8_opcode op;
+	op.addr = STATE_ADDR;
+	op.data = RUNNING_STATE;
+
+	chip8_write(&op);
+}
+
+void pauseChip8() {
+	chip8_opcode op;
+	op.addr = STATE_ADDR;
+	op.data = PAUSED_STATE;
+
+	chip8_write(&op);
+}
+
+void runInstructionChip8() {
+	chip8_opcode op;
+	op.addr = STATE_ADDR;
+	op.data = RUN_INSTRUCTION_STATE;
+
+	chip8_write(&op);
+}
+
+int chip8isRunning() {
+	chip8_opcode op;
+	op.addr = STATE_ADDR;
+	chip8_read(&op);
+	return op.readdata == RUNNING_STATE;
+}
+
+int chip8isPaused() {
+	chip8_opcode op;
+	op.addr = STATE_ADDR;
+	chip8_read(&op);
+	return op.readdata == PAUSED_STATE;
+}
+
+int chip8isRunInstruction() {
+	chip8_opcode op;
+	op.addr = STATE_ADDR;
+	chip8_read(&op);
+	return op.readdata == RUN_INSTRUCTION_STATE;
+}
+
+int readPC() {
+	chip8_opcode op;
+	op.addr = PROGRAM_COUNTER_ADDR;
+	chip8_read(&op);
+	// fprintf(fp, "Instruction: %04x, PC: %d\n", (op.readdata & 0xfffff000) >> 12, (op.readdata & 0xfff));
+	return (op.readdata & 0xfff);
+}
+
+void writePC(int pc) {
+	chip8_opcode op;
+	op.addr = PROGRAM_COUNTER_ADDR;
+	op.data = pc;
+	chip8_write(&op);
+}
+
+void printMemory() {
+	int i = 0;
+	for(i = 0; i < MEMORY_END; ++i) {
+		printf("%d ", readMemory(i));
+	}
+	printf("\n");
+}
+
+int readStackPointer() {
+	chip8_opcode op;
+	op.addr = STACK_POINTER_ADDR;
+	chip8_read(&op);
+	return op.readdata;
+}
+
+void resetStack() {
+	chip8_opcode op;
+	op.addr = STACK_ADDR;
+	chip8_write(&op);
+}
+
+int readSoundTimer() {
+	chip8_opcode op;
+	op.addr = SOUND_TIMER_ADDR;
+	chip8_read(&op);
+	return op.readdata;
+}
+
+void writeSoundTimer(int value) {
+	chip8_opcode op;
+	op.addr = SOUND_TIMER_ADDR;
+	op.data = value;
+	chip8_write(&op);
+}
+
+int readDelayTimer() {
+	chip8_opcode op;
+	op.addr = DELAY_TIMER_ADDR;
+	chip8_read(&op);
+	return op.readdata;
+}
+
+void writeDelayTimer(int value) {
+	chip8_opcode op;
+	op.addr = DELAY_TIMER_ADDR;
+	op.data = value;
+	chip8_write(&op);
+}
+
+int writeInstruction(int instruction) {
+	chip8_opcode op;
+	op.addr = INSTRUCTION_ADDR;
+	op.data = instruction;
+	chip8_write(&op);
+
+	return chip8io_wait_instruction(1000000);
+}
+
+int chip8io_wait_instruction(unsigned long timeout_us) {
+	struct timespec start, now;
+	unsigned long sleep_us = 0;
+	unsigned int polls = 0;
+	chip8_opcode op;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for(;;) {
+		op.addr = INSTRUCTION_ADDR;
+		op.data = 0;
+		if(chip8io_ioctl(CHIP8_READ_ATTR, &op))
+			return -1;
+		if((op.readdata >> 16) == 0)
+			return 0;
+
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if((now.tv_sec - start.tv_sec) * 1000000UL + (now.tv_nsec - start.tv_nsec) / 1000 >= timeout_us) {
+			errno = ETIMEDOUT;
+			return -1;
+		}
+
+		/* The verilated RTL only moves when clocked */
+		if(sim) {
+			chip8io_advance(1);
+			continue;
+		}
+
+		/* Most instructions are done within a few polls, then back off */
+		if(++polls < INJECT_SPIN_POLLS)
+			continue;
+		sleep_us = sleep_us ? sleep_us * 2 : 1;
+		if(sleep_us > INJECT_MAX_SLEEP_US)
+			sleep_us = INJECT_MAX_SLEEP_US;
+		usleep(sleep_us);
+	}
+}
+
+int chip8io_inject(const uint16_t *instructions, unsigned int count, unsigned long timeout_us) {
+	chip8_opcode op;
+	unsigned int state, k;
+	int done = -1;
+
+	op.addr = STATE_ADDR;
+	op.data = 0;
+	if(chip8io_ioctl(CHIP8_READ_ATTR, &op))
+		return -1;
+	state = op.readdata & 0x3;
+
+	/* Let an instruction the CPU was running finish first */
+	op.data = RUN_INSTRUCTION_STATE;
+	if(chip8io_ioctl(CHIP8_WRITE_ATTR, &op))
+		return -1;
+	if(chip8io_wait_instruction(timeout_us))
+		goto out;
+
+	for(k = 0; k < count; ++k) {
+		op.addr = INSTRUCTION_ADDR;
+		op.data = instructions[k];
+		if(chip8io_ioctl(CHIP8_WRITE_ATTR, &op) || chip8io_wait_instruction(timeout_us))
+			break;
+	}
+	done = k;
+
+out:
+	op.addr = STATE_ADDR;
+	op.data = state;
+	if(state != RUN_INSTRUCTION_STATE && chip8io_ioctl(CHIP8_WRITE_ATTR, &op))
+		return -1;
+	return done;
+}
+
+int readInstruction() {
+	chip8_opcode op;
+	op.addr = INSTRUCTION_ADDR;
+	chip8_read(&op);
+	return op.readdata;
+}
+
+
+/* Instructions retired so far, from the counts in the latency histogram */
+static int read_retired(uint64_t *retired) {
+	chip8_opcode ops[CHIP8LATENCY_CLASSES];
+	unsigned int cls;
+
+	for(cls = 0; cls < CHIP8LATENCY_CLASSES; ++cls) {
+		ops[cls].addr = LATENCY_HIST_ADDR;
+		ops[cls].data = cls * CHIP8LATENCY_FIELDS + CHIP8LATENCY_COUNT;
+	}
+	if(chip8io_batch(ops, CHIP8LATENCY_CLASSES, 0))
+		return -1;
+	*retired = 0;
+	for(cls = 0; cls < CHIP8LATENCY_CLASSES; ++cls)
+		*retired += ops[cls].readdata;
+	return 0;
+}
+
+/* Polls until the board retires an instruction after a traced key write */
+static void trace_board_retire(uint32_t id, uint64_t before) {
+	struct timespec start, now;
+	uint64_t retired;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	do {
+		if(read_retired(&retired))
+			return;
+		if(retired != before) {
+			chip8trace_point_id(id, CHIP8TRACE_RETIRE, 0);
+			return;
+		}
+		clock_gettime(CLOCK_MONOTONIC, &now);
+	} while((now.tv_sec - start.tv_sec) * 1000000L + (now.tv_nsec - start.tv_nsec) / 1000 <
+			CHIP8TRACE_RETIRE_TIMEOUT_US);
+}
+
+void chip8writekeypress(char val, unsigned int ispressed) {
+	chip8_opcode op;
+	uint32_t id = model == NULL ? chip8trace_current() : 0;
+	uint64_t before;
+
+	op.addr = KEY_PRESS_ADDR;
+	op.data = ((ispressed & 0x1) << 4) | (val & 0xf);
+	if(id != 0 && read_retired(&before))
+		id = 0;
+	chip8_write(&op);
+	if(id != 0)
+		trace_board_retire(id, before);
+}
+
+void printKeyState() {
+	chip8_opcode op;
+	op.addr = KEY_PRESS_ADDR;
+	chip8_read(&op);
+
+	printf("Is pressed: %d, Key val: %d, raw value: %d\n", (op.readdata & 0x10) >> 4, (op.readdata & 0xf), op.readdata);
+}
+
+void writeReset() {
+	chip8_opcode op;
+	op.addr = RESET_ADDR;
+	chip8_write(&op);
+}
+
+void printStatus(FILE *out, int index) {
+
+	fprintf(out, "Status %d\n", index);
+	if(chip8isPaused()) {
+		fprintf(out, "Paused\n");
+	} else if(chip8isRunning()) {
+		fprintf(out, "Running\n");
+	} else {
+		fprintf(out, "Run Instruction\n");
+	}
+	int pc = readPC();
+	int mem = readMemory(pc);
+	int mem2 = readMemory(pc + 1);
+	fprintf(out, "Program counter is: %d, instruction is: %04x / %04x\n", pc, mem << 4 | mem2, readInstruction());
+	fprintf(out, "I register: %d\n", readIRegister());
+	int i;
+	for(i = 0; i < 0x10; ++i) {
+	fprintf(out, "v%d: %d\n", i, readRegister(i));
+	}
+
+	fprintf(out, "Sound timer: %d\n", readSoundTimer());
+	fprintf(out, "Delay timer: %d\n\n", readDelayTimer());
+}
+
+
+void resetChip8(const char* filename) {
+	chip8io_write_hook hook = write_hook;
+
+	if(hook != NULL && model != NULL) {
+		pthread_mutex_lock(&model_lock);
+		hook(write_hook_arg, RESET_ADDR, 0, model);
+		pthread_mutex_unlock(&model_lock);
+	} else if(hook != NULL) {
+		hook(write_hook_arg, RESET_ADDR, 0, NULL);
+	}
+	write_hook = NULL;
+
+	//Need to write to registers and all
+	//Reload font set etc.
+	pauseChip8();
+	resetMemory();
+
+	loadfontset();
+	if(filename != 0)
+		loadROM(filename);
+	refreshFrameBuffer();
+
+	int i;
+	for(i = 0; i < 0x10; ++i) {
+		writeRegister(i, 0);
+	}
+
+	// printMemory();
+	writePC(0x200);
+	setIRegister(0);
+	resetStack();
+	chip8writekeypress(0, 0);
+	writeSoundTimer(0);
+	writeDelayTimer(0);
+	write_hook = hook;
+	printStatus(stdout, 0);
+}
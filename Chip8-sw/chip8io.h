@@ -0,0 +1,183 @@
+#ifndef __CHIP8_IO_H__
+#define __CHIP8_IO_H__
+
+#include <stdio.h>
+#include <stdint.h>
+#include "chip8driver.h"
+#include "chip8core.h"
+
+#define CHIP8_DEVICE "/dev/vga_led"
+
+#define FONTSET_LENGTH CHIP8_FONTSET_LENGTH
+#define MEMORY_START 0x200
+#define MEMORY_END 0x1000
+
+struct chip8_model;
+struct chip8_stats;
+
+extern int chip8_fd;
+
+/*
+* Selects where register requests go:
+* * NULL or "device" - the chip8driver ioctls on /dev/vga_led
+* * "model"          - the in-process model in chip8model.c
+* * "sim", "sim-fast" - the verilated RTL in chip8sim.cpp, only in binaries
+*                      built by make sim. sim-fast skips padding stages.
+* * anything else    - path of a device node speaking the chip8driver ioctls
+* Returns 0 on success, -1 if the backend could not be opened
+*/
+int chip8io_open(const char *backend);
+void chip8io_close();
+
+/* The in-process model, or NULL when talking to a device */
+struct chip8_model *chip8io_model();
+
+/* ioctl(2) against the selected backend */
+int chip8io_ioctl(unsigned long cmd, chip8_opcode *op);
+
+/*
+* Performs a sequence of reads (write == 0) or writes with as few system
+* calls as the backend allows, see CHIP8_BATCH_ATTR
+*/
+int chip8io_batch(chip8_opcode *ops, unsigned int count, int write);
+
+/*
+* Lets the model execute up to the given number of instructions. The board
+* runs on its own, so this does nothing for the device. Safe to call from
+* another thread than the one making requests.
+* Returns the number of instructions retired.
+*/
+unsigned long chip8io_advance(unsigned long instructions);
+
+/*
+* The model takes the same per-class locks as chip8driver.c, see
+* chip8_reg_class. chip8stress turns them off to show the torn reads
+* they prevent.
+*/
+void chip8io_class_locking(int enable);
+
+/*
+* Called after every write to KEY_PRESS_ADDR or STATE_ADDR, and with
+* RESET_ADDR when resetChip8 starts; the writes resetChip8 makes itself are
+* not reported. For the model the hook runs under the bus lock and is given
+* the model, so no instruction retires between the write and the hook, and
+* it must not make requests. Otherwise it is given NULL once the request
+* has completed. chip8input.c records input through it.
+*/
+typedef void (*chip8io_write_hook)(void *arg, unsigned int addr, unsigned int data,
+		const struct chip8_model *m);
+void chip8io_set_write_hook(chip8io_write_hook hook, void *arg);
+
+/* Nonzero for the model and the verilated RTL, which only run when advanced */
+int chip8io_simulated();
+/* Instruction slots in one 60 Hz frame of board time */
+unsigned long chip8io_slots_per_frame();
+
+/*
+* Advances a simulated backend in real time from a background thread, one
+* frame of slots every 1/60 s. Does nothing for the device, which has its
+* own clock. chip8io_close stops it.
+*/
+int chip8io_start_clock();
+void chip8io_stop_clock();
+
+/*
+* Counts requests to the model and the verilated RTL the way chip8driver.c
+* counts them for the board, see chip8stats.h, in a chip8_stats per thread.
+* Off until enabled; the board's are read from debugfs.
+*/
+void chip8io_stats_enable(int enable);
+/* Sums every thread's counters into s */
+void chip8io_stats(struct chip8_stats *s);
+void chip8io_stats_reset();
+
+void quit_program(int signal);
+
+void chip8_write(chip8_opcode *op);
+void chip8_read(chip8_opcode *op);
+
+void setFramebuffer(int x, int y, int value);
+/*
+* Reads the back buffer, which holds drawing not yet presented; it is the
+* frame on screen only once chip8io_wait_present has returned 0 and until
+* the next CLS, DRW or setFramebuffer
+*/
+int readFramebuffer(int x, int y);
+void flipPixel(int x, int y);
+void readFramebufferPacked(uint64_t rows[CHIP8_FB_HEIGHT]);
+/* FRAMEBUFFER_STATUS_ADDR, see chip8driver.h */
+int readFramebufferStatus();
+
+/*
+* Waits until FRAMEBUFFER_STATUS_ADDR reads neither pending nor busy, so
+* the back buffer matches the screen. Polls the device, sleeping 100 us
+* between polls after the first few, and runs the model up to its next
+* vertical blank. Returns 0, or -1 with errno ETIMEDOUT after the given
+* number of vertical blanks or at once for a model that is not running,
+* or set by a failed ioctl. The verilated RTL is clocked an instruction
+* slot at a time, whether it runs or not.
+*/
+int chip8io_wait_present(unsigned int frames);
+
+void setMemory(int address, int data);
+int readMemory(int address);
+/* Reads len bytes of memory starting at address with a single batch */
+void readMemoryBlock(uint8_t *buf, int address, int len);
+void setIRegister(int data);
+int readIRegister();
+int readRegister(int reg);
+void writeRegister(int reg, int value);
+
+void loadfontset();
+void refreshFrameBuffer();
+void loadROM(const char* romfilename);
+void resetMemory();
+
+void startChip8();
+void pauseChip8();
+void runInstructionChip8();
+int chip8isRunning();
+int chip8isPaused();
+int chip8isRunInstruction();
+
+int readPC();
+void writePC(int pc);
+void printMemory();
+void resetStack();
+int readStackPointer();
+int readSoundTimer();
+void writeSoundTimer(int value);
+int readDelayTimer();
+void writeDelayTimer(int value);
+/*
+* Writes INSTRUCTION_ADDR, then waits up to a second for it to finish.
+* Returns chip8io_wait_instruction's result, -1 with ETIMEDOUT if it never
+* did, as in RUNNING_STATE or on Fx0A without a key.
+*/
+int writeInstruction(int instruction);
+int readInstruction();
+
+/*
+* Waits until the stage read back from INSTRUCTION_ADDR is 0, polling back
+* to back at first and then sleeping with exponential backoff up to 1 ms.
+* Returns 0, or -1 with errno ETIMEDOUT after timeout_us or set by a failed
+* ioctl.
+*/
+int chip8io_wait_instruction(unsigned long timeout_us);
+
+/*
+* Runs count instructions one after another in RUN_INSTRUCTION_STATE, each
+* started once the one before is done, then restores the previous state.
+* An instruction the CPU was in the middle of finishes first. Returns the
+* number of instructions completed, less than count if one timed out (errno
+* ETIMEDOUT), or -1 if an ioctl failed.
+*/
+int chip8io_inject(const uint16_t *instructions, unsigned int count, unsigned long timeout_us);
+
+void chip8writekeypress(char val, unsigned int ispressed);
+void printKeyState();
+void writeReset();
+void printStatus(FILE *out, int index);
+void resetChip8(const char* filename);
+
+#endif //__CHIP8_IO_H__
@@ -0,0 +1,363 @@
+/*
+ * Request counters and ioctl latency, from the driver or the model
+ *
+ * chip8ioc show [-d dir]
+ *     Prints the driver's counters from dir/stats, by default
+ *     /sys/kernel/debug/vga_led
+ * chip8ioc reset [-d dir]
+ *     Clears them
+ * chip8ioc run [-b backend] [-r rom] [-n reports] [-d dir]
+ *     Loads a ROM with resetChip8 and handles reports keyboard reports the
+ *     way chip8's main loop does, then prints the requests that took: the
+ *     driver's counters for the device, the ones chip8io keeps otherwise
+ * chip8ioc test [-b backend]
+ *     Checks the counts, invalid requests, batches and histograms against
+ *     the model, from several threads at once, and the text and the reset.
+ *     With -b only checks that batches agree with single requests there,
+ *     for drivers with and without CHIP8_BATCH_ATTR.
+ *
+ * Columbia University
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "chip8io.h"
+#include "chip8stats.h"
+#include "chip8test.h"
+
+#define DEFAULT_ROM "../test/Pong.ch8"
+#define DEFAULT_DEBUGFS "/sys/kernel/debug/vga_led"
+#define TEST_THREADS 4
+#define TEST_REQUESTS 1000
+
+static void usage() {
+	fprintf(stderr,
+		"Usage: chip8ioc show [-d dir]\n"
+		"       chip8ioc reset [-d dir]\n"
+		"       chip8ioc run [-b backend] [-r rom] [-n reports] [-d dir]\n"
+		"       chip8ioc test [-b backend]\n");
+	exit(1);
+}
+
+static int show_driver(const char *dir) {
+	char path[4096], buf[CHIP8STATS_TEXT_MAX];
+	size_t n;
+	FILE *f;
+
+	snprintf(path, sizeof(path), "%s/stats", dir);
+	if ((f = fopen(path, "r")) == NULL) {
+		perror(path);
+		return 1;
+	}
+	while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+		fwrite(buf, 1, n, stdout);
+	fclose(f);
+	return 0;
+}
+
+static int reset_driver(const char *dir) {
+	char path[4096];
+	FILE *f;
+
+	snprintf(path, sizeof(path), "%s/reset", dir);
+	if ((f = fopen(path, "w")) == NULL || fputs("1\n", f) == EOF || fclose(f) != 0) {
+		perror(path);
+		return 1;
+	}
+	return 0;
+}
+
+static int show(int argc, char **argv, int reset) {
+	const char *dir = DEFAULT_DEBUGFS;
+	int c;
+
+	while ((c = getopt(argc, argv, "d:")) != -1) {
+		switch (c) {
+		case 'd': dir = optarg; break;
+		default: usage();
+		}
+	}
+	return reset ? reset_driver(dir) : show_driver(dir);
+}
+
+static void print_stats() {
+	static char buf[CHIP8STATS_TEXT_MAX];
+	struct chip8_stats s;
+
+	chip8io_stats(&s);
+	chip8stats_format(&s, buf, sizeof(buf));
+	fputs(buf, stdout);
+}
+
+static int run(int argc, char **argv) {
+	const char *backend = NULL, *rom = DEFAULT_ROM, *dir = DEFAULT_DEBUGFS;
+	unsigned long reports = 100, k;
+	int c, device, ret = 0;
+	chip8_opcode op;
+
+	while ((c = getopt(argc, argv, "b:r:n:d:")) != -1) {
+		switch (c) {
+		case 'b': backend = optarg; break;
+		case 'r': rom = optarg; break;
+		case 'n': reports = strtoul(optarg, NULL, 0); break;
+		case 'd': dir = optarg; break;
+		default: usage();
+		}
+	}
+
+	if (chip8io_open(backend)) {
+		fprintf(stderr, "Could not open %s\n", backend ? backend : CHIP8_DEVICE);
+		return 1;
+	}
+	device = !chip8io_simulated();
+	if (device && reset_driver(dir))
+		ret = 1;
+	chip8io_stats_enable(1);
+
+	resetChip8(rom);
+	startChip8();
+	/* Per report: the loop condition, the key write and printKeyState's read */
+	for (k = 0; k < reports; ++k) {
+		if (!chip8isRunning())
+			chip8isPaused();
+		chip8writekeypress(k & 0xf, k & 1);
+		op.addr = KEY_PRESS_ADDR;
+		chip8_read(&op);
+		chip8io_advance(chip8io_slots_per_frame());
+	}
+	pauseChip8();
+
+	printf("\n");
+	if (device)
+		ret |= show_driver(dir);
+	else
+		print_stats();
+	chip8io_close();
+	return ret;
+}
+
+static uint64_t hist_total(const uint64_t *hist) {
+	uint64_t total = 0;
+	unsigned int k;
+
+	for (k = 0; k < CHIP8STATS_BUCKETS; ++k)
+		total += hist[k];
+	return total;
+}
+
+static int buckets() {
+	uint64_t hist[CHIP8STATS_BUCKETS] = { 0 };
+	int errors = 0;
+
+	errors += chip8test_check("bucket of 0 ns", chip8stats_bucket(0), 0);
+	errors += chip8test_check("bucket of 1 ns", chip8stats_bucket(1), 0);
+	errors += chip8test_check("bucket of 2 ns", chip8stats_bucket(2), 1);
+	errors += chip8test_check("bucket of 1023 ns", chip8stats_bucket(1023), 9);
+	errors += chip8test_check("bucket of 1024 ns", chip8stats_bucket(1024), 10);
+	errors += chip8test_check("bucket of an hour", chip8stats_bucket(3600000000000ULL), CHIP8STATS_BUCKETS - 1);
+
+	errors += chip8test_check("p50 of nothing", chip8stats_percentile(hist, 50), 0);
+	hist[6] = 90;
+	hist[12] = 10;
+	errors += chip8test_check("p50", chip8stats_percentile(hist, 50), 128);
+	errors += chip8test_check("p90", chip8stats_percentile(hist, 90), 128);
+	errors += chip8test_check("p99", chip8stats_percentile(hist, 99), 8192);
+
+	errors += chip8test_check("index of V3", chip8stats_index(V3_ADDR), 3);
+	errors += chip8test_check("index of LATENCY_HIST_ADDR", chip8stats_index(LATENCY_HIST_ADDR), 29);
+	errors += chip8test_check("index of FRAMEBUFFER_STATUS_ADDR", chip8stats_index(FRAMEBUFFER_STATUS_ADDR), 30);
+	errors += chip8test_check("index between registers", chip8stats_index(I_ADDR + 1), CHIP8STATS_OTHER);
+	errors += chip8test_check("index past the map", chip8stats_index(0x1000), CHIP8STATS_OTHER);
+	return errors;
+}
+
+static int counts() {
+	struct chip8_stats s;
+	chip8_opcode op, ops[10];
+	uint8_t mem[100];
+	int errors = 0, k;
+
+	chip8io_stats_reset();
+	for (k = 0; k < 5; ++k)
+		readRegister(3);
+	writeRegister(1, 7);
+	writeRegister(1, 8);
+
+	op.addr = STACK_POINTER_ADDR;
+	op.data = 100;
+	errors += chip8test_check("bad stack pointer rejected", chip8io_ioctl(CHIP8_WRITE_ATTR, &op), -1);
+	op.addr = 0x7C;
+	op.data = 0;
+	errors += chip8test_check("unmapped address rejected", chip8io_ioctl(CHIP8_READ_ATTR, &op), -1);
+
+	readMemoryBlock(mem, 0, sizeof(mem));
+	for (k = 0; k < 10; ++k) {
+		ops[k].addr = MEMORY_ADDR;
+		ops[k].data = (1 << 20) | ((0x300 + k) << 8) | k;
+	}
+	ops[3].addr = STATE_ADDR;
+	ops[3].data = 0x3;
+	errors += chip8test_check("batch stops at the bad state", chip8io_batch(ops, 10, 1), -1);
+
+	chip8io_stats(&s);
+	errors += chip8test_check("V3 reads", s.addr[3].reads, 5);
+	errors += chip8test_check("V1 writes", s.addr[1].writes, 2);
+	errors += chip8test_check("stack pointer invalid", s.addr[chip8stats_index(STACK_POINTER_ADDR)].invalid, 1);
+	errors += chip8test_check("other invalid", s.addr[CHIP8STATS_OTHER].invalid, 1);
+	errors += chip8test_check("memory reads", s.addr[chip8stats_index(MEMORY_ADDR)].reads, 100);
+	errors += chip8test_check("memory writes", s.addr[chip8stats_index(MEMORY_ADDR)].writes, 3);
+	errors += chip8test_check("state invalid", s.addr[chip8stats_index(STATE_ADDR)].invalid, 1);
+
+	errors += chip8test_check("read calls", s.calls[CHIP8STATS_READ], 6);
+	errors += chip8test_check("read failures", s.failed[CHIP8STATS_READ], 1);
+	errors += chip8test_check("write calls", s.calls[CHIP8STATS_WRITE], 3);
+	errors += chip8test_check("write failures", s.failed[CHIP8STATS_WRITE], 1);
+	errors += chip8test_check("batch calls", s.calls[CHIP8STATS_BATCH], 2);
+	errors += chip8test_check("batch requests up to the bad one", s.ops[CHIP8STATS_BATCH], 104);
+	errors += chip8test_check("batch failures", s.failed[CHIP8STATS_BATCH], 1);
+	for (k = 0; k < CHIP8STATS_IOCTLS; ++k)
+		errors += chip8test_check("histogram holds every call", hist_total(s.hist[k]), s.calls[k]);
+	return errors;
+}
+
+/* Batched writes and reads agree with single requests, whatever the backend */
+static int batches() {
+	static chip8_opcode ops[CHIP8_BATCH_MAX + 1];
+	uint8_t mem[256];
+	int errors = 0, wrong = 0, k;
+
+	for (k = 0; k < 256; ++k) {
+		ops[k].addr = MEMORY_ADDR;
+		ops[k].data = (1 << 20) | ((0x300 + k) << 8) | (k * 7 & 0xff);
+	}
+	errors += chip8test_check("batch write", chip8io_batch(ops, 256, 1), 0);
+	readMemoryBlock(mem, 0x300, 256);
+	for (k = 0; k < 256; ++k) {
+		if (mem[k] != (k * 7 & 0xff) || readMemory(0x300 + k) != mem[k])
+			wrong++;
+	}
+	errors += chip8test_check("batch reads that differ", wrong, 0);
+
+	/* Past CHIP8_BATCH_MAX the device takes one request at a time */
+	if (!chip8io_simulated()) {
+		wrong = 0;
+		for (k = 0; k <= CHIP8_BATCH_MAX; ++k) {
+			ops[k].addr = MEMORY_ADDR;
+			ops[k].data = (0x300 + k % 256) << 8;
+		}
+		errors += chip8test_check("batch over the limit", chip8io_batch(ops, CHIP8_BATCH_MAX + 1, 0), 0);
+		for (k = 0; k <= CHIP8_BATCH_MAX; ++k) {
+			if ((ops[k].readdata & 0xff) != mem[k % 256])
+				wrong++;
+		}
+		errors += chip8test_check("reads over the limit that differ", wrong, 0);
+	}
+	return errors;
+}
+
+static void *reader_f(void *arg) {
+	int k;
+
+	for (k = 0; k < TEST_REQUESTS; ++k)
+		readPC();
+	return NULL;
+}
+
+static int threads() {
+	pthread_t t[TEST_THREADS];
+	struct chip8_stats s;
+	int k;
+
+	chip8io_stats_reset();
+	for (k = 0; k < TEST_THREADS; ++k)
+		pthread_create(&t[k], NULL, reader_f, NULL);
+	for (k = 0; k < TEST_THREADS; ++k)
+		pthread_join(t[k], NULL);
+
+	chip8io_stats(&s);
+	return chip8test_check("PC reads from every thread", s.addr[chip8stats_index(PROGRAM_COUNTER_ADDR)].reads,
+		TEST_THREADS * TEST_REQUESTS) +
+		chip8test_check("read calls from every thread", s.calls[CHIP8STATS_READ], TEST_THREADS * TEST_REQUESTS);
+}
+
+static int text() {
+	static const struct chip8_stats zero;
+	struct chip8_stats s;
+	char buf[CHIP8STATS_TEXT_MAX], small[64];
+	size_t n;
+	int errors = 0;
+
+	chip8io_stats_reset();
+	readPC();
+	readPC();
+	readIRegister();
+	chip8io_stats(&s);
+	n = chip8stats_format(&s, buf, sizeof(buf));
+	errors += chip8test_check("text length", n, strlen(buf));
+	errors += chip8test_check("busiest register first", strstr(buf, "\nPC ") != NULL && strstr(buf, "\nPC ") <
+		strstr(buf, "\nI "), 1);
+	errors += chip8test_check("idle registers left out", strstr(buf, "\nV0 ") == NULL, 1);
+
+	memset(small, 'x', sizeof(small));
+	errors += chip8test_check("truncated length", chip8stats_format(&s, small, sizeof(small)), n);
+	errors += chip8test_check("truncated text terminated", strlen(small), sizeof(small) - 1);
+
+	chip8io_stats_reset();
+	chip8io_stats(&s);
+	errors += chip8test_check("reset clears", memcmp(&s, &zero, sizeof(s)) == 0, 1);
+	return errors;
+}
+
+static int test(int argc, char **argv) {
+	const char *backend = NULL;
+	int errors = 0, c;
+
+	while ((c = getopt(argc, argv, "b:")) != -1) {
+		switch (c) {
+		case 'b': backend = optarg; break;
+		default: usage();
+		}
+	}
+
+	if (backend != NULL) {
+		if (chip8io_open(backend))
+			return chip8test_report(1);
+		errors += batches();
+		chip8io_close();
+		return chip8test_report(errors);
+	}
+
+	if (chip8io_open("model"))
+		return chip8test_report(1);
+	chip8io_stats_enable(1);
+
+	errors += buckets();
+	errors += batches();
+	errors += counts();
+	errors += threads();
+	errors += text();
+
+	chip8io_close();
+	return chip8test_report(errors);
+}
+
+int main(int argc, char **argv) {
+	if (argc < 2)
+		usage();
+
+	if (strcmp(argv[1], "show") == 0)
+		return show(argc - 1, argv + 1, 0);
+	if (strcmp(argv[1], "reset") == 0)
+		return show(argc - 1, argv + 1, 1);
+	if (strcmp(argv[1], "run") == 0)
+		return run(argc - 1, argv + 1);
+	if (strcmp(argv[1], "test") == 0)
+		return test(argc - 1, argv + 1);
+
+	usage();
+	return 1;
+}
@@ -0,0 +1,412 @@
+/*
+ * Key input latency from a fake keyboard
+ *
+ * chip8keys run [-b backend] [-r rom] [-n reports] [-i interval_ms] [-p]
+ *     Feeds the game reports from a fake HID source, pressing and releasing
+ *     keypad keys every interval, through the same decode and register
+ *     writes as chip8 with tracing on, and prints the latency histogram.
+ *     -p reads the key state back after every report like chip8's loop
+ * chip8keys test
+ *     Checks that every report is traced through to the instruction that
+ *     retires after it, against the model run by hand and by its clock,
+ *     while another thread collects, and that a wrapped ring loses only
+ *     its oldest events
+ *
+ * Columbia University
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "chip8io.h"
+#include "chip8model.h"
+#include "chip8trace.h"
+#include "usbkeypad.h"
+#include "chip8test.h"
+
+#define DEFAULT_ROM "../test/Pong.ch8"
+#define MAX_EVENTS (16 * CHIP8TRACE_RING)
+
+/* 200 LD V0,K  202 JP 200 */
+static const uint8_t key_rom[] = { 0xF0, 0x0A, 0x12, 0x00 };
+
+static const uint8_t keycodes[] = {
+	KEY1, KEY2, KEY3, KEYC, KEY4, KEY5, KEY6, KEYD,
+	KEY7, KEY8, KEY9, KEYE, KEYA, KEY0, KEYB, KEYF,
+};
+
+struct source {
+	int fd;
+	unsigned int reports;
+	unsigned int interval_us;
+};
+
+struct reader {
+	int fd;
+	int readback;
+	unsigned int handled;
+};
+
+static struct chip8trace_event events[MAX_EVENTS];
+
+static void usage() {
+	fprintf(stderr,
+		"Usage: chip8keys run [-b backend] [-r rom] [-n reports] [-i interval_ms] [-p]\n"
+		"       chip8keys test\n");
+	exit(1);
+}
+
+/* Report k of the fake keyboard: even ones press a key, odd ones release it */
+static void fake_report(unsigned int k, struct usb_keyboard_packet *p) {
+	memset(p, 0, sizeof(*p));
+	if (k % 2 == 0)
+		p->keycode[0] = keycodes[(k / 2) % 16];
+}
+
+/* The fake HID source, writing reports into a pipe at a steady rate */
+static void *source_f(void *arg) {
+	struct source *s = arg;
+	struct usb_keyboard_packet p;
+	unsigned int k;
+
+	for (k = 0; k < s->reports; ++k) {
+		usleep(s->interval_us);
+		fake_report(k, &p);
+		if (write(s->fd, &p, sizeof(p)) != sizeof(p))
+			break;
+	}
+	close(s->fd);
+	return NULL;
+}
+
+/* What checkforkeypress in chip8.c does with a report */
+static void handle(struct usb_keyboard_packet *p) {
+	char val[1];
+
+	chip8trace_begin(p->keycode[0]);
+	if (kbiskeypad(p, val))
+		chip8writekeypress(val[0], 1);
+	else
+		chip8writekeypress(0, 0);
+}
+
+/* Blocks on the pipe the way chip8 blocks on the interrupt transfer */
+static void *reader_f(void *arg) {
+	struct reader *r = arg;
+	struct usb_keyboard_packet p;
+
+	while (read(r->fd, &p, sizeof(p)) == sizeof(p)) {
+		handle(&p);
+		if (r->readback)
+			printKeyState();
+		r->handled++;
+	}
+	return NULL;
+}
+
+/* Runs the fake keyboard against the open backend, returns reports handled */
+static unsigned int feed(unsigned int reports, unsigned int interval_us, int readback) {
+	struct source s;
+	struct reader r;
+	pthread_t source_thread, reader_thread;
+	int fds[2];
+
+	if (pipe(fds))
+		return 0;
+	s.fd = fds[1];
+	s.reports = reports;
+	s.interval_us = interval_us;
+	r.fd = fds[0];
+	r.readback = readback;
+	r.handled = 0;
+
+	pthread_create(&reader_thread, NULL, reader_f, &r);
+	pthread_create(&source_thread, NULL, source_f, &s);
+	pthread_join(source_thread, NULL);
+	pthread_join(reader_thread, NULL);
+	close(fds[0]);
+	return r.handled;
+}
+
+static void summarize(struct chip8trace_summary *s) {
+	uint64_t dropped = 0;
+	size_t n = chip8trace_collect(events, MAX_EVENTS, &dropped);
+
+	chip8trace_summarize(events, n, dropped, s);
+}
+
+static int run(int argc, char **argv) {
+	const char *backend = NULL, *rom = DEFAULT_ROM;
+	unsigned int reports = 200, interval_ms = 50, handled;
+	struct chip8trace_summary summary;
+	int readback = 0, saved, devnull, opt;
+
+	while ((opt = getopt(argc, argv, "b:r:n:i:p")) != -1) {
+		switch (opt) {
+		case 'b': backend = optarg; break;
+		case 'r': rom = optarg; break;
+		case 'n': reports = strtoul(optarg, NULL, 0); break;
+		case 'i': interval_ms = strtoul(optarg, NULL, 0); break;
+		case 'p': readback = 1; break;
+		default: usage();
+		}
+	}
+
+	if (access(rom, R_OK)) {
+		perror(rom);
+		return 1;
+	}
+	if (chip8io_open(backend))
+		return 1;
+
+	/* resetChip8 and printKeyState print to stdout */
+	fflush(stdout);
+	saved = dup(1);
+	if ((devnull = open("/dev/null", O_WRONLY)) != -1)
+		dup2(devnull, 1);
+	resetChip8(rom);
+	chip8io_start_clock();
+	startChip8();
+
+	chip8trace_enable(1);
+	handled = feed(reports, interval_ms * 1000, readback);
+	chip8trace_enable(0);
+
+	chip8io_stop_clock();
+	fflush(stdout);
+	dup2(saved, 1);
+	close(saved);
+	if (devnull != -1)
+		close(devnull);
+	chip8io_close();
+
+	printf("%u reports, one every %u ms%s\n", handled, interval_ms,
+		readback ? ", key state read back after each" : "");
+	summarize(&summary);
+	chip8trace_report(stdout, &summary);
+	return 0;
+}
+
+/* Releases are not decoded, everything else goes through every point */
+static int complete(unsigned int points) {
+	return points == (1 << CHIP8TRACE_HID | 1 << CHIP8TRACE_KEY_WRITE | 1 << CHIP8TRACE_RETIRE) ||
+		points == (1 << CHIP8TRACE_POINTS) - 1;
+}
+
+/* Counts summarized traces that went through at least the given points */
+static unsigned int count_traces(const struct chip8trace_event *e, size_t n, unsigned int want) {
+	unsigned int points = 0, found = 0;
+	size_t k;
+
+	for (k = 0; k < n; ++k) {
+		if (k > 0 && e[k].id != e[k - 1].id) {
+			found += (points & want) == want;
+			points = 0;
+		}
+		points |= 1 << e[k].point;
+	}
+	return found + (n > 0 && (points & want) == want);
+}
+
+/* Counts whole traces in summarized events, and checks their points came in order */
+static int check_traces(const struct chip8trace_event *e, size_t n, unsigned int traces) {
+	unsigned int points = 0, whole = 0, in_order = 1, last = 0;
+	uint32_t id = 0;
+	size_t k;
+
+	for (k = 0; k < n; ++k) {
+		if (e[k].id != id) {
+			whole += complete(points);
+			id = e[k].id;
+			points = 0;
+		} else if (e[k].point < last) {
+			in_order = 0;
+		}
+		points |= 1 << e[k].point;
+		last = e[k].point;
+	}
+	whole += complete(points);
+	return chip8test_check("whole traces", whole, traces) + chip8test_check("points in order", in_order, 1);
+}
+
+/*
+* The model stepped by hand: a press lets the waiting LD V0,K retire, a
+* release is seen at the JP after it
+*/
+static int by_hand() {
+	struct chip8trace_summary summary;
+	struct usb_keyboard_packet p;
+	struct chip8_model *m;
+	uint64_t dropped = 0;
+	unsigned int k, press_ok = 0, release_ok = 0;
+	int errors = 0;
+	size_t n, e;
+
+	if (chip8io_open("model"))
+		return 1;
+	m = chip8io_model();
+	chip8core_clear_memory(&m->core);
+	chip8core_load(&m->core, key_rom, sizeof(key_rom));
+	startChip8();
+	chip8io_advance(10);
+
+	chip8trace_enable(1);
+	for (k = 0; k < 64; ++k) {
+		fake_report(k, &p);
+		handle(&p);
+		chip8io_advance(1);
+	}
+	chip8trace_enable(0);
+	chip8io_close();
+
+	n = chip8trace_collect(events, MAX_EVENTS, &dropped);
+	for (e = 0; e < n; ++e) {
+		if (events[e].point != CHIP8TRACE_RETIRE)
+			continue;
+		press_ok += events[e].arg == 0xF0;
+		release_ok += events[e].arg == 0x12;
+	}
+	errors += chip8test_check("presses retiring LD V0,K", press_ok, 32);
+	errors += chip8test_check("releases retiring JP", release_ok, 32);
+
+	chip8trace_summarize(events, n, dropped, &summary);
+	errors += check_traces(events, n, 64);
+	errors += chip8test_check("traces", summary.traces, 64);
+	errors += chip8test_check("retired", summary.retired, 64);
+	errors += chip8test_check("decoded", summary.stage[0].count, 32);
+	return errors;
+}
+
+struct collector {
+	volatile int done;
+	unsigned long passes;
+};
+
+/* Collects over and over while the keyboard thread records */
+static void *collector_f(void *arg) {
+	static struct chip8trace_event copy[MAX_EVENTS];
+	struct collector *c = arg;
+	uint64_t dropped;
+
+	while (!c->done) {
+		dropped = 0;
+		chip8trace_collect(copy, MAX_EVENTS, &dropped);
+		c->passes++;
+	}
+	return NULL;
+}
+
+/*
+* The model on its real-time clock, the fake keyboard on its own thread.
+* Reports come further apart than frames, so every press retires the
+* waiting LD V0,K before the next report. A release caught at LD V0,K has
+* nothing retire after it until the next press takes over the model's
+* trace, so only presses are sure to get that far.
+*/
+static int clocked() {
+	struct chip8trace_summary summary;
+	struct collector c = { 0, 0 };
+	pthread_t collector_thread;
+	unsigned int handled, presses;
+	int errors = 0;
+	uint64_t worst, dropped = 0;
+	size_t n;
+
+	if (chip8io_open("model"))
+		return 1;
+	chip8core_clear_memory(&chip8io_model()->core);
+	chip8core_load(&chip8io_model()->core, key_rom, sizeof(key_rom));
+	chip8io_start_clock();
+	startChip8();
+
+	chip8trace_enable(1);
+	pthread_create(&collector_thread, NULL, collector_f, &c);
+	handled = feed(60, 20000, 0);
+	usleep(50000);
+	c.done = 1;
+	pthread_join(collector_thread, NULL);
+	chip8trace_enable(0);
+	chip8io_stop_clock();
+	chip8io_close();
+
+	n = chip8trace_collect(events, MAX_EVENTS, &dropped);
+	chip8trace_summarize(events, n, dropped, &summary);
+	chip8trace_report(stdout, &summary);
+	presses = count_traces(events, n, 1 << CHIP8TRACE_DECODE | 1 << CHIP8TRACE_RETIRE);
+	errors += chip8test_check("reports", handled, 60);
+	/* The 64 traces run by hand are still in this thread's ring */
+	errors += chip8test_check("traces", summary.traces, 124);
+	errors += chip8test_check("presses retired", presses, 32 + 30);
+	errors += chip8test_check("retired at least the presses", summary.retired >= presses, 1);
+	errors += chip8test_check("collected while recording", c.passes > 0, 1);
+
+	/* The clock runs a frame every 1/60 s, allow for a busy host */
+	worst = summary.stage[3].max;
+	printf("write to retire at most %.1f ms\n", worst / 1e6);
+	errors += chip8test_check("write to retire within 100 ms", worst < 100000000ULL, 1);
+	return errors;
+}
+
+static void *flood_f(void *arg) {
+	unsigned int k, *traces = arg;
+
+	for (k = 0; k < *traces; ++k) {
+		chip8trace_begin(0);
+		chip8trace_point(CHIP8TRACE_KEY_WRITE, 0);
+	}
+	return NULL;
+}
+
+/*
+* A thread that outruns its ring loses its oldest events and nothing else.
+* Collecting a full ring also gives up the oldest slot, which a thread
+* still running could be overwriting, so one more event may go.
+*/
+static int wrapped() {
+	struct chip8trace_summary before, after;
+	unsigned int traces = CHIP8TRACE_RING;
+	uint64_t lost;
+	pthread_t t;
+	int errors = 0;
+
+	summarize(&before);
+	chip8trace_enable(1);
+	pthread_create(&t, NULL, flood_f, &traces);
+	pthread_join(t, NULL);
+	chip8trace_enable(0);
+	summarize(&after);
+
+	lost = after.dropped - before.dropped;
+	errors += chip8test_check("events lost, the oldest half and one slot at most",
+		lost == CHIP8TRACE_RING || lost == CHIP8TRACE_RING + 1, 1);
+	errors += chip8test_check("whole traces kept", after.traces - before.traces,
+		CHIP8TRACE_RING / 2 - (lost - CHIP8TRACE_RING));
+	return errors;
+}
+
+static int test(int argc, char **argv) {
+	int errors = 0;
+
+	errors += by_hand();
+	errors += clocked();
+	errors += wrapped();
+	return chip8test_report(errors);
+}
+
+int main(int argc, char **argv) {
+	if (argc < 2)
+		usage();
+
+	if (strcmp(argv[1], "run") == 0)
+		return run(argc - 1, argv + 1);
+	if (strcmp(argv[1], "test") == 0)
+		return test(argc - 1, argv + 1);
+
+	usage();
+	return 1;
+}
@@ -0,0 +1,242 @@
+/*
+ * Per-opcode latency report
+ *
+ * chip8lat report [-b backend] [-c]
+ *     Reads the latency histogram and prints, per opcode class, how many
+ *     stages of the CPU_CYCLE_LENGTH slot were real work and how much was
+ *     padding. -c clears the histogram afterwards.
+ * chip8lat clear [-b backend]
+ * chip8lat run [-r rom] [-n frames]
+ *     Plays a ROM on the software model and prints the same report
+ * chip8lat test
+ *     Runs the program from Testbenches/Chip8_LatencyHist_test.sv on the
+ *     model and checks the histogram read back against the same values
+ *
+ * Columbia University
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "chip8io.h"
+#include "chip8model.h"
+#include "chip8latency.h"
+#include "chip8test.h"
+
+#define DEFAULT_ROM "../test/Pong.ch8"
+
+static void usage() {
+	fprintf(stderr,
+		"Usage: chip8lat report [-b backend] [-c]\n"
+		"       chip8lat clear [-b backend]\n"
+		"       chip8lat run [-r rom] [-n frames]\n"
+		"       chip8lat test\n");
+	exit(1);
+}
+
+static int print_report() {
+	uint32_t hist[CHIP8LATENCY_WORDS];
+	struct chip8_latency classes[CHIP8LATENCY_CLASSES];
+
+	if (chip8latency_read(hist)) {
+		perror("histogram read failed");
+		return -1;
+	}
+	chip8latency_decode(hist, classes);
+	chip8latency_report(stdout, classes, CHIP8_CPU_CYCLE_LENGTH, CHIP8_CLOCK_HZ);
+	return 0;
+}
+
+static int report(int argc, char **argv) {
+	const char *backend = NULL;
+	int clear = 0, ret = 0, opt;
+
+	while ((opt = getopt(argc, argv, "b:c")) != -1) {
+		switch (opt) {
+		case 'b': backend = optarg; break;
+		case 'c': clear = 1; break;
+		default: usage();
+		}
+	}
+
+	if (chip8io_open(backend))
+		return 1;
+	if (print_report())
+		ret = 1;
+	else if (clear && chip8latency_clear()) {
+		perror("clear failed");
+		ret = 1;
+	}
+	chip8io_close();
+	return ret;
+}
+
+static int clear(int argc, char **argv) {
+	const char *backend = NULL;
+	int ret = 0, opt;
+
+	while ((opt = getopt(argc, argv, "b:")) != -1) {
+		switch (opt) {
+		case 'b': backend = optarg; break;
+		default: usage();
+		}
+	}
+
+	if (chip8io_open(backend))
+		return 1;
+	if (chip8latency_clear()) {
+		perror("clear failed");
+		ret = 1;
+	}
+	chip8io_close();
+	return ret;
+}
+
+static int run(int argc, char **argv) {
+	const char *rom = DEFAULT_ROM;
+	struct chip8_model *m;
+	int frames = 600, k, ret, opt;
+
+	while ((opt = getopt(argc, argv, "r:n:")) != -1) {
+		switch (opt) {
+		case 'r': rom = optarg; break;
+		case 'n': frames = atoi(optarg); break;
+		default: usage();
+		}
+	}
+
+	if (chip8io_open("model"))
+		return 1;
+	m = chip8io_model();
+	chip8core_clear_memory(&m->core);
+	if (chip8core_load_file(&m->core, rom) < 0) {
+		perror(rom);
+		chip8io_close();
+		return 1;
+	}
+	startChip8();
+
+	for (k = 0; k < frames; ++k) {
+		/* Hold 1 and 4 in turn so that the game reacts */
+		chip8core_set_key(&m->core, (k / 30) % 2 ? 0x4 : 0x1, (k / 15) % 2);
+		chip8io_advance(chip8model_slots_per_frame(m));
+	}
+
+	ret = print_report() ? 1 : 0;
+	chip8io_close();
+	return ret;
+}
+
+static int expect(const uint32_t *hist, unsigned int cls, uint32_t count, uint32_t max,
+		unsigned int bucket) {
+	const uint32_t *h = hist + cls * CHIP8LATENCY_FIELDS;
+
+	if (h[CHIP8LATENCY_COUNT] >= count && h[CHIP8LATENCY_MAX] == max &&
+			h[CHIP8LATENCY_BUCKET + bucket] == h[CHIP8LATENCY_COUNT])
+		return 0;
+	printf("%s: count %u, max %u, bucket %u; expected %u, %u\n",
+		chip8latency_class_name(cls), h[CHIP8LATENCY_COUNT], h[CHIP8LATENCY_MAX],
+		h[CHIP8LATENCY_BUCKET + bucket], count, max);
+	return 1;
+}
+
+static int test() {
+	static const uint16_t program[] = {
+		0x00E0, 0x6005, 0xA300, 0xD015, 0xF233, 0xF355, 0x120C
+	};
+	uint32_t hist[CHIP8LATENCY_WORDS], words[CHIP8LATENCY_WORDS];
+	struct chip8_model *m;
+	int errors = 0;
+	unsigned int k;
+
+	if (chip8io_open("model"))
+		return 1;
+	m = chip8io_model();
+	chip8core_clear_memory(&m->core);
+	for (k = 0; k < sizeof(program) / sizeof(program[0]); ++k) {
+		setMemory(MEMORY_START + 2 * k, program[k] >> 8);
+		setMemory(MEMORY_START + 2 * k + 1, program[k] & 0xff);
+	}
+	writePC(MEMORY_START);
+	startChip8();
+	chip8io_advance(10);
+	pauseChip8();
+
+	if (chip8latency_read(hist)) {
+		perror("histogram read failed");
+		chip8io_close();
+		return 1;
+	}
+	errors += expect(hist, 1, 1, 8188, 5);
+	errors += expect(hist, 8, 1, CHIP8LATENCY_MIN_WORK, 0);
+	errors += expect(hist, 12, 1, CHIP8LATENCY_MIN_WORK, 0);
+	errors += expect(hist, 15, 1, 655, 3);
+	errors += expect(hist, 19, 1, 241, 2);
+	errors += expect(hist, 20, 1, 31, 1);
+	errors += expect(hist, 3, 2, CHIP8LATENCY_MIN_WORK, 0);
+	if (memcmp(hist, m->latency, sizeof(hist)) != 0) {
+		printf("batch read does not match the model\n");
+		errors++;
+	}
+
+	/* Time halted on Fx0A goes to the Fx0A once a key is pressed */
+	setMemory(MEMORY_START, 0xF4);
+	setMemory(MEMORY_START + 1, 0x0A);
+	writePC(MEMORY_START);
+	chip8writekeypress(0x7, 0);
+	startChip8();
+	chip8io_advance(5);
+	chip8writekeypress(0x7, 1);
+	chip8io_advance(1);
+	pauseChip8();
+	chip8latency_read(hist);
+	if (hist[17 * CHIP8LATENCY_FIELDS + CHIP8LATENCY_HALT_LO] != 5 * m->cycles_per_instruction) {
+		printf("LD Vx,K: %u cycles halted, expected %u\n",
+			hist[17 * CHIP8LATENCY_FIELDS + CHIP8LATENCY_HALT_LO], 5 * m->cycles_per_instruction);
+		errors++;
+	}
+
+	/* Sums carry into the high word */
+	memset(words, 0, sizeof(words));
+	words[CHIP8LATENCY_WORK_LO] = 0xfffffff0;
+	chip8latency_record(words, 0x0000, 0x20, 0, CHIP8_CPU_CYCLE_LENGTH);
+	if (words[CHIP8LATENCY_WORK_LO] != 0x10 || words[CHIP8LATENCY_WORK_HI] != 1) {
+		printf("work sum did not carry\n");
+		errors++;
+	}
+
+	if (chip8latency_clear() || chip8latency_read(hist)) {
+		perror("clear failed");
+		errors++;
+	} else {
+		for (k = 0; k < CHIP8LATENCY_WORDS; ++k)
+			if (hist[k] != 0)
+				break;
+		if (k < CHIP8LATENCY_WORDS) {
+			printf("word %u not cleared\n", k);
+			errors++;
+		}
+	}
+
+	chip8io_close();
+	return chip8test_report(errors);
+}
+
+int main(int argc, char **argv) {
+	if (argc < 2)
+		usage();
+
+	if (strcmp(argv[1], "report") == 0)
+		return report(argc - 1, argv + 1);
+	if (strcmp(argv[1], "clear") == 0)
+		return clear(argc - 1, argv + 1);
+	if (strcmp(argv[1], "run") == 0)
+		return run(argc - 1, argv + 1);
+	if (strcmp(argv[1], "test") == 0 && argc == 2)
+		return test();
+
+	usage();
+	return 1;
+}
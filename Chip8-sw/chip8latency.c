@@ -0,0 +1,201 @@
+/*
+ * Per-opcode latency histogram, see chip8latency.h and
+ * Chip8-qsys/Chip8_Perf/Chip8_LatencyHist.sv
+ */
+
+#include "chip8latency.h"
+#include "chip8io.h"
+
+static const char *class_names[CHIP8LATENCY_CLASSES] = {
+	"SYS", "CLS", "RET", "JP", "CALL", "SE Vx,kk", "SNE Vx,kk", "SE Vx,Vy",
+	"LD Vx,kk", "ADD Vx,kk", "8xy? ALU", "SNE Vx,Vy", "LD I", "JP V0", "RND",
+	"DRW", "SKP/SKNP", "LD Vx,K", "Fx timers/I", "LD B", "LD [I]", "LD Vx,[I]",
+	"invalid",
+};
+
+static const uint32_t bucket_bounds[CHIP8LATENCY_BUCKETS - 2] = {
+	16, 64, 256, 1024, 4096, 16384
+};
+
+unsigned int chip8latency_class(uint16_t instruction) {
+	unsigned int kk = instruction & 0xff;
+
+	switch (instruction >> 12) {
+	case 0x0:
+		if (instruction == 0x00E0) return 1;
+		if (instruction == 0x00EE) return 2;
+		return 0;
+	case 0x1: return 3;
+	case 0x2: return 4;
+	case 0x3: return 5;
+	case 0x4: return 6;
+	case 0x5: return (instruction & 0xf) == 0 ? 7 : 22;
+	case 0x6: return 8;
+	case 0x7: return 9;
+	case 0x8: return 10;
+	case 0x9: return (instruction & 0xf) == 0 ? 11 : 22;
+	case 0xA: return 12;
+	case 0xB: return 13;
+	case 0xC: return 14;
+	case 0xD: return 15;
+	case 0xE: return kk == 0x9E || kk == 0xA1 ? 16 : 22;
+	default:
+		switch (kk) {
+		case 0x0A: return 17;
+		case 0x07: case 0x15: case 0x18: case 0x1E: case 0x29: return 18;
+		case 0x33: return 19;
+		case 0x55: return 20;
+		case 0x65: return 21;
+		default: return 22;
+		}
+	}
+}
+
+const char *chip8latency_class_name(unsigned int cls) {
+	return cls < CHIP8LATENCY_CLASSES ? class_names[cls] : "?";
+}
+
+unsigned int chip8latency_bucket(uint32_t stage, uint32_t cycle_length) {
+	unsigned int b;
+
+	for (b = 0; b < CHIP8LATENCY_BUCKETS - 2; ++b)
+		if (stage < bucket_bounds[b])
+			return b;
+	return stage < cycle_length ? CHIP8LATENCY_BUCKETS - 2 : CHIP8LATENCY_BUCKETS - 1;
+}
+
+uint32_t chip8latency_work_stage(uint16_t instruction) {
+	unsigned int x = (instruction >> 8) & 0xf;
+	unsigned int n = instruction & 0xf;
+	uint32_t stage = CHIP8LATENCY_MIN_WORK;
+
+	/* Framebuffer sweep up to stage 8188 */
+	if (instruction == 0x00E0)
+		return 8188;
+
+	switch (instruction >> 12) {
+	case 0xD:
+		/* One pixel write every 16 stages, 8 per 128-stage row, from stage 16 */
+		if (n > 0)
+			stage = 128 * n + 15;
+		break;
+	case 0xF:
+		if ((instruction & 0xff) == 0x33)
+			stage = 0xF1;
+		else if ((instruction & 0xff) == 0x55 || (instruction & 0xff) == 0x65)
+			stage = 8 * x + 7;
+		break;
+	default: break;
+	}
+
+	return stage > CHIP8LATENCY_MIN_WORK ? stage : CHIP8LATENCY_MIN_WORK;
+}
+
+static void add64(uint32_t *lo, uint64_t value) {
+	uint64_t sum = (lo[0] | ((uint64_t) lo[1] << 32)) + value;
+	lo[0] = sum & 0xffffffff;
+	lo[1] = sum >> 32;
+}
+
+void chip8latency_record(uint32_t hist[CHIP8LATENCY_WORDS], uint16_t instruction,
+		uint32_t work_stage, uint32_t halt_cycles, uint32_t cycle_length) {
+	chip8latency_record_many(hist, instruction, work_stage, halt_cycles, cycle_length, 1);
+}
+
+void chip8latency_record_many(uint32_t hist[CHIP8LATENCY_WORDS], uint16_t instruction,
+		uint32_t work_stage, uint32_t halt_cycles, uint32_t cycle_length, uint64_t count) {
+	uint32_t *h = hist + chip8latency_class(instruction) * CHIP8LATENCY_FIELDS;
+
+	/* 32-bit counters wrap the same way count increments would */
+	h[CHIP8LATENCY_COUNT] += (uint32_t) count;
+	add64(h + CHIP8LATENCY_WORK_LO, work_stage * count);
+	if (work_stage > h[CHIP8LATENCY_MAX])
+		h[CHIP8LATENCY_MAX] = work_stage;
+	add64(h + CHIP8LATENCY_HALT_LO, halt_cycles * count);
+	h[CHIP8LATENCY_BUCKET + chip8latency_bucket(work_stage, cycle_length)] += (uint32_t) count;
+}
+
+void chip8latency_decode(const uint32_t hist[CHIP8LATENCY_WORDS],
+		struct chip8_latency classes[CHIP8LATENCY_CLASSES]) {
+	unsigned int cls, b;
+
+	for (cls = 0; cls < CHIP8LATENCY_CLASSES; ++cls) {
+		const uint32_t *h = hist + cls * CHIP8LATENCY_FIELDS;
+		struct chip8_latency *l = &classes[cls];
+
+		l->count = h[CHIP8LATENCY_COUNT];
+		l->work = h[CHIP8LATENCY_WORK_LO] | ((uint64_t) h[CHIP8LATENCY_WORK_HI] << 32);
+		l->halt = h[CHIP8LATENCY_HALT_LO] | ((uint64_t) h[CHIP8LATENCY_HALT_HI] << 32);
+		l->max = h[CHIP8LATENCY_MAX];
+		for (b = 0; b < CHIP8LATENCY_BUCKETS; ++b)
+			l->buckets[b] = h[CHIP8LATENCY_BUCKET + b];
+	}
+}
+
+int chip8latency_read(uint32_t hist[CHIP8LATENCY_WORDS]) {
+	static chip8_opcode ops[CHIP8LATENCY_WORDS];
+	int k;
+
+	for (k = 0; k < CHIP8LATENCY_WORDS; ++k) {
+		ops[k].addr = LATENCY_HIST_ADDR;
+		ops[k].data = k;
+	}
+	if (chip8io_batch(ops, CHIP8LATENCY_WORDS, 0))
+		return -1;
+	for (k = 0; k < CHIP8LATENCY_WORDS; ++k)
+		hist[k] = ops[k].readdata;
+	return 0;
+}
+
+int chip8latency_clear() {
+	chip8_opcode op;
+
+	op.addr = LATENCY_HIST_ADDR;
+	op.data = CHIP8LATENCY_CLEAR;
+	return chip8io_ioctl(CHIP8_WRITE_ATTR, &op) ? -1 : 0;
+}
+
+void chip8latency_report(FILE *out, const struct chip8_latency classes[CHIP8LATENCY_CLASSES],
+		uint32_t cycle_length, unsigned long clock_hz) {
+	uint64_t count = 0, work = 0, halt = 0, padded = 0;
+	uint32_t longest = 0;
+	unsigned int cls, b;
+	double slots;
+
+	fprintf(out, "%-12s %10s %8s %6s %6s %9s  %s\n", "class", "count", "mean", "max",
+		"work", "halted", "<16 <64 <256 <1k <4k <16k <slot full");
+	for (cls = 0; cls < CHIP8LATENCY_CLASSES; ++cls) {
+		const struct chip8_latency *l = &classes[cls];
+
+		if (l->count == 0)
+			continue;
+		fprintf(out, "%-12s %10llu %8.1f %6u %5.2f%% %8.3fs ", chip8latency_class_name(cls),
+			(unsigned long long) l->count, (double) l->work / l->count, l->max,
+			100.0 * l->work / ((double) l->count * cycle_length), (double) l->halt / clock_hz);
+		for (b = 0; b < CHIP8LATENCY_BUCKETS; ++b)
+			fprintf(out, " %u", l->buckets[b]);
+		fputc('\n', out);
+
+		count += l->count;
+		work += l->work;
+		halt += l->halt;
+		padded += l->count * ((uint64_t) l->max + 1);
+		if (l->max > longest)
+			longest = l->max;
+	}
+
+	if (count == 0) {
+		fprintf(out, "no instructions recorded\n");
+		return;
+	}
+
+	slots = (double) count * cycle_length;
+	fprintf(out, "\n%llu instructions, %.3f s of %u-cycle slots plus %.3f s halted on Fx0A\n",
+		(unsigned long long) count, slots / clock_hz, cycle_length, (double) halt / clock_hz);
+	fprintf(out, "real work %.2f%% of the slots, padding %.2f%%\n",
+		100.0 * work / slots, 100.0 - 100.0 * work / slots);
+	fprintf(out, "one slot of %u cycles covers every instruction seen: %.1fx the current rate\n",
+		longest + 1, (double) cycle_length / (longest + 1));
+	fprintf(out, "slots sized per class to its largest work stage: %.1fx the current rate\n",
+		slots / padded);
+}
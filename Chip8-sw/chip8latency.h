@@ -0,0 +1,77 @@
+#ifndef __CHIP8_LATENCY_H__
+#define __CHIP8_LATENCY_H__
+
+#include <stdio.h>
+#include <stdint.h>
+
+/*
+* Per-opcode latency histogram
+*
+* Chip8_Perf/Chip8_LatencyHist.sv records, for every instruction the board
+* completes, the last stage of its CPU_CYCLE_LENGTH slot at which the CPU
+* still had a side effect (its work stage) and the cycles it spent halted
+* on Fx0A. Counters are kept per opcode class and read through
+* LATENCY_HIST_ADDR as 16 words per class, addressed {class, field}.
+* The model keeps the same words, with work stages taken from the stage
+* schedule in Chip8_CPU.sv.
+*/
+
+#define CHIP8LATENCY_CLASSES 23
+#define CHIP8LATENCY_FIELDS 16
+#define CHIP8LATENCY_WORDS 512
+#define CHIP8LATENCY_BUCKETS 8
+
+/* Fields within a class */
+#define CHIP8LATENCY_COUNT 0
+#define CHIP8LATENCY_WORK_LO 1
+#define CHIP8LATENCY_WORK_HI 2
+#define CHIP8LATENCY_MAX 3
+#define CHIP8LATENCY_HALT_LO 4
+#define CHIP8LATENCY_HALT_HI 5
+#define CHIP8LATENCY_BUCKET 8
+
+/* Write to LATENCY_HIST_ADDR to zero every counter */
+#define CHIP8LATENCY_CLEAR (1 << 9)
+
+/* next_pc is settled at NEXT_PC_WRITE_STAGE, no instruction finishes earlier */
+#define CHIP8LATENCY_MIN_WORK 12
+
+struct chip8_latency {
+	uint64_t count;
+	uint64_t work;          //Sum of work stages
+	uint64_t halt;          //Cycles halted on Fx0A
+	uint32_t max;
+	uint32_t buckets[CHIP8LATENCY_BUCKETS];
+};
+
+unsigned int chip8latency_class(uint16_t instruction);
+const char *chip8latency_class_name(unsigned int cls);
+
+/* Bucket for a work stage, the bounds are 16, 64, 256, ... 16384, cycle_length */
+unsigned int chip8latency_bucket(uint32_t stage, uint32_t cycle_length);
+
+/* Last stage with a side effect for the instruction in Chip8_CPU.sv */
+uint32_t chip8latency_work_stage(uint16_t instruction);
+
+/* Updates the raw words the way Chip8_LatencyHist.sv does */
+void chip8latency_record(uint32_t hist[CHIP8LATENCY_WORDS], uint16_t instruction,
+		uint32_t work_stage, uint32_t halt_cycles, uint32_t cycle_length);
+/* The same as count calls to chip8latency_record */
+void chip8latency_record_many(uint32_t hist[CHIP8LATENCY_WORDS], uint16_t instruction,
+		uint32_t work_stage, uint32_t halt_cycles, uint32_t cycle_length, uint64_t count);
+
+void chip8latency_decode(const uint32_t hist[CHIP8LATENCY_WORDS],
+		struct chip8_latency classes[CHIP8LATENCY_CLASSES]);
+
+/* Reads every word from the selected chip8io backend in one batch, 0 or -1 */
+int chip8latency_read(uint32_t hist[CHIP8LATENCY_WORDS]);
+int chip8latency_clear();
+
+/*
+* Prints real work against padding per class, and how short the slot could
+* get if every class kept its largest observed work stage
+*/
+void chip8latency_report(FILE *out, const struct chip8_latency classes[CHIP8LATENCY_CLASSES],
+		uint32_t cycle_length, unsigned long clock_hz);
+
+#endif //__CHIP8_LATENCY_H__
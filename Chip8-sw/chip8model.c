@@ -0,0 +1,349 @@
+/*
+ * In-process model of the Chip8_Top register map
+ *
+ * Lets the host tools run against a software Chip8 when there is no board.
+ * See chip8model.h.
+ */
+
+#include <errno.h>
+#include <string.h>
+
+#include "chip8model.h"
+#include "chip8prof.h"
+#include "chip8trace.h"
+#include "chip8debug.h"
+
+void chip8model_init(struct chip8_model *m) {
+	memset(m, 0, sizeof(*m));
+	chip8core_reset(&m->core);
+	m->state = PAUSED_STATE;
+	m->cycles_per_instruction = CHIP8_CPU_CYCLE_LENGTH;
+	m->trace_due = UINT64_MAX;
+	m->drawn_frame = UINT64_MAX;
+}
+
+/* Vertical blanks of board time so far, fb_frames in Chip8_framebuffer */
+static uint64_t vga_frame(const struct chip8_model *m) {
+	return (m->ticks * CHIP8_CLK_DIV_PERIOD + m->cycles) / CHIP8_VGA_FRAME_CYCLES;
+}
+
+/* CLS and DRW write the back buffer */
+static inline int draws(uint16_t op) {
+	return op == 0x00e0 || (op & 0xf000) == 0xd000;
+}
+
+/*
+* Mirrors address 18'h1B in Chip8_Top: control state is reset while memory,
+* registers, timers and the framebuffer keep their contents
+*/
+static void reset_top(struct chip8_model *m) {
+	m->core.pc = CHIP8_PROGRAM_START;
+	m->core.i = 0;
+	m->core.sp = 0;
+	m->core.halted = 0;
+	m->state = PAUSED_STATE;
+	m->instruction = 0;
+	m->stage = 0;
+	m->fbvx_prev = 0;
+	m->fbvy_prev = 0;
+	m->mem_addr_prev = 0;
+	m->stk_addr_prev = 0;
+	m->halt_cycles = 0;
+	chip8core_touch(&m->core);
+}
+
+/*
+* Runs the instruction written to INSTRUCTION_ADDR in RUN_INSTRUCTION_STATE.
+* It completes at once and stage reads back 0, unless Fx0A is waiting for
+* a key, in which case stage stays non-zero until KEY_PRESS_ADDR brings one.
+*/
+static void run_injected(struct chip8_model *m) {
+	if (chip8core_execute(&m->core, m->instruction) == CHIP8_STEP_HALTED) {
+		m->stage = 2;
+		return;
+	}
+	if (draws(m->instruction))
+		m->drawn_frame = vga_frame(m);
+	chip8latency_record(m->latency, m->instruction, chip8latency_work_stage(m->instruction),
+		0, CHIP8_CPU_CYCLE_LENGTH);
+	m->stage = 0;
+}
+
+void chip8model_write(struct chip8_model *m, unsigned int addr, unsigned int data) {
+	struct chip8_core *c = &m->core;
+
+	if (addr <= VF_ADDR) {
+		c->v[(addr >> 2) & 0xf] = data & 0xff;
+		chip8core_touch(c);
+		return;
+	}
+
+	switch (addr) {
+	case I_ADDR: c->i = data & 0xffff; chip8core_touch(c); break;
+	case SOUND_TIMER_ADDR: c->sound_timer = data & 0xff; chip8core_touch(c); break;
+	case DELAY_TIMER_ADDR: c->delay_timer = data & 0xff; chip8core_touch(c); break;
+	case STACK_ADDR: c->sp = 0; chip8core_touch(c); break;
+	case STACK_POINTER_ADDR: c->sp = data & (CHIP8_STACK_DEPTH - 1); chip8core_touch(c); break;
+
+	case STACK_ENTRY_ADDR:
+		m->stk_addr_prev = (data >> 16) & 0xf;
+		if (data & (1 << 20)) {
+			c->stack[m->stk_addr_prev] = data & 0xffff;
+			chip8core_touch(c);
+		}
+		break;
+
+	case PROGRAM_COUNTER_ADDR: c->pc = data & 0xfff; chip8core_touch(c); break;
+	case KEY_PRESS_ADDR:
+		chip8core_set_key(c, data & 0xf, (data >> 4) & 0x1);
+		if (m->state == RUN_INSTRUCTION_STATE && m->stage != 0 && c->key_pressed)
+			run_injected(m);
+		break;
+
+	case STATE_ADDR:
+		switch (data & 0x3) {
+		case 0x0: m->state = RUNNING_STATE; break;
+		case 0x1: m->state = RUN_INSTRUCTION_STATE; break;
+		default: m->state = PAUSED_STATE; break;
+		}
+		break;
+
+	case FRAMEBUFFER_ADDR:
+		m->fbvx_prev = (data >> 5) & 0x3f;
+		m->fbvy_prev = data & 0x1f;
+		if (data & (1 << 12)) {
+			chip8core_set_pixel(c, m->fbvx_prev, m->fbvy_prev, (data >> 11) & 0x1);
+			chip8core_touch(c);
+			m->drawn_frame = vga_frame(m);
+		}
+		break;
+
+	case MEMORY_ADDR:
+		m->mem_addr_prev = (data >> 8) & 0xfff;
+		if (data & (1 << 20)) {
+			chip8core_store(c, m->mem_addr_prev, data & 0xff);
+			chip8core_touch(c);
+		}
+		break;
+
+	case INSTRUCTION_ADDR:
+		m->instruction = data & 0xffff;
+		m->stage = 0;
+		if (m->state == RUN_INSTRUCTION_STATE)
+			run_injected(m);
+		break;
+
+	case RESET_ADDR: reset_top(m); break;
+
+	case LATENCY_HIST_ADDR:
+		m->latency_addr_prev = data & (CHIP8LATENCY_WORDS - 1);
+		if (data & CHIP8LATENCY_CLEAR)
+			memset(m->latency, 0, sizeof(m->latency));
+		break;
+
+	default: break;
+	}
+}
+
+unsigned int chip8model_read(struct chip8_model *m, unsigned int addr) {
+	struct chip8_core *c = &m->core;
+	if (addr <= VF_ADDR)
+		return c->v[(addr >> 2) & 0xf];
+
+	switch (addr) {
+	case I_ADDR: return c->i;
+	case SOUND_TIMER_ADDR: return c->sound_timer;
+	case DELAY_TIMER_ADDR: return c->delay_timer;
+	case STACK_ADDR: return 0x13;
+	case PROGRAM_COUNTER_ADDR: return ((unsigned int) m->instruction << 12) | c->pc;
+	case KEY_PRESS_ADDR: return (c->key_pressed << 4) | c->key;
+	case STATE_ADDR: return m->state;
+	case FRAMEBUFFER_ADDR: return chip8core_pixel(c, m->fbvx_prev, m->fbvy_prev);
+	case STACK_POINTER_ADDR: return c->sp;
+	case STACK_ENTRY_ADDR: return (m->stk_addr_prev << 16) | c->stack[m->stk_addr_prev];
+	case MEMORY_ADDR: return (m->mem_addr_prev << 8) | c->mem[m->mem_addr_prev];
+	case INSTRUCTION_ADDR: return ((m->stage & 0xffff) << 16) | m->instruction;
+	case LATENCY_HIST_ADDR: return m->latency[m->latency_addr_prev];
+	/*
+	* Drawing is presented at the next vertical blank, which like the rest
+	* of board time only comes while running. There is no catch up to wait
+	* for, busy stays clear.
+	*/
+	case FRAMEBUFFER_STATUS_ADDR:
+		return ((vga_frame(m) & 0xffff) << 16) |
+			(m->drawn_frame == vga_frame(m) ? FRAMEBUFFER_STATUS_PENDING : 0);
+	default: break;
+	}
+
+	return 101;
+}
+
+long chip8model_ioctl(struct chip8_model *m, unsigned int cmd, chip8_opcode *op) {
+	int isWrite;
+
+	switch (cmd) {
+	case CHIP8_WRITE_ATTR:
+		if (!isValidInstruction(op->addr, op->data, 1))
+			return -EINVAL;
+		chip8model_write(m, op->addr, op->data);
+		break;
+
+	case CHIP8_READ_ATTR:
+		isWrite = isValidInstruction(op->addr, op->data, 0);
+		if (isWrite == 0)
+			return -EINVAL;
+		if (isWrite == 2)
+			chip8model_write(m, op->addr, op->data);
+		op->readdata = chip8model_read(m, op->addr);
+		break;
+
+	default:
+		return -ENOTTY;
+	}
+
+	return 0;
+}
+
+long chip8model_batch(struct chip8_model *m, chip8_batch *batch) {
+	unsigned int i;
+	long ret;
+
+	if (batch->count > CHIP8_BATCH_MAX)
+		return -EINVAL;
+
+	for (i = 0; i < batch->count; ++i) {
+		ret = chip8model_ioctl(m, batch->write ? CHIP8_WRITE_ATTR : CHIP8_READ_ATTR, &batch->ops[i]);
+		if (ret)
+			return ret;
+	}
+
+	return 0;
+}
+
+/* Shorter waits are quicker to step through than to skip */
+#define FAST_FORWARD_MIN_PASSES 8
+
+/*
+* Number of whole passes through the wait loop at the PC that fit in n
+* slots and all read a non-zero DT, 0 if the PC is not at one. Pass j reads
+* DT after (cycles + 3 * j * cycles_per_instruction) / CLK_DIV_PERIOD ticks.
+*/
+static unsigned long wait_passes(const struct chip8_model *m, unsigned long n) {
+	const struct chip8_core *c = &m->core;
+	uint16_t op = chip8core_fetch(c, c->pc);
+	uint64_t until_zero, passes;
+
+	if ((op & 0xf0ff) != 0xf007 || c->delay_timer == 0 || m->profile != NULL || c->rewind != NULL ||
+			c->debug != NULL)
+		return 0;
+	if (chip8core_fetch(c, c->pc + 2) != (0x3000 | (op & 0x0f00)) ||
+			chip8core_fetch(c, c->pc + 4) != (0x1000 | c->pc))
+		return 0;
+
+	until_zero = (uint64_t) c->delay_timer * CHIP8_CLK_DIV_PERIOD - m->cycles;
+	passes = (until_zero - 1) / (3 * (uint64_t) m->cycles_per_instruction) + 1;
+	if (passes > n / 3)
+		passes = n / 3;
+	return passes >= FAST_FORWARD_MIN_PASSES ? passes : 0;
+}
+
+static void skip_passes(struct chip8_model *m, unsigned long passes) {
+	struct chip8_core *c = &m->core;
+	uint64_t slots = 3 * (uint64_t) passes;
+	uint64_t last = m->cycles + (slots - 3) * m->cycles_per_instruction;
+	uint64_t end = m->cycles + slots * m->cycles_per_instruction;
+	uint64_t ticks = end / CHIP8_CLK_DIV_PERIOD;
+	uint16_t op = chip8core_fetch(c, c->pc);
+	uint16_t skip = chip8core_fetch(c, c->pc + 2), jump = chip8core_fetch(c, c->pc + 4);
+
+	c->v[(op >> 8) & 0xf] = c->delay_timer - last / CHIP8_CLK_DIV_PERIOD;
+	c->delay_timer = ticks < c->delay_timer ? c->delay_timer - ticks : 0;
+	c->sound_timer = ticks < c->sound_timer ? c->sound_timer - ticks : 0;
+	c->retired += slots;
+	chip8core_skip_rand(c, slots);
+
+	chip8latency_record_many(m->latency, op, chip8latency_work_stage(op), 0,
+		CHIP8_CPU_CYCLE_LENGTH, passes);
+	chip8latency_record_many(m->latency, skip, chip8latency_work_stage(skip), 0,
+		CHIP8_CPU_CYCLE_LENGTH, passes);
+	chip8latency_record_many(m->latency, jump, chip8latency_work_stage(jump), 0,
+		CHIP8_CPU_CYCLE_LENGTH, passes);
+	m->instruction = jump;
+
+	m->cycles = end % CHIP8_CLK_DIV_PERIOD;
+	m->ticks += ticks;
+	m->slots += slots;
+	m->skipped += slots;
+}
+
+static void trace_retire(struct chip8_model *m) {
+	chip8trace_point_id(m->trace_id, CHIP8TRACE_RETIRE, m->instruction >> 8);
+	m->trace_due = UINT64_MAX;
+}
+
+/*
+* The loop behind chip8model_run, inlined once with debug set and once
+* without, so that a model with no debugger attached pays nothing for it
+*/
+static inline __attribute__((always_inline)) unsigned long run(struct chip8_model *m, unsigned long n,
+		const int debug) {
+	struct chip8_core *c = &m->core;
+	uint64_t start = c->retired;
+	unsigned long passes;
+	uint16_t pc;
+	int result;
+
+	while (n > 0 && m->state == RUNNING_STATE) {
+		if (m->fast_forward && (passes = wait_passes(m, n)) > 0) {
+			skip_passes(m, passes);
+			n -= 3 * passes;
+			if (c->retired >= m->trace_due)
+				trace_retire(m);
+			continue;
+		}
+
+		pc = c->pc;
+		m->instruction = chip8core_fetch(c, pc);
+		result = debug ? chip8debug_step(c) : chip8core_step(c);
+		/* A breakpoint stops before the slot */
+		if (debug && result == CHIP8_STEP_BREAK) {
+			c->debug->stopped = 0;
+			m->state = PAUSED_STATE;
+			break;
+		}
+		n--;
+
+		if (m->profile != NULL)
+			chip8prof_sample(m->profile, pc);
+		if (result == CHIP8_STEP_HALTED) {
+			m->halt_cycles += m->cycles_per_instruction;
+		} else {
+			chip8latency_record(m->latency, m->instruction,
+				chip8latency_work_stage(m->instruction), m->halt_cycles, CHIP8_CPU_CYCLE_LENGTH);
+			m->halt_cycles = 0;
+			if (draws(m->instruction))
+				m->drawn_frame = vga_frame(m);
+			if (c->retired >= m->trace_due)
+				trace_retire(m);
+		}
+
+		m->slots++;
+		m->cycles += m->cycles_per_instruction;
+		while (m->cycles >= CHIP8_CLK_DIV_PERIOD) {
+			m->cycles -= CHIP8_CLK_DIV_PERIOD;
+			m->ticks++;
+			chip8core_tick60(c);
+		}
+
+		if (debug && c->debug->stopped) {
+			c->debug->stopped = 0;
+			m->state = PAUSED_STATE;
+		}
+	}
+
+	return (unsigned long) (c->retired - start);
+}
+
+unsigned long chip8model_run(struct chip8_model *m, unsigned long n) {
+	return m->core.debug != NULL ? run(m, n, 1) : run(m, n, 0);
+}
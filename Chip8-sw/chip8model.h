@@ -0,0 +1,103 @@
+#ifndef __CHIP8_MODEL_H__
+#define __CHIP8_MODEL_H__
+
+#include <stdint.h>
+#include "chip8driver.h"
+#include "chip8core.h"
+#include "chip8latency.h"
+
+/*
+* In-process model of the Chip8_Top register map
+*
+* Accepts the same chip8_opcode requests as chip8driver.c, including the
+* write-then-read requests for MEMORY_ADDR and FRAMEBUFFER_ADDR, and runs a
+* chip8_core while in RUNNING_STATE. Values read back match what
+* Chip8-qsys/Chip8_Top.sv drives onto data_out for the same address.
+*/
+
+/* Board timing, see enums.svh and Chip8_Timers/clk_div.sv */
+#define CHIP8_CLOCK_HZ 50000000
+#define CHIP8_CPU_CYCLE_LENGTH 50000
+#define CHIP8_CLK_DIV_PERIOD 833334
+#define CHIP8_VGA_FRAME_CYCLES 840000   //Chip8_VGA_Emulator.sv, 1600 x 525
+
+struct chip8_profile;
+
+struct chip8_model {
+	struct chip8_core core;
+	unsigned int state;
+	unsigned int fbvx_prev;
+	unsigned int fbvy_prev;
+	unsigned int mem_addr_prev;
+	unsigned int stk_addr_prev;
+	uint16_t instruction;           //cpu_instruction in Chip8_Top
+	uint32_t stage;                 //Non-zero while an injected Fx0A waits for a key
+
+	unsigned int cycles_per_instruction;
+	unsigned long cycles;           //Clock cycles since the last 60 Hz tick
+	uint64_t slots;                 //Instruction slots run, halted ones included
+	uint64_t ticks;                 //60 Hz ticks run
+	int fast_forward;               //Skip delay-timer wait loops, see chip8model_run
+	uint64_t skipped;               //Slots fast-forwarded over
+
+	struct chip8_profile *profile;  //Counts every instruction slot when set
+
+	/*
+	* A traced key write sets trace_due to the retired count of the next
+	* instruction, which records CHIP8TRACE_RETIRE for trace_id once it
+	* retires. UINT64_MAX while nothing is being traced.
+	*/
+	uint64_t trace_due;
+	uint32_t trace_id;
+
+	/*
+	* Vertical blank the last framebuffer write came before, UINT64_MAX
+	* before the first. FRAMEBUFFER_STATUS_ADDR reads pending until the
+	* next one, when the board would swap it onto the screen.
+	*/
+	uint64_t drawn_frame;
+
+	uint32_t latency[CHIP8LATENCY_WORDS];   //Words behind LATENCY_HIST_ADDR
+	unsigned int latency_addr_prev;
+	uint32_t halt_cycles;           //Of the instruction waiting on Fx0A
+};
+
+/* Power-on state: paused, memory cleared, fontset not loaded */
+void chip8model_init(struct chip8_model *m);
+
+/* Avalon-style accesses; addr is one of the *_ADDR offsets in chip8driver.h */
+void chip8model_write(struct chip8_model *m, unsigned int addr, unsigned int data);
+unsigned int chip8model_read(struct chip8_model *m, unsigned int addr);
+
+/* Same contract as chip8_ioctl in chip8driver.c, returns 0 or -errno */
+long chip8model_ioctl(struct chip8_model *m, unsigned int cmd, chip8_opcode *op);
+long chip8model_batch(struct chip8_model *m, chip8_batch *batch);
+
+/*
+* Runs up to n instruction slots while in RUNNING_STATE, ticking the timers
+* at 60 Hz of simulated board time. Slots spent halted on Fx0A still pass
+* time and are profiled at the Fx0A. Every retired instruction goes into
+* the latency histogram. Returns the number of instructions retired.
+*
+* With fast_forward set, passes through the delay-timer wait loop
+*
+*   L:  Fx07    LD Vx, DT
+*       3x00    SE Vx, 0
+*       1L      JP L
+*
+* that are bound to find DT non-zero are done in one go instead of one slot
+* at a time. Everything the host can see, down to the LFSR, the counters
+* and the histogram, ends up as if they had been run. It stays off while
+* profiling, recording rewind history or debugging, which see every slot.
+*
+* With a chip8_debug attached to the core, a breakpoint, watch or register
+* condition that stops it leaves the model in PAUSED_STATE, see chip8debug.h.
+*/
+unsigned long chip8model_run(struct chip8_model *m, unsigned long n);
+
+/* Number of instruction slots per 60 Hz frame at the configured rate */
+static inline unsigned long chip8model_slots_per_frame(const struct chip8_model *m) {
+	return (CHIP8_CLK_DIV_PERIOD + m->cycles_per_instruction - 1) / m->cycles_per_instruction;
+}
+
+#endif //__CHIP8_MODEL_H__
@@ -0,0 +1,217 @@
+/*
+ * Sampling PC profiler, see chip8prof.h
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "chip8prof.h"
+#include "chip8io.h"
+#include "chip8model.h"
+#include "chip8disasm.h"
+
+#define FRAME_NS (1000000000L / 60)
+#define MAX_BLOCK_LISTING 12
+
+struct hot {
+	unsigned int start;
+	unsigned int end;       //Last instruction in the block
+	unsigned int count;
+	uint64_t hits;
+};
+
+static double elapsed(const struct timespec *start) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static void *sampler(void *arg) {
+	struct chip8_profile *p = arg;
+	struct chip8_model *m = chip8io_model();
+	long period = m != NULL ? FRAME_NS : 1000000000L / p->rate;
+	struct timespec start, deadline, now;
+	chip8_opcode ops[2];
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	deadline = start;
+	while (!p->stop) {
+		deadline.tv_nsec += period;
+		while (deadline.tv_nsec >= 1000000000L) {
+			deadline.tv_nsec -= 1000000000L;
+			deadline.tv_sec++;
+		}
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL);
+
+		/* Fell behind, skip the missed periods instead of bursting */
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if (now.tv_sec > deadline.tv_sec + 1)
+			deadline = now;
+
+		/* The model counts every slot itself through m->profile */
+		if (m != NULL) {
+			chip8io_advance(chip8model_slots_per_frame(m));
+			continue;
+		}
+
+		/* Only count time the CPU is actually running */
+		ops[0].addr = STATE_ADDR;
+		ops[0].data = 0;
+		ops[1].addr = PROGRAM_COUNTER_ADDR;
+		ops[1].data = 0;
+		if (chip8io_batch(ops, 2, 0) == 0 && (ops[0].readdata & 0x3) == RUNNING_STATE)
+			chip8prof_sample(p, ops[1].readdata & 0xfff);
+	}
+
+	p->seconds = elapsed(&start);
+	return NULL;
+}
+
+int chip8prof_start(struct chip8_profile *p, unsigned int rate) {
+	struct chip8_model *m = chip8io_model();
+
+	memset(p->hits, 0, sizeof(p->hits));
+	p->samples = 0;
+	p->seconds = 0;
+	p->stop = 0;
+	p->rate = rate ? rate : CHIP8PROF_DEFAULT_RATE;
+	p->exact = m != NULL;
+	if (m != NULL)
+		m->profile = p;
+
+	if (pthread_create(&p->thread, NULL, sampler, p)) {
+		if (m != NULL)
+			m->profile = NULL;
+		return -1;
+	}
+	return 0;
+}
+
+void chip8prof_stop(struct chip8_profile *p) {
+	struct chip8_model *m = chip8io_model();
+
+	p->stop = 1;
+	pthread_join(p->thread, NULL);
+	if (m != NULL)
+		m->profile = NULL;
+}
+
+static uint16_t fetch(const uint8_t *mem, unsigned int addr) {
+	return (mem[addr & 0xfff] << 8) | mem[(addr + 1) & 0xfff];
+}
+
+static int by_hits(const void *a, const void *b) {
+	const struct hot *x = a, *y = b;
+	if (x->hits != y->hits)
+		return x->hits < y->hits ? 1 : -1;
+	return (int) x->start - (int) y->start;
+}
+
+static double percent(const struct chip8_profile *p, uint64_t hits) {
+	return p->samples ? 100.0 * hits / p->samples : 0;
+}
+
+static void print_instruction(FILE *out, const struct chip8_profile *p,
+		const uint8_t *mem, unsigned int addr, const char *indent) {
+	char text[24];
+	uint16_t instruction = fetch(mem, addr);
+
+	chip8disasm(instruction, text, sizeof(text));
+	fprintf(out, "%s0x%03x %9u %6.2f%%  %04x  %s\n", indent, addr,
+		p->hits[addr], percent(p, p->hits[addr]), instruction, text);
+}
+
+/*
+* Splits the executed addresses into basic blocks. A block starts wherever
+* execution can arrive other than by falling through: after an address
+* that never ran, after any control transfer and at jump and call targets.
+*/
+static int find_blocks(const struct chip8_profile *p, const uint8_t *mem, struct hot *blocks) {
+	static uint8_t leader[CHIP8_MEMORY_SIZE];
+	unsigned int addr, flow;
+	int n = 0;
+
+	memset(leader, 0, sizeof(leader));
+	for (addr = 0; addr < CHIP8_MEMORY_SIZE; ++addr) {
+		if (p->hits[addr] == 0)
+			continue;
+		if (addr < 2 || p->hits[addr - 2] == 0)
+			leader[addr] = 1;
+
+		flow = chip8disasm_flow(fetch(mem, addr));
+		if (flow & CHIP8_FLOW_ENDS_BLOCK)
+			leader[(addr + 2) & 0xfff] = 1;
+		if (flow & CHIP8_FLOW_SKIP)
+			leader[(addr + 4) & 0xfff] = 1;
+		if ((flow & (CHIP8_FLOW_JUMP | CHIP8_FLOW_CALL)) && !(flow & CHIP8_FLOW_INDIRECT))
+			leader[fetch(mem, addr) & 0xfff] = 1;
+	}
+
+	for (addr = 0; addr < CHIP8_MEMORY_SIZE; ++addr) {
+		struct hot *b;
+
+		if (p->hits[addr] == 0 || !leader[addr])
+			continue;
+
+		b = &blocks[n++];
+		b->start = b->end = addr;
+		b->count = 1;
+		b->hits = p->hits[addr];
+		while (!(chip8disasm_flow(fetch(mem, b->end)) & CHIP8_FLOW_ENDS_BLOCK) &&
+				b->end + 2 < CHIP8_MEMORY_SIZE && p->hits[b->end + 2] && !leader[b->end + 2]) {
+			b->end += 2;
+			b->count++;
+			b->hits += p->hits[b->end];
+		}
+	}
+
+	return n;
+}
+
+void chip8prof_report(FILE *out, const struct chip8_profile *p,
+		const uint8_t mem[CHIP8_MEMORY_SIZE], int top) {
+	static struct hot hot[CHIP8_MEMORY_SIZE];
+	unsigned int addr;
+	int n = 0, k;
+
+	if (p->exact)
+		fprintf(out, "%llu samples, every instruction slot over %.1f s\n",
+			(unsigned long long) p->samples, p->seconds);
+	else
+		fprintf(out, "%llu samples at %u Hz over %.1f s\n",
+			(unsigned long long) p->samples, p->rate, p->seconds);
+	if (p->samples == 0)
+		return;
+
+	for (addr = 0; addr < CHIP8_MEMORY_SIZE; ++addr) {
+		if (p->hits[addr] == 0)
+			continue;
+		hot[n].start = hot[n].end = addr;
+		hot[n].count = 1;
+		hot[n].hits = p->hits[addr];
+		n++;
+	}
+	qsort(hot, n, sizeof(hot[0]), by_hits);
+
+	fprintf(out, "\nHottest addresses\n");
+	fprintf(out, "  addr    samples       %%  word  instruction\n");
+	for (k = 0; k < n && k < top; ++k)
+		print_instruction(out, p, mem, hot[k].start, "  ");
+
+	n = find_blocks(p, mem, hot);
+	qsort(hot, n, sizeof(hot[0]), by_hits);
+
+	fprintf(out, "\nHottest basic blocks\n");
+	for (k = 0; k < n && k < top; ++k) {
+		struct hot *b = &hot[k];
+		unsigned int i;
+
+		fprintf(out, "  0x%03x-0x%03x %9llu %6.2f%%  %u instruction%s\n", b->start, b->end,
+			(unsigned long long) b->hits, percent(p, b->hits), b->count, b->count == 1 ? "" : "s");
+		for (i = 0; i < b->count && i < MAX_BLOCK_LISTING; ++i)
+			print_instruction(out, p, mem, b->start + 2 * i, "      ");
+		if (b->count > MAX_BLOCK_LISTING)
+			fprintf(out, "      ...\n");
+	}
+}
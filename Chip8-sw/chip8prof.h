@@ -0,0 +1,50 @@
+#ifndef __CHIP8_PROF_H__
+#define __CHIP8_PROF_H__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "chip8core.h"
+
+/*
+* Sampling PC profiler
+*
+* On the board a thread reads PROGRAM_COUNTER_ADDR at a fixed rate. The
+* read is a plain register access that the CPU never waits on, so the game
+* runs as it would unprofiled. With the software model the same thread
+* runs the model in real time and every instruction slot is counted
+* instead, which gives an exact profile.
+*
+* Samples go into a fixed histogram with one counter per address.
+*/
+
+#define CHIP8PROF_DEFAULT_RATE 2000
+
+struct chip8_profile {
+	uint32_t hits[CHIP8_MEMORY_SIZE];
+	uint64_t samples;
+	int exact;              //Every instruction slot was counted
+
+	unsigned int rate;      //Samples per second on the board
+	double seconds;         //Time spent sampling
+	pthread_t thread;
+	volatile int stop;
+};
+
+static inline void chip8prof_sample(struct chip8_profile *p, unsigned int pc) {
+	p->hits[pc & 0xfff]++;
+	p->samples++;
+}
+
+/* Starts sampling the selected chip8io backend, returns 0 or -1 */
+int chip8prof_start(struct chip8_profile *p, unsigned int rate);
+void chip8prof_stop(struct chip8_profile *p);
+
+/*
+* Prints the hottest addresses and basic blocks, disassembled from the
+* given memory image
+*/
+void chip8prof_report(FILE *out, const struct chip8_profile *p,
+		const uint8_t mem[CHIP8_MEMORY_SIZE], int top);
+
+#endif //__CHIP8_PROF_H__
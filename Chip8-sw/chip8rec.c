@@ -0,0 +1,608 @@
+/*
+ * Framebuffer stream recorder and player
+ *
+ * chip8rec record <stream> [-b backend] [-r rom] [-n frames] [-k interval] [-a] [-t]
+ *     Snapshots the framebuffer at 60 Hz and appends it to a delta-compressed
+ *     stream (see fbstream.h). -b picks the backend as in chip8io_open, -r
+ *     resets the Chip8 with a ROM and starts it, -k sets the keyframe
+ *     interval, -a appends to an existing stream and -t paces the model in
+ *     real time (the device is always sampled in real time). Each frame is
+ *     captured once what was drawn has been presented, so the stream holds
+ *     what was on screen. Prints the stream bandwidth, the CPU cost of
+ *     capturing and encoding and the frames captured without waiting.
+ *
+ * chip8rec info <stream>
+ * chip8rec play <stream> [-f first] [-n frames] [-t]
+ *     Prints frames as text, -t plays them back at 60 Hz
+ * chip8rec export <stream> <frame> <out.pgm|out.png> [-s scale]
+ * chip8rec test [-r rom]
+ *     Checks against the model that drawing is pending until the next
+ *     vertical blank and that record waits for it, then records a stream
+ *     in two sessions and reads it back in order, seeking around every
+ *     keyframe, exported, with a corrupt trailer and truncated
+ *
+ * Columbia University
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "chip8io.h"
+#include "chip8model.h"
+#include "fbstream.h"
+#include "chip8test.h"
+
+#define FRAME_NS (1000000000L / 60)
+/* Vertical blanks to wait for drawing to be presented before capturing */
+#define PRESENT_TIMEOUT 2
+
+#define DEFAULT_ROM "../test/Pong.ch8"
+#define TEST_FRAMES 200
+#define TEST_INTERVAL 16
+
+static double seconds(clockid_t clock) {
+	struct timespec ts;
+	clock_gettime(clock, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void sleep_until(struct timespec *deadline) {
+	deadline->tv_nsec += FRAME_NS;
+	if (deadline->tv_nsec >= 1000000000L) {
+		deadline->tv_nsec -= 1000000000L;
+		deadline->tv_sec++;
+	}
+	clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, deadline, NULL);
+}
+
+static void usage() {
+	fprintf(stderr,
+		"Usage: chip8rec record <stream> [-b backend] [-r rom] [-n frames] [-k interval] [-a] [-t]\n"
+		"       chip8rec info <stream>\n"
+		"       chip8rec play <stream> [-f first] [-n frames] [-t]\n"
+		"       chip8rec export <stream> <frame> <out.pgm|out.png> [-s scale]\n"
+		"       chip8rec test [-r rom]\n");
+	exit(1);
+}
+
+static int record(const char *path, int argc, char **argv) {
+	const char *backend = NULL, *rom = NULL;
+	unsigned long nframes = 600;
+	unsigned int interval = 60;
+	int append = 0, realtime = 0, opt;
+	struct fbstream_writer w;
+	uint64_t rows[CHIP8_FB_HEIGHT];
+	double capture_cpu = 0, encode_cpu = 0, wall;
+	struct timespec deadline;
+	unsigned long i, unpresented = 0;
+
+	while ((opt = getopt(argc, argv, "b:r:n:k:at")) != -1) {
+		switch (opt) {
+		case 'b': backend = optarg; break;
+		case 'r': rom = optarg; break;
+		case 'n': nframes = strtoul(optarg, NULL, 0); break;
+		case 'k': interval = strtoul(optarg, NULL, 0); break;
+		case 'a': append = 1; break;
+		case 't': realtime = 1; break;
+		default: usage();
+		}
+	}
+
+	if (chip8io_open(backend))
+		return 1;
+	if (chip8io_model() == NULL)
+		realtime = 1;
+
+	if (rom != NULL) {
+		resetChip8(rom);
+		startChip8();
+	}
+
+	if (fbstream_create(&w, path, interval, append)) {
+		fprintf(stderr, "could not open %s\n", path);
+		chip8io_close();
+		return 1;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	wall = seconds(CLOCK_MONOTONIC);
+	for (i = 0; i < nframes; ++i) {
+		double t0, t1, t2;
+
+		if (chip8io_model() != NULL)
+			chip8io_advance(chip8model_slots_per_frame(chip8io_model()));
+
+		/* Reads come from the back buffer, which matches the screen once presented */
+		if (chip8io_wait_present(PRESENT_TIMEOUT))
+			unpresented++;
+
+		t0 = seconds(CLOCK_PROCESS_CPUTIME_ID);
+		readFramebufferPacked(rows);
+		t1 = seconds(CLOCK_PROCESS_CPUTIME_ID);
+		if (fbstream_append(&w, rows)) {
+			fprintf(stderr, "write to %s failed\n", path);
+			break;
+		}
+		t2 = seconds(CLOCK_PROCESS_CPUTIME_ID);
+
+		capture_cpu += t1 - t0;
+		encode_cpu += t2 - t1;
+		if (realtime)
+			sleep_until(&deadline);
+	}
+	wall = seconds(CLOCK_MONOTONIC) - wall;
+
+	printf("Recorded %lu frames (%u total) in %.2f s\n", i, w.frames, wall);
+	if (i > 0) {
+		printf("Stream: %llu bytes, %.1f bytes/frame, %.0f bytes/s at 60 Hz (raw: %d bytes/s)\n",
+			(unsigned long long) w.payload_bytes, (double) w.payload_bytes / i,
+			60.0 * w.payload_bytes / i, (int) (60 * CHIP8_FB_BYTES));
+		printf("Capture: %.1f us/frame, encode: %.2f us/frame, %.2f%% of one CPU at 60 Hz\n",
+			1e6 * capture_cpu / i, 1e6 * encode_cpu / i,
+			100.0 * 60.0 * (capture_cpu + encode_cpu) / i);
+		if (unpresented > 0)
+			printf("%lu frames captured before being presented\n", unpresented);
+	}
+
+	fbstream_finish(&w);
+	chip8io_close();
+	return 0;
+}
+
+static int info(const char *path) {
+	struct fbstream_reader r;
+
+	if (fbstream_open(&r, path)) {
+		fprintf(stderr, "could not read %s\n", path);
+		return 1;
+	}
+	printf("%s: %u frames at %u Hz (%.2f s), keyframe every %u frames, %zu keyframes, %llu bytes of frames\n",
+		path, r.frames, r.fps, r.fps ? (double) r.frames / r.fps : 0.0, r.keyframe_interval,
+		r.nindex, (unsigned long long) (r.data_end - FBSTREAM_HEADER_SIZE));
+	fbstream_close(&r);
+	return 0;
+}
+
+static void print_frame(FILE *out, uint32_t frame, const uint64_t *rows) {
+	int x, y;
+
+	fprintf(out, "Frame %u\n", frame);
+	for (y = 0; y < CHIP8_FB_HEIGHT; ++y) {
+		for (x = 0; x < CHIP8_FB_WIDTH; ++x)
+			fputc((rows[y] >> x) & 0x1 ? '#' : '.', out);
+		fputc('\n', out);
+	}
+}
+
+static int play(const char *path, int argc, char **argv) {
+	struct fbstream_reader r;
+	uint64_t rows[CHIP8_FB_HEIGHT];
+	unsigned long first = 0, count = ~0UL;
+	int realtime = 0, opt, ret = 0;
+	struct timespec deadline;
+
+	while ((opt = getopt(argc, argv, "f:n:t")) != -1) {
+		switch (opt) {
+		case 'f': first = strtoul(optarg, NULL, 0); break;
+		case 'n': count = strtoul(optarg, NULL, 0); break;
+		case 't': realtime = 1; break;
+		default: usage();
+		}
+	}
+
+	if (fbstream_open(&r, path) || fbstream_seek(&r, first)) {
+		fprintf(stderr, "could not read %s\n", path);
+		return 1;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	while (count-- > 0 && (ret = fbstream_next(&r, rows)) == 1) {
+		print_frame(stdout, r.next_frame - 1, rows);
+		if (realtime)
+			sleep_until(&deadline);
+	}
+
+	fbstream_close(&r);
+	return ret < 0;
+}
+
+static uint32_t crc_table[256];
+
+static uint32_t crc32(uint32_t crc, const uint8_t *buf, size_t len) {
+	size_t i;
+	int k;
+
+	if (crc_table[1] == 0) {
+		for (i = 0; i < 256; ++i) {
+			uint32_t c = i;
+			for (k = 0; k < 8; ++k)
+				c = c & 1 ? 0xedb88320 ^ (c >> 1) : c >> 1;
+			crc_table[i] = c;
+		}
+	}
+
+	crc = ~crc;
+	for (i = 0; i < len; ++i)
+		crc = crc_table[(crc ^ buf[i]) & 0xff] ^ (crc >> 8);
+	return ~crc;
+}
+
+static void put_be32(uint8_t *p, uint32_t v) {
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
+
+static void write_chunk(FILE *out, const char *type, const uint8_t *data, size_t len) {
+	uint8_t buf[4];
+	uint32_t crc;
+
+	put_be32(buf, len);
+	fwrite(buf, 1, 4, out);
+	fwrite(type, 1, 4, out);
+	fwrite(data, 1, len, out);
+	crc = crc32(crc32(0, (const uint8_t *) type, 4), data, len);
+	put_be32(buf, crc);
+	fwrite(buf, 1, 4, out);
+}
+
+/*
+* Writes an 8-bit grayscale PNG. The image data goes into stored (not
+* compressed) deflate blocks so no zlib is needed.
+*/
+static int write_png(FILE *out, const uint8_t *pixels, int width, int height) {
+	size_t rawlen = (size_t) (width + 1) * height;
+	size_t nblocks = (rawlen + 65534) / 65535;
+	size_t idatlen = 2 + rawlen + 5 * nblocks + 4;
+	uint8_t *idat = malloc(idatlen), *p;
+	uint8_t ihdr[13];
+	uint32_t a = 1, b = 0;
+	size_t done = 0;
+	int y;
+
+	if (idat == NULL)
+		return -1;
+
+	fwrite("\x89PNG\r\n\x1a\n", 1, 8, out);
+	put_be32(ihdr, width);
+	put_be32(ihdr + 4, height);
+	ihdr[8] = 8;    //Bit depth
+	ihdr[9] = 0;    //Grayscale
+	ihdr[10] = ihdr[11] = ihdr[12] = 0;
+	write_chunk(out, "IHDR", ihdr, sizeof(ihdr));
+
+	p = idat;
+	*p++ = 0x78;
+	*p++ = 0x01;
+	for (y = 0; y < height; ++y) {
+		const uint8_t *row = pixels + (size_t) y * width;
+		int x;
+		for (x = -1; x < width; ++x) {
+			uint8_t v = x < 0 ? 0 : row[x];   //Filter type 0 per row
+			if (done % 65535 == 0) {
+				size_t left = rawlen - done;
+				size_t blen = left > 65535 ? 65535 : left;
+				*p++ = left <= 65535;
+				*p++ = blen & 0xff;
+				*p++ = blen >> 8;
+				*p++ = ~blen & 0xff;
+				*p++ = (~blen >> 8) & 0xff;
+			}
+			*p++ = v;
+			a = (a + v) % 65521;
+			b = (b + a) % 65521;
+			done++;
+		}
+	}
+	put_be32(p, (b << 16) | a);
+	p += 4;
+
+	write_chunk(out, "IDAT", idat, p - idat);
+	write_chunk(out, "IEND", NULL, 0);
+	free(idat);
+	return 0;
+}
+
+static int export_frame(const char *path, int argc, char **argv) {
+	struct fbstream_reader r;
+	uint64_t rows[CHIP8_FB_HEIGHT];
+	unsigned long frame;
+	const char *outname;
+	int scale = 1, opt, width, height, x, y, ret;
+	uint8_t *pixels;
+	FILE *out;
+
+	if (argc < 3)
+		usage();
+	frame = strtoul(argv[1], NULL, 0);
+	outname = argv[2];
+	optind = 3;
+	while ((opt = getopt(argc, argv, "s:")) != -1) {
+		switch (opt) {
+		case 's': scale = atoi(optarg); break;
+		default: usage();
+		}
+	}
+	if (scale < 1)
+		scale = 1;
+
+	if (fbstream_open(&r, path) || fbstream_seek(&r, frame) || fbstream_next(&r, rows) != 1) {
+		fprintf(stderr, "could not read frame %lu of %s\n", frame, path);
+		return 1;
+	}
+	fbstream_close(&r);
+
+	width = CHIP8_FB_WIDTH * scale;
+	height = CHIP8_FB_HEIGHT * scale;
+	pixels = malloc((size_t) width * height);
+	if (pixels == NULL)
+		return 1;
+	for (y = 0; y < height; ++y)
+		for (x = 0; x < width; ++x)
+			pixels[y * width + x] = (rows[y / scale] >> (x / scale)) & 0x1 ? 255 : 0;
+
+	if ((out = fopen(outname, "wb")) == NULL) {
+		fprintf(stderr, "could not open %s\n", outname);
+		free(pixels);
+		return 1;
+	}
+
+	if (strlen(outname) > 4 && strcmp(outname + strlen(outname) - 4, ".png") == 0) {
+		ret = write_png(out, pixels, width, height);
+	} else {
+		fprintf(out, "P5\n%d %d\n255\n", width, height);
+		ret = fwrite(pixels, 1, (size_t) width * height, out) != (size_t) width * height;
+	}
+
+	free(pixels);
+	return (fclose(out) != 0 || ret) ? 1 : 0;
+}
+
+/* Drawing is pending until the next vertical blank, which the wait finds */
+static int present() {
+	int status, frames, errors = 0;
+
+	status = readFramebufferStatus();
+	errors += chip8test_check("pending at power-on", status & FRAMEBUFFER_STATUS_PENDING, 0);
+
+	/* Paused, no vertical blank comes to present a host write */
+	setFramebuffer(3, 4, 1);
+	errors += chip8test_check("pending after a host write", readFramebufferStatus() & FRAMEBUFFER_STATUS_PENDING,
+		FRAMEBUFFER_STATUS_PENDING);
+	errors += chip8test_check("wait while paused", chip8io_wait_present(PRESENT_TIMEOUT), -1);
+
+	/* JP 0x200: pending up to the blank, clear from it on */
+	setMemory(0x200, 0x12);
+	setMemory(0x201, 0x00);
+	writePC(0x200);
+	startChip8();
+	frames = FRAMEBUFFER_STATUS_FRAMES(readFramebufferStatus());
+	while (FRAMEBUFFER_STATUS_FRAMES(status = readFramebufferStatus()) == frames) {
+		if (!(status & FRAMEBUFFER_STATUS_PENDING))
+			break;
+		chip8io_advance(1);
+	}
+	errors += chip8test_check("frames at the first blank", FRAMEBUFFER_STATUS_FRAMES(status), frames + 1);
+	errors += chip8test_check("pending after the blank", status & FRAMEBUFFER_STATUS_PENDING, 0);
+	errors += chip8test_check("pixel presented", readFramebuffer(3, 4), 1);
+
+	/* DRW V0, V1, 5 every other instruction, the wait catches a blank between */
+	pauseChip8();
+	setMemory(0x200, 0xd0);
+	setMemory(0x201, 0x15);
+	setMemory(0x202, 0x12);
+	setMemory(0x203, 0x00);
+	writePC(0x200);
+	startChip8();
+	chip8io_advance(1);
+	status = readFramebufferStatus();
+	errors += chip8test_check("pending after DRW", status & FRAMEBUFFER_STATUS_PENDING, FRAMEBUFFER_STATUS_PENDING);
+	frames = FRAMEBUFFER_STATUS_FRAMES(status);
+	errors += chip8test_check("wait while drawing", chip8io_wait_present(PRESENT_TIMEOUT), 0);
+	status = readFramebufferStatus();
+	errors += chip8test_check("pending after the wait", status & FRAMEBUFFER_STATUS_PENDING, 0);
+	errors += chip8test_check("frames after the wait", FRAMEBUFFER_STATUS_FRAMES(status), frames + 1);
+	return errors;
+}
+
+/* Records TEST_FRAMES frames of the ROM into path over two sessions, keeping each in frames */
+static int record_frames(const char *path, const char *rom, uint64_t frames[][CHIP8_FB_HEIGHT]) {
+	struct fbstream_writer w;
+	int i, errors = 0;
+
+	resetChip8(rom);
+	startChip8();
+	for (i = 0; i < TEST_FRAMES; ++i) {
+		/* Stop halfway and append the rest */
+		if ((i == 0 || i == TEST_FRAMES / 2) && fbstream_create(&w, path, TEST_INTERVAL, i > 0)) {
+			printf("could not open %s\n", path);
+			return 1;
+		}
+		chip8io_advance(chip8io_slots_per_frame());
+		chip8io_wait_present(PRESENT_TIMEOUT);
+		readFramebufferPacked(frames[i]);
+		errors += chip8test_check("append", fbstream_append(&w, frames[i]), 0);
+		if (i == TEST_FRAMES / 2 - 1 || i == TEST_FRAMES - 1)
+			errors += chip8test_check("finish", fbstream_finish(&w), 0);
+	}
+	return errors;
+}
+
+/*
+* Reads the stream back in order and from every keyframe and the frames
+* around it, returns the number of frames that differ or could not be read
+*/
+static int read_frames(const char *path, uint64_t frames[][CHIP8_FB_HEIGHT], uint32_t nframes) {
+	struct fbstream_reader r;
+	uint64_t rows[CHIP8_FB_HEIGHT];
+	uint32_t i, k;
+	int wrong = 0;
+
+	if (fbstream_open(&r, path)) {
+		printf("could not read %s\n", path);
+		return 1;
+	}
+	wrong += chip8test_check("frames", r.frames, nframes);
+	for (i = 0; i < nframes; ++i)
+		wrong += fbstream_next(&r, rows) != 1 || memcmp(rows, frames[i], sizeof(rows)) != 0;
+	wrong += chip8test_check("next past the end", fbstream_next(&r, rows), 0);
+
+	for (k = 0; k < nframes; k += TEST_INTERVAL) {
+		for (i = k > 0 ? k - 1 : 0; i <= k + 1 && i < nframes; ++i) {
+			wrong += fbstream_seek(&r, i) != 0 || fbstream_next(&r, rows) != 1 ||
+				memcmp(rows, frames[i], sizeof(rows)) != 0;
+		}
+	}
+	wrong += chip8test_check("seek to the frame count", fbstream_seek(&r, nframes), -1);
+	fbstream_close(&r);
+	return wrong;
+}
+
+/* Exports frame n at scale 2 as PGM and as PNG and checks the pixels */
+static int export_frames(const char *path, uint64_t frames[][CHIP8_FB_HEIGHT], int n) {
+	char frame[16], pgm[] = "/tmp/chip8rec-XXXXXX.pgm", png[] = "/tmp/chip8rec-XXXXXX.png";
+	char *args[] = { (char *) path, frame, pgm, "-s", "2", NULL };
+	uint8_t buf[64 + 2 * CHIP8_FB_HEIGHT * (2 * CHIP8_FB_WIDTH + 1) + 64];
+	const uint8_t *p;
+	int errors = 0, wrong = 0, x, y, fd;
+	size_t len;
+	FILE *f;
+
+	snprintf(frame, sizeof(frame), "%d", n);
+	if ((fd = mkstemps(pgm, 4)) == -1 || close(fd) || (fd = mkstemps(png, 4)) == -1 || close(fd)) {
+		perror("mkstemps");
+		return 1;
+	}
+
+	errors += chip8test_check("export to PGM", export_frame(path, 5, args), 0);
+	f = fopen(pgm, "rb");
+	len = f != NULL ? fread(buf, 1, sizeof(buf), f) : 0;
+	if (f != NULL)
+		fclose(f);
+	p = buf + strlen("P5\n128 64\n255\n");
+	errors += chip8test_check("PGM size", len, p - buf + 4 * CHIP8_FB_WIDTH * CHIP8_FB_HEIGHT);
+	if (len >= strlen("P5\n128 64\n255\n") && memcmp(buf, "P5\n128 64\n255\n", p - buf) == 0) {
+		for (y = 0; y < 2 * CHIP8_FB_HEIGHT; ++y)
+			for (x = 0; x < 2 * CHIP8_FB_WIDTH && (size_t) (p - buf) < len; ++x, ++p)
+				wrong += *p != ((frames[n][y / 2] >> (x / 2)) & 0x1 ? 255 : 0);
+	} else {
+		errors++;
+	}
+	errors += chip8test_check("PGM pixels that differ", wrong, 0);
+
+	/* A single stored deflate block, after the signature, IHDR and the zlib header */
+	args[2] = png;
+	errors += chip8test_check("export to PNG", export_frame(path, 5, args), 0);
+	f = fopen(png, "rb");
+	len = f != NULL ? fread(buf, 1, sizeof(buf), f) : 0;
+	if (f != NULL)
+		fclose(f);
+	errors += chip8test_check("PNG size", len, 8 + 25 + 12 + 2 + 5 + 2 * CHIP8_FB_HEIGHT * (2 * CHIP8_FB_WIDTH + 1) + 4 + 12);
+	errors += chip8test_check("PNG signature", memcmp(buf, "\x89PNG\r\n\x1a\n", 8), 0);
+	errors += chip8test_check("PNG trailer", len >= 12 && memcmp(buf + len - 8, "IEND", 4) == 0, 1);
+	wrong = 0;
+	p = buf + 8 + 25 + 8 + 2 + 5;
+	for (y = 0; y < 2 * CHIP8_FB_HEIGHT && (size_t) (p - buf) < len; ++y) {
+		wrong += *p++ != 0;
+		for (x = 0; x < 2 * CHIP8_FB_WIDTH && (size_t) (p - buf) < len; ++x, ++p)
+			wrong += *p != ((frames[n][y / 2] >> (x / 2)) & 0x1 ? 255 : 0);
+	}
+	errors += chip8test_check("PNG pixels that differ", wrong, 0);
+
+	unlink(pgm);
+	unlink(png);
+	return errors;
+}
+
+/* Overwrites the data_end offset in the trailer */
+static int corrupt_trailer(const char *path, uint64_t data_end) {
+	FILE *f = fopen(path, "r+b");
+	int k;
+
+	if (f == NULL || fseek(f, -FBSTREAM_TRAILER_SIZE, SEEK_END))
+		return -1;
+	for (k = 0; k < 8; ++k)
+		fputc((data_end >> (8 * k)) & 0xff, f);
+	return fclose(f);
+}
+
+/*
+* Records the model into a stream and reads it back: in order, around every
+* keyframe, exported, with a trailer that points past the file and cut
+* short in the last record
+*/
+static int stream(const char *rom) {
+	static uint64_t frames[TEST_FRAMES][CHIP8_FB_HEIGHT];
+	char path[] = "/tmp/chip8rec-XXXXXX";
+	struct fbstream_reader r;
+	uint64_t data_end = 0;
+	int errors = 0, fd;
+
+	if ((fd = mkstemp(path)) == -1) {
+		perror(path);
+		return 1;
+	}
+	close(fd);
+
+	errors += record_frames(path, rom, frames);
+	errors += chip8test_check("frames that differ", read_frames(path, frames, TEST_FRAMES), 0);
+	if (fbstream_open(&r, path) == 0) {
+		errors += chip8test_check("keyframes", r.nindex, (TEST_FRAMES + TEST_INTERVAL - 1) / TEST_INTERVAL);
+		data_end = r.data_end;
+		fbstream_close(&r);
+	}
+	errors += export_frames(path, frames, TEST_INTERVAL + 1);
+
+	errors += chip8test_check("corrupt trailer", corrupt_trailer(path, 1ULL << 40), 0);
+	errors += chip8test_check("frames that differ after the trailer", read_frames(path, frames, TEST_FRAMES), 0);
+
+	errors += chip8test_check("truncate", truncate(path, data_end - 1), 0);
+	errors += chip8test_check("frames that differ when truncated", read_frames(path, frames, TEST_FRAMES - 1), 0);
+
+	unlink(path);
+	return errors;
+}
+
+static int test(int argc, char **argv) {
+	const char *rom = DEFAULT_ROM;
+	int errors = 0, opt;
+
+	while ((opt = getopt(argc, argv, "r:")) != -1) {
+		switch (opt) {
+		case 'r': rom = optarg; break;
+		default: usage();
+		}
+	}
+
+	if (chip8io_open("model"))
+		return chip8test_report(1);
+	errors += present();
+	errors += stream(rom);
+	chip8io_close();
+
+	return chip8test_report(errors);
+}
+
+int main(int argc, char **argv) {
+	if (argc >= 2 && strcmp(argv[1], "test") == 0)
+		return test(argc - 1, argv + 1);
+	if (argc < 3)
+		usage();
+
+	/* Options follow the stream name */
+	if (strcmp(argv[1], "record") == 0)
+		return record(argv[2], argc - 2, argv + 2);
+	if (strcmp(argv[1], "info") == 0)
+		return info(argv[2]);
+	if (strcmp(argv[1], "play") == 0)
+		return play(argv[2], argc - 2, argv + 2);
+	if (strcmp(argv[1], "export") == 0)
+		return export_frame(argv[2], argc - 2, argv + 2);
+
+	usage();
+	return 1;
+}
@@ -0,0 +1,381 @@
+/*
+ * Rewind buffer for the software core, see chip8rewind.h
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "chip8rewind.h"
+
+#define RECORD_KEYFRAME 'K'
+#define RECORD_DELTA 'D'
+#define RECORD_TICK 'T'
+
+/* Every record starts with this header, lengths are multiples of 8 */
+struct record {
+	uint8_t  type;
+	uint8_t  pad[3];
+	uint32_t len;
+	uint64_t stamp;
+};
+
+struct regs {
+	uint8_t  v[CHIP8_NUM_REGISTERS];
+	uint16_t i;
+	uint16_t pc;
+	uint16_t stack[CHIP8_STACK_DEPTH];
+	uint8_t  sp;
+	uint8_t  delay_timer;
+	uint8_t  sound_timer;
+	uint8_t  key;
+	uint8_t  key_pressed;
+	uint8_t  halted;
+	uint16_t rand_state;
+};
+
+#define RECORD_LEN(payload) ((sizeof(struct record) + (payload) + 7) & ~(size_t) 7)
+#define KEYFRAME_LEN RECORD_LEN(sizeof(struct regs) + CHIP8_MEMORY_SIZE + CHIP8_FB_BYTES)
+/* A delta with every page and row dirty, the largest record */
+#define MAX_RECORD_LEN RECORD_LEN(sizeof(struct regs) + sizeof(uint64_t) + sizeof(uint32_t) + \
+		CHIP8_MEMORY_SIZE + CHIP8_FB_BYTES)
+
+static struct record *at(const struct chip8_rewind *rw, size_t offset) {
+	return (struct record *) (rw->buf + offset);
+}
+
+static size_t next_offset(const struct chip8_rewind *rw, size_t offset) {
+	offset += at(rw, offset)->len;
+	if (rw->wrap && offset == rw->wrap)
+		offset = 0;
+	return offset;
+}
+
+static struct chip8rewind_keyframe *key(const struct chip8_rewind *rw, size_t n) {
+	return &rw->keys[(rw->first_key + n) % rw->max_keys];
+}
+
+int chip8rewind_init(struct chip8_rewind *rw, size_t size,
+		unsigned int keyframe_interval, unsigned int delta_interval) {
+	memset(rw, 0, sizeof(*rw));
+	if (size < 2 * MAX_RECORD_LEN)
+		return -1;
+
+	rw->size = size;
+	rw->max_keys = size / KEYFRAME_LEN + 1;
+	rw->buf = malloc(size);
+	rw->keys = malloc(rw->max_keys * sizeof(*rw->keys));
+	if (rw->buf == NULL || rw->keys == NULL) {
+		chip8rewind_free(rw);
+		return -1;
+	}
+
+	rw->keyframe_interval = keyframe_interval ? keyframe_interval : CHIP8REWIND_KEYFRAME_INTERVAL;
+	rw->delta_interval = delta_interval ? delta_interval : CHIP8REWIND_DELTA_INTERVAL;
+	if (rw->delta_interval > rw->keyframe_interval)
+		rw->delta_interval = rw->keyframe_interval;
+	return 0;
+}
+
+void chip8rewind_free(struct chip8_rewind *rw) {
+	free(rw->buf);
+	free(rw->keys);
+	rw->buf = NULL;
+	rw->keys = NULL;
+}
+
+size_t chip8rewind_footprint(const struct chip8_rewind *rw) {
+	return sizeof(*rw) + rw->size + rw->max_keys * sizeof(*rw->keys);
+}
+
+void chip8rewind_discard(struct chip8_rewind *rw, struct chip8_core *c) {
+	rw->head = 0;
+	rw->tail = 0;
+	rw->wrap = 0;
+	rw->first_key = 0;
+	rw->nkeys = 0;
+	c->rewind_due = c->retired;
+}
+
+void chip8rewind_attach(struct chip8_rewind *rw, struct chip8_core *c) {
+	c->rewind = rw;
+	chip8rewind_discard(rw, c);
+}
+
+void chip8rewind_detach(struct chip8_core *c) {
+	c->rewind = NULL;
+	c->rewind_due = UINT64_MAX;
+}
+
+uint64_t chip8rewind_oldest(const struct chip8_rewind *rw) {
+	return rw->nkeys ? key(rw, 0)->stamp : UINT64_MAX;
+}
+
+/* Drops the oldest keyframe and the records that depend on it */
+static void evict(struct chip8_rewind *rw) {
+	rw->first_key = (rw->first_key + 1) % rw->max_keys;
+	if (--rw->nkeys == 0) {
+		rw->head = rw->tail = rw->wrap = 0;
+		return;
+	}
+
+	rw->tail = key(rw, 0)->offset;
+	/* Moved past the wrap point, only the lower part is left */
+	if (rw->wrap && rw->tail < rw->head)
+		rw->wrap = 0;
+}
+
+/*
+* Makes room for a record of len bytes and returns its offset, evicting old
+* keyframes as needed. A delta must not evict the keyframe it builds on, so
+* with keep_last set this fails with SIZE_MAX instead.
+*/
+static size_t reserve(struct chip8_rewind *rw, size_t len, int keep_last) {
+	size_t offset;
+
+	for (;;) {
+		if (!rw->wrap) {
+			if (rw->head + len <= rw->size)
+				break;
+			if (len <= rw->tail) {
+				rw->wrap = rw->head;
+				rw->head = 0;
+				break;
+			}
+		} else if (rw->head + len <= rw->tail) {
+			break;
+		}
+
+		if (keep_last && rw->nkeys <= 1)
+			return SIZE_MAX;
+		evict(rw);
+	}
+
+	offset = rw->head;
+	rw->head += len;
+	rw->bytes += len;
+	return offset;
+}
+
+static uint8_t *put_header(struct chip8_rewind *rw, size_t offset, uint8_t type,
+		size_t len, uint64_t stamp) {
+	struct record *r = at(rw, offset);
+	memset(r, 0, sizeof(*r));
+	r->type = type;
+	r->len = len;
+	r->stamp = stamp;
+	return (uint8_t *) (r + 1);
+}
+
+static void save_regs(struct regs *r, const struct chip8_core *c) {
+	memcpy(r->v, c->v, sizeof(r->v));
+	r->i = c->i;
+	r->pc = c->pc;
+	memcpy(r->stack, c->stack, sizeof(r->stack));
+	r->sp = c->sp;
+	r->delay_timer = c->delay_timer;
+	r->sound_timer = c->sound_timer;
+	r->key = c->key;
+	r->key_pressed = c->key_pressed;
+	r->halted = c->halted;
+	r->rand_state = c->rand_state;
+}
+
+static void load_regs(struct chip8_core *c, const struct regs *r) {
+	memcpy(c->v, r->v, sizeof(c->v));
+	c->i = r->i;
+	c->pc = r->pc;
+	memcpy(c->stack, r->stack, sizeof(c->stack));
+	c->sp = r->sp;
+	c->delay_timer = r->delay_timer;
+	c->sound_timer = r->sound_timer;
+	c->key = r->key;
+	c->key_pressed = r->key_pressed;
+	c->halted = r->halted;
+	c->rand_state = r->rand_state;
+}
+
+static void write_keyframe(struct chip8_rewind *rw, struct chip8_core *c) {
+	struct regs regs;
+	size_t offset = reserve(rw, KEYFRAME_LEN, 0);
+	uint8_t *p = put_header(rw, offset, RECORD_KEYFRAME, KEYFRAME_LEN, c->retired);
+
+	save_regs(&regs, c);
+	memcpy(p, &regs, sizeof(regs));
+	p += sizeof(regs);
+	memcpy(p, c->mem, CHIP8_MEMORY_SIZE);
+	p += CHIP8_MEMORY_SIZE;
+	memcpy(p, c->fb, CHIP8_FB_BYTES);
+
+	key(rw, rw->nkeys)->stamp = c->retired;
+	key(rw, rw->nkeys)->offset = offset;
+	rw->nkeys++;
+	rw->next_keyframe = c->retired + rw->keyframe_interval;
+	rw->keyframes++;
+}
+
+static int write_delta(struct chip8_rewind *rw, struct chip8_core *c) {
+	uint64_t pages = c->dirty_pages;
+	uint32_t rows = c->dirty_rows;
+	struct regs regs;
+	size_t len, offset;
+	uint8_t *p;
+	int k;
+
+	len = RECORD_LEN(sizeof(regs) + sizeof(pages) + sizeof(rows) +
+		__builtin_popcountll(pages) * CHIP8_PAGE_SIZE +
+		__builtin_popcount(rows) * sizeof(uint64_t));
+	if ((offset = reserve(rw, len, 1)) == SIZE_MAX)
+		return -1;
+	p = put_header(rw, offset, RECORD_DELTA, len, c->retired);
+
+	save_regs(&regs, c);
+	memcpy(p, &regs, sizeof(regs));
+	p += sizeof(regs);
+	memcpy(p, &pages, sizeof(pages));
+	p += sizeof(pages);
+	memcpy(p, &rows, sizeof(rows));
+	p += sizeof(rows);
+	for (k = 0; k < CHIP8_NUM_PAGES; ++k) {
+		if (pages & (1ULL << k)) {
+			memcpy(p, c->mem + k * CHIP8_PAGE_SIZE, CHIP8_PAGE_SIZE);
+			p += CHIP8_PAGE_SIZE;
+		}
+	}
+	for (k = 0; k < CHIP8_FB_HEIGHT; ++k) {
+		if (rows & (1u << k)) {
+			memcpy(p, &c->fb[k], sizeof(uint64_t));
+			p += sizeof(uint64_t);
+		}
+	}
+
+	rw->deltas++;
+	return 0;
+}
+
+void chip8rewind_record(struct chip8_rewind *rw, struct chip8_core *c) {
+	uint64_t due;
+
+	if (rw->nkeys == 0 || c->retired >= rw->next_keyframe || write_delta(rw, c))
+		write_keyframe(rw, c);
+
+	c->dirty_pages = 0;
+	c->dirty_rows = 0;
+	due = c->retired + rw->delta_interval;
+	c->rewind_due = due < rw->next_keyframe ? due : rw->next_keyframe;
+}
+
+void chip8rewind_tick(struct chip8_rewind *rw, struct chip8_core *c) {
+	size_t offset;
+
+	/* The keyframe that starts the ring will hold the timers */
+	if (rw->nkeys == 0)
+		return;
+
+	if ((offset = reserve(rw, RECORD_LEN(0), 1)) == SIZE_MAX) {
+		chip8core_touch(c);
+		return;
+	}
+	put_header(rw, offset, RECORD_TICK, RECORD_LEN(0), c->retired);
+	rw->ticks++;
+}
+
+static void apply(struct chip8_core *c, const struct record *r) {
+	const uint8_t *p = (const uint8_t *) (r + 1);
+	struct regs regs;
+	uint64_t pages;
+	uint32_t rows;
+	int k;
+
+	memcpy(&regs, p, sizeof(regs));
+	load_regs(c, &regs);
+	p += sizeof(regs);
+	c->retired = r->stamp;
+
+	if (r->type == RECORD_KEYFRAME) {
+		memcpy(c->mem, p, CHIP8_MEMORY_SIZE);
+		memcpy(c->fb, p + CHIP8_MEMORY_SIZE, CHIP8_FB_BYTES);
+		return;
+	}
+
+	memcpy(&pages, p, sizeof(pages));
+	p += sizeof(pages);
+	memcpy(&rows, p, sizeof(rows));
+	p += sizeof(rows);
+	for (k = 0; k < CHIP8_NUM_PAGES; ++k) {
+		if (pages & (1ULL << k)) {
+			memcpy(c->mem + k * CHIP8_PAGE_SIZE, p, CHIP8_PAGE_SIZE);
+			p += CHIP8_PAGE_SIZE;
+		}
+	}
+	for (k = 0; k < CHIP8_FB_HEIGHT; ++k) {
+		if (rows & (1u << k)) {
+			memcpy(&c->fb[k], p, sizeof(uint64_t));
+			p += sizeof(uint64_t);
+		}
+	}
+}
+
+int chip8rewind_seek(struct chip8_rewind *rw, struct chip8_core *c, uint64_t instruction) {
+	size_t lo = 0, hi, last, offset;
+
+	/* Host writes since the last instruction belong to the present */
+	if (c->retired >= c->rewind_due)
+		chip8rewind_record(rw, c);
+
+	if (rw->nkeys == 0 || instruction < key(rw, 0)->stamp || instruction > c->retired)
+		return -1;
+
+	/* Latest keyframe at or before the instruction */
+	hi = rw->nkeys;
+	while (hi - lo > 1) {
+		size_t mid = (lo + hi) / 2;
+		if (key(rw, mid)->stamp <= instruction) lo = mid;
+		else hi = mid;
+	}
+
+	last = key(rw, lo)->offset;
+	apply(c, at(rw, last));
+	for (offset = next_offset(rw, last); offset != rw->head; offset = next_offset(rw, offset)) {
+		const struct record *r = at(rw, offset);
+		if (r->stamp > instruction)
+			break;
+		if (r->type == RECORD_DELTA) {
+			apply(c, r);
+			last = offset;
+		}
+	}
+
+	/* Re-execute the rest without recording, replaying the timer ticks */
+	c->rewind = NULL;
+	c->rewind_due = UINT64_MAX;
+	c->dirty_pages = 0;
+	c->dirty_rows = 0;
+	offset = next_offset(rw, last);
+	for (;;) {
+		while (offset != rw->head && at(rw, offset)->stamp <= c->retired) {
+			if (at(rw, offset)->type == RECORD_TICK)
+				chip8core_tick60(c);
+			offset = next_offset(rw, offset);
+		}
+		/* Fx0A only ever ends with a key press, which is always recorded */
+		if (c->retired >= instruction || chip8core_step(c) == CHIP8_STEP_HALTED)
+			break;
+	}
+
+	/* Everything after the last record replayed is a future that is gone */
+	if (offset != rw->head) {
+		if (rw->wrap && offset == 0) {
+			offset = rw->wrap;
+			rw->wrap = 0;
+		} else if (rw->wrap && offset >= rw->tail) {
+			rw->wrap = 0;
+		}
+		rw->head = offset;
+	}
+	rw->nkeys = lo + 1;
+	rw->next_keyframe = key(rw, lo)->stamp + rw->keyframe_interval;
+
+	c->rewind = rw;
+	c->rewind_due = c->retired;
+	return c->retired == instruction ? 0 : -1;
+}
@@ -0,0 +1,97 @@
+#ifndef __CHIP8_REWIND_H__
+#define __CHIP8_REWIND_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include "chip8core.h"
+
+/*
+* Rewind buffer for the software core
+*
+* Once attached to a chip8_core, chip8core_step appends records to a ring
+* of fixed size:
+* * a keyframe with all of memory, the framebuffer and the registers every
+*   keyframe_interval instructions
+* * a delta every delta_interval instructions, and before the next
+*   instruction whenever the host changed state, holding the registers and
+*   only the memory pages and framebuffer rows written since the previous
+*   record
+* * a tick whenever the 60 Hz timers count down, so that re-execution
+*   sees them at the same instruction
+*
+* chip8rewind_seek goes back to any instruction in the window by loading
+* the nearest keyframe, applying the deltas after it and re-executing at
+* most delta_interval instructions. When the ring is full the oldest
+* keyframe is dropped along with its deltas.
+*
+* Every record is stamped with the number of instructions retired when it
+* was taken. Seeking to instruction n gives the latest state with that
+* count, i.e. after any key presses and host writes made before
+* instruction n + 1 ran.
+*/
+
+#define CHIP8REWIND_KEYFRAME_INTERVAL 1000
+#define CHIP8REWIND_DELTA_INTERVAL 100
+
+struct chip8rewind_keyframe {
+	uint64_t stamp;
+	size_t offset;
+};
+
+struct chip8_rewind {
+	uint8_t *buf;
+	size_t size;
+	size_t head;            //Where the next record goes
+	size_t tail;            //Oldest record, always a keyframe
+	size_t wrap;            //End of the upper part while head < tail, else 0
+
+	/* Keyframes in the ring, oldest first */
+	struct chip8rewind_keyframe *keys;
+	size_t max_keys;
+	size_t first_key;
+	size_t nkeys;
+
+	unsigned int keyframe_interval;
+	unsigned int delta_interval;
+	uint64_t next_keyframe;
+
+	/* Statistics */
+	uint64_t keyframes;
+	uint64_t deltas;
+	uint64_t ticks;
+	uint64_t bytes;         //Bytes of records written
+};
+
+/*
+* Allocates a ring of the given size, which must hold at least two
+* keyframes. Intervals of 0 pick the defaults. Returns 0 or -1.
+*/
+int chip8rewind_init(struct chip8_rewind *rw, size_t size,
+		unsigned int keyframe_interval, unsigned int delta_interval);
+void chip8rewind_free(struct chip8_rewind *rw);
+
+/* Bytes allocated for the ring and its keyframe index */
+size_t chip8rewind_footprint(const struct chip8_rewind *rw);
+
+/* Starts recording a core, the first record is a keyframe */
+void chip8rewind_attach(struct chip8_rewind *rw, struct chip8_core *c);
+void chip8rewind_detach(struct chip8_core *c);
+
+/* Drops everything recorded so far */
+void chip8rewind_discard(struct chip8_rewind *rw, struct chip8_core *c);
+
+/* Oldest instruction that can be reached, or UINT64_MAX if none */
+uint64_t chip8rewind_oldest(const struct chip8_rewind *rw);
+
+/*
+* Puts the core back to the given instruction. Recording continues from
+* there and everything recorded after it is dropped. Returns -1 if the
+* instruction is outside the window.
+*/
+int chip8rewind_seek(struct chip8_rewind *rw, struct chip8_core *c, uint64_t instruction);
+
+/* Hooks called by chip8core.c */
+void chip8rewind_record(struct chip8_rewind *rw, struct chip8_core *c);
+void chip8rewind_tick(struct chip8_rewind *rw, struct chip8_core *c);
+
+#endif //__CHIP8_REWIND_H__
@@ -0,0 +1,271 @@
+/*
+ * Rewind buffer benchmark and test
+ *
+ * chip8rwd bench [-r rom] [-n instructions] [-m bytes] [-k keyframe] [-d delta]
+ *     Runs a ROM on the software model with and without a rewind buffer
+ *     and reports the per-instruction overhead, the memory footprint, how
+ *     far back the buffer reaches and how long seeks take
+ * chip8rwd test [-r rom] [-m bytes]
+ *     Plays a ROM with key presses, rewinds to recorded checkpoints and
+ *     checks that every one of them is reproduced exactly
+ *
+ * Columbia University
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "chip8model.h"
+#include "chip8rewind.h"
+#include "chip8test.h"
+
+#define DEFAULT_ROM "../test/Pong.ch8"
+
+static double seconds() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void usage() {
+	fprintf(stderr,
+		"Usage: chip8rwd bench [-r rom] [-n instructions] [-m bytes] [-k keyframe] [-d delta]\n"
+		"       chip8rwd test [-r rom] [-m bytes]\n");
+	exit(1);
+}
+
+static int start_model(struct chip8_model *m, const char *rom) {
+	chip8model_init(m);
+	chip8core_clear_memory(&m->core);
+	if (chip8core_load_file(&m->core, rom) < 0) {
+		perror(rom);
+		return -1;
+	}
+	m->state = RUNNING_STATE;
+	return 0;
+}
+
+/* Runs whole frames, holding 1 and 4 in turn so that the game reacts */
+static void play(struct chip8_model *m, unsigned long instructions) {
+	unsigned long frame = 0;
+
+	while (m->core.retired < instructions) {
+		chip8core_set_key(&m->core, (frame / 30) % 2 ? 0x4 : 0x1, (frame / 15) % 2);
+		chip8model_run(m, chip8model_slots_per_frame(m));
+		frame++;
+	}
+}
+
+static int bench(int argc, char **argv) {
+	const char *rom = DEFAULT_ROM;
+	unsigned long instructions = 2000000;
+	unsigned int keyframe = 0, delta = 0;
+	size_t size = 1 << 20;
+	static struct chip8_model m;
+	struct chip8_rewind rw;
+	double plain, recorded, seek_total = 0, seek_max = 0;
+	uint64_t oldest, newest, target;
+	int seeks = 0, opt;
+
+	while ((opt = getopt(argc, argv, "r:n:m:k:d:")) != -1) {
+		switch (opt) {
+		case 'r': rom = optarg; break;
+		case 'n': instructions = strtoul(optarg, NULL, 0); break;
+		case 'm': size = strtoul(optarg, NULL, 0); break;
+		case 'k': keyframe = strtoul(optarg, NULL, 0); break;
+		case 'd': delta = strtoul(optarg, NULL, 0); break;
+		default: usage();
+		}
+	}
+
+	if (start_model(&m, rom))
+		return 1;
+	plain = seconds();
+	play(&m, instructions);
+	plain = seconds() - plain;
+
+	if (chip8rewind_init(&rw, size, keyframe, delta)) {
+		fprintf(stderr, "could not allocate a %zu byte rewind buffer\n", size);
+		return 1;
+	}
+	if (start_model(&m, rom))
+		return 1;
+	chip8rewind_attach(&rw, &m.core);
+	recorded = seconds();
+	play(&m, instructions);
+	recorded = seconds() - recorded;
+
+	oldest = chip8rewind_oldest(&rw);
+	newest = m.core.retired;
+
+	printf("%lu instructions, keyframe every %u, delta every %u\n",
+		instructions, rw.keyframe_interval, rw.delta_interval);
+	printf("rewind disabled       %8.1f ns/instruction\n", plain / instructions * 1e9);
+	printf("rewind enabled        %8.1f ns/instruction (%+.1f%%)\n",
+		recorded / instructions * 1e9, (recorded / plain - 1) * 100);
+	printf("footprint             %8zu bytes\n", chip8rewind_footprint(&rw));
+	printf("recorded              %8.1f bytes/instruction, %llu keyframes, %llu deltas, %llu ticks\n",
+		(double) rw.bytes / instructions, (unsigned long long) rw.keyframes,
+		(unsigned long long) rw.deltas, (unsigned long long) rw.ticks);
+	printf("window                %8llu instructions (%.1f s at %d instructions/s)\n",
+		(unsigned long long) (newest - oldest), (newest - oldest) / 1000.0,
+		CHIP8_CLOCK_HZ / CHIP8_CPU_CYCLE_LENGTH);
+
+	/* Seeks only go backwards, so walk down the window in random steps */
+	srand(1);
+	target = newest;
+	while (target > oldest + 2 * rw.delta_interval && seeks < 200) {
+		double t;
+
+		target -= 1 + rand() % ((newest - oldest) / 100 + 1);
+		if (target < oldest)
+			break;
+		t = seconds();
+		if (chip8rewind_seek(&rw, &m.core, target)) {
+			fprintf(stderr, "seek to %llu failed\n", (unsigned long long) target);
+			break;
+		}
+		t = seconds() - t;
+		seek_total += t;
+		if (t > seek_max)
+			seek_max = t;
+		seeks++;
+	}
+	if (seeks)
+		printf("seek                  %8.1f us mean, %.1f us max over %d seeks\n",
+			seek_total / seeks * 1e6, seek_max * 1e6, seeks);
+
+	chip8rewind_free(&rw);
+	return 0;
+}
+
+/* The model state at one point of the test run */
+struct checkpoint {
+	struct chip8_core core;
+	unsigned long cycles;
+	unsigned int key;       //Key state applied right before the checkpoint
+	unsigned int slots;     //Instruction slots run right after it
+};
+
+static int same(const struct chip8_core *a, const struct chip8_core *b) {
+	return memcmp(a->mem, b->mem, sizeof(a->mem)) == 0 &&
+		memcmp(a->v, b->v, sizeof(a->v)) == 0 &&
+		a->i == b->i && a->pc == b->pc &&
+		memcmp(a->stack, b->stack, sizeof(a->stack)) == 0 &&
+		a->sp == b->sp && a->delay_timer == b->delay_timer &&
+		a->sound_timer == b->sound_timer && a->key == b->key &&
+		a->key_pressed == b->key_pressed && a->halted == b->halted &&
+		a->rand_state == b->rand_state &&
+		memcmp(a->fb, b->fb, sizeof(a->fb)) == 0 &&
+		a->retired == b->retired;
+}
+
+/*
+* Runs the checkpoints' inputs from checkpoint first on, recording the
+* state before each chunk
+*/
+static void run_checkpoints(struct chip8_model *m, struct checkpoint *cp, int first, int n) {
+	int k;
+	for (k = first; k < n; ++k) {
+		chip8core_set_key(&m->core, cp[k].key & 0xf, cp[k].key >> 4);
+		cp[k].core = m->core;
+		cp[k].cycles = m->cycles;
+		chip8model_run(m, cp[k].slots);
+	}
+}
+
+static int check(struct chip8_model *m, struct chip8_rewind *rw, struct checkpoint *cp, int k) {
+	if (chip8rewind_seek(rw, &m->core, cp[k].core.retired) || !same(&m->core, &cp[k].core)) {
+		printf("checkpoint %d (instruction %llu) not reproduced\n", k,
+			(unsigned long long) cp[k].core.retired);
+		return 1;
+	}
+	m->cycles = cp[k].cycles;
+	return 0;
+}
+
+static int test(int argc, char **argv) {
+	const char *rom = DEFAULT_ROM;
+	size_t size = 256 << 10;
+	static struct chip8_model m;
+	static struct checkpoint cp[1500], replay[1500];
+	struct chip8_rewind rw;
+	int n = sizeof(cp) / sizeof(cp[0]), errors = 0, checked = 0, first, k, opt;
+	uint64_t oldest;
+
+	while ((opt = getopt(argc, argv, "r:m:")) != -1) {
+		switch (opt) {
+		case 'r': rom = optarg; break;
+		case 'm': size = strtoul(optarg, NULL, 0); break;
+		default: usage();
+		}
+	}
+
+	if (chip8rewind_init(&rw, size, 0, 0) || start_model(&m, rom))
+		return 1;
+	chip8rewind_attach(&rw, &m.core);
+
+	/* Chunks of a few to a hundred instructions with key changes between */
+	srand(2);
+	for (k = 0; k < n; ++k) {
+		cp[k].key = rand() % 4 ? 0 : 0x10 | (rand() % 2 ? 0x4 : 0x1);
+		cp[k].slots = 1 + rand() % 100;
+	}
+	run_checkpoints(&m, cp, 0, n);
+
+	oldest = chip8rewind_oldest(&rw);
+	for (first = 0; first < n && cp[first].core.retired < oldest; ++first)
+		;
+	printf("%llu instructions, window starts at %llu\n",
+		(unsigned long long) m.core.retired, (unsigned long long) oldest);
+	if (first == 0 || first >= n - 2) {
+		printf("window should cover part of the run, pick another -m\n");
+		errors++;
+		goto out;
+	}
+
+	/* Walk back over the window */
+	for (k = n - 1; k >= (n + first) / 2; k -= 7, ++checked)
+		errors += check(&m, &rw, cp, k);
+
+	/* Branch off at an earlier point, play the same inputs again and go back */
+	k = first + (n - first) / 4;
+	errors += check(&m, &rw, cp, k);
+	memcpy(replay, cp, sizeof(cp));
+	run_checkpoints(&m, replay, k, n);
+	for (k = n - 1; k >= first + (n - first) / 4; k -= 11, ++checked) {
+		if (!same(&replay[k].core, &cp[k].core)) {
+			printf("replayed checkpoint %d differs\n", k);
+			errors++;
+		}
+		errors += check(&m, &rw, cp, k);
+	}
+	for (k = first + (n - first) / 4; k >= first; --k, ++checked)
+		errors += check(&m, &rw, cp, k);
+
+	if (chip8rewind_seek(&rw, &m.core, cp[first - 1].core.retired) == 0) {
+		printf("seek outside the window succeeded\n");
+		errors++;
+	}
+
+out:
+	printf("%d checkpoints checked\n", checked);
+	chip8rewind_free(&rw);
+	return chip8test_report(errors);
+}
+
+int main(int argc, char **argv) {
+	if (argc < 2)
+		usage();
+
+	if (strcmp(argv[1], "bench") == 0)
+		return bench(argc - 1, argv + 1);
+	if (strcmp(argv[1], "test") == 0)
+		return test(argc - 1, argv + 1);
+
+	usage();
+	return 1;
+}
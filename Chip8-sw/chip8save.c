@@ -0,0 +1,389 @@
+/*
+ * Save-state tool
+ *
+ * chip8save save <state> [-b backend] [-r rom]
+ *     Captures the running Chip8. With -r memory is stored as a delta
+ *     against the ROM image, which keeps states small.
+ * chip8save load <state> [-b backend] [-r rom] [-k]
+ *     Restores a state. -r is needed for delta states, -k says the Chip8
+ *     still holds the ROM image (e.g. right after a reset) so that only
+ *     memory that differs from it is written.
+ * chip8save info <state>
+ * chip8save bench [-b backend] [-r rom] [-n iterations]
+ *     Times capture, restore, save and mmap load
+ * chip8save test [-r rom] [-n frames]
+ *     Round trip against the software model: runs a ROM, captures and
+ *     saves it, restores it into a fresh model and checks that both
+ *     continue identically
+ *
+ * Columbia University
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "chip8io.h"
+#include "chip8model.h"
+#include "chip8state.h"
+#include "chip8test.h"
+
+#define DEFAULT_ROM "../test/Pong.ch8"
+
+static double seconds() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void usage() {
+	fprintf(stderr,
+		"Usage: chip8save save <state> [-b backend] [-r rom]\n"
+		"       chip8save load <state> [-b backend] [-r rom] [-k]\n"
+		"       chip8save info <state>\n"
+		"       chip8save bench [-b backend] [-r rom] [-n iterations]\n"
+		"       chip8save test [-r rom] [-n frames]\n");
+	exit(1);
+}
+
+static int save(const char *path, int argc, char **argv) {
+	const char *backend = NULL, *rom = NULL;
+	uint8_t image[CHIP8_MEMORY_SIZE];
+	struct chip8_state s;
+	double t;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "b:r:")) != -1) {
+		switch (opt) {
+		case 'b': backend = optarg; break;
+		case 'r': rom = optarg; break;
+		default: usage();
+		}
+	}
+
+	if (rom != NULL && chip8state_rom_image_file(image, rom)) {
+		perror(rom);
+		return 1;
+	}
+	if (chip8io_open(backend))
+		return 1;
+
+	t = seconds();
+	if (chip8state_capture(&s)) {
+		perror("capture failed");
+		chip8io_close();
+		return 1;
+	}
+	t = seconds() - t;
+	chip8io_close();
+
+	if (chip8state_write(path, &s, rom != NULL ? image : NULL)) {
+		perror(path);
+		return 1;
+	}
+	printf("captured in %.3f ms\n", t * 1e3);
+	return 0;
+}
+
+static int load(const char *path, int argc, char **argv) {
+	const char *backend = NULL, *rom = NULL;
+	uint8_t image[CHIP8_MEMORY_SIZE], buf[CHIP8_MEMORY_SIZE];
+	struct chip8state_map map;
+	const uint8_t *mem;
+	int keep = 0, ret = 0, opt;
+	double t;
+
+	while ((opt = getopt(argc, argv, "b:r:k")) != -1) {
+		switch (opt) {
+		case 'b': backend = optarg; break;
+		case 'r': rom = optarg; break;
+		case 'k': keep = 1; break;
+		default: usage();
+		}
+	}
+
+	if ((keep || rom != NULL) && (rom == NULL || chip8state_rom_image_file(image, rom))) {
+		fprintf(stderr, "-k needs a readable ROM\n");
+		return 1;
+	}
+	if (chip8state_map(&map, path)) {
+		fprintf(stderr, "%s is not a save-state\n", path);
+		return 1;
+	}
+	if ((mem = chip8state_memory(&map, rom != NULL ? image : NULL, buf)) == NULL) {
+		fprintf(stderr, "%s was saved against a different ROM\n", path);
+		chip8state_unmap(&map);
+		return 1;
+	}
+	if (chip8io_open(backend)) {
+		chip8state_unmap(&map);
+		return 1;
+	}
+
+	t = seconds();
+	if (chip8state_restore(map.h, mem, keep ? image : NULL)) {
+		perror("restore failed");
+		ret = 1;
+	}
+	t = seconds() - t;
+
+	chip8io_close();
+	chip8state_unmap(&map);
+	if (ret == 0)
+		printf("restored in %.3f ms\n", t * 1e3);
+	return ret;
+}
+
+static int info(const char *path) {
+	struct chip8state_map map;
+	const struct chip8state_header *h;
+	int k, pixels = 0;
+
+	if (chip8state_map(&map, path)) {
+		fprintf(stderr, "%s is not a save-state\n", path);
+		return 1;
+	}
+	h = map.h;
+
+	for (k = 0; k < CHIP8_FB_HEIGHT; ++k)
+		pixels += __builtin_popcountll(h->fb[k]);
+
+	printf("version %u, %zu bytes, memory %s (%u bytes)", h->version, map.len,
+		(h->flags & CHIP8STATE_MEM_DELTA) ? "delta" : "raw", h->mem_len);
+	if (h->flags & CHIP8STATE_MEM_DELTA)
+		printf(" against ROM image %08x", h->rom_hash);
+	printf("\nPC %03x  I %04x  SP %u  DT %u  ST %u  key %x%s  state %u  %d pixels lit\n",
+		h->pc, h->i, h->sp, h->delay_timer, h->sound_timer, h->key & 0xf,
+		(h->key & 0x10) ? " (pressed)" : "", h->run_state, pixels);
+	for (k = 0; k < CHIP8_NUM_REGISTERS; ++k)
+		printf("V%X %02x%c", k, h->v[k], k % 8 == 7 ? '\n' : ' ');
+	for (k = 0; k < h->sp; ++k)
+		printf("stack[%d] %03x\n", k, h->stack[k]);
+
+	chip8state_unmap(&map);
+	return 0;
+}
+
+static void report(const char *what, double total, int n) {
+	printf("%-22s %9.1f us\n", what, total / n * 1e6);
+}
+
+static int bench(int argc, char **argv) {
+	const char *backend = NULL, *rom = DEFAULT_ROM;
+	uint8_t image[CHIP8_MEMORY_SIZE], buf[CHIP8_MEMORY_SIZE];
+	char path[] = "/tmp/chip8save-XXXXXX";
+	struct chip8_state s;
+	struct chip8state_map map;
+	double t[5] = {0};
+	int n = 20, k, fd, opt;
+
+	while ((opt = getopt(argc, argv, "b:r:n:")) != -1) {
+		switch (opt) {
+		case 'b': backend = optarg; break;
+		case 'r': rom = optarg; break;
+		case 'n': n = atoi(optarg); break;
+		default: usage();
+		}
+	}
+
+	if (chip8state_rom_image_file(image, rom)) {
+		perror(rom);
+		return 1;
+	}
+	if ((fd = mkstemp(path)) == -1) {
+		perror(path);
+		return 1;
+	}
+	close(fd);
+	if (chip8io_open(backend))
+		return 1;
+	if (chip8io_model() != NULL) {
+		chip8core_clear_memory(&chip8io_model()->core);
+		chip8core_load_file(&chip8io_model()->core, rom);
+		startChip8();
+		chip8io_advance(5000);
+	}
+
+	for (k = 0; k < n; ++k) {
+		double start = seconds();
+		if (chip8state_capture(&s))
+			break;
+		t[0] += seconds() - start;
+
+		start = seconds();
+		if (chip8state_restore(&s.h, s.mem, NULL))
+			break;
+		t[1] += seconds() - start;
+
+		/* Memory is already in place, only registers and the framebuffer go out */
+		start = seconds();
+		if (chip8state_restore(&s.h, s.mem, s.mem))
+			break;
+		t[2] += seconds() - start;
+
+		start = seconds();
+		if (chip8state_write(path, &s, image))
+			break;
+		t[3] += seconds() - start;
+
+		start = seconds();
+		if (chip8state_map(&map, path))
+			break;
+		if (chip8state_memory(&map, image, buf) == NULL)
+			break;
+		chip8state_unmap(&map);
+		t[4] += seconds() - start;
+	}
+	chip8io_close();
+	unlink(path);
+
+	if (k < n) {
+		perror("bench failed");
+		return 1;
+	}
+
+	printf("%d iterations on %s\n", n, backend ? backend : CHIP8_DEVICE);
+	report("capture", t[0], n);
+	report("restore", t[1], n);
+	report("restore, same memory", t[2], n);
+	report("save (delta)", t[3], n);
+	report("mmap load (delta)", t[4], n);
+	return 0;
+}
+
+/* Compares everything a state holds, returns the number of differences */
+static int compare(const char *when, const struct chip8_core *a, const struct chip8_core *b) {
+	int errors = 0;
+
+#define CHECK(field) do { \
+		if (memcmp(&a->field, &b->field, sizeof(a->field)) != 0) { \
+			printf("%s: %s differs\n", when, #field); \
+			errors++; \
+		} \
+	} while (0)
+
+	CHECK(mem);
+	CHECK(v);
+	CHECK(i);
+	CHECK(pc);
+	CHECK(stack);
+	CHECK(sp);
+	CHECK(delay_timer);
+	CHECK(sound_timer);
+	CHECK(key);
+	CHECK(key_pressed);
+	CHECK(fb);
+#undef CHECK
+
+	return errors;
+}
+
+static void run_frames(struct chip8_model *m, int frames) {
+	int k;
+	for (k = 0; k < frames; ++k) {
+		/* Hold 1 and 4 in turn so the paddles move */
+		chip8core_set_key(&m->core, (k / 30) % 2 ? 0x4 : 0x1, (k / 15) % 2);
+		chip8model_run(m, chip8model_slots_per_frame(m));
+	}
+}
+
+static int test(int argc, char **argv) {
+	const char *rom = DEFAULT_ROM;
+	uint8_t image[CHIP8_MEMORY_SIZE], buf[CHIP8_MEMORY_SIZE];
+	char path[] = "/tmp/chip8save-XXXXXX";
+	static struct chip8_model a;
+	static struct chip8_state s, direct;
+	struct chip8state_map map;
+	struct chip8_model *b;
+	const uint8_t *mem;
+	int frames = 300, errors = 0, fd, opt;
+
+	while ((opt = getopt(argc, argv, "r:n:")) != -1) {
+		switch (opt) {
+		case 'r': rom = optarg; break;
+		case 'n': frames = atoi(optarg); break;
+		default: usage();
+		}
+	}
+
+	if (chip8state_rom_image_file(image, rom)) {
+		perror(rom);
+		return 1;
+	}
+	if ((fd = mkstemp(path)) == -1) {
+		perror(path);
+		return 1;
+	}
+	close(fd);
+	if (chip8io_open("model"))
+		return 1;
+	b = chip8io_model();
+
+	/* Play for a while on the backend model, then keep a copy as A */
+	chip8core_clear_memory(&b->core);
+	chip8core_load_file(&b->core, rom);
+	b->state = RUNNING_STATE;
+	run_frames(b, frames);
+	a = *b;
+
+	if (chip8state_capture(&s) || chip8state_write(path, &s, image)) {
+		perror("capture failed");
+		goto out;
+	}
+	chip8state_from_core(&direct, &a.core, a.state);
+	if (memcmp(&direct, &s, sizeof(s)) != 0) {
+		printf("captured state does not match the model\n");
+		errors++;
+	}
+
+	/* Restore the mapped file into a fresh model holding only the ROM */
+	chip8model_init(b);
+	chip8core_clear_memory(&b->core);
+	chip8core_load_file(&b->core, rom);
+	if (chip8state_map(&map, path)) {
+		printf("could not map %s\n", path);
+		errors++;
+		goto out;
+	}
+	printf("state file: %zu bytes, %u bytes of memory delta\n", map.len, map.h->mem_len);
+	if ((mem = chip8state_memory(&map, image, buf)) == NULL ||
+			chip8state_restore(map.h, mem, image)) {
+		printf("restore failed\n");
+		errors++;
+	}
+	chip8state_unmap(&map);
+	errors += compare("after restore", &a.core, &b->core);
+
+	/* The LFSR and the 60 Hz phase are not architectural, carry them over */
+	b->core.rand_state = a.core.rand_state;
+	b->cycles = a.cycles;
+	run_frames(&a, frames);
+	run_frames(b, frames);
+	errors += compare("after running on", &a.core, &b->core);
+
+out:
+	chip8io_close();
+	unlink(path);
+	return chip8test_report(errors);
+}
+
+int main(int argc, char **argv) {
+	if (argc < 2)
+		usage();
+
+	if (strcmp(argv[1], "save") == 0 && argc >= 3)
+		return save(argv[2], argc - 2, argv + 2);
+	if (strcmp(argv[1], "load") == 0 && argc >= 3)
+		return load(argv[2], argc - 2, argv + 2);
+	if (strcmp(argv[1], "info") == 0 && argc == 3)
+		return info(argv[2]);
+	if (strcmp(argv[1], "bench") == 0)
+		return bench(argc - 1, argv + 1);
+	if (strcmp(argv[1], "test") == 0)
+		return test(argc - 1, argv + 1);
+
+	usage();
+	return 1;
+}
@@ -0,0 +1,63 @@
+/*
+ * Virtual clock for the model, see chip8sched.h
+ */
+
+#include <string.h>
+
+#include "chip8sched.h"
+#include "chip8model.h"
+
+#define FRAME_NS (1000000000L / 60)
+
+void chip8sched_init(struct chip8_sched *s, struct chip8_model *m,
+		unsigned long instructions_per_tick, int mode, int fast_forward) {
+	memset(s, 0, sizeof(*s));
+	s->m = m;
+	s->mode = mode;
+
+	if (instructions_per_tick == 0)
+		m->cycles_per_instruction = CHIP8_CPU_CYCLE_LENGTH;
+	else if (instructions_per_tick >= CHIP8_CLK_DIV_PERIOD)
+		m->cycles_per_instruction = 1;
+	else
+		m->cycles_per_instruction = CHIP8_CLK_DIV_PERIOD / instructions_per_tick;
+	m->fast_forward = fast_forward;
+	clock_gettime(CLOCK_MONOTONIC, &s->start);
+}
+
+/* Sleeps until the next tick is due, or starts over from now if more than a second behind */
+static void wait_tick(struct chip8_sched *s) {
+	struct timespec due, now;
+	uint64_t ns = ++s->paced * FRAME_NS;
+
+	due.tv_sec = s->start.tv_sec + ns / 1000000000L;
+	due.tv_nsec = s->start.tv_nsec + ns % 1000000000L;
+	if (due.tv_nsec >= 1000000000L) {
+		due.tv_nsec -= 1000000000L;
+		due.tv_sec++;
+	}
+	clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &due, NULL);
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (now.tv_sec > due.tv_sec + 1) {
+		s->start = now;
+		s->paced = 0;
+	}
+}
+
+uint64_t chip8sched_run(struct chip8_sched *s, uint64_t ticks) {
+	struct chip8_model *m = s->m;
+	uint64_t start = m->core.retired;
+	unsigned long slots;
+
+	while (ticks-- > 0 && m->state == RUNNING_STATE) {
+		/* Slots until the cycle count crosses the next tick */
+		slots = (CHIP8_CLK_DIV_PERIOD - m->cycles + m->cycles_per_instruction - 1) /
+			m->cycles_per_instruction;
+		chip8model_run(m, slots);
+		s->ticks++;
+		if (s->mode == CHIP8SCHED_REALTIME)
+			wait_tick(s);
+	}
+	return m->core.retired - start;
+}
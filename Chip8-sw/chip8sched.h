@@ -0,0 +1,48 @@
+#ifndef __CHIP8_SCHED_H__
+#define __CHIP8_SCHED_H__
+
+#include <stdint.h>
+#include <time.h>
+
+/*
+* Virtual clock for the model
+*
+* timer.sv decrements the timers on clk_60 from clk_div.sv, whatever the
+* instruction rate. Board time is kept in cycles of the 50 MHz clock: an
+* instruction slot takes cycles_per_instruction of them and a tick comes
+* every CHIP8_CLK_DIV_PERIOD, and chip8model_run interleaves the two
+* exactly. The scheduler sets the ratio and runs the model a tick at a time:
+* * CHIP8SCHED_VIRTUAL  - as fast as the host goes, the same result every run
+* * CHIP8SCHED_REALTIME - tick k runs no earlier than k/60 s after the start,
+*                         sleeping in between as the board would
+* Both can fast-forward over delay-timer waits, see chip8model_run.
+*/
+
+#define CHIP8SCHED_VIRTUAL 0
+#define CHIP8SCHED_REALTIME 1
+
+struct chip8_model;
+
+struct chip8_sched {
+	struct chip8_model *m;
+	int mode;
+	uint64_t ticks;                 //Run by this scheduler
+	struct timespec start;          //Wall time real-time pacing counts from
+	uint64_t paced;                 //Ticks since start
+};
+
+/*
+* instructions_per_tick sets cycles_per_instruction to CHIP8_CLK_DIV_PERIOD
+* over it, rounded down to whole cycles. 0 keeps the board's 50000 cycles,
+* about 16.7 instructions per tick.
+*/
+void chip8sched_init(struct chip8_sched *s, struct chip8_model *m,
+		unsigned long instructions_per_tick, int mode, int fast_forward);
+
+/*
+* Runs until ticks more 60 Hz ticks have gone by, or the model leaves
+* RUNNING_STATE. Returns the number of instructions retired.
+*/
+uint64_t chip8sched_run(struct chip8_sched *s, uint64_t ticks);
+
+#endif //__CHIP8_SCHED_H__
@@ -0,0 +1,348 @@
+/*
+ * LD_PRELOAD shim that serves /dev/vga_led from the software model
+ *
+ * LD_PRELOAD=./libchip8shim.so ./chip8 pong.ch8
+ *
+ * open, ioctl and close on the device node are answered by a chip8_model
+ * in the calling process with the same ioctl ABI as chip8driver.c, so the
+ * unmodified chip8 binary and tools run without a board. Every other file
+ * goes to libc. A background thread runs the model at a fixed instruction
+ * rate while it is in RUNNING_STATE.
+ *
+ * CHIP8_SHIM_RATE    instructions per second, default 1000 as on the board,
+ *                    0 runs as fast as the host can
+ * CHIP8_SHIM_DEVICE  path to serve, default /dev/vga_led
+ * CHIP8_SHIM_STATS   file the per-ioctl overhead is written to at exit,
+ *                    default stderr
+ * CHIP8_SHIM_NO_BATCH
+ *                    when set, CHIP8_BATCH_ATTR fails with EINVAL like a
+ *                    module from before it
+ *
+ * Columbia University
+ */
+
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "chip8io.h"
+#include "chip8model.h"
+
+#define EXPORT __attribute__((visibility("default")))
+
+#define FRAME_NS (1000000000L / 60)
+#define MAX_FDS 16
+#define DEFAULT_RATE (CHIP8_CLOCK_HZ / CHIP8_CPU_CYCLE_LENGTH)
+
+enum { STAT_WRITE, STAT_READ, STAT_BATCH, STAT_OTHER, STATS };
+
+static const char *stat_names[STATS] = { "write", "read", "batch", "other" };
+
+struct ioctl_stat {
+	uint64_t calls;
+	uint64_t ops;           //Requests carried, more than calls for batches
+	uint64_t ns;
+	uint64_t max_ns;
+};
+
+static int (*real_open)(const char *, int, ...);
+static int (*real_openat)(int, const char *, int, ...);
+static int (*real_ioctl)(int, unsigned long, ...);
+static int (*real_close)(int);
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static struct chip8_model *model;
+static int fds[MAX_FDS];
+static int nfds;
+
+static pthread_t run_thread;
+static atomic_int running;
+static unsigned long rate;
+static int no_batch;
+static uint64_t retired;
+static double started;
+
+static struct ioctl_stat stats[STATS];
+
+static uint64_t now_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void resolve() {
+	if (real_open != NULL)
+		return;
+	real_open = dlsym(RTLD_NEXT, "open");
+	real_openat = dlsym(RTLD_NEXT, "openat");
+	real_ioctl = dlsym(RTLD_NEXT, "ioctl");
+	real_close = dlsym(RTLD_NEXT, "close");
+}
+
+static int is_device(const char *path) {
+	const char *device = getenv("CHIP8_SHIM_DEVICE");
+	return path != NULL && strcmp(path, device != NULL ? device : CHIP8_DEVICE) == 0;
+}
+
+/* Caller holds lock */
+static int find_fd(int fd) {
+	int k;
+	for (k = 0; k < nfds; ++k)
+		if (fds[k] == fd)
+			return k;
+	return -1;
+}
+
+/*
+* Runs one frame of slots every 1/60 s, so the 60 Hz timers keep real time
+* whatever the rate. Unthrottled, it runs frames back to back while the
+* model is running and idles a frame at a time while it is not.
+*/
+static void *run_f(void *arg) {
+	struct timespec deadline, now;
+	int idle;
+
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	while (atomic_load(&running)) {
+		pthread_mutex_lock(&lock);
+		idle = model->state != RUNNING_STATE;
+		retired += chip8model_run(model, chip8model_slots_per_frame(model));
+		pthread_mutex_unlock(&lock);
+
+		if (rate == 0 && !idle)
+			continue;
+
+		deadline.tv_nsec += FRAME_NS;
+		while (deadline.tv_nsec >= 1000000000L) {
+			deadline.tv_nsec -= 1000000000L;
+			deadline.tv_sec++;
+		}
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL);
+
+		/* Fell behind, skip the missed frames instead of bursting */
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if (rate == 0 || now.tv_sec > deadline.tv_sec + 1)
+			deadline = now;
+	}
+	return NULL;
+}
+
+/* Power-on state for the first open, the model then lives as long as the process */
+static int start_model() {
+	const char *env = getenv("CHIP8_SHIM_RATE");
+
+	model = malloc(sizeof(*model));
+	if (model == NULL)
+		return -1;
+	chip8model_init(model);
+
+	no_batch = getenv("CHIP8_SHIM_NO_BATCH") != NULL;
+	rate = env != NULL ? strtoul(env, NULL, 0) : DEFAULT_RATE;
+	if (rate > 0) {
+		model->cycles_per_instruction = CHIP8_CLOCK_HZ / rate;
+		if (model->cycles_per_instruction == 0)
+			model->cycles_per_instruction = 1;
+	}
+
+	started = now_ns() / 1e9;
+	atomic_store(&running, 1);
+	if (pthread_create(&run_thread, NULL, run_f, NULL)) {
+		atomic_store(&running, 0);
+		free(model);
+		model = NULL;
+		return -1;
+	}
+	return 0;
+}
+
+/* Stands a real descriptor on /dev/null in for the device */
+static int open_device(int flags) {
+	int fd;
+
+	pthread_mutex_lock(&lock);
+	if (nfds == MAX_FDS || (model == NULL && start_model())) {
+		pthread_mutex_unlock(&lock);
+		errno = model == NULL ? ENOMEM : EMFILE;
+		return -1;
+	}
+	fd = real_open("/dev/null", O_RDWR | (flags & O_CLOEXEC));
+	if (fd != -1)
+		fds[nfds++] = fd;
+	pthread_mutex_unlock(&lock);
+	return fd;
+}
+
+static mode_t open_mode(int flags, va_list ap) {
+	return flags & (O_CREAT | O_TMPFILE) ? va_arg(ap, mode_t) : 0;
+}
+
+EXPORT int open(const char *path, int flags, ...) {
+	va_list ap;
+	mode_t mode;
+
+	resolve();
+	if (is_device(path))
+		return open_device(flags);
+	va_start(ap, flags);
+	mode = open_mode(flags, ap);
+	va_end(ap);
+	return real_open(path, flags, mode);
+}
+
+EXPORT int open64(const char *path, int flags, ...) {
+	va_list ap;
+	mode_t mode;
+
+	resolve();
+	if (is_device(path))
+		return open_device(flags);
+	va_start(ap, flags);
+	mode = open_mode(flags, ap);
+	va_end(ap);
+	return real_open(path, flags | O_LARGEFILE, mode);
+}
+
+EXPORT int openat(int dirfd, const char *path, int flags, ...) {
+	va_list ap;
+	mode_t mode;
+
+	resolve();
+	if (is_device(path))
+		return open_device(flags);
+	va_start(ap, flags);
+	mode = open_mode(flags, ap);
+	va_end(ap);
+	return real_openat(dirfd, path, flags, mode);
+}
+
+EXPORT int openat64(int dirfd, const char *path, int flags, ...) {
+	va_list ap;
+	mode_t mode;
+
+	resolve();
+	if (is_device(path))
+		return open_device(flags);
+	va_start(ap, flags);
+	mode = open_mode(flags, ap);
+	va_end(ap);
+	return real_openat(dirfd, path, flags | O_LARGEFILE, mode);
+}
+
+EXPORT int ioctl(int fd, unsigned long cmd, ...) {
+	struct ioctl_stat *s;
+	uint64_t start, ns;
+	unsigned int ops = 1;
+	va_list ap;
+	void *arg;
+	long ret;
+
+	resolve();
+	va_start(ap, cmd);
+	arg = va_arg(ap, void *);
+	va_end(ap);
+
+	start = now_ns();
+	pthread_mutex_lock(&lock);
+	if (find_fd(fd) < 0) {
+		pthread_mutex_unlock(&lock);
+		return real_ioctl(fd, cmd, arg);
+	}
+
+	switch (cmd) {
+	case CHIP8_WRITE_ATTR:
+		s = &stats[STAT_WRITE];
+		ret = chip8model_ioctl(model, cmd, arg);
+		break;
+	case CHIP8_READ_ATTR:
+		s = &stats[STAT_READ];
+		ret = chip8model_ioctl(model, cmd, arg);
+		break;
+	case CHIP8_BATCH_ATTR:
+		if (no_batch) {
+			s = &stats[STAT_OTHER];
+			ret = -EINVAL;
+			break;
+		}
+		s = &stats[STAT_BATCH];
+		ret = chip8model_batch(model, arg);
+		ops = ((chip8_batch *) arg)->count;
+		break;
+	default:
+		s = &stats[STAT_OTHER];
+		ret = -ENOTTY;
+		break;
+	}
+
+	ns = now_ns() - start;
+	s->calls++;
+	s->ops += ops;
+	s->ns += ns;
+	if (ns > s->max_ns)
+		s->max_ns = ns;
+	pthread_mutex_unlock(&lock);
+
+	if (ret) {
+		errno = -ret;
+		return -1;
+	}
+	return 0;
+}
+
+EXPORT int close(int fd) {
+	int k;
+
+	resolve();
+	pthread_mutex_lock(&lock);
+	if ((k = find_fd(fd)) >= 0)
+		fds[k] = fds[--nfds];
+	pthread_mutex_unlock(&lock);
+	return real_close(fd);
+}
+
+static void report(FILE *out) {
+	double seconds = now_ns() / 1e9 - started;
+	int k;
+
+	fprintf(out, "chip8shim: %-6s %10s %10s %10s %10s\n", "ioctl", "calls", "requests",
+		"mean ns", "max ns");
+	for (k = 0; k < STATS; ++k) {
+		if (stats[k].calls == 0)
+			continue;
+		fprintf(out, "chip8shim: %-6s %10llu %10llu %10.0f %10llu\n", stat_names[k],
+			(unsigned long long) stats[k].calls, (unsigned long long) stats[k].ops,
+			(double) stats[k].ns / stats[k].calls, (unsigned long long) stats[k].max_ns);
+	}
+	fprintf(out, "chip8shim: %llu instructions in %.3f s, %.0f per second",
+		(unsigned long long) retired, seconds, seconds > 0 ? retired / seconds : 0);
+	if (rate)
+		fprintf(out, " at a rate of %lu\n", rate);
+	else
+		fprintf(out, " unthrottled\n");
+}
+
+__attribute__((destructor)) static void shim_exit() {
+	const char *path = getenv("CHIP8_SHIM_STATS");
+	FILE *out = stderr;
+
+	if (model == NULL)
+		return;
+	atomic_store(&running, 0);
+	pthread_join(run_thread, NULL);
+
+	if (path != NULL && (out = fopen(path, "a")) == NULL)
+		out = stderr;
+	report(out);
+	if (out != stderr)
+		fclose(out);
+	free(model);
+	model = NULL;
+}
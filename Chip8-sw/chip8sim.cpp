@@ -0,0 +1,253 @@
+/*
+ * Verilator co-simulation backend, see chip8sim.h
+ *
+ * Built by "make sim" against obj_dir/VChip8_SimTop, which Verilator
+ * generates from Chip8-qsys/sim/Chip8_SimTop.sv and the RTL it wraps
+ *
+ * Columbia University
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+
+#include "VChip8_SimTop.h"
+#include "VChip8_SimTop___024root.h"
+#include "verilated.h"
+
+#include "chip8sim.h"
+extern "C" {
+#include "chip8latency.h"
+}
+
+/* enums.svh, Chip8_Timers/clk_div.sv */
+#define CPU_CYCLE_LENGTH 50000
+#define DRW_VF_STAGE 30000
+#define PREFETCH_STAGE 512
+#define PREFETCH_CYCLES 5
+#define CLK_DIV_STOP 833333
+#define VGA_FRAME_CYCLES 840000
+#define VGA_VBLANK_START 768000
+#define Chip8_RUNNING 0
+#define Chip8_RUN_INSTRUCTION 1
+#define Chip8_PAUSED 2
+
+/* Chip8_LatencyHist needs 14 cycles after completion, stay clear of them */
+#define FAST_MIN_STAGE 16
+
+#define TOP(var) (top->rootp->Chip8_SimTop__DOT__top__DOT__ ## var)
+
+static VerilatedContext *context;
+static VChip8_SimTop *top;
+static int fast;
+static struct chip8sim_stats stats;
+
+static double seconds() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void tick() {
+	top->clk = 0;
+	top->eval();
+	top->clk = 1;
+	top->eval();
+	stats.cycles++;
+}
+
+/*
+* Moves a running instruction past stages that only pad the slot. Returns
+* the number of cycles skipped.
+*/
+static uint32_t fast_forward() {
+	uint32_t stage = TOP(stage), target, skip, count, scan, edge;
+	uint16_t instruction = TOP(cpu_instruction);
+
+	if (TOP(state) != Chip8_RUNNING || TOP(halt_for_keypress))
+		return 0;
+	if (stage <= FAST_MIN_STAGE || stage >= CPU_CYCLE_LENGTH ||
+			stage <= chip8latency_work_stage(instruction) + 1)
+		return 0;
+
+	if (stage < PREFETCH_STAGE)
+		target = PREFETCH_STAGE;
+	else if (stage < PREFETCH_STAGE + PREFETCH_CYCLES)
+		return 0;
+	else if (TOP(is_drawing) && stage <= DRW_VF_STAGE)
+		target = DRW_VF_STAGE;
+	else if (TOP(is_drawing) && stage <= DRW_VF_STAGE + 1)
+		return 0;
+	else
+		target = CPU_CYCLE_LENGTH;
+
+	/* Never jump over a 60 Hz tick, let it happen on a real cycle */
+	skip = target - stage;
+	count = TOP(clk_div__DOT__count);
+	if (count + skip >= CLK_DIV_STOP)
+		skip = count < CLK_DIV_STOP - 1 ? CLK_DIV_STOP - 1 - count : 0;
+
+	/* Nor over either edge of vblank, buffers only swap inside it */
+	scan = TOP(framebuffer__DOT__led_emulator__DOT__scan);
+	edge = scan < VGA_VBLANK_START ? VGA_VBLANK_START : VGA_FRAME_CYCLES;
+	if (scan + skip >= edge)
+		skip = scan < edge - 1 ? edge - 1 - scan : 0;
+	if (skip == 0)
+		return 0;
+
+	TOP(stage) = stage + skip;
+	TOP(clk_div__DOT__count) = count + skip;
+	TOP(framebuffer__DOT__led_emulator__DOT__scan) = scan + skip;
+	stats.skipped += skip;
+	return skip;
+}
+
+/*
+* Clocks one cycle while the design runs, counting completed instructions,
+* injected ones included. A prefetched instruction goes from the last stage
+* straight to stage 2, so completions are taken from hist_sample.
+*/
+static int run_cycle() {
+	tick();
+	if (TOP(hist_sample)) {
+		stats.instructions++;
+		return 1;
+	}
+	return 0;
+}
+
+/* One Avalon transfer: a cycle with chipselect, then the bus gap */
+static uint32_t access(unsigned int addr, uint32_t data, int write) {
+	uint32_t readdata;
+	int k;
+
+	top->chipselect = 1;
+	top->write = write;
+	top->address = addr >> 2;
+	top->writedata = data;
+	run_cycle();
+	readdata = top->data_out;
+
+	top->chipselect = 0;
+	top->write = 0;
+	for (k = 0; k < CHIP8SIM_ACCESS_GAP; ++k)
+		run_cycle();
+
+	stats.accesses++;
+	return readdata;
+}
+
+extern "C" int chip8sim_open(int fast_mode) {
+	int k;
+
+	context = new VerilatedContext;
+	top = new VChip8_SimTop(context);
+	fast = fast_mode;
+	memset(&stats, 0, sizeof(stats));
+
+	top->chipselect = 0;
+	top->write = 0;
+	top->reset = 1;
+	for (k = 0; k < 2; ++k)
+		tick();
+	top->reset = 0;
+
+	/* The latency histogram clears itself after reset */
+	for (k = 0; k < CHIP8LATENCY_WORDS + 2; ++k)
+		tick();
+	return 0;
+}
+
+extern "C" void chip8sim_close() {
+	if (top == NULL)
+		return;
+	top->final();
+	delete top;
+	delete context;
+	top = NULL;
+	context = NULL;
+}
+
+extern "C" long chip8sim_ioctl(unsigned int cmd, chip8_opcode *op) {
+	double start = seconds();
+	int isWrite;
+
+	switch (cmd) {
+	case CHIP8_WRITE_ATTR:
+		if (!isValidInstruction(op->addr, op->data, 1))
+			return -EINVAL;
+		access(op->addr, op->data, 1);
+		break;
+
+	case CHIP8_READ_ATTR:
+		isWrite = isValidInstruction(op->addr, op->data, 0);
+		if (isWrite == 0)
+			return -EINVAL;
+		if (isWrite == 2)
+			access(op->addr, op->data, 1);
+		op->readdata = access(op->addr, 0, 0);
+		break;
+
+	default:
+		return -ENOTTY;
+	}
+
+	stats.seconds += seconds() - start;
+	return 0;
+}
+
+extern "C" long chip8sim_batch(chip8_batch *batch) {
+	unsigned int i;
+	long ret;
+
+	if (batch->count > CHIP8_BATCH_MAX)
+		return -EINVAL;
+
+	for (i = 0; i < batch->count; ++i) {
+		ret = chip8sim_ioctl(batch->write ? CHIP8_WRITE_ATTR : CHIP8_READ_ATTR, &batch->ops[i]);
+		if (ret)
+			return ret;
+	}
+
+	return 0;
+}
+
+extern "C" unsigned long chip8sim_run(unsigned long n) {
+	uint64_t budget = (uint64_t) n * (CPU_CYCLE_LENGTH + 2);
+	unsigned long retired = 0;
+	double start = seconds();
+
+	while (retired < n && budget > 0 && (TOP(state) == Chip8_RUNNING ||
+			(TOP(state) == Chip8_RUN_INSTRUCTION && TOP(stage) != 0))) {
+		retired += run_cycle();
+		budget--;
+		if (fast) {
+			uint32_t skip = fast_forward();
+			budget -= skip < budget ? skip : budget;
+		}
+	}
+
+	stats.seconds += seconds() - start;
+	return retired;
+}
+
+extern "C" unsigned long chip8sim_clock(uint64_t cycles) {
+	unsigned long retired = 0;
+	double start = seconds();
+
+	while (cycles > 0) {
+		retired += run_cycle();
+		cycles--;
+		if (fast) {
+			uint32_t skip = fast_forward();
+			cycles -= skip < cycles ? skip : cycles;
+		}
+	}
+
+	stats.seconds += seconds() - start;
+	return retired;
+}
+
+extern "C" void chip8sim_stats(struct chip8sim_stats *s) {
+	*s = stats;
+}
@@ -0,0 +1,70 @@
+#ifndef __CHIP8_SIM_H__
+#define __CHIP8_SIM_H__
+
+#include <stdint.h>
+#include "chip8driver.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+* Verilator co-simulation of Chip8_Top
+*
+* Chip8-qsys/sim/Chip8_SimTop.sv is verilated together with the real RTL,
+* with behavioral RAMs in place of the megafunctions and the VGA and audio
+* PHYs left out. Every register access is played as an Avalon slave
+* transfer, one cycle with chipselect followed by CHIP8SIM_ACCESS_GAP idle
+* cycles like the bus latency on the board, and the design is clocked
+* through all of them. Between accesses the design only runs when asked
+* to through chip8sim_run.
+*
+* In fast mode, once a running instruction has done its last write (see
+* chip8latency_work_stage) the stage counter is moved straight to
+* CPU_CYCLE_LENGTH, and for DRW to the VF write at stage 30000 first. It
+* stops at PREFETCH_STAGE on the way, so the next instruction is still
+* prefetched on real cycles. The 60 Hz divider is moved by the same amount, so the timers still tick once
+* per 833334 cycles of simulated time, and the VGA raster position too,
+* never over an edge of vblank. The LFSR behind RND is the only
+* state that sees fewer cycles than on the board.
+*/
+
+#define CHIP8SIM_ACCESS_GAP 4
+
+struct chip8sim_stats {
+	uint64_t cycles;        //Clock cycles evaluated
+	uint64_t skipped;       //Padding cycles fast-forwarded in fast mode
+	uint64_t accesses;      //Avalon transfers
+	uint64_t instructions;  //Instructions completed
+	double seconds;         //Wall time spent evaluating
+};
+
+/* Builds and resets the design, returns 0 or -1 */
+int chip8sim_open(int fast);
+void chip8sim_close();
+
+/* Same contract as chip8model_ioctl and chip8model_batch */
+long chip8sim_ioctl(unsigned int cmd, chip8_opcode *op);
+long chip8sim_batch(chip8_batch *batch);
+
+/*
+* Clocks the design for up to n instruction slots of simulated time while
+* it is running or an injected instruction is in flight, returns the number
+* of instructions completed
+*/
+unsigned long chip8sim_run(unsigned long n);
+
+/*
+* Clocks the design for the given number of cycles whatever state it is
+* in, as board time passes while the host waits, returns the number of
+* instructions completed
+*/
+unsigned long chip8sim_clock(uint64_t cycles);
+
+void chip8sim_stats(struct chip8sim_stats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //__CHIP8_SIM_H__
@@ -0,0 +1,297 @@
+/*
+ * Save-states, see chip8state.h for the file layout
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "chip8state.h"
+#include "chip8io.h"
+#include "xorrle.h"
+
+/* The header is written and mapped as is */
+_Static_assert(sizeof(struct chip8state_header) == CHIP8STATE_HEADER_SIZE,
+		"chip8state_header must match the file layout");
+#if __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "chip8state assumes a little-endian host"
+#endif
+
+/* V0-VF, I, timers, SP, PC, key, stack, memory and framebuffer */
+#define STATE_OPS (CHIP8_NUM_REGISTERS + 6 + CHIP8_STACK_DEPTH + \
+		CHIP8_MEMORY_SIZE + CHIP8_FB_WIDTH * CHIP8_FB_HEIGHT + 2)
+
+static chip8_opcode ops[STATE_OPS];
+
+uint32_t chip8state_hash(const uint8_t *buf, size_t len) {
+	uint32_t hash = 2166136261u;
+	size_t k;
+
+	for (k = 0; k < len; ++k) {
+		hash ^= buf[k];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+void chip8state_rom_image(uint8_t image[CHIP8_MEMORY_SIZE], const uint8_t *rom, size_t len) {
+	memset(image, 0, CHIP8_MEMORY_SIZE);
+	memcpy(image, chip8_fontset, CHIP8_FONTSET_LENGTH);
+	if (len > CHIP8_MEMORY_SIZE - CHIP8_PROGRAM_START)
+		len = CHIP8_MEMORY_SIZE - CHIP8_PROGRAM_START;
+	memcpy(image + CHIP8_PROGRAM_START, rom, len);
+}
+
+int chip8state_rom_image_file(uint8_t image[CHIP8_MEMORY_SIZE], const char *filename) {
+	uint8_t rom[CHIP8_MEMORY_SIZE - CHIP8_PROGRAM_START];
+	FILE *f = fopen(filename, "rb");
+	size_t len;
+
+	if (f == NULL)
+		return -1;
+	len = fread(rom, 1, sizeof(rom), f);
+	fclose(f);
+	chip8state_rom_image(image, rom, len);
+	return 0;
+}
+
+static void init_header(struct chip8state_header *h) {
+	memset(h, 0, sizeof(*h));
+	memcpy(h->magic, "C8SS", 4);
+	h->version = CHIP8STATE_VERSION;
+	h->mem_len = CHIP8_MEMORY_SIZE;
+}
+
+void chip8state_from_core(struct chip8_state *s, const struct chip8_core *c, unsigned int run_state) {
+	struct chip8state_header *h = &s->h;
+
+	init_header(h);
+	memcpy(h->fb, c->fb, sizeof(h->fb));
+	memcpy(h->v, c->v, sizeof(h->v));
+	h->i = c->i;
+	h->pc = c->pc;
+	memcpy(h->stack, c->stack, sizeof(h->stack));
+	h->sp = c->sp;
+	h->delay_timer = c->delay_timer;
+	h->sound_timer = c->sound_timer;
+	h->key = (c->key_pressed << 4) | c->key;
+	h->run_state = run_state;
+	memcpy(s->mem, c->mem, sizeof(s->mem));
+}
+
+void chip8state_to_core(const struct chip8_state *s, struct chip8_core *c) {
+	const struct chip8state_header *h = &s->h;
+
+	memcpy(c->fb, h->fb, sizeof(c->fb));
+	memcpy(c->v, h->v, sizeof(c->v));
+	c->i = h->i;
+	c->pc = h->pc;
+	memcpy(c->stack, h->stack, sizeof(c->stack));
+	c->sp = h->sp;
+	c->delay_timer = h->delay_timer;
+	c->sound_timer = h->sound_timer;
+	chip8core_set_key(c, h->key & 0xf, (h->key >> 4) & 0x1);
+	memcpy(c->mem, s->mem, sizeof(c->mem));
+}
+
+static chip8_opcode *add_op(unsigned int *n, unsigned int addr, unsigned int data) {
+	chip8_opcode *op = &ops[(*n)++];
+	op->addr = addr;
+	op->data = data;
+	op->readdata = 0;
+	return op;
+}
+
+static int set_state(unsigned int state) {
+	chip8_opcode op;
+	op.addr = STATE_ADDR;
+	op.data = state;
+	return chip8io_ioctl(CHIP8_WRITE_ATTR, &op);
+}
+
+/* Waits out the catch up after a swap, the back buffer is stale until then */
+static int wait_catchup() {
+	chip8_opcode op;
+	op.addr = FRAMEBUFFER_STATUS_ADDR;
+	op.data = 0;
+	do {
+		if (chip8io_ioctl(CHIP8_READ_ATTR, &op))
+			return -1;
+	} while (op.readdata & FRAMEBUFFER_STATUS_BUSY);
+	return 0;
+}
+
+int chip8state_capture(struct chip8_state *s) {
+	struct chip8state_header *h = &s->h;
+	chip8_opcode op;
+	unsigned int n = 0, k, x, y;
+
+	op.addr = STATE_ADDR;
+	op.data = 0;
+	if (chip8io_ioctl(CHIP8_READ_ATTR, &op))
+		return -1;
+	init_header(h);
+	h->run_state = op.readdata & 0x3;
+
+	/* Nothing may change between the first and the last read */
+	if (h->run_state != PAUSED_STATE && set_state(PAUSED_STATE))
+		return -1;
+	if (wait_catchup()) {
+		if (h->run_state != PAUSED_STATE)
+			set_state(h->run_state);
+		return -1;
+	}
+
+	for (k = 0; k < CHIP8_NUM_REGISTERS; ++k)
+		add_op(&n, V0_ADDR + 4 * k, 0);
+	add_op(&n, I_ADDR, 0);
+	add_op(&n, SOUND_TIMER_ADDR, 0);
+	add_op(&n, DELAY_TIMER_ADDR, 0);
+	add_op(&n, STACK_POINTER_ADDR, 0);
+	add_op(&n, PROGRAM_COUNTER_ADDR, 0);
+	add_op(&n, KEY_PRESS_ADDR, 0);
+	for (k = 0; k < CHIP8_STACK_DEPTH; ++k)
+		add_op(&n, STACK_ENTRY_ADDR, k << 16);
+	for (k = 0; k < CHIP8_MEMORY_SIZE; ++k)
+		add_op(&n, MEMORY_ADDR, k << 8);
+	for (y = 0; y < CHIP8_FB_HEIGHT; ++y)
+		for (x = 0; x < CHIP8_FB_WIDTH; ++x)
+			add_op(&n, FRAMEBUFFER_ADDR, (x << 5) | y);
+
+	if (chip8io_batch(ops, n, 0)) {
+		if (h->run_state != PAUSED_STATE)
+			set_state(h->run_state);
+		return -1;
+	}
+
+	n = 0;
+	for (k = 0; k < CHIP8_NUM_REGISTERS; ++k)
+		h->v[k] = ops[n++].readdata & 0xff;
+	h->i = ops[n++].readdata & 0xffff;
+	h->sound_timer = ops[n++].readdata & 0xff;
+	h->delay_timer = ops[n++].readdata & 0xff;
+	h->sp = ops[n++].readdata & (CHIP8_STACK_DEPTH - 1);
+	h->pc = ops[n++].readdata & 0xfff;      //Upper bits carry the instruction
+	h->key = ops[n++].readdata & 0x1f;
+	for (k = 0; k < CHIP8_STACK_DEPTH; ++k)
+		h->stack[k] = ops[n++].readdata & 0xffff;
+	for (k = 0; k < CHIP8_MEMORY_SIZE; ++k)
+		s->mem[k] = ops[n++].readdata & 0xff;
+	for (y = 0; y < CHIP8_FB_HEIGHT; ++y) {
+		h->fb[y] = 0;
+		for (x = 0; x < CHIP8_FB_WIDTH; ++x)
+			if (ops[n++].readdata & 0x1)
+				h->fb[y] |= 1ULL << x;
+	}
+
+	if (h->run_state != PAUSED_STATE && set_state(h->run_state))
+		return -1;
+	return 0;
+}
+
+int chip8state_restore(const struct chip8state_header *h, const uint8_t *mem,
+		const uint8_t *baseline) {
+	unsigned int n = 0, k, x, y;
+
+	add_op(&n, STATE_ADDR, PAUSED_STATE);
+	for (k = 0; k < CHIP8_MEMORY_SIZE; ++k)
+		if (baseline == NULL || baseline[k] != mem[k])
+			add_op(&n, MEMORY_ADDR, (1 << 20) | (k << 8) | mem[k]);
+	for (y = 0; y < CHIP8_FB_HEIGHT; ++y)
+		for (x = 0; x < CHIP8_FB_WIDTH; ++x)
+			add_op(&n, FRAMEBUFFER_ADDR, (1 << 12) | (((h->fb[y] >> x) & 0x1) << 11) | (x << 5) | y);
+	for (k = 0; k < CHIP8_NUM_REGISTERS; ++k)
+		add_op(&n, V0_ADDR + 4 * k, h->v[k]);
+	add_op(&n, I_ADDR, h->i);
+	add_op(&n, SOUND_TIMER_ADDR, h->sound_timer);
+	add_op(&n, DELAY_TIMER_ADDR, h->delay_timer);
+	for (k = 0; k < CHIP8_STACK_DEPTH; ++k)
+		add_op(&n, STACK_ENTRY_ADDR, (1 << 20) | (k << 16) | h->stack[k]);
+	add_op(&n, STACK_POINTER_ADDR, h->sp & (CHIP8_STACK_DEPTH - 1));
+	add_op(&n, PROGRAM_COUNTER_ADDR, h->pc & 0xfff);
+	add_op(&n, KEY_PRESS_ADDR, h->key & 0x1f);
+	add_op(&n, STATE_ADDR, h->run_state <= PAUSED_STATE ? h->run_state : PAUSED_STATE);
+
+	return chip8io_batch(ops, n, 1);
+}
+
+int chip8state_write(const char *path, const struct chip8_state *s, const uint8_t *rom_image) {
+	struct chip8state_header h = s->h;
+	uint8_t delta[XORRLE_MAX_ENCODED(CHIP8_MEMORY_SIZE)];
+	const uint8_t *mem = s->mem;
+	FILE *f;
+	int ret = 0;
+
+	if (rom_image != NULL) {
+		h.flags |= CHIP8STATE_MEM_DELTA;
+		h.rom_hash = chip8state_hash(rom_image, CHIP8_MEMORY_SIZE);
+		h.mem_len = xorrle_encode(s->mem, rom_image, CHIP8_MEMORY_SIZE, delta);
+		mem = delta;
+	} else {
+		h.flags &= ~CHIP8STATE_MEM_DELTA;
+		h.mem_len = CHIP8_MEMORY_SIZE;
+	}
+
+	if ((f = fopen(path, "wb")) == NULL)
+		return -1;
+	ret |= fwrite(&h, 1, sizeof(h), f) != sizeof(h);
+	ret |= fwrite(mem, 1, h.mem_len, f) != h.mem_len;
+	ret |= fclose(f) != 0;
+	return ret ? -1 : 0;
+}
+
+int chip8state_map(struct chip8state_map *map, const char *path) {
+	const struct chip8state_header *h;
+	struct stat st;
+	int fd;
+
+	memset(map, 0, sizeof(*map));
+	if ((fd = open(path, O_RDONLY)) == -1)
+		return -1;
+	if (fstat(fd, &st) || st.st_size < CHIP8STATE_HEADER_SIZE) {
+		close(fd);
+		return -1;
+	}
+
+	map->len = st.st_size;
+	map->addr = mmap(NULL, map->len, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map->addr == MAP_FAILED) {
+		map->addr = NULL;
+		return -1;
+	}
+
+	h = map->addr;
+	if (memcmp(h->magic, "C8SS", 4) != 0 || h->version != CHIP8STATE_VERSION ||
+			h->mem_len > map->len - CHIP8STATE_HEADER_SIZE ||
+			(!(h->flags & CHIP8STATE_MEM_DELTA) && h->mem_len != CHIP8_MEMORY_SIZE)) {
+		chip8state_unmap(map);
+		return -1;
+	}
+
+	map->h = h;
+	map->mem = (const uint8_t *) map->addr + CHIP8STATE_HEADER_SIZE;
+	return 0;
+}
+
+void chip8state_unmap(struct chip8state_map *map) {
+	if (map->addr != NULL)
+		munmap(map->addr, map->len);
+	memset(map, 0, sizeof(*map));
+}
+
+const uint8_t *chip8state_memory(const struct chip8state_map *map, const uint8_t *rom_image,
+		uint8_t buf[CHIP8_MEMORY_SIZE]) {
+	if (!(map->h->flags & CHIP8STATE_MEM_DELTA))
+		return map->mem;
+
+	if (rom_image == NULL || chip8state_hash(rom_image, CHIP8_MEMORY_SIZE) != map->h->rom_hash)
+		return NULL;
+	memcpy(buf, rom_image, CHIP8_MEMORY_SIZE);
+	if (xorrle_decode(map->mem, map->h->mem_len, buf, CHIP8_MEMORY_SIZE))
+		return NULL;
+	return buf;
+}
@@ -0,0 +1,125 @@
+#ifndef __CHIP8_STATE_H__
+#define __CHIP8_STATE_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include "chip8core.h"
+
+/*
+* Save-state file format
+*
+* A fixed little-endian header with everything but memory, followed by
+* mem_len bytes of memory:
+*
+*   offset  size  field
+*   0       4     "C8SS"
+*   4       2     version
+*   6       2     flags, CHIP8STATE_MEM_DELTA
+*   8       4     FNV-1a hash of the ROM image the memory is relative to
+*   12      4     mem_len
+*   16      256   framebuffer, one u64 per row, bit x is pixel (x, y)
+*   272     16    V0-VF
+*   288     2     I
+*   290     2     PC
+*   292     32    stack entries
+*   324     1     stack pointer
+*   325     1     delay timer
+*   326     1     sound timer
+*   327     1     key state as read from KEY_PRESS_ADDR
+*   328     1     state as read from STATE_ADDR
+*   329     7     reserved, zero
+*   336           memory
+*
+* Memory is either the raw 4 KB or, with CHIP8STATE_MEM_DELTA, the xorrle.h
+* encoding of memory XORed with the ROM image (fontset at 0 and the ROM at
+* 0x200). A game rarely writes more than a few hundred bytes, so delta
+* states stay well under 1 KB. Raw states can be used straight out of an
+* mmap(2) without copying.
+*
+* The Fx0A wait and the LFSR behind Cxkk are not visible through the
+* register map and are not saved.
+*/
+
+#define CHIP8STATE_VERSION 1
+#define CHIP8STATE_HEADER_SIZE 336
+
+#define CHIP8STATE_MEM_DELTA 0x1
+
+struct chip8state_header {
+	char     magic[4];
+	uint16_t version;
+	uint16_t flags;
+	uint32_t rom_hash;
+	uint32_t mem_len;
+	uint64_t fb[CHIP8_FB_HEIGHT];
+	uint8_t  v[CHIP8_NUM_REGISTERS];
+	uint16_t i;
+	uint16_t pc;
+	uint16_t stack[CHIP8_STACK_DEPTH];
+	uint8_t  sp;
+	uint8_t  delay_timer;
+	uint8_t  sound_timer;
+	uint8_t  key;
+	uint8_t  run_state;
+	uint8_t  reserved[7];
+};
+
+/* A decoded state, memory always raw */
+struct chip8_state {
+	struct chip8state_header h;
+	uint8_t mem[CHIP8_MEMORY_SIZE];
+};
+
+/* A state file mapped with chip8state_map */
+struct chip8state_map {
+	const struct chip8state_header *h;
+	const uint8_t *mem;     //mem_len bytes, raw or delta per h->flags
+	void *addr;
+	size_t len;
+};
+
+uint32_t chip8state_hash(const uint8_t *buf, size_t len);
+
+/* Builds the memory image right after loading a ROM: fontset and ROM */
+void chip8state_rom_image(uint8_t image[CHIP8_MEMORY_SIZE], const uint8_t *rom, size_t len);
+int chip8state_rom_image_file(uint8_t image[CHIP8_MEMORY_SIZE], const char *filename);
+
+void chip8state_from_core(struct chip8_state *s, const struct chip8_core *c, unsigned int run_state);
+/* Fills the architectural state of a core, the rest is left alone */
+void chip8state_to_core(const struct chip8_state *s, struct chip8_core *c);
+
+/*
+* Reads the whole state through the selected chip8io backend in a single
+* batch, pausing the Chip8 for the duration and letting the framebuffer
+* finish catching up after a swap first. Returns 0 or -1.
+*/
+int chip8state_capture(struct chip8_state *s);
+
+/*
+* Writes a state back through the selected chip8io backend, memory given
+* raw. When baseline is not NULL it must hold what memory currently
+* contains (e.g. the ROM image right after loadROM) and only the bytes
+* that differ are written. The Chip8 is left in the saved run state.
+*/
+int chip8state_restore(const struct chip8state_header *h, const uint8_t *mem,
+		const uint8_t *baseline);
+
+/*
+* Saves a state. With a ROM image memory is stored as a delta against it,
+* otherwise raw. Returns 0 or -1.
+*/
+int chip8state_write(const char *path, const struct chip8_state *s, const uint8_t *rom_image);
+
+/* Maps a state file read-only, returns -1 if it is not a valid state */
+int chip8state_map(struct chip8state_map *map, const char *path);
+void chip8state_unmap(struct chip8state_map *map);
+
+/*
+* Returns the raw memory of a mapped state, decoding it into buf when it is
+* stored as a delta. rom_image must then be the image it was saved against.
+* Returns NULL on a mismatched ROM or a corrupt payload.
+*/
+const uint8_t *chip8state_memory(const struct chip8state_map *map, const uint8_t *rom_image,
+		uint8_t buf[CHIP8_MEMORY_SIZE]);
+
+#endif //__CHIP8_STATE_H__
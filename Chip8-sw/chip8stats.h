@@ -0,0 +1,190 @@
+#ifndef __CHIP8_STATS_H__
+#define __CHIP8_STATS_H__
+
+/*
+* Request counters for chip8driver.c
+*
+* The driver keeps one chip8_stats per CPU and only ever touches the one of
+* the CPU it runs on, with preemption off, so counting takes no lock and no
+* atomic. Readers sum every CPU's copy. The userspace model does the same
+* with one per thread in chip8io.c, and runs the same code, so the counting
+* and the text below can be tested without a board.
+*
+* Every request is counted against its register as a read, a write, or an
+* invalid request rejected by isValidInstruction; a batch is counted up to
+* and including the request it stopped at. Every ioctl is counted by type
+* with the requests it carried and its latency, in log2 buckets of
+* nanoseconds: bucket k holds [2^k, 2^(k+1)), bucket 0 also 0, and the last
+* one everything above.
+*
+* The driver shows the sum in debugfs as vga_led/stats, and any write to
+* vga_led/reset clears it. Counts that move while being read or cleared may
+* be off by the requests in flight.
+*/
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#include <linux/kernel.h>
+#include <linux/string.h>
+#include <linux/math64.h>
+#define chip8stats_div(a, b) div64_u64(a, b)
+#else
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#define chip8stats_div(a, b) ((a) / (b))
+#endif
+
+#include "chip8driver.h"
+
+/* Registers are 4 bytes apart, addresses past the map or between registers count as other */
+#define CHIP8STATS_ADDRS 32
+#define CHIP8STATS_OTHER (CHIP8STATS_ADDRS - 1)
+
+/* ioctl types */
+#define CHIP8STATS_READ  0
+#define CHIP8STATS_WRITE 1
+#define CHIP8STATS_BATCH 2
+#define CHIP8STATS_IOCTLS 3
+
+#define CHIP8STATS_BUCKETS 32
+
+/* Room for chip8stats_format with every register in use */
+#define CHIP8STATS_TEXT_MAX 4096
+
+struct chip8stats_addr {
+	uint64_t reads;
+	uint64_t writes;
+	uint64_t invalid;
+};
+
+/* Only uint64_t, chip8stats_add sums it word by word */
+struct chip8_stats {
+	struct chip8stats_addr addr[CHIP8STATS_ADDRS];
+	uint64_t calls[CHIP8STATS_IOCTLS];
+	uint64_t ops[CHIP8STATS_IOCTLS];        //Requests carried
+	uint64_t failed[CHIP8STATS_IOCTLS];     //Returned an error
+	uint64_t ns[CHIP8STATS_IOCTLS];         //Total latency
+	uint64_t hist[CHIP8STATS_IOCTLS][CHIP8STATS_BUCKETS];
+};
+
+static inline unsigned int chip8stats_index(unsigned int addr) {
+	return addr < 4 * CHIP8STATS_OTHER && (addr & 0x3) == 0 ? addr >> 2 : CHIP8STATS_OTHER;
+}
+
+static inline unsigned int chip8stats_bucket(uint64_t ns) {
+	unsigned int k;
+
+	if (ns == 0)
+		return 0;
+	k = 63 - __builtin_clzll(ns);
+	return k < CHIP8STATS_BUCKETS ? k : CHIP8STATS_BUCKETS - 1;
+}
+
+/* One request, valid as isValidInstruction found it */
+static inline void chip8stats_op(struct chip8_stats *s, unsigned int addr, int write, int valid) {
+	struct chip8stats_addr *a = &s->addr[chip8stats_index(addr)];
+
+	if (!valid)
+		a->invalid++;
+	else if (write)
+		a->writes++;
+	else
+		a->reads++;
+}
+
+/* One ioctl of the given type carrying ops requests */
+static inline void chip8stats_ioctl(struct chip8_stats *s, unsigned int type, unsigned int ops, int failed,
+		uint64_t ns) {
+	s->calls[type]++;
+	s->ops[type] += ops;
+	s->failed[type] += failed != 0;
+	s->ns[type] += ns;
+	s->hist[type][chip8stats_bucket(ns)]++;
+}
+
+static inline void chip8stats_add(struct chip8_stats *sum, const struct chip8_stats *s) {
+	uint64_t *to = (uint64_t *) sum;
+	const uint64_t *from = (const uint64_t *) s;
+	size_t k;
+
+	for (k = 0; k < sizeof(*s) / sizeof(uint64_t); ++k)
+		to[k] += from[k];
+}
+
+/* Upper end of the bucket holding the pct-th percentile, 0 when empty */
+static inline uint64_t chip8stats_percentile(const uint64_t hist[CHIP8STATS_BUCKETS], unsigned int pct) {
+	uint64_t total = 0, seen = 0;
+	unsigned int k;
+
+	for (k = 0; k < CHIP8STATS_BUCKETS; ++k)
+		total += hist[k];
+	for (k = 0; k < CHIP8STATS_BUCKETS; ++k) {
+		seen += hist[k];
+		if (total != 0 && seen * 100 >= total * pct)
+			return 2ULL << k;
+	}
+	return 0;
+}
+
+static inline const char *chip8stats_addr_name(unsigned int index) {
+	static const char *const names[CHIP8STATS_ADDRS] = {
+		"V0", "V1", "V2", "V3", "V4", "V5", "V6", "V7",
+		"V8", "V9", "VA", "VB", "VC", "VD", "VE", "VF",
+		"I", "sound timer", "delay timer", "stack reset", "PC", "key press", "state",
+		"framebuffer", "stack pointer", "memory", "instruction", "reset", "stack entry",
+		"latency hist", "fb status", "other",
+	};
+	return names[index];
+}
+
+static inline const char *chip8stats_ioctl_name(unsigned int type) {
+	static const char *const names[CHIP8STATS_IOCTLS] = { "read", "write", "batch" };
+	return names[type];
+}
+
+#define chip8stats_printf(buf, len, n, ...) \
+	((n) += snprintf((buf) + ((n) < (len) ? (n) : (len)), (n) < (len) ? (len) - (n) : 0, __VA_ARGS__))
+
+/*
+* Prints the ioctls with their latency percentiles, then the registers that
+* saw any request, busiest first. Returns the length like snprintf.
+*/
+static inline size_t chip8stats_format(const struct chip8_stats *s, char *buf, size_t len) {
+	uint64_t busiest, total;
+	unsigned int k, best, done = 0;
+	size_t n = 0;
+
+	chip8stats_printf(buf, len, n, "%-14s %10s %10s %8s %10s %10s %10s\n",
+		"ioctl", "calls", "requests", "failed", "mean ns", "p50 ns", "p99 ns");
+	for (k = 0; k < CHIP8STATS_IOCTLS; ++k)
+		chip8stats_printf(buf, len, n, "%-14s %10llu %10llu %8llu %10llu %10llu %10llu\n",
+			chip8stats_ioctl_name(k), (unsigned long long) s->calls[k],
+			(unsigned long long) s->ops[k], (unsigned long long) s->failed[k],
+			(unsigned long long) (s->calls[k] ? chip8stats_div(s->ns[k], s->calls[k]) : 0),
+			(unsigned long long) chip8stats_percentile(s->hist[k], 50),
+			(unsigned long long) chip8stats_percentile(s->hist[k], 99));
+
+	chip8stats_printf(buf, len, n, "\n%-14s %10s %10s %8s\n", "register", "reads", "writes", "invalid");
+	for (;;) {
+		busiest = 0;
+		best = 0;
+		for (k = 0; k < CHIP8STATS_ADDRS; ++k) {
+			total = s->addr[k].reads + s->addr[k].writes + s->addr[k].invalid;
+			if (!((done >> k) & 1) && total > busiest) {
+				busiest = total;
+				best = k;
+			}
+		}
+		if (busiest == 0)
+			break;
+		done |= 1u << best;
+		chip8stats_printf(buf, len, n, "%-14s %10llu %10llu %8llu\n", chip8stats_addr_name(best),
+			(unsigned long long) s->addr[best].reads, (unsigned long long) s->addr[best].writes,
+			(unsigned long long) s->addr[best].invalid);
+	}
+	return n;
+}
+
+#endif //__CHIP8_STATS_H__
@@ -0,0 +1,225 @@
+/*
+ * Concurrent register access stress test
+ *
+ * chip8stress run [-b backend] [-t threads] [-n requests] [-u]
+ *     Fills memory, the stack and V0-VF with known values while paused,
+ *     then runs 1 to threads threads at once, each issuing requests ioctls
+ *     that mix two-step memory and stack reads, register reads and memory
+ *     writes that move the address latch. Memory and stack reads echo the
+ *     latched address, so a read that returns another thread's address or
+ *     the wrong data is torn. Prints ioctl throughput and torn reads for
+ *     every thread count. -u turns the model's class locks off to show the
+ *     races they close.
+ * chip8stress test
+ *     run against the model with 4 threads, fails on any torn read
+ *
+ * Columbia University
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "chip8io.h"
+#include "chip8test.h"
+
+#define STRESS_MEMORY 0x1000
+#define STRESS_STACK 16
+
+struct worker {
+	pthread_t thread;
+	unsigned int seed;
+	unsigned long requests;
+	unsigned long torn;
+	unsigned long failed;
+};
+
+static double seconds() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void usage() {
+	fprintf(stderr,
+		"Usage: chip8stress run [-b backend] [-t threads] [-n requests] [-u]\n"
+		"       chip8stress test\n");
+	exit(1);
+}
+
+/* Values written before the run, every one differs from its neighbours */
+static unsigned int memory_value(unsigned int addr) {
+	return (addr * 37 + (addr >> 8)) & 0xff;
+}
+
+static unsigned int stack_value(unsigned int entry) {
+	return 0x200 + entry * 0x111;
+}
+
+static unsigned int register_value(unsigned int x) {
+	return 0x11 * x;
+}
+
+static int fill() {
+	static chip8_opcode ops[STRESS_MEMORY];
+	unsigned int k;
+
+	pauseChip8();
+	for (k = 0; k < STRESS_MEMORY; ++k) {
+		ops[k].addr = MEMORY_ADDR;
+		ops[k].data = (1 << 20) | (k << 8) | memory_value(k);
+	}
+	if (chip8io_batch(ops, STRESS_MEMORY, 1))
+		return -1;
+	for (k = 0; k < STRESS_STACK; ++k) {
+		ops[k].addr = STACK_ENTRY_ADDR;
+		ops[k].data = (1 << 20) | (k << 16) | stack_value(k);
+	}
+	for (k = 0; k < 16; ++k) {
+		ops[STRESS_STACK + k].addr = V0_ADDR + 4 * k;
+		ops[STRESS_STACK + k].data = register_value(k);
+	}
+	return chip8io_batch(ops, STRESS_STACK + 16, 1);
+}
+
+static void *worker_f(void *arg) {
+	struct worker *w = arg;
+	chip8_opcode op;
+	unsigned long k;
+	unsigned int r, a;
+
+	for (k = 0; k < w->requests; ++k) {
+		r = rand_r(&w->seed);
+		switch (k % 4) {
+		case 0:
+			a = r % STRESS_MEMORY;
+			op.addr = MEMORY_ADDR;
+			op.data = a << 8;
+			if (chip8io_ioctl(CHIP8_READ_ATTR, &op))
+				w->failed++;
+			else if (op.readdata != ((a << 8) | memory_value(a)))
+				w->torn++;
+			break;
+		case 1:
+			a = r % STRESS_STACK;
+			op.addr = STACK_ENTRY_ADDR;
+			op.data = a << 16;
+			if (chip8io_ioctl(CHIP8_READ_ATTR, &op))
+				w->failed++;
+			else if (op.readdata != ((a << 16) | stack_value(a)))
+				w->torn++;
+			break;
+		case 2:
+			a = r % 16;
+			op.addr = V0_ADDR + 4 * a;
+			op.data = 0;
+			if (chip8io_ioctl(CHIP8_READ_ATTR, &op))
+				w->failed++;
+			else if (op.readdata != register_value(a))
+				w->torn++;
+			break;
+		default:
+			/* Same value back, only the latch moves */
+			a = r % STRESS_MEMORY;
+			op.addr = MEMORY_ADDR;
+			op.data = (1 << 20) | (a << 8) | memory_value(a);
+			if (chip8io_ioctl(CHIP8_WRITE_ATTR, &op))
+				w->failed++;
+			break;
+		}
+	}
+	return NULL;
+}
+
+/* Runs n threads once, returns the torn reads and prints a table row */
+static unsigned long run_threads(unsigned int n, unsigned long requests) {
+	struct worker *workers = calloc(n, sizeof(*workers));
+	unsigned long torn = 0, failed = 0;
+	unsigned int k;
+	double t;
+
+	if (workers == NULL)
+		return 0;
+
+	t = seconds();
+	for (k = 0; k < n; ++k) {
+		workers[k].seed = k + 1;
+		workers[k].requests = requests;
+		pthread_create(&workers[k].thread, NULL, worker_f, &workers[k]);
+	}
+	for (k = 0; k < n; ++k) {
+		pthread_join(workers[k].thread, NULL);
+		torn += workers[k].torn;
+		failed += workers[k].failed;
+	}
+	t = seconds() - t;
+
+	printf("%7u %12.0f %9.2f %8lu %8lu\n", n, n * requests / t, t * 1e9 / (n * requests),
+		torn, failed);
+	free(workers);
+	return torn + failed;
+}
+
+static unsigned long stress(const char *backend, unsigned int threads, unsigned long requests,
+		int unlocked) {
+	unsigned long bad = 0;
+	unsigned int n;
+
+	if (chip8io_open(backend))
+		return 1;
+	if (fill()) {
+		perror("fill failed");
+		chip8io_close();
+		return 1;
+	}
+	chip8io_class_locking(!unlocked);
+
+	printf("%7s %12s %9s %8s %8s\n", "threads", "ioctls/s", "ns each", "torn", "failed");
+	for (n = 1; n <= threads; ++n)
+		bad += run_threads(n, requests);
+
+	chip8io_class_locking(1);
+	chip8io_close();
+	return bad;
+}
+
+static int run(int argc, char **argv) {
+	const char *backend = NULL;
+	unsigned int threads = 8;
+	unsigned long requests = 100000;
+	int unlocked = 0, opt;
+
+	while ((opt = getopt(argc, argv, "b:t:n:u")) != -1) {
+		switch (opt) {
+		case 'b': backend = optarg; break;
+		case 't': threads = atoi(optarg); break;
+		case 'n': requests = strtoul(optarg, NULL, 0); break;
+		case 'u': unlocked = 1; break;
+		default: usage();
+		}
+	}
+
+	return stress(backend, threads, requests, unlocked) ? 1 : 0;
+}
+
+static int test() {
+	unsigned long bad = stress("model", 4, 50000, 0);
+
+	return chip8test_report(bad != 0);
+}
+
+int main(int argc, char **argv) {
+	if (argc < 2)
+		usage();
+
+	if (strcmp(argv[1], "run") == 0)
+		return run(argc - 1, argv + 1);
+	if (strcmp(argv[1], "test") == 0 && argc == 2)
+		return test();
+
+	usage();
+	return 1;
+}
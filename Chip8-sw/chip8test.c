@@ -0,0 +1,26 @@
+/*
+ * Checks shared by the tools' test subcommands, see chip8test.h
+ */
+
+#include <stdio.h>
+
+#include "chip8test.h"
+
+int chip8test_check(const char *what, long long got, long long expected) {
+	if (got == expected)
+		return 0;
+	printf("%s: %lld, expected %lld\n", what, got, expected);
+	return 1;
+}
+
+int chip8test_check_hex(const char *what, long long got, long long expected) {
+	if (got == expected)
+		return 0;
+	printf("%s: 0x%llx, expected 0x%llx\n", what, got, expected);
+	return 1;
+}
+
+int chip8test_report(int errors) {
+	printf("%s\n", errors ? "FAILED" : "passed");
+	return errors ? 1 : 0;
+}
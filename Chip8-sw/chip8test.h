@@ -0,0 +1,18 @@
+#ifndef __CHIP8_TEST_H__
+#define __CHIP8_TEST_H__
+
+/*
+* Checks shared by the tools' test subcommands
+*
+* Each check prints what it found when that is not what was expected and
+* returns 1, or 0 when it is, so a test adds them up into its errors.
+*/
+
+int chip8test_check(const char *what, long long got, long long expected);
+/* The same, printing the values in hex */
+int chip8test_check_hex(const char *what, long long got, long long expected);
+
+/* Prints passed or FAILED and returns the exit status of the test */
+int chip8test_report(int errors);
+
+#endif //__CHIP8_TEST_H__
@@ -0,0 +1,261 @@
+/*
+ * Key input latency tracing, see chip8trace.h
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "chip8trace.h"
+
+struct ring {
+	struct chip8trace_event events[CHIP8TRACE_RING];
+	uint64_t head;                  //Events ever written, published with release
+	struct ring *next;
+};
+
+/* Interval of each stage, from one point to a later one of the same trace */
+static const struct {
+	const char *name;
+	unsigned int from, to;
+} stages[CHIP8TRACE_STAGES] = {
+	{ "report to decode", CHIP8TRACE_HID, CHIP8TRACE_DECODE },
+	{ "decode to write", CHIP8TRACE_DECODE, CHIP8TRACE_KEY_WRITE },
+	{ "report to write", CHIP8TRACE_HID, CHIP8TRACE_KEY_WRITE },
+	{ "write to retire", CHIP8TRACE_KEY_WRITE, CHIP8TRACE_RETIRE },
+	{ "report to retire", CHIP8TRACE_HID, CHIP8TRACE_RETIRE },
+};
+
+volatile int chip8trace_enabled;
+
+static struct ring *rings;             //Every thread's ring, pushed with a CAS
+static uint32_t next_id;
+static __thread struct ring *mine;
+static __thread uint32_t current;
+
+static uint64_t now_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void chip8trace_enable(int enable) {
+	chip8trace_enabled = enable;
+}
+
+static struct ring *my_ring() {
+	struct ring *r;
+
+	if (mine != NULL)
+		return mine;
+	if ((r = calloc(1, sizeof(*r))) == NULL)
+		return NULL;
+	r->next = __atomic_load_n(&rings, __ATOMIC_RELAXED);
+	while (!__atomic_compare_exchange_n(&rings, &r->next, r, 0, __ATOMIC_RELEASE,
+			__ATOMIC_RELAXED))
+		;
+	return mine = r;
+}
+
+void chip8trace_point_id(uint32_t id, unsigned int point, unsigned int arg) {
+	struct chip8trace_event *e;
+	struct ring *r;
+
+	if (!chip8trace_enabled || id == 0 || (r = my_ring()) == NULL)
+		return;
+	e = &r->events[r->head % CHIP8TRACE_RING];
+	e->ns = now_ns();
+	e->id = id;
+	e->point = point;
+	e->arg = arg;
+	e->reserved = 0;
+	__atomic_store_n(&r->head, r->head + 1, __ATOMIC_RELEASE);
+}
+
+uint32_t chip8trace_begin(unsigned int arg) {
+	if (!chip8trace_enabled)
+		return current = 0;
+	/* 0 means no trace, skip it when the counter wraps */
+	while ((current = __atomic_add_fetch(&next_id, 1, __ATOMIC_RELAXED)) == 0)
+		;
+	chip8trace_point_id(current, CHIP8TRACE_HID, arg);
+	return current;
+}
+
+uint32_t chip8trace_current() {
+	return chip8trace_enabled ? current : 0;
+}
+
+void chip8trace_point(unsigned int point, unsigned int arg) {
+	if (chip8trace_enabled && current != 0)
+		chip8trace_point_id(current, point, arg);
+}
+
+size_t chip8trace_collect(struct chip8trace_event *out, size_t max, uint64_t *dropped) {
+	struct ring *r;
+	size_t n = 0;
+
+	for (r = __atomic_load_n(&rings, __ATOMIC_ACQUIRE); r != NULL; r = r->next) {
+		uint64_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE), from, k;
+		size_t start = n;
+
+		from = head > CHIP8TRACE_RING ? head - CHIP8TRACE_RING : 0;
+		*dropped += from;
+		for (k = from; k < head && n < max; ++k)
+			out[n++] = r->events[k % CHIP8TRACE_RING];
+
+		/*
+		* The owner may have lapped the copy, and is writing the slot
+		* after the last event it published: keep what it cannot have touched
+		*/
+		head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+		if (head + 1 > from + CHIP8TRACE_RING) {
+			uint64_t lost = head + 1 - CHIP8TRACE_RING - from;
+
+			if (lost > n - start)
+				lost = n - start;
+			memmove(&out[start], &out[start + lost], (n - start - lost) * sizeof(*out));
+			n -= lost;
+			*dropped += lost;
+		}
+	}
+	return n;
+}
+
+static int by_trace(const void *a, const void *b) {
+	const struct chip8trace_event *x = a, *y = b;
+
+	if (x->id != y->id)
+		return x->id < y->id ? -1 : 1;
+	if (x->ns != y->ns)
+		return x->ns < y->ns ? -1 : 1;
+	return x->point < y->point ? -1 : x->point > y->point;
+}
+
+static unsigned int bucket(uint64_t ns) {
+	unsigned int k = 0;
+
+	while (ns > 1 && k < CHIP8TRACE_BUCKETS - 1) {
+		ns >>= 1;
+		k++;
+	}
+	return k;
+}
+
+static void add(struct chip8trace_stage *st, uint64_t ns) {
+	if (st->count == 0 || ns < st->min)
+		st->min = ns;
+	if (ns > st->max)
+		st->max = ns;
+	st->count++;
+	st->sum += ns;
+	st->buckets[bucket(ns)]++;
+}
+
+void chip8trace_summarize(struct chip8trace_event *events, size_t n, uint64_t dropped,
+		struct chip8trace_summary *s) {
+	size_t k = 0, j;
+
+	memset(s, 0, sizeof(*s));
+	s->dropped = dropped;
+	qsort(events, n, sizeof(*events), by_trace);
+
+	while (k < n) {
+		uint64_t at[CHIP8TRACE_POINTS];
+		unsigned int seen = 0, st;
+
+		/* The first time the trace reached each point */
+		for (j = k; j < n && events[j].id == events[k].id; ++j) {
+			unsigned int p = events[j].point;
+
+			if (p < CHIP8TRACE_POINTS && !(seen & (1 << p))) {
+				seen |= 1 << p;
+				at[p] = events[j].ns;
+			}
+		}
+		k = j;
+
+		/* A trace whose report was lost to a wrapped ring is not counted */
+		if (!(seen & (1 << CHIP8TRACE_HID)))
+			continue;
+		s->traces++;
+		if (seen & (1 << CHIP8TRACE_RETIRE))
+			s->retired++;
+		for (st = 0; st < CHIP8TRACE_STAGES; ++st) {
+			unsigned int from = stages[st].from, to = stages[st].to;
+
+			if ((seen & (1 << from)) && (seen & (1 << to)) && at[to] >= at[from])
+				add(&s->stage[st], at[to] - at[from]);
+		}
+	}
+}
+
+const char *chip8trace_stage_name(unsigned int stage) {
+	return stage < CHIP8TRACE_STAGES ? stages[stage].name : "?";
+}
+
+uint64_t chip8trace_percentile(const struct chip8trace_stage *st, double q) {
+	uint64_t want = (uint64_t) (q * st->count + 0.5), seen = 0, top;
+	unsigned int k;
+
+	if (st->count == 0)
+		return 0;
+	if (want < 1)
+		want = 1;
+	for (k = 0; k < CHIP8TRACE_BUCKETS; ++k) {
+		seen += st->buckets[k];
+		if (seen >= want)
+			break;
+	}
+	top = k + 1 < CHIP8TRACE_BUCKETS ? 2ULL << k : st->max;
+	return top < st->max ? top : st->max;
+}
+
+static void print_ns(FILE *out, uint64_t ns) {
+	if (ns >= 10000000)
+		fprintf(out, "%7.1f ms", ns / 1e6);
+	else
+		fprintf(out, "%7.1f us", ns / 1e3);
+}
+
+void chip8trace_report(FILE *out, const struct chip8trace_summary *s) {
+	unsigned int st, k;
+
+	fprintf(out, "%llu key reports traced, %llu reached a retired instruction, %llu events lost\n",
+		(unsigned long long) s->traces, (unsigned long long) s->retired,
+		(unsigned long long) s->dropped);
+
+	for (st = 0; st < CHIP8TRACE_STAGES; ++st) {
+		const struct chip8trace_stage *x = &s->stage[st];
+		uint32_t most = 0;
+
+		if (x->count == 0)
+			continue;
+		fprintf(out, "\n%s, %llu traces\n  min ", stages[st].name, (unsigned long long) x->count);
+		print_ns(out, x->min);
+		fprintf(out, "  mean ");
+		print_ns(out, x->sum / x->count);
+		fprintf(out, "  p50 <");
+		print_ns(out, chip8trace_percentile(x, 0.50));
+		fprintf(out, "  p99 <");
+		print_ns(out, chip8trace_percentile(x, 0.99));
+		fprintf(out, "  max ");
+		print_ns(out, x->max);
+		fprintf(out, "\n");
+
+		for (k = 0; k < CHIP8TRACE_BUCKETS; ++k)
+			if (x->buckets[k] > most)
+				most = x->buckets[k];
+		for (k = 0; k < CHIP8TRACE_BUCKETS; ++k) {
+			unsigned int bar;
+
+			if (x->buckets[k] == 0)
+				continue;
+			bar = (unsigned int) (40ULL * x->buckets[k] / most);
+			fprintf(out, "  <");
+			print_ns(out, 2ULL << k);
+			fprintf(out, " %8u %.*s\n", x->buckets[k], bar > 0 ? bar : 1,
+				"########################################");
+		}
+	}
+}
@@ -0,0 +1,103 @@
+#ifndef __CHIP8_TRACE_H__
+#define __CHIP8_TRACE_H__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+* Key input latency tracing
+*
+* Every HID report starts a trace with a new id. The points after it are
+* stamped with CLOCK_MONOTONIC as the report goes through the input path:
+*
+*   CHIP8TRACE_HID        report read from the keyboard (or a fake source)
+*   CHIP8TRACE_DECODE     kbiskeypad found a Chip8 key in it
+*   CHIP8TRACE_KEY_WRITE  the KEY_PRESS_ADDR write has completed
+*   CHIP8TRACE_RETIRE     the first instruction retired after that write
+*
+* The first three are recorded by the thread reading the keyboard, which
+* carries the id of its current trace. The model records the last one from
+* whichever thread runs it, at the exact instruction; a key write before
+* the previous one has retired an instruction takes over from it. On the
+* board and in the simulator chip8writekeypress polls the latency
+* histogram after the write until its count moves.
+*
+* Events go into a ring per thread that only that thread writes, so
+* recording takes no lock and costs a clock read and a few stores. Rings
+* are registered once per thread and live until exit; a ring that wraps
+* loses its oldest events. With tracing off every point is a single load.
+*/
+
+#define CHIP8TRACE_HID       0
+#define CHIP8TRACE_DECODE    1
+#define CHIP8TRACE_KEY_WRITE 2
+#define CHIP8TRACE_RETIRE    3
+#define CHIP8TRACE_POINTS    4
+
+/* Events per thread */
+#define CHIP8TRACE_RING 4096
+
+/* Intervals summarized, see chip8trace_stage_name */
+#define CHIP8TRACE_STAGES 5
+/* Powers of two of nanoseconds, the last one open ended */
+#define CHIP8TRACE_BUCKETS 32
+
+/* How long chip8writekeypress waits for the board to retire an instruction */
+#define CHIP8TRACE_RETIRE_TIMEOUT_US 100000
+
+struct chip8trace_event {
+	uint64_t ns;            //CLOCK_MONOTONIC
+	uint32_t id;            //Trace the point belongs to
+	uint8_t point;
+	uint8_t arg;            //HID key code, Chip8 key or opcode high byte
+	uint16_t reserved;
+};
+
+struct chip8trace_stage {
+	uint64_t count;
+	uint64_t sum;           //Nanoseconds
+	uint64_t min;
+	uint64_t max;
+	uint32_t buckets[CHIP8TRACE_BUCKETS];
+};
+
+struct chip8trace_summary {
+	uint64_t traces;
+	uint64_t retired;       //Traces that got as far as CHIP8TRACE_RETIRE
+	uint64_t dropped;       //Events lost to rings wrapping
+	struct chip8trace_stage stage[CHIP8TRACE_STAGES];
+};
+
+extern volatile int chip8trace_enabled;
+
+void chip8trace_enable(int enable);
+
+/* Starts a trace on this thread with its HID point, returns its id or 0 when off */
+uint32_t chip8trace_begin(unsigned int arg);
+/* Id of this thread's current trace, 0 for none */
+uint32_t chip8trace_current();
+/* Records a point of this thread's current trace, if there is one */
+void chip8trace_point(unsigned int point, unsigned int arg);
+/* Records a point of any trace, from any thread */
+void chip8trace_point_id(uint32_t id, unsigned int point, unsigned int arg);
+
+/*
+* Copies up to max events out of every thread's ring, oldest first per
+* thread, while they keep recording. Returns the number copied; events
+* overwritten before or during the copy are added to *dropped.
+*/
+size_t chip8trace_collect(struct chip8trace_event *out, size_t max, uint64_t *dropped);
+
+/* Sorts events by trace and fills in the interval of every stage each trace went through */
+void chip8trace_summarize(struct chip8trace_event *events, size_t n, uint64_t dropped,
+		struct chip8trace_summary *s);
+
+const char *chip8trace_stage_name(unsigned int stage);
+/* Approximate percentile of a stage from its buckets, in nanoseconds */
+uint64_t chip8trace_percentile(const struct chip8trace_stage *st, double q);
+
+/* Prints percentiles and a histogram per stage */
+void chip8trace_report(FILE *out, const struct chip8trace_summary *s);
+
+#endif //__CHIP8_TRACE_H__
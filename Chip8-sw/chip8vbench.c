@@ -0,0 +1,70 @@
+/*
+ * Co-simulation benchmark
+ *
+ * chip8vbench [-r rom] [-n instructions]
+ *     Loads a ROM into the verilated RTL through resetChip8 and runs it for
+ *     the given number of instruction slots, once cycle-accurate and once in
+ *     fast mode, and prints simulated cycles per second for each and how
+ *     many times faster fast mode is
+ *
+ * Built by make sim
+ *
+ * Columbia University
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "chip8io.h"
+#include "chip8sim.h"
+
+#define DEFAULT_ROM "../test/Pong.ch8"
+
+static void usage() {
+	fprintf(stderr, "Usage: chip8vbench [-r rom] [-n instructions]\n");
+	exit(1);
+}
+
+static int bench(const char *backend, const char *rom, unsigned long n, double *rate) {
+	struct chip8sim_stats s;
+	unsigned long retired;
+	double simulated;
+
+	if (chip8io_open(backend))
+		return -1;
+	resetChip8(rom);
+	startChip8();
+	retired = chip8io_advance(n);
+	chip8sim_stats(&s);
+	chip8io_close();
+
+	simulated = s.cycles + s.skipped;
+	*rate = s.seconds > 0 ? simulated / s.seconds : 0;
+	printf("%-9s %8lu instr %12.0f cycles/s %5.1f%% skipped %10.0f instr/s %8llu accesses %7.3fs\n",
+		backend, retired, *rate,
+		simulated > 0 ? 100.0 * s.skipped / simulated : 0,
+		s.seconds > 0 ? s.instructions / s.seconds : 0,
+		(unsigned long long) s.accesses, s.seconds);
+	return 0;
+}
+
+int main(int argc, char **argv) {
+	const char *rom = DEFAULT_ROM;
+	unsigned long n = 2000;
+	double exact, fast;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "r:n:")) != -1) {
+		switch (opt) {
+		case 'r': rom = optarg; break;
+		case 'n': n = strtoul(optarg, NULL, 0); break;
+		default: usage();
+		}
+	}
+
+	if (bench("sim", rom, n, &exact) || bench("sim-fast", rom, n, &fast))
+		return 1;
+	printf("fast mode %.1fx\n", exact > 0 ? fast / exact : 0);
+	return 0;
+}
@@ -0,0 +1,347 @@
+/*
+ * Delta-compressed framebuffer stream, see fbstream.h for the file layout
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "fbstream.h"
+#include "xorrle.h"
+
+static void put16(uint8_t *p, uint16_t v) {
+	p[0] = v & 0xff;
+	p[1] = v >> 8;
+}
+
+static void put32(uint8_t *p, uint32_t v) {
+	put16(p, v & 0xffff);
+	put16(p + 2, v >> 16);
+}
+
+static void put64(uint8_t *p, uint64_t v) {
+	put32(p, v & 0xffffffff);
+	put32(p + 4, v >> 32);
+}
+
+static uint16_t get16(const uint8_t *p) {
+	return p[0] | (p[1] << 8);
+}
+
+static uint32_t get32(const uint8_t *p) {
+	return get16(p) | ((uint32_t) get16(p + 2) << 16);
+}
+
+static uint64_t get64(const uint8_t *p) {
+	return get32(p) | ((uint64_t) get32(p + 4) << 32);
+}
+
+/* Serializes a packed frame, rows are stored little-endian */
+static void frame_bytes(const uint64_t *rows, uint8_t *out) {
+	int k;
+	for (k = 0; k < (int) CHIP8_FB_BYTES; ++k)
+		out[k] = (rows[k >> 3] >> (8 * (k & 0x7))) & 0xff;
+}
+
+size_t fbstream_encode(const uint64_t *cur, const uint64_t *prev, uint8_t *out) {
+	uint8_t curbytes[CHIP8_FB_BYTES], prevbytes[CHIP8_FB_BYTES];
+
+	frame_bytes(cur, curbytes);
+	if (prev == NULL)
+		return xorrle_encode(curbytes, NULL, CHIP8_FB_BYTES, out);
+	frame_bytes(prev, prevbytes);
+	return xorrle_encode(curbytes, prevbytes, CHIP8_FB_BYTES, out);
+}
+
+int fbstream_decode(const uint8_t *in, size_t len, uint64_t *rows) {
+	uint8_t bytes[CHIP8_FB_BYTES];
+	int k;
+
+	frame_bytes(rows, bytes);
+	if (xorrle_decode(in, len, bytes, CHIP8_FB_BYTES))
+		return -1;
+	for (k = 0; k < CHIP8_FB_HEIGHT; ++k)
+		rows[k] = 0;
+	for (k = 0; k < (int) CHIP8_FB_BYTES; ++k)
+		rows[k >> 3] |= (uint64_t) bytes[k] << (8 * (k & 0x7));
+	return 0;
+}
+
+static int add_keyframe(struct fbstream_keyframe **index, size_t *n, size_t *cap,
+		uint32_t frame, uint64_t offset) {
+	if (*n == *cap) {
+		size_t newcap = *cap ? *cap * 2 : 64;
+		struct fbstream_keyframe *grown = realloc(*index, newcap * sizeof(**index));
+		if (grown == NULL)
+			return -1;
+		*index = grown;
+		*cap = newcap;
+	}
+	(*index)[*n].frame = frame;
+	(*index)[*n].offset = offset;
+	(*n)++;
+	return 0;
+}
+
+/*
+* Loads the index the trailer points to. Fails unless the index fits
+* between the records and the trailer, each keyframe it lists lies among
+* the records and they come in order.
+*/
+static int load_trailer(struct fbstream_reader *r, uint64_t filelen) {
+	uint8_t buf[FBSTREAM_TRAILER_SIZE], ixhead[8], entry[12];
+	uint64_t index_end = filelen - FBSTREAM_TRAILER_SIZE;
+	size_t cap = 0;
+	uint32_t count, i;
+
+	fseek(r->f, index_end, SEEK_SET);
+	if (fread(buf, 1, sizeof(buf), r->f) != sizeof(buf) || memcmp(buf + 8, "C8FE", 4) != 0)
+		return -1;
+
+	r->data_end = get64(buf);
+	if (r->data_end < FBSTREAM_HEADER_SIZE || r->data_end + 12 > index_end)
+		return -1;
+	fseek(r->f, r->data_end, SEEK_SET);
+	if (fread(ixhead, 1, 8, r->f) != 8 || memcmp(ixhead, "C8IX", 4) != 0)
+		return -1;
+	count = get32(ixhead + 4);
+	if (r->data_end + 12 + 12 * (uint64_t) count != index_end)
+		return -1;
+	for (i = 0; i < count; ++i) {
+		if (fread(entry, 1, sizeof(entry), r->f) != sizeof(entry))
+			return -1;
+		if (get64(entry + 4) + FBSTREAM_RECORD_SIZE > r->data_end ||
+				get64(entry + 4) < FBSTREAM_HEADER_SIZE ||
+				(i > 0 && (get32(entry) <= r->index[i - 1].frame ||
+				get64(entry + 4) <= r->index[i - 1].offset)))
+			return -1;
+		if (add_keyframe(&r->index, &r->nindex, &cap, get32(entry), get64(entry + 4)))
+			return -1;
+	}
+	/* Frame count is kept after the last index entry */
+	if (fread(ixhead, 1, 4, r->f) != 4)
+		return -1;
+	r->frames = get32(ixhead);
+	return count > 0 && r->index[count - 1].frame >= r->frames ? -1 : 0;
+}
+
+/*
+* Loads the index from the trailer, or rebuilds it by walking the records
+* when the trailer is missing or does not fit the file
+*/
+static int load_index(struct fbstream_reader *r) {
+	uint8_t buf[FBSTREAM_RECORD_SIZE];
+	size_t cap = 0;
+	long filelen;
+	uint64_t pos;
+
+	fseek(r->f, 0, SEEK_END);
+	filelen = ftell(r->f);
+
+	if (filelen >= FBSTREAM_HEADER_SIZE + FBSTREAM_TRAILER_SIZE && load_trailer(r, filelen) == 0)
+		return 0;
+	free(r->index);
+	r->index = NULL;
+	r->nindex = 0;
+
+	/* No trailer, scan every record */
+	pos = FBSTREAM_HEADER_SIZE;
+	r->frames = 0;
+	fseek(r->f, pos, SEEK_SET);
+	while (fread(buf, 1, FBSTREAM_RECORD_SIZE, r->f) == FBSTREAM_RECORD_SIZE) {
+		uint16_t len = get16(buf + 2);
+
+		if (buf[0] != FBSTREAM_KEYFRAME && buf[0] != FBSTREAM_DELTA)
+			break;
+		if (pos + FBSTREAM_RECORD_SIZE + len > (uint64_t) filelen)
+			break;
+		if (buf[0] == FBSTREAM_KEYFRAME &&
+				add_keyframe(&r->index, &r->nindex, &cap, get32(buf + 4), pos))
+			return -1;
+		r->frames = get32(buf + 4) + 1;
+		pos += FBSTREAM_RECORD_SIZE + len;
+		fseek(r->f, pos, SEEK_SET);
+	}
+	r->data_end = pos;
+	return 0;
+}
+
+int fbstream_open(struct fbstream_reader *r, const char *path) {
+	uint8_t header[FBSTREAM_HEADER_SIZE];
+
+	memset(r, 0, sizeof(*r));
+	if ((r->f = fopen(path, "rb")) == NULL)
+		return -1;
+
+	if (fread(header, 1, sizeof(header), r->f) != sizeof(header) ||
+			memcmp(header, "C8FS", 4) != 0 || get16(header + 4) != FBSTREAM_VERSION ||
+			header[6] != CHIP8_FB_WIDTH || header[7] != CHIP8_FB_HEIGHT) {
+		fclose(r->f);
+		return -1;
+	}
+	r->fps = get16(header + 8);
+	r->keyframe_interval = get16(header + 10);
+
+	if (load_index(r) || (r->frames > 0 && r->nindex == 0)) {
+		fbstream_close(r);
+		return -1;
+	}
+
+	return fbstream_seek(r, 0);
+}
+
+int fbstream_next(struct fbstream_reader *r, uint64_t rows[CHIP8_FB_HEIGHT]) {
+	uint8_t record[FBSTREAM_RECORD_SIZE];
+	uint8_t payload[FBSTREAM_MAX_PAYLOAD];
+	uint16_t len;
+
+	if (r->next_frame >= r->frames || (uint64_t) ftell(r->f) >= r->data_end)
+		return 0;
+
+	if (fread(record, 1, sizeof(record), r->f) != sizeof(record))
+		return -1;
+	len = get16(record + 2);
+	if (len > sizeof(payload) || fread(payload, 1, len, r->f) != len)
+		return -1;
+	if (get32(record + 4) != r->next_frame)
+		return -1;
+
+	if (record[0] == FBSTREAM_KEYFRAME)
+		memset(r->cur, 0, sizeof(r->cur));
+	else if (record[0] != FBSTREAM_DELTA)
+		return -1;
+	if (fbstream_decode(payload, len, r->cur))
+		return -1;
+
+	r->next_frame++;
+	memcpy(rows, r->cur, sizeof(r->cur));
+	return 1;
+}
+
+int fbstream_seek(struct fbstream_reader *r, uint32_t frame) {
+	uint64_t rows[CHIP8_FB_HEIGHT];
+	size_t lo = 0, hi = r->nindex;
+
+	/* An empty stream stays at frame 0, where fbstream_next returns 0 */
+	if (r->nindex == 0 || frame >= r->frames)
+		return frame == 0 && r->frames == 0 ? 0 : -1;
+
+	/* Last keyframe at or before the requested frame */
+	while (hi - lo > 1) {
+		size_t mid = (lo + hi) / 2;
+		if (r->index[mid].frame <= frame) lo = mid;
+		else hi = mid;
+	}
+
+	fseek(r->f, r->index[lo].offset, SEEK_SET);
+	r->next_frame = r->index[lo].frame;
+	while (r->next_frame < frame)
+		if (fbstream_next(r, rows) != 1)
+			return -1;
+
+	return 0;
+}
+
+void fbstream_close(struct fbstream_reader *r) {
+	if (r->f)
+		fclose(r->f);
+	free(r->index);
+	r->f = NULL;
+	r->index = NULL;
+}
+
+int fbstream_create(struct fbstream_writer *w, const char *path,
+		unsigned int keyframe_interval, int append) {
+	struct fbstream_reader r;
+	uint8_t header[FBSTREAM_HEADER_SIZE];
+
+	memset(w, 0, sizeof(*w));
+	w->keyframe_interval = keyframe_interval ? keyframe_interval : 1;
+
+	if (append && fbstream_open(&r, path) == 0) {
+		/* Pick up where the last session stopped */
+		if (r.frames > 0 && (fbstream_seek(&r, r.frames - 1) || fbstream_next(&r, w->prev) != 1)) {
+			fbstream_close(&r);
+			return -1;
+		}
+		w->keyframe_interval = r.keyframe_interval;
+		w->frames = r.frames;
+		w->offset = r.data_end;
+		w->index = r.index;
+		w->nindex = w->index_cap = r.nindex;
+		r.index = NULL;
+		fbstream_close(&r);
+
+		if ((w->f = fopen(path, "r+b")) == NULL || ftruncate(fileno(w->f), w->offset))
+			return -1;
+		fseek(w->f, w->offset, SEEK_SET);
+		return 0;
+	}
+
+	if ((w->f = fopen(path, "wb")) == NULL)
+		return -1;
+
+	memcpy(header, "C8FS", 4);
+	put16(header + 4, FBSTREAM_VERSION);
+	header[6] = CHIP8_FB_WIDTH;
+	header[7] = CHIP8_FB_HEIGHT;
+	put16(header + 8, 60);
+	put16(header + 10, w->keyframe_interval);
+	put32(header + 12, 0);
+	if (fwrite(header, 1, sizeof(header), w->f) != sizeof(header))
+		return -1;
+
+	w->offset = FBSTREAM_HEADER_SIZE;
+	return 0;
+}
+
+int fbstream_append(struct fbstream_writer *w, const uint64_t rows[CHIP8_FB_HEIGHT]) {
+	uint8_t record[FBSTREAM_RECORD_SIZE];
+	uint8_t payload[FBSTREAM_MAX_PAYLOAD];
+	int keyframe = (w->frames % w->keyframe_interval) == 0;
+	size_t len = fbstream_encode(rows, keyframe ? NULL : w->prev, payload);
+
+	if (keyframe && add_keyframe(&w->index, &w->nindex, &w->index_cap, w->frames, w->offset))
+		return -1;
+
+	record[0] = keyframe ? FBSTREAM_KEYFRAME : FBSTREAM_DELTA;
+	record[1] = 0;
+	put16(record + 2, len);
+	put32(record + 4, w->frames);
+	if (fwrite(record, 1, sizeof(record), w->f) != sizeof(record) ||
+			fwrite(payload, 1, len, w->f) != len)
+		return -1;
+
+	memcpy(w->prev, rows, sizeof(w->prev));
+	w->offset += sizeof(record) + len;
+	w->payload_bytes += sizeof(record) + len;
+	w->frames++;
+	return 0;
+}
+
+int fbstream_finish(struct fbstream_writer *w) {
+	uint8_t buf[FBSTREAM_TRAILER_SIZE];
+	size_t i;
+	int ret = 0;
+
+	memcpy(buf, "C8IX", 4);
+	put32(buf + 4, w->nindex);
+	ret |= fwrite(buf, 1, 8, w->f) != 8;
+	for (i = 0; i < w->nindex; ++i) {
+		put32(buf, w->index[i].frame);
+		put64(buf + 4, w->index[i].offset);
+		ret |= fwrite(buf, 1, 12, w->f) != 12;
+	}
+	put32(buf, w->frames);
+	ret |= fwrite(buf, 1, 4, w->f) != 4;
+
+	put64(buf, w->offset);
+	memcpy(buf + 8, "C8FE", 4);
+	ret |= fwrite(buf, 1, FBSTREAM_TRAILER_SIZE, w->f) != FBSTREAM_TRAILER_SIZE;
+
+	ret |= fclose(w->f) != 0;
+	free(w->index);
+	w->f = NULL;
+	w->index = NULL;
+	return ret ? -1 : 0;
+}
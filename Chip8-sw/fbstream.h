@@ -0,0 +1,99 @@
+#ifndef __FBSTREAM_H__
+#define __FBSTREAM_H__
+
+#include <stdio.h>
+#include <stdint.h>
+#include "chip8core.h"
+#include "xorrle.h"
+
+/*
+* Delta-compressed stream of 64x32 framebuffer snapshots
+*
+* File layout (all integers little-endian):
+*
+* Header, FBSTREAM_HEADER_SIZE bytes
+*   "C8FS", u16 version, u8 width, u8 height, u16 fps, u16 keyframe interval,
+*   u32 reserved
+*
+* Frame records, one per captured frame
+*   u8 type ('K' keyframe, 'D' delta), u8 reserved, u16 payload length,
+*   u32 frame number, payload
+*
+*   The payload is the packed frame (one u64 per row) XORed with the previous
+*   frame, or with a blank frame for keyframes, and run-length encoded with
+*   xorrle.h. An empty delta payload means nothing changed.
+*
+* Keyframe index, written on close
+*   "C8IX", u32 count, count x <u32 frame number, u64 record offset>,
+*   u32 total frame count
+*
+* Trailer, FBSTREAM_TRAILER_SIZE bytes
+*   u64 index offset, "C8FE"
+*
+* A stream without a trailer (e.g. the recorder was killed), or whose
+* trailer does not fit the file, is still readable, fbstream_open rebuilds
+* the index by scanning the records.
+* Reopening a stream for append drops the index and trailer and rewrites
+* them on close.
+*/
+
+#define FBSTREAM_VERSION 1
+#define FBSTREAM_HEADER_SIZE 16
+#define FBSTREAM_RECORD_SIZE 8
+#define FBSTREAM_TRAILER_SIZE 12
+#define FBSTREAM_MAX_PAYLOAD XORRLE_MAX_ENCODED(CHIP8_FB_BYTES)
+
+#define FBSTREAM_KEYFRAME 'K'
+#define FBSTREAM_DELTA 'D'
+
+struct fbstream_keyframe {
+	uint32_t frame;
+	uint64_t offset;
+};
+
+struct fbstream_writer {
+	FILE *f;
+	unsigned int keyframe_interval;
+	uint32_t frames;
+	uint64_t prev[CHIP8_FB_HEIGHT];
+	uint64_t offset;                //Where the next record goes
+	uint64_t payload_bytes;         //Bytes written for frames this session
+	struct fbstream_keyframe *index;
+	size_t nindex, index_cap;
+};
+
+struct fbstream_reader {
+	FILE *f;
+	unsigned int fps;
+	unsigned int keyframe_interval;
+	uint32_t frames;
+	uint32_t next_frame;
+	uint64_t cur[CHIP8_FB_HEIGHT];
+	struct fbstream_keyframe *index;
+	size_t nindex;
+	uint64_t data_end;
+};
+
+/*
+* Run-length encodes cur XOR prev (prev may be NULL for a keyframe) into out,
+* which must hold FBSTREAM_MAX_PAYLOAD bytes. Returns the payload length.
+*/
+size_t fbstream_encode(const uint64_t *cur, const uint64_t *prev, uint8_t *out);
+
+/* XORs a decoded payload into rows, returns -1 if the payload is malformed */
+int fbstream_decode(const uint8_t *in, size_t len, uint64_t *rows);
+
+/* Creates a new stream, or appends to an existing one if append is set */
+int fbstream_create(struct fbstream_writer *w, const char *path,
+	unsigned int keyframe_interval, int append);
+int fbstream_append(struct fbstream_writer *w, const uint64_t rows[CHIP8_FB_HEIGHT]);
+int fbstream_finish(struct fbstream_writer *w);
+
+int fbstream_open(struct fbstream_reader *r, const char *path);
+/* Decodes the next frame, returns 1 on success, 0 at the end, -1 on error */
+int fbstream_next(struct fbstream_reader *r, uint64_t rows[CHIP8_FB_HEIGHT]);
+/* Positions the reader so fbstream_next returns the given frame, -1 past the last */
+int fbstream_seek(struct fbstream_reader *r, uint32_t frame);
+void fbstream_close(struct fbstream_reader *r);
+
+#endif //__FBSTREAM_H__
@@ -0,0 +1,51 @@
+/*
+ * Key code decoders for USB keyboard reports, see usbkeypad.h
+ */
+
+#include "usbkeypad.h"
+#include "chip8trace.h"
+
+/*
+* Check to see if any value in the keypad is currently pressed
+*/
+int kbiskeypad(struct usb_keyboard_packet* packet, char val[1]) {
+	uint8_t keycode = packet->keycode[0];
+
+	switch(keycode) {
+		case KEY1: val[0] = 0x1; break;
+		case KEY2: val[0] = 0x2; break;
+		case KEY3: val[0] = 0x3; break;
+		case KEYC: val[0] = 0xC; break;
+		case KEY4: val[0] = 0x4; break;
+		case KEY5: val[0] = 0x5; break;
+		case KEY6: val[0] = 0x6; break;
+		case KEYD: val[0] = 0xD; break;
+		case KEY7: val[0] = 0x7; break;
+		case KEY8: val[0] = 0x8; break;
+		case KEY9: val[0] = 0x9; break;
+		case KEYE: val[0] = 0xE; break;
+		case KEYA: val[0] = 0xA; break;
+		case KEY0: val[0] = 0x0; break;
+		case KEYB: val[0] = 0xB; break;
+		case KEYF: val[0] = 0xF; break;
+		default: return 0;
+	}
+
+	chip8trace_point(CHIP8TRACE_DECODE, val[0]);
+	return 1;
+}
+
+int kbisstart(struct usb_keyboard_packet* packet) {
+	uint8_t keycode = packet->keycode[0];
+	return keycode == KEY_START;
+}
+
+int kbispause(struct usb_keyboard_packet* packet) {
+	uint8_t keycode = packet->keycode[0];
+	return keycode == KEY_PAUSE;
+}
+
+int kbisreset(struct usb_keyboard_packet* packet) {
+	uint8_t keycode = packet->keycode[0];
+	return keycode == KEY_RESET;
+}
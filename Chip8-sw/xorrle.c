@@ -0,0 +1,62 @@
+/*
+ * XOR + run-length coding, see xorrle.h
+ */
+
+#include <string.h>
+
+#include "xorrle.h"
+
+/* True if a zero run long enough to be worth a new token starts at k */
+static int zero_run_starts(const uint8_t *cur, const uint8_t *ref, size_t n, size_t k) {
+	size_t j;
+	for (j = k; j < k + 3 && j < n; ++j)
+		if ((cur[j] ^ (ref ? ref[j] : 0)) != 0)
+			return 0;
+	return 1;
+}
+
+size_t xorrle_encode(const uint8_t *cur, const uint8_t *ref, size_t n, uint8_t *out) {
+	size_t i = 0, len = 0, k;
+
+	while (i < n) {
+		size_t zeros = 0, literals = 0;
+
+		while (i + zeros < n && zeros < 255 && (cur[i + zeros] ^ (ref ? ref[i + zeros] : 0)) == 0)
+			zeros++;
+		/* Unchanged bytes at the end need no token */
+		if (i + zeros == n)
+			break;
+
+		k = i + zeros;
+		while (k + literals < n && literals < 255 && !zero_run_starts(cur, ref, n, k + literals))
+			literals++;
+
+		out[len++] = zeros;
+		out[len++] = literals;
+		for (i = k; i < k + literals; ++i)
+			out[len++] = cur[i] ^ (ref ? ref[i] : 0);
+	}
+
+	return len;
+}
+
+int xorrle_decode(const uint8_t *in, size_t len, uint8_t *buf, size_t n) {
+	const uint8_t *end = in + len;
+	size_t pos = 0;
+
+	while (in < end) {
+		size_t zeros, literals;
+
+		if (end - in < 2)
+			return -1;
+		zeros = *in++;
+		literals = *in++;
+		pos += zeros;
+		if (pos + literals > n || (size_t) (end - in) < literals)
+			return -1;
+		while (literals-- > 0)
+			buf[pos++] ^= *in++;
+	}
+
+	return 0;
+}
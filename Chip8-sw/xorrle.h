@@ -0,0 +1,29 @@
+#ifndef __XORRLE_H__
+#define __XORRLE_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+* XOR + run-length coding used by the framebuffer streams and save-states
+*
+* The buffer is XORed with a reference (or taken as is when there is none)
+* and written as pairs of <u8 zero bytes, u8 literal count, literal bytes>.
+* Zero runs shorter than three bytes stay inside literal runs, and trailing
+* zero bytes are not written at all, so an unchanged buffer encodes to
+* nothing.
+*/
+
+/* Worst case encoded size for an n byte buffer */
+#define XORRLE_MAX_ENCODED(n) ((n) + 2 * ((n) / 3 + 2))
+
+/*
+* Encodes cur XOR ref (ref may be NULL) into out, which must hold
+* XORRLE_MAX_ENCODED(n) bytes. Returns the encoded length.
+*/
+size_t xorrle_encode(const uint8_t *cur, const uint8_t *ref, size_t n, uint8_t *out);
+
+/* XORs an encoded buffer into buf, returns -1 if it is malformed */
+int xorrle_decode(const uint8_t *in, size_t len, uint8_t *buf, size_t n);
+
+#endif //__XORRLE_H__